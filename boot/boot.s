@@ -22,10 +22,7 @@ start:
     mov si, boot_msg
     call print_string
 
-    ; Load kernel from disk
-    mov bx, KERNEL_OFFSET      ; Load kernel to this address
-    mov dh, 15                 ; Number of sectors to read (adjust as needed)
-    mov dl, [boot_drive]       ; Drive number
+    ; Load kernel from disk into the low-memory staging buffer
     call disk_load
 
     ; Switch to protected mode
@@ -59,22 +56,38 @@ init_pm:
     mov ebp, 0x90000
     mov esp, ebp
 
+    ; Copy kernel from the staging buffer to its link address (1MB)
+    mov esi, KERNEL_LOAD_SEG * 16
+    mov edi, KERNEL_ADDR
+    mov ecx, KERNEL_SECTORS * 512 / 4
+    cld
+    rep movsd
+
     ; Jump to kernel
-    call KERNEL_OFFSET
+    mov eax, KERNEL_ADDR
+    call eax
 
     ; Should never reach here
     jmp $
 
 ; Data
 boot_drive db 0
+lba dw 0
 boot_msg db 'Mini OS Bootloader Starting...', 0x0D, 0x0A, 0
 
 ; Constants
-KERNEL_OFFSET equ 0x1000
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 512     ; Kernel image size in sectors (set by the Makefile)
+%endif
+KERNEL_LOAD_SEG equ 0x1000     ; Real-mode staging buffer at 0x10000
+KERNEL_ADDR equ 0x100000       ; Link address from kernel/linker.ld
+SECTORS_PER_TRACK equ 18       ; 1.44MB floppy geometry
+HEADS equ 2
 CODE_SEG equ gdt_code - gdt_start
 DATA_SEG equ gdt_data - gdt_start
 
-; GDT
+; GDT (only what is needed to reach protected mode; the kernel installs
+; its own GDT with user segments and a TSS in gdt_init())
 gdt_start:
 gdt_null:                       ; Null descriptor
     dd 0
@@ -119,20 +132,46 @@ print_string:
 
 disk_load:
     pusha
-    push dx                     ; Save number of sectors to read
-
-    mov ah, 0x02                ; BIOS read sector function
-    mov al, dh                  ; Number of sectors to read
-    mov ch, 0x00                ; Cylinder 0
-    mov dh, 0x00                ; Head 0
-    mov cl, 0x02                ; Start from sector 2 (sector 1 is bootloader)
+    mov ax, KERNEL_LOAD_SEG
+    mov es, ax
+    mov word [lba], 1           ; Kernel starts at sector 2 (LBA 1)
+    mov di, KERNEL_SECTORS
+
+.next_sector:
+    ; LBA -> CHS, one sector at a time so track and 64KB DMA
+    ; boundaries never matter
+    mov ax, [lba]
+    xor dx, dx
+    mov bx, SECTORS_PER_TRACK
+    div bx                      ; AX = track, DX = sector - 1
+    mov cl, dl
+    inc cl                      ; Sector (1-based)
+    xor dx, dx
+    mov bx, HEADS
+    div bx                      ; AX = cylinder, DX = head
+    mov ch, al                  ; Cylinder
+    mov dh, dl                  ; Head
+    mov dl, [boot_drive]        ; Drive number
+    xor bx, bx                  ; ES:BX = destination
+    mov si, 3                   ; Retry count
+
+.retry:
+    mov ax, 0x0201              ; BIOS read sector function, 1 sector
     int 0x13                    ; BIOS interrupt
-
-    jc disk_error               ; Jump if error (carry flag set)
-
-    pop dx                      ; Restore DX
-    cmp al, dh                  ; Check if we read the expected number of sectors
-    jne disk_error
+    jnc .sector_done
+    xor ax, ax                  ; Reset disk system and try again
+    int 0x13
+    dec si
+    jnz .retry
+    jmp disk_error
+
+.sector_done:
+    mov ax, es                  ; Advance destination by 512 bytes
+    add ax, 0x20
+    mov es, ax
+    inc word [lba]
+    dec di
+    jnz .next_sector
 
     popa
     ret
@@ -0,0 +1,88 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "terminal.h"
+#include "blkdev.h"
+
+// Primary IDE channel in compatibility mode
+#define ATA_PRIMARY_IO   0x1F0
+#define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_PRIMARY_IRQ  14
+
+// Task file registers (offsets from the I/O base)
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DRIVE    6
+#define ATA_REG_STATUS   7      // Read: status (acknowledges the IRQ)
+#define ATA_REG_COMMAND  7      // Write: command
+
+// Control block register: alternate status / device control
+#define ATA_CTRL_NIEN    0x02   // Mask the device interrupt
+
+// Status bits
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_DF   0x20
+#define ATA_SR_DRDY 0x40
+#define ATA_SR_BSY  0x80
+
+// Commands
+#define ATA_CMD_READ_SECTORS       0x20
+#define ATA_CMD_READ_SECTORS_EXT   0x24
+#define ATA_CMD_READ_DMA_EXT       0x25
+#define ATA_CMD_READ_MULTIPLE_EXT  0x29
+#define ATA_CMD_WRITE_SECTORS      0x30
+#define ATA_CMD_WRITE_SECTORS_EXT  0x34
+#define ATA_CMD_WRITE_DMA_EXT      0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE      0xC4
+#define ATA_CMD_WRITE_MULTIPLE     0xC5
+#define ATA_CMD_SET_MULTIPLE       0xC6
+#define ATA_CMD_READ_DMA           0xC8
+#define ATA_CMD_WRITE_DMA          0xCA
+#define ATA_CMD_FLUSH_CACHE        0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT    0xEA
+#define ATA_CMD_IDENTIFY           0xEC
+
+// PIIX bus master IDE registers (offsets from BAR 4, primary channel)
+#define ATA_BM_COMMAND   0
+#define ATA_BM_STATUS    2
+#define ATA_BM_PRDT      4
+#define ATA_BM_CMD_START 0x01
+#define ATA_BM_CMD_READ  0x08   // Device to memory
+#define ATA_BM_SR_ACTIVE 0x01
+#define ATA_BM_SR_ERR    0x02
+#define ATA_BM_SR_IRQ    0x04
+
+// Physical region descriptor: a buffer that must not cross a 64 KB
+// boundary; a byte count of 0 means 64 KB
+#define ATA_PRD_EOT       0x8000
+#define ATA_PRD_BOUNDARY  0x10000
+
+typedef struct {
+    uint32_t addr;
+    uint16_t bytes;
+    uint16_t flags;
+} ata_prd_t;
+
+// Requests below this size use PIO; setting up DMA costs more than it saves
+#define ATA_DMA_MIN_SECTORS 8
+
+// 256 sectors is the largest LBA28 transfer
+#define ATA_MAX_SECTORS  256
+
+// Merged requests per command; each piece needs at least one PRD entry
+#define ATA_MAX_SEGMENTS 32
+#define ATA_LBA28_LIMIT  0x10000000u
+
+// Polling limit while probing (status reads)
+#define ATA_POLL_LIMIT   1000000
+
+// Function declarations
+void ata_init(void);
+
+#endif // ATA_H
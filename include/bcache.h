@@ -0,0 +1,72 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "terminal.h"
+#include "blkdev.h"
+#include "sched.h"
+
+// Write-back block cache in front of the block devices. Blocks are found
+// through a hash of (device, block number) and evicted least recently
+// used first. Writes only dirty the cached copy; dirty blocks go to disk
+// in sorted batches when they are evicted or on bcache_sync().
+//
+// Clean blocks carry a CRC-32C of their data, taken when they are read
+// from or written to disk. A block is checked when it is looked up with
+// no other references (holders may be changing it); a mismatch means the
+// cached copy was corrupted in memory, and the block is read again.
+#define BCACHE_BLOCK_SIZE      4096
+#define BCACHE_BLOCK_SECTORS   (BCACHE_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BCACHE_BLOCK_SHIFT     12
+#define BCACHE_BLOCKS          256          // 1 MB of cached data
+#define BCACHE_HASH_BITS       7
+#define BCACHE_HASH_BUCKETS    (1 << BCACHE_HASH_BITS)
+#define BCACHE_WRITEBACK_BATCH 32
+
+// Buffer flags
+#define BCACHE_VALID 0x01                   // Data matches the disk or newer
+#define BCACHE_DIRTY 0x02                   // Newer than the disk
+#define BCACHE_BUSY  0x04                   // Read or write in flight
+#define BCACHE_CSUM  0x08                   // crc matches data
+
+typedef struct bcache_buf {
+    block_device_t* dev;
+    uint32_t block;
+    uint8_t flags;
+    uint32_t refcount;
+    uint8_t* data;
+    uint32_t crc;                           // CRC-32C of data if BCACHE_CSUM
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;            // Towards most recently used
+    struct bcache_buf* lru_next;
+    wait_queue_t waiters;                   // Threads waiting for BUSY to clear
+    blk_request_t req;
+} bcache_buf_t;
+
+typedef struct {
+    uint32_t lookups;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t readaheads;                    // Blocks read ahead
+    uint32_t writebacks;                    // Blocks written
+    uint32_t writeback_batches;
+    uint32_t errors;
+    uint32_t verified;                      // Checksums checked on lookup
+    uint32_t corrupt;                       // ... that did not match
+} bcache_stats_t;
+
+// Function declarations
+void bcache_init(void);
+bcache_buf_t* bcache_get(block_device_t* dev, uint32_t block);
+void bcache_put(bcache_buf_t* buf);
+void bcache_mark_dirty(bcache_buf_t* buf);
+void bcache_readahead(block_device_t* dev, uint32_t block, uint32_t count);
+void bcache_drop_clean(block_device_t* dev);
+int32_t bcache_read(block_device_t* dev, uint64_t offset, void* buffer, uint32_t size);
+int32_t bcache_write(block_device_t* dev, uint64_t offset, const void* buffer, uint32_t size);
+int32_t bcache_sync(block_device_t* dev);
+void bcache_get_stats(bcache_stats_t* stats);
+void bcache_print_stats(void);
+void bcache_benchmark(const char* name);
+
+#endif // BCACHE_H
@@ -0,0 +1,135 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include "terminal.h"
+#include "errors.h"
+
+// Block devices. Requests are asynchronous: blkdev_submit() puts them on
+// the device's request queue, where adjacent requests are merged and the
+// deadline elevator (blkqueue.c) orders them by sector. The queue feeds
+// the driver up to queue_depth requests at a time; the driver calls
+// blkdev_complete() from its interrupt bottom half, which runs each
+// client's req->complete(). blkdev_read() and blkdev_write() wrap this for
+// callers that want to sleep until done.
+#define BLK_SECTOR_SIZE  512
+#define BLK_SECTOR_SHIFT 9
+#define BLK_MAX_DEVICES  8
+
+// Request operations
+#define BLK_OP_READ  0
+#define BLK_OP_WRITE 1
+#define BLK_OP_FLUSH 2
+
+// req->status while the request is in flight
+#define BLK_PENDING 1
+
+// Elevator tuning
+#define BLKQ_READ_EXPIRE_MS  50             // Deadline for a read to be dispatched
+#define BLKQ_WRITE_EXPIRE_MS 500
+#define BLKQ_FIFO_BATCH      16             // Requests per direction before re-deciding
+#define BLKQ_WRITES_STARVED  2              // Read batches allowed while writes wait
+
+typedef struct blk_request {
+    uint8_t op;
+    uint64_t sector;
+    uint32_t count;                 // Sectors
+    void* buffer;                   // Physically contiguous kernel memory
+    volatile int32_t status;        // BLK_PENDING, then E_OK or an error
+    void (*complete)(struct blk_request* req);  // Softirq context, may be 0
+    void* private_data;             // For the submitter
+
+    // Request queue state. A driver receives the head of a merge chain:
+    // nr_sectors starting at sector, with the data in the buffers of the
+    // requests linked through merge_next (nr_segments of them).
+    struct blk_request* next;       // Driver queue link
+    struct blk_request* merge_next;
+    struct blk_request* merge_tail;
+    uint32_t nr_sectors;
+    uint32_t nr_segments;
+    struct blk_request* sort_prev;  // Elevator order by sector
+    struct blk_request* sort_next;
+    struct blk_request* fifo_prev;  // Arrival order, for deadlines
+    struct blk_request* fifo_next;
+    uint64_t deadline;              // Timer tick
+    uint64_t submit_tsc;
+    uint64_t dispatch_tsc;
+} blk_request_t;
+
+typedef struct {
+    uint32_t requests;              // Submitted by clients
+    uint32_t completed;             // Client requests completed
+    uint32_t merges;                // Requests merged into a queued one
+    uint32_t dispatched;            // Requests passed to the driver
+    uint64_t dispatched_sectors;
+    uint64_t queue_cycles;          // Submit to dispatch, summed per client request
+    uint64_t service_cycles;        // Dispatch to completion, summed per dispatch
+    uint32_t sectors_read;
+    uint32_t sectors_written;
+    uint32_t errors;
+    uint32_t interrupts;            // Completion interrupts taken
+    uint32_t notifications;         // Doorbell writes / commands issued
+} blk_stats_t;
+
+// Per-device request queue, one sorted list and one FIFO per direction
+typedef struct {
+    blk_request_t* sort_head[2];
+    blk_request_t* fifo_head[2];
+    blk_request_t* fifo_tail[2];
+    blk_request_t* special_head;    // Flushes, dispatched first
+    blk_request_t* special_tail;
+    blk_request_t* last_merge;      // Merge hint for sequential streams
+    uint64_t head_sector;           // Where the last dispatch ended
+    uint8_t batch_dir;
+    uint32_t batch_count;
+    uint32_t starved;               // Read batches while writes waited
+    uint32_t pending;               // Queued, not dispatched
+    uint32_t in_flight;             // Dispatched, not completed
+    uint32_t plug_depth;
+} blk_queue_t;
+
+struct block_device;
+
+// submit() hands a (possibly merged) request to the driver without
+// necessarily telling the device; kick() starts everything handed over
+// since the last kick, so a batch costs one doorbell. Requests passed on
+// during blkdev_complete() are started when the driver finishes its
+// completion batch and need no kick.
+typedef struct {
+    int32_t (*submit)(struct block_device* dev, blk_request_t* req);
+    void (*kick)(struct block_device* dev);
+} blk_ops_t;
+
+typedef struct block_device {
+    char name[8];
+    uint64_t sector_count;
+    uint32_t max_sectors;           // Largest single (merged) request
+    uint32_t max_segments;          // Buffers per request, 1 disables merging
+    uint32_t queue_depth;           // Requests the device can have in flight
+    uint8_t read_only;
+    const blk_ops_t* ops;
+    void* driver_data;
+    blk_queue_t queue;
+    blk_stats_t stats;
+} block_device_t;
+
+// Registry
+int blkdev_register(block_device_t* dev);
+size_t blkdev_count(void);
+block_device_t* blkdev_get(size_t index);
+block_device_t* blkdev_find(const char* name);
+
+// Requests
+int32_t blkdev_submit(block_device_t* dev, blk_request_t* req);
+void blkdev_kick(block_device_t* dev);
+void blkdev_plug(block_device_t* dev);
+void blkdev_unplug(block_device_t* dev);
+void blkdev_complete(block_device_t* dev, blk_request_t* req, int32_t status);
+int32_t blkdev_read(block_device_t* dev, uint64_t sector, uint32_t count, void* buffer);
+int32_t blkdev_write(block_device_t* dev, uint64_t sector, uint32_t count, const void* buffer);
+int32_t blkdev_flush(block_device_t* dev);
+
+// Statistics (blkstat command) and benchmark (blkbench command)
+void blkdev_print_stats(void);
+void blkdev_benchmark(const char* name);
+
+#endif // BLKDEV_H
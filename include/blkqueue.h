@@ -0,0 +1,20 @@
+#ifndef BLKQUEUE_H
+#define BLKQUEUE_H
+
+#include "blkdev.h"
+
+// Request queue and deadline elevator behind blkdev_submit(). Reads and
+// writes each have a list sorted by sector and a FIFO with deadlines.
+// Dispatch serves one direction at a time in batches of ascending sectors
+// continuing from where the previous request ended (one-way elevator);
+// an expired FIFO head starts the next batch instead, and writes get a
+// batch after BLKQ_WRITES_STARVED read batches. New requests are merged
+// into a queued request they extend at either end.
+//
+// Called by blkdev.c with interrupts disabled.
+void blkqueue_init(block_device_t* dev);
+void blkqueue_insert(block_device_t* dev, blk_request_t* req);
+void blkqueue_dispatch(block_device_t* dev, int kick);
+void blkqueue_complete(block_device_t* dev, blk_request_t* req, int32_t status);
+
+#endif // BLKQUEUE_H
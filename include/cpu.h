@@ -0,0 +1,188 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "terminal.h"
+
+// CPUID leaf 1 feature bits (EDX)
+#define CPUID_EDX_TSC   (1 << 4)
+#define CPUID_EDX_MSR   (1 << 5)
+#define CPUID_EDX_SEP   (1 << 11)
+#define CPUID_EDX_PAT   (1 << 16)
+#define CPUID_EDX_FXSR  (1 << 24)
+#define CPUID_EDX_SSE   (1 << 25)
+#define CPUID_EDX_SSE2  (1 << 26)
+
+// CPUID leaf 1 feature bits (ECX)
+#define CPUID_ECX_SSE3  (1 << 0)
+#define CPUID_ECX_SSE42 (1 << 20)
+
+// CR0 bits
+#define CR0_PE (1u << 0)    // Protected mode
+#define CR0_MP (1u << 1)    // Monitor coprocessor
+#define CR0_EM (1u << 2)    // FPU emulation
+#define CR0_TS (1u << 3)    // Task switched
+#define CR0_NE (1u << 5)    // Native FPU error reporting
+#define CR0_WP (1u << 16)   // Write protect in ring 0
+#define CR0_PG (1u << 31)   // Paging
+
+// CR4 bits
+#define CR4_OSFXSR     (1u << 9)    // fxsave/fxrstor and SSE enabled
+#define CR4_OSXMMEXCPT (1u << 10)   // Unmasked SSE exceptions raise #XM
+
+// EFLAGS bits
+#define EFLAGS_IF 0x200
+
+// Port I/O
+static inline void outb(uint16_t port, uint8_t value) {
+    __asm__ volatile("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ volatile("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void outw(uint16_t port, uint16_t value) {
+    __asm__ volatile("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint16_t inw(uint16_t port) {
+    uint16_t value;
+    __asm__ volatile("inw %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static inline void outl(uint16_t port, uint32_t value) {
+    __asm__ volatile("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ volatile("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+// String port I/O: count 16-bit words between a port and memory
+static inline void insw(uint16_t port, void* buffer, uint32_t count) {
+    __asm__ volatile("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* buffer, uint32_t count) {
+    __asm__ volatile("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+// Short delay for slow ISA devices (writes to an unused port)
+static inline void io_wait(void) {
+    outb(0x80, 0);
+}
+
+// Time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+// Model specific registers
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t low, high;
+    __asm__ volatile("rdmsr" : "=a"(low), "=d"(high) : "c"(msr));
+    return ((uint64_t)high << 32) | low;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    uint32_t a, b, c, d;
+    __asm__ volatile("cpuid" : "=a"(a), "=b"(b), "=c"(c), "=d"(d) : "a"(leaf), "c"(0));
+    if (eax) *eax = a;
+    if (ebx) *ebx = b;
+    if (ecx) *ecx = c;
+    if (edx) *edx = d;
+}
+
+// Control registers
+static inline uint32_t read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile("movl %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uint32_t value) {
+    __asm__ volatile("movl %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uint32_t read_cr2(void) {
+    uint32_t value;
+    __asm__ volatile("movl %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t value;
+    __asm__ volatile("movl %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint32_t value) {
+    __asm__ volatile("movl %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline void invlpg(uint32_t addr) {
+    __asm__ volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile("movl %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint32_t value) {
+    __asm__ volatile("movl %0, %%cr4" : : "r"(value) : "memory");
+}
+
+// Save EFLAGS and disable interrupts; pair with irq_restore()
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    __asm__ volatile("pushfl\n\tpopl %0\n\tcli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    __asm__ volatile("pushl %0\n\tpopfl" : : "r"(flags) : "memory", "cc");
+}
+
+// Take pending interrupts, then disable them again: a break in long work
+// done with interrupts off. STI holds them off for one more instruction,
+// so they come in after the NOP.
+static inline void irq_window(void) {
+    __asm__ volatile("sti\n\tnop\n\tcli" : : : "memory");
+}
+
+// Ordering for memory shared with devices. x86 keeps stores in order with
+// other stores and loads with other loads, so only a store followed by a
+// load of another location needs a real fence.
+static inline void compiler_barrier(void) {
+    __asm__ volatile("" : : : "memory");
+}
+
+static inline void memory_barrier(void) {
+    __asm__ volatile("lock; addl $0, (%%esp)" : : : "memory", "cc");
+}
+
+// 64-by-32 bit unsigned division (there is no libgcc to provide __udivdi3)
+static inline uint64_t div64_32(uint64_t dividend, uint32_t divisor) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quot_high = high / divisor;
+    uint32_t quot_low;
+    high %= divisor;
+    __asm__("divl %2" : "=a"(quot_low), "=d"(high) : "rm"(divisor), "a"(low), "d"(high));
+    return ((uint64_t)quot_high << 32) | quot_low;
+}
+
+#endif // CPU_H
@@ -0,0 +1,47 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include "terminal.h"
+
+// CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), as used by iSCSI,
+// ext4 and btrfs. crc32c() is incremental: pass 0 to start and the
+// previous result to continue, so crc32c(crc32c(0, a), b) is the checksum
+// of a followed by b.
+//
+// crc32c_init() picks the fastest implementation for the CPU:
+//   slice8  table driven, eight bytes per step (slicing-by-8, 8 KB tables)
+//   sse4    the SSE4.2 crc32 instruction, four bytes per step
+//   sse4x3  the same on three interleaved streams: crc32 has a latency of
+//           three cycles but issues one per cycle, so independent streams
+//           keep it busy. The stream checksums are combined by shifting
+//           them over the bytes that follow (multiplication by x^(8n)).
+#define CRC32C_POLY        0x82F63B78
+#define CRC32C_SLICE8      0
+#define CRC32C_SSE4        1
+#define CRC32C_SSE4X3      2
+#define CRC32C_ENGINES     3
+
+// sse4x3 stream lengths: blocks of three long streams first, then of
+// three short ones, then single-stream for the rest
+#define CRC32C_LONG_STREAM  4096
+#define CRC32C_SHORT_STREAM 256
+
+// Trailer at the end of the kernel image (linker.ld puts the .imagecrc
+// section last); tools/imgcrc stores the checksum of everything before it
+#define CRC32C_IMAGE_MAGIC 0x43524349       // "ICRC"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+} crc32c_trailer_t;
+
+// Function declarations
+void crc32c_init(void);
+void crc32c_log_image(void);
+uint32_t crc32c(uint32_t crc, const void* data, size_t length);
+uint32_t crc32c_engine(uint32_t engine, uint32_t crc, const void* data, size_t length);
+int crc32c_engine_available(uint32_t engine);
+const char* crc32c_engine_name(uint32_t engine);
+void crc32c_benchmark(void);
+
+#endif // CRC32C_H
@@ -0,0 +1,113 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include "terminal.h"
+#include "errors.h"
+#include "initrd.h"
+#include "fat.h"
+#include "sched.h"
+
+// ELF32 program loader. exec maps each PT_LOAD segment into a new address
+// space as a lazily populated area (see vm_ops_t) without reading it; the
+// program header is the only part of the file read up front. Pages are
+// read on first access into a per-binary page cache that outlives the
+// programs: read-only pages map the cached frame itself, shared by every
+// instance, and writable pages map it copy-on-write so only data that is
+// actually written gets a private copy. Programs come from the initrd or,
+// under FAT_MOUNT_POINT, from the FAT disk.
+
+// File header identification
+#define ELF_MAGIC       0x464C457F          // "\x7FELF"
+#define ELF_CLASS_32    1
+#define ELF_DATA_LSB    1
+#define ELF_VERSION     1
+#define ELF_ET_EXEC     2
+#define ELF_EM_386      3
+
+// Program header types and segment flags
+#define ELF_PT_LOAD     1
+#define ELF_PF_X        0x1
+#define ELF_PF_W        0x2
+#define ELF_PF_R        0x4
+
+// Loader limits
+#define ELF_IMAGE_MAX   8                   // Binaries kept in the page cache
+#define ELF_SEGMENT_MAX 4                   // PT_LOAD segments per binary
+#define ELF_PHDR_MAX    16                  // Program headers per binary
+#define ELF_PATH_MAX    128
+#define ELF_STACK_SIZE  (16 * 1024)         // Below USER_STACK_TOP
+
+// elf_spawn() flags
+#define ELF_EXEC_EAGER  0x01                // Read every page before starting (benchmark)
+
+typedef struct {
+    uint8_t ident[16];
+    uint16_t type;
+    uint16_t machine;
+    uint32_t version;
+    uint32_t entry;
+    uint32_t phoff;
+    uint32_t shoff;
+    uint32_t flags;
+    uint16_t ehsize;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint16_t shentsize;
+    uint16_t shnum;
+    uint16_t shstrndx;
+} __attribute__((packed)) elf32_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t offset;
+    uint32_t vaddr;
+    uint32_t paddr;
+    uint32_t filesz;
+    uint32_t memsz;
+    uint32_t flags;
+    uint32_t align;
+} __attribute__((packed)) elf32_phdr_t;
+
+typedef struct {
+    uint32_t vaddr;
+    uint32_t memsz;
+    uint32_t offset;
+    uint32_t filesz;
+    uint32_t flags;                 // ELF_PF_*
+} elf_segment_t;
+
+// A binary and its page cache
+typedef struct {
+    char path[ELF_PATH_MAX];        // Empty while the slot is being filled
+    uint8_t in_use;
+    uint32_t users;                 // Areas mapping it, in any address space
+    const initrd_node_t* node;      // Backing file: an initrd node, or
+    fat_file_t file;                // a FAT file
+    uint32_t size;
+    uint32_t entry;
+    elf_segment_t segments[ELF_SEGMENT_MAX];
+    uint32_t segment_count;
+    uint32_t* pages;                // Frame per file page, 0 until first read
+    uint32_t page_count;
+    uint32_t table_pages;           // Pages holding the pages array
+    uint64_t last_used;             // TSC, for eviction
+} elf_image_t;
+
+typedef struct {
+    uint32_t execs;
+    uint32_t cache_hits;            // Faults served from the page cache
+    uint32_t cache_fills;           // File pages read into the page cache
+    uint32_t private_pages;         // Partly file-backed or written on first touch
+    uint32_t zero_pages;            // bss
+    uint32_t evictions;
+} elf_stats_t;
+
+// Function declarations
+int32_t elf_spawn(const char* path, uint32_t flags, thread_t** thread);
+void elf_get_stats(elf_stats_t* stats);
+
+// Shell support (exec and execbench commands)
+void elf_exec(const char* path);
+void elf_benchmark(void);
+
+#endif // ELF_H
@@ -0,0 +1,20 @@
+#ifndef ERRORS_H
+#define ERRORS_H
+
+// Kernel error codes. Functions that can fail return 0 (or a non-negative
+// count) on success and one of these negative values on failure; system
+// calls hand them back to user space unchanged in EAX.
+#define E_OK         0
+#define E_NOSYS     -1   // No such system call
+#define E_INVAL     -2   // Invalid argument
+#define E_NOMEM     -3   // Out of memory
+#define E_FAULT     -4   // Bad address
+#define E_AGAIN     -5   // Resource temporarily unavailable
+#define E_TIMEDOUT  -6   // Operation timed out
+#define E_NOENT     -7   // No such file or object
+#define E_IO        -8   // Device I/O error
+#define E_BUSY      -9   // Resource busy
+#define E_NODEV    -10   // No such device
+#define E_PERM     -11   // Operation not permitted
+
+#endif // ERRORS_H
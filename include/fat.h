@@ -0,0 +1,81 @@
+#ifndef FAT_H
+#define FAT_H
+
+#include "terminal.h"
+#include "errors.h"
+
+// Read-only FAT12/FAT16, mounted at FAT_MOUNT_POINT from the first block
+// device with a FAT boot sector. The whole FAT is decoded at mount into an
+// array of next-cluster numbers plus, per cluster, the length of the
+// contiguous run starting there, so seeking skips whole runs. Resolved
+// path components are kept in a dentry cache. Sequential reads keep a
+// readahead window (up to FAT_READAHEAD_MAX) in flight through the block
+// cache, started as one span per cluster run so the request queue turns
+// each run into large merged requests.
+#define FAT_MOUNT_POINT   "/disk"
+#define FAT_NAME_MAX      255
+#define FAT_ENTRY_SIZE    32
+
+// Readahead window (bytes): starts small, doubles on sequential reads
+#define FAT_READAHEAD_MIN (16 * 1024)
+#define FAT_READAHEAD_MAX (128 * 1024)
+
+// Dentry cache
+#define FAT_DCACHE_ENTRIES   128
+#define FAT_DCACHE_HASH_BITS 6
+#define FAT_DCACHE_NAME_MAX  31             // Longer names are not cached
+
+// Directory entry attributes
+#define FAT_ATTR_READ_ONLY 0x01
+#define FAT_ATTR_HIDDEN    0x02
+#define FAT_ATTR_SYSTEM    0x04
+#define FAT_ATTR_VOLUME_ID 0x08
+#define FAT_ATTR_DIRECTORY 0x10
+#define FAT_ATTR_ARCHIVE   0x20
+#define FAT_ATTR_LFN       0x0F
+
+// Decoded FAT values
+#define FAT_FREE 0x0000
+#define FAT_BAD  0xFFF7
+#define FAT_EOC  0xFFFF
+
+typedef struct {
+    char name[FAT_NAME_MAX + 1];
+    uint8_t attr;
+    uint32_t cluster;               // 0 for the (FAT12/16) root directory
+    uint32_t size;
+} fat_dirent_t;
+
+// Position in a cluster chain: chain[index] == cluster
+typedef struct {
+    uint32_t index;
+    uint32_t cluster;
+} fat_cursor_t;
+
+typedef struct {
+    fat_dirent_t entry;
+    uint32_t position;
+    fat_cursor_t cursor;            // Last cluster read
+    uint32_t last_end;              // Where the previous read stopped
+    uint8_t readahead;              // 0 disables readahead (benchmark)
+    uint32_t ra_end;                // Readahead started up to this offset
+    uint32_t ra_window;
+    fat_cursor_t ra_cursor;
+} fat_file_t;
+
+// Function declarations
+void fat_init(void);
+int fat_mounted(void);
+void fat_drop_cache(void);
+const char* fat_path(const char* path);
+int32_t fat_open(const char* path, fat_file_t* file);
+int32_t fat_read(fat_file_t* file, void* buffer, uint32_t size);
+void fat_seek(fat_file_t* file, uint32_t position);
+
+// Shell support (ls, cat and stat under FAT_MOUNT_POINT, fatbench command)
+void fat_ls(const char* path);
+void fat_cat(const char* path);
+void fat_stat(const char* path);
+void fat_benchmark(const char* path);
+
+#endif // FAT_H
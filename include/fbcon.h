@@ -0,0 +1,80 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include "terminal.h"
+
+// Framebuffer console on the Bochs/QEMU std-VGA (BGA) linear framebuffer.
+// The terminal writes VGA_ENTRY() cells into a RAM grid as in text mode;
+// once per frame the cells that differ from what is on screen are drawn
+// into a RAM back buffer from a per-color-pair glyph cache, and only the
+// rectangle around them is copied to the framebuffer. Scrolls move the
+// back buffer with SSE2 and are batched: a burst of output costs one
+// full-screen copy per frame, not one per line.
+//
+// The framebuffer is placed above the first 256 KB of video memory, where
+// the text mode planes (characters and font) live, so text mode comes
+// back intact when the console is switched off.
+
+// Bochs graphics adapter (BGA) registers, index/data port pair
+#define BGA_INDEX_PORT      0x01CE
+#define BGA_DATA_PORT       0x01CF
+#define BGA_REG_ID          0
+#define BGA_REG_XRES        1
+#define BGA_REG_YRES        2
+#define BGA_REG_BPP         3
+#define BGA_REG_ENABLE      4
+#define BGA_REG_VIRT_WIDTH  6
+#define BGA_REG_VIRT_HEIGHT 7
+#define BGA_REG_X_OFFSET    8
+#define BGA_REG_Y_OFFSET    9
+#define BGA_ID_32BPP        0xB0C2          // First version with 32 bpp
+#define BGA_ID_MAX          0xB0CF
+#define BGA_ENABLED         0x01
+#define BGA_LFB_ENABLED     0x40
+#define BGA_NO_CLEAR_MEM    0x80
+
+// QEMU std-VGA PCI function; BAR0 is the linear framebuffer
+#define BGA_PCI_VENDOR 0x1234
+#define BGA_PCI_DEVICE 0x1111
+
+#define FBCON_VRAM_SIZE      (16 * 1024 * 1024)
+#define FBCON_TEXT_RESERVE   0x40000        // Text mode planes, left alone
+#define FBCON_DEFAULT_WIDTH  1024
+#define FBCON_DEFAULT_HEIGHT 768
+#define FBCON_MAX_WIDTH      2560
+#define FBCON_MAX_HEIGHT     1600
+#define FBCON_MIN_WIDTH      320
+#define FBCON_MIN_HEIGHT     200
+
+// Output is drawn at most once per frame
+#define FBCON_FRAME_MS 16
+
+// Color pairs (attribute bytes) with rendered glyphs; the least recently
+// used pair is dropped when a new one is needed
+#define FBCON_GLYPH_SLOTS 16
+
+typedef struct {
+    uint32_t frames;                // Flushes that drew something
+    uint32_t cells;                 // Cells drawn into the back buffer
+    uint32_t scrolls;               // Lines scrolled
+    uint32_t glyphs;                // Glyphs rendered into the cache
+    uint32_t evictions;             // Color pairs dropped from the cache
+    uint32_t sse2_frames;           // Frames drawn with SSE2
+    uint64_t bytes;                 // Bytes written to the framebuffer
+    uint64_t cycles;                // Spent in flushes
+    uint64_t max_cycles;
+} fbcon_stats_t;
+
+// Function declarations
+int fbcon_enable(uint32_t width, uint32_t height);
+void fbcon_disable(void);
+int fbcon_active(void);
+void fbcon_flush(void);
+void fbcon_get_stats(fbcon_stats_t* stats);
+
+// Shell: fbcon [WIDTHxHEIGHT|off], fbstat, fbbench
+void fbcon_command(const char* args);
+void fbcon_print_stats(void);
+void fbcon_benchmark(void);
+
+#endif // FBCON_H
@@ -0,0 +1,14 @@
+#ifndef FONT_H
+#define FONT_H
+
+#include "terminal.h"
+
+// Built-in bitmap font for the framebuffer console
+#define FONT_WIDTH  8
+#define FONT_HEIGHT 16
+#define FONT_FIRST  0x20                    // First glyph in the table
+#define FONT_GLYPHS 95                      // 0x20 - 0x7E
+
+extern const uint8_t font_8x16[FONT_GLYPHS][FONT_HEIGHT];
+
+#endif // FONT_H
@@ -0,0 +1,42 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "terminal.h"
+
+// Size of the fxsave area (must be 16-byte aligned)
+#define FPU_STATE_SIZE 512
+
+// Exceptions
+#define FPU_NM_VECTOR 7     // Device not available: FPU used with CR0.TS set
+
+// Lazy FPU/SSE switching. CR0.TS is set whenever the running thread does
+// not own the FPU registers; its first FPU or SSE instruction traps (#NM)
+// and only then is the previous owner's state saved and its own restored.
+// Threads that never touch the FPU never pay for the 512-byte copy.
+//
+// The kernel is built with -mno-sse -mno-mmx, so the compiler never uses
+// these registers by itself. Kernel code that wants SSE brackets it with
+// kernel_fpu_begin()/kernel_fpu_end() and must not block in between.
+
+struct thread;
+
+typedef struct {
+    uint32_t nm_traps;          // #NM exceptions taken
+    uint32_t saves;             // fxsave of a previous owner
+    uint32_t restores;          // fxrstor of a thread's state
+    uint32_t kernel_sections;   // kernel_fpu_begin() calls
+} fpu_stats_t;
+
+// Function declarations
+void fpu_init(void);
+int fpu_sse_available(void);
+int fpu_sse2_available(void);
+void fpu_handle_nm(void);
+void fpu_switch(struct thread* next);
+void fpu_thread_exit(struct thread* thread);
+void kernel_fpu_begin(void);
+int kernel_fpu_try_begin(void);
+void kernel_fpu_end(void);
+const fpu_stats_t* fpu_get_stats(void);
+
+#endif // FPU_H
@@ -0,0 +1,43 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "terminal.h"
+#include "errors.h"
+
+// Fast user-space locking (futexes). A lock lives in an ordinary word of
+// user memory and is taken and released with atomic instructions in ring
+// 3; the kernel only provides a place to sleep:
+//
+//   wait(addr, expected, timeout_ms)  sleep if *addr still equals expected;
+//                                     E_AGAIN if it does not, E_TIMEDOUT
+//                                     once timeout_ms has passed
+//   wake(addr, count)                 wake up to count threads waiting on
+//                                     addr; returns how many were woken
+//
+// Waiters are keyed by the physical address of the word, so threads that
+// map the same page at different addresses meet on it. They are kept in
+// a hash table of FIFO lists; the comparison with expected and the
+// enqueue happen with interrupts disabled, so a wake issued after the
+// word was changed cannot be missed. See user_sync.h for the mutex,
+// condition variable and semaphore built on top.
+#define FUTEX_HASH_BITS    6
+#define FUTEX_HASH_BUCKETS (1 << FUTEX_HASH_BITS)
+#define FUTEX_WAIT_FOREVER 0xFFFFFFFF       // timeout_ms: no timeout
+#define FUTEX_WAKE_ALL     0xFFFFFFFF       // count: every waiter
+
+typedef struct {
+    uint32_t waits;                 // Threads that went to sleep
+    uint32_t mismatches;            // Waits that returned E_AGAIN at once
+    uint32_t timeouts;
+    uint32_t wakes;                 // Wake calls
+    uint32_t woken;                 // Threads woken by them
+} futex_stats_t;
+
+// Function declarations
+void futex_init(void);
+int32_t futex_wait(uint32_t addr, uint32_t expected, uint32_t timeout_ms);
+int32_t futex_wake(uint32_t addr, uint32_t count);
+void futex_get_stats(futex_stats_t* stats);
+void futex_benchmark(void);
+
+#endif // FUTEX_H
@@ -0,0 +1,88 @@
+#ifndef GDT_H
+#define GDT_H
+
+#include "terminal.h"
+
+// Segment selectors. The order kernel code, kernel data, user code, user
+// data is required by SYSENTER/SYSEXIT, which derive every selector from
+// IA32_SYSENTER_CS (+8 kernel SS, +16 user CS, +24 user SS).
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+#define GDT_USER_CODE   0x18
+#define GDT_USER_DATA   0x20
+#define GDT_TSS         0x28
+#define GDT_ENTRIES     6
+
+// Requested privilege level for user selectors
+#define RPL_USER 3
+#define USER_CODE_SELECTOR (GDT_USER_CODE | RPL_USER)
+#define USER_DATA_SELECTOR (GDT_USER_DATA | RPL_USER)
+
+// Access byte values
+#define GDT_ACCESS_KERNEL_CODE 0x9A  // Present, ring 0, code, readable
+#define GDT_ACCESS_KERNEL_DATA 0x92  // Present, ring 0, data, writable
+#define GDT_ACCESS_USER_CODE   0xFA  // Present, ring 3, code, readable
+#define GDT_ACCESS_USER_DATA   0xF2  // Present, ring 3, data, writable
+#define GDT_ACCESS_TSS         0x89  // Present, ring 0, 32-bit available TSS
+
+// Granularity byte values
+#define GDT_GRAN_4K_32BIT 0xCF       // 4 KB granularity, 32-bit, limit 19:16 = 0xF
+#define GDT_GRAN_BYTE     0x00
+
+// GDT entry structure
+typedef struct {
+    uint16_t limit_low;     // Limit (bits 0-15)
+    uint16_t base_low;      // Base (bits 0-15)
+    uint8_t base_middle;    // Base (bits 16-23)
+    uint8_t access;         // Access byte
+    uint8_t granularity;    // Flags + Limit (bits 16-19)
+    uint8_t base_high;      // Base (bits 24-31)
+} __attribute__((packed)) gdt_entry_t;
+
+// GDT pointer structure for lgdt instruction
+typedef struct {
+    uint16_t limit;         // Size of GDT - 1
+    uint32_t base;          // Base address of GDT
+} __attribute__((packed)) gdt_ptr_t;
+
+// 32-bit Task State Segment. Only ss0:esp0 (the stack loaded on a ring
+// 3 -> ring 0 transition) is used; there is no hardware task switching.
+typedef struct {
+    uint32_t prev_tss;
+    uint32_t esp0;          // Kernel stack pointer (offset 4, used by sysenter_entry)
+    uint32_t ss0;           // Kernel stack segment
+    uint32_t esp1;
+    uint32_t ss1;
+    uint32_t esp2;
+    uint32_t ss2;
+    uint32_t cr3;
+    uint32_t eip;
+    uint32_t eflags;
+    uint32_t eax;
+    uint32_t ecx;
+    uint32_t edx;
+    uint32_t ebx;
+    uint32_t esp;
+    uint32_t ebp;
+    uint32_t esi;
+    uint32_t edi;
+    uint32_t es;
+    uint32_t cs;
+    uint32_t ss;
+    uint32_t ds;
+    uint32_t fs;
+    uint32_t gs;
+    uint32_t ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+// The TSS is shared with the sysenter entry stub, which reads esp0 directly
+extern tss_t tss;
+
+// Function declarations
+void gdt_init(void);
+void gdt_set_gate(uint8_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity);
+void tss_set_kernel_stack(uint32_t esp0);
+
+#endif // GDT_H
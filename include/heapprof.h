@@ -0,0 +1,57 @@
+#ifndef HEAPPROF_H
+#define HEAPPROF_H
+
+#include "terminal.h"
+
+// Allocation profiler for the page allocator (make HEAPPROF=1). Every
+// live pmm_alloc() block is kept in an open-addressed hash table keyed by
+// its address, with its size, when it was taken and the call site (the
+// return address in the caller). Per-site counters give live pages and
+// the allocation rate, and blocks older than HEAPPROF_OLD_SECONDS are
+// reported as possible leaks. Call sites are named through the kernel
+// symbol table (ksyms.h) that a HEAPPROF=1 build links in.
+//
+// Without HEAPPROF the hooks below are empty inline functions, so the
+// allocator pays nothing.
+#define HEAPPROF_LIVE_BITS   12
+#define HEAPPROF_LIVE        (1 << HEAPPROF_LIVE_BITS)  // Live blocks tracked
+#define HEAPPROF_SITE_BITS   8
+#define HEAPPROF_SITES       (1 << HEAPPROF_SITE_BITS)  // Call sites
+#define HEAPPROF_TOP         8              // Sites listed per table
+#define HEAPPROF_OLD_SECONDS 30
+
+typedef struct {
+    uint32_t addr;                  // 0: slot empty
+    uint16_t pages;                 // Saturates at 0xFFFF
+    uint16_t site;                  // Index into the site table
+    uint64_t tsc;                   // When it was allocated
+} heapprof_block_t;
+
+typedef struct {
+    uint32_t caller;                // Return address, 0: slot empty
+    uint32_t allocs;                // Since the last reset
+    uint32_t frees;
+    uint32_t live_blocks;
+    uint32_t live_pages;
+} heapprof_site_t;
+
+#ifdef HEAPPROF
+// Called by the page allocator with interrupts disabled
+void heapprof_alloc(void* addr, size_t pages, void* caller);
+void heapprof_free(void* addr);
+#else
+static inline void heapprof_alloc(void* addr, size_t pages, void* caller) {
+    (void)addr;
+    (void)pages;
+    (void)caller;
+}
+
+static inline void heapprof_free(void* addr) {
+    (void)addr;
+}
+#endif
+
+// Shell: heapprof [reset]
+void heapprof_print(const char* args);
+
+#endif // HEAPPROF_H
@@ -0,0 +1,17 @@
+#ifndef INIT_H
+#define INIT_H
+
+// Section annotations; kernel/linker.ld places the sections.
+//
+// __init functions and __initdata objects are only used while the kernel
+// boots. They share a few pages that kernel_main hands to the page
+// allocator (memory_free_init()) before it starts the shell, so nothing
+// may call or point into them after that.
+#define __init     __attribute__((section(".init.text"), cold, noinline))
+#define __initdata __attribute__((section(".init.data")))
+
+// Interrupt and console output paths, kept together at the start of
+// .text so they share cache lines and TLB entries
+#define __hot      __attribute__((section(".text.hot"), hot))
+
+#endif // INIT_H
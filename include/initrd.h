@@ -0,0 +1,77 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include "terminal.h"
+#include "errors.h"
+
+// Boot archive. The build packs initrd/ (tools/mkinitrd.c) and links the
+// archive into the kernel image, where it stays mapped read-only. At boot
+// every path is put in a hash table, so a lookup is one hash and usually
+// one comparison, and file data is read in place without copying.
+//
+// Layout: header, then the entries (each followed by its NUL-terminated
+// full path, padded to 4 bytes), then the file data (each file aligned to
+// INITRD_ALIGN). Parents come before their children and siblings are
+// sorted by name. tools/mkinitrd.c writes the same layout.
+#define INITRD_MAGIC     0x44524E49         // "INRD"
+#define INITRD_VERSION   1
+#define INITRD_ALIGN     16
+#define INITRD_PATH_MAX  256
+
+// Entry types
+#define INITRD_FILE 1
+#define INITRD_DIR  2
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;                 // Entries
+    uint32_t size;                  // Whole archive, bytes
+} initrd_header_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t size;                  // File size, 0 for directories
+    uint32_t data;                  // File data offset from the header
+    uint32_t path_len;              // Excluding the NUL
+} initrd_entry_t;
+
+// In-memory node; path and data point into the archive
+typedef struct initrd_node {
+    const char* path;
+    uint32_t path_len;
+    uint32_t hash;
+    uint32_t type;
+    uint32_t size;
+    const uint8_t* data;
+    struct initrd_node* hash_next;
+    struct initrd_node* parent;
+    struct initrd_node* children;   // In archive (sorted) order
+    struct initrd_node* last_child;
+    struct initrd_node* next_sibling;
+} initrd_node_t;
+
+// Path index over one archive
+typedef struct {
+    const uint8_t* image;
+    uint32_t size;
+    initrd_node_t* nodes;           // nodes[0] is the root directory
+    uint32_t count;
+    initrd_node_t** buckets;
+    uint32_t mask;                  // Buckets - 1 (a power of two)
+    void* pages;                    // nodes and buckets, from pmm_alloc()
+    uint32_t page_count;
+} initrd_index_t;
+
+// Function declarations
+void initrd_init(void);
+const initrd_node_t* initrd_lookup(const char* path);
+uint32_t initrd_read(const initrd_node_t* node, uint32_t offset, uint32_t size, const void** data);
+
+// Shell support (ls, cat, stat and initrdbench commands)
+void initrd_ls(const char* path);
+void initrd_cat(const char* path);
+void initrd_stat(const char* path);
+void initrd_benchmark(void);
+
+#endif // INITRD_H
@@ -56,6 +56,12 @@ typedef struct {
 #define ICW4_BUF_MASTER 0x0C // Buffered mode/master
 #define ICW4_SFNM     0x10   // Special fully nested (not)
 
+#define PIC_EOI      0x20    // End-of-interrupt command
+
+// IDT gate flags
+#define IDT_GATE_INTERRUPT      0x8E  // Present, ring 0, 32-bit interrupt gate
+#define IDT_GATE_USER_INTERRUPT 0xEE  // Present, callable from ring 3
+
 // Interrupt numbers
 #define IRQ0 32  // Timer
 #define IRQ1 33  // Keyboard
@@ -74,12 +80,34 @@ typedef struct {
 #define IRQ14 46 // Primary ATA
 #define IRQ15 47 // Secondary ATA
 
+// Driver handlers for peripheral lines. PCI INTx lines can be shared, so
+// every handler on a line is called and checks its own device.
+#define IRQ_HANDLERS_PER_LINE 4
+typedef void (*irq_handler_t)(void* context);
+
+// Hard interrupt statistics. Interrupts-off time runs from handler entry
+// to exit, minus the time bottom halves run with interrupts enabled (see
+// softirq.h), and excludes the context switch on the way out.
+typedef struct {
+    uint32_t count[16];             // Per IRQ line
+    uint32_t off_spans;
+    uint64_t off_cycles;
+    uint64_t off_max;               // Longest single span
+} irq_stats_t;
+
 // Function declarations
 void interrupts_init(void);
+int irq_register_handler(uint8_t irq, irq_handler_t handler, void* context);
 void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags);
 void pic_init(void);
 void pic_send_eoi(uint8_t irq);
+void pic_mask_irq(uint8_t irq);
+void pic_unmask_irq(uint8_t irq);
 void interrupt_handler(interrupt_frame_t* frame);
+void irq_off_begin(void);
+void irq_off_end(void);
+void irq_get_stats(irq_stats_t* stats);
+void irq_reset_stats(void);
 
 // Interrupt handler declarations
 void isr0(void);   // Division by zero
@@ -133,4 +161,7 @@ void irq13(void);  // FPU
 void irq14(void);  // Primary ATA
 void irq15(void);  // Secondary ATA
 
+// System call gate (int 0x80)
+void isr128(void);
+
 #endif // INTERRUPTS_H 
\ No newline at end of file
@@ -0,0 +1,36 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include "terminal.h"
+#include "errors.h"
+
+// Synchronous message passing between threads through endpoints.
+//
+// A message is two words carried in registers (ESI, EDI) plus an optional
+// page grant in EBP: a page-aligned user address with a page count in the
+// low 12 bits. Granted pages are moved from the sender's address space to
+// the receiver's window without copying; the sender loses them. Pages that
+// do not fit in the window stay with the sender.
+//
+// Receivers learn the sender's thread id (the return value), the two words
+// and where the granted pages were mapped (address | count, or 0).
+#define IPC_ENDPOINT_MAX     32
+#define IPC_GRANT_PAGES_MASK 0xFFF
+#define IPC_GRANT(addr, pages) ((uint32_t)(addr) | (uint32_t)(pages))
+
+// Operation a blocked thread is waiting in
+#define IPC_OP_NONE  0
+#define IPC_OP_SEND  1
+#define IPC_OP_CALL  2
+#define IPC_OP_RECV  3
+
+struct thread;
+
+// Function declarations
+void ipc_init(void);
+int32_t ipc_endpoint_create(void);
+void ipc_endpoint_destroy(int32_t endpoint);
+void ipc_thread_exit(struct thread* thread);
+void ipc_benchmark(void);
+
+#endif // IPC_H
@@ -0,0 +1,43 @@
+#ifndef KDATA_H
+#define KDATA_H
+
+#include "terminal.h"
+
+// Shared kernel data page (vDSO-style).
+//
+// One physical page written only by the kernel and mapped read-only at
+// USER_KDATA_ADDR in every address space, so user code can read the clock
+// and basic system information without a system call. Fields that change
+// at run time are protected by a sequence lock: the kernel makes seq odd
+// while updating, readers retry when seq was odd or changed under them.
+//
+// Time is derived from the TSC:
+//   ns = base_ns + (((rdtsc() - tsc_base) * tsc_mult) >> tsc_shift)
+// The kernel rebases once a second so the product never overflows.
+#define KDATA_VERSION 1
+#define KDATA_TSC_SHIFT 24
+
+typedef struct {
+    volatile uint32_t seq;          // Sequence lock, odd while being updated
+    uint32_t version;               // KDATA_VERSION
+    uint32_t cpu_count;             // Online CPUs
+    uint32_t tick_hz;               // Timer interrupt frequency
+    uint32_t tsc_khz;               // Calibrated TSC frequency
+    uint32_t tsc_mult;              // TSC cycles -> ns multiplier
+    uint32_t tsc_shift;             // TSC cycles -> ns shift
+    uint32_t reserved;
+    volatile uint64_t ticks;        // Timer ticks since boot
+    volatile uint64_t tsc_base;     // TSC value at the last rebase
+    volatile uint64_t mono_ns_base; // Monotonic ns since boot at tsc_base
+    volatile uint64_t wall_ns_base; // Wall clock (ns since 1970-01-01 UTC) at tsc_base
+} kdata_page_t;
+
+// Kernel side
+void kdata_init(void);
+uint32_t kdata_page_frame(void);
+kdata_page_t* kdata_get(void);
+void kdata_set_clock(uint32_t tsc_khz, uint64_t wall_ns);
+void kdata_tick(void);
+uint64_t kdata_monotonic_ns(void);
+
+#endif // KDATA_H
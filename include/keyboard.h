@@ -57,6 +57,9 @@
 // Extended key prefix
 #define SCANCODE_EXTENDED     0xE0
 
+// Scancodes buffered between the interrupt handler and the shell thread
+#define KEYBOARD_BUFFER_SIZE  64
+
 // Key states
 #define KEY_STATE_RELEASED    0x80
 #define KEY_STATE_PRESSED     0x00
@@ -75,16 +78,23 @@ typedef struct {
 // Function declarations
 void keyboard_init(void);
 void keyboard_handler(void);
+void keyboard_run(void) __attribute__((noreturn));
 uint8_t keyboard_read_scancode(void);
 char keyboard_scancode_to_ascii(uint8_t scancode);
-void keyboard_process_scancode(uint8_t scancode);
+void keyboard_process_scancode(uint8_t scancode, uint64_t tsc);
 void keyboard_echo_character(char c);
 void keyboard_handle_special_key(uint8_t scancode);
+void keyboard_switch_console(uint32_t console);
 
 // Command line interface
 #define MAX_COMMAND_LENGTH 256
 #define MAX_COMMAND_HISTORY 10
 
+// Commands in a pipeline (cmd | cmd | ...); each runs to completion with
+// its output in a RAM pipe (stream.h) that the next one reads
+#define MAX_PIPELINE_COMMANDS 4
+#define MAX_REPEAT_COUNT   100000
+
 typedef struct {
     char buffer[MAX_COMMAND_LENGTH];
     uint16_t position;
@@ -92,11 +102,12 @@ typedef struct {
     char history[MAX_COMMAND_HISTORY][MAX_COMMAND_LENGTH];
     uint8_t history_count;
     uint8_t history_position;
+    uint8_t started;                // Prompt shown on its console
 } command_line_t;
 
 // Command line functions
 void command_line_init(void);
-void command_line_process_input(char c);
+void command_line_process_input(char c, uint64_t tsc);
 void command_line_handle_backspace(void);
 void command_line_handle_enter(void);
 void command_line_handle_arrow_keys(uint8_t scancode);
@@ -111,5 +122,40 @@ void cmd_echo(const char* args);
 void cmd_reboot(void);
 void cmd_version(void);
 void cmd_status(void);
+void cmd_sysbench(void);
+void cmd_cowbench(void);
+void cmd_ipcbench(void);
+void cmd_futexbench(void);
+void cmd_klibbench(const char* args);
+void cmd_lspci(void);
+void cmd_blkbench(const char* args);
+void cmd_cachestat(void);
+void cmd_sync(void);
+void cmd_cachebench(const char* args);
+void cmd_blkstat(void);
+void cmd_ls(const char* args);
+void cmd_cat(const char* args);
+void cmd_stat(const char* args);
+void cmd_initrdbench(void);
+void cmd_fatbench(const char* args);
+void cmd_exec(const char* args);
+void cmd_execbench(void);
+void cmd_timerbench(void);
+void cmd_irqstat(void);
+void cmd_irqbench(void);
+void cmd_fbcon(const char* args);
+void cmd_fbstat(void);
+void cmd_fbbench(void);
+void cmd_ansibench(void);
+void cmd_vcbench(void);
+void cmd_sbstat(void);
+void cmd_dmesg(const char* args);
+void cmd_klogstat(void);
+void cmd_latency(void);
+void cmd_heapprof(const char* args);
+void cmd_crcbench(void);
+void cmd_grep(const char* args);
+void cmd_time(const char* args);
+void cmd_repeat(const char* args);
 
 #endif // KEYBOARD_H 
\ No newline at end of file
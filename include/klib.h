@@ -0,0 +1,47 @@
+#ifndef KLIB_H
+#define KLIB_H
+
+#include "terminal.h"
+
+// Freestanding C library routines. The memory and string routines have
+// several implementations; klib_init() picks one per routine from CPUID:
+//   byte  reference byte-at-a-time loop
+//   swar  32-bit words at a time (SIMD within a register)
+//   rep   rep movsd / rep stosd
+//   erms  rep movsb / rep stosb on CPUs with Enhanced REP MOVSB
+//   sse2  16-byte vector loads and stores inside kernel_fpu_begin/end
+// Until klib_init() runs the integer-only variants are used, so these are
+// safe from the very first line of kernel_main().
+#define KLIB_VARIANT_BYTE 0
+#define KLIB_VARIANT_SWAR 1
+#define KLIB_VARIANT_REP  2
+#define KLIB_VARIANT_ERMS 3
+#define KLIB_VARIANT_SSE2 4
+#define KLIB_VARIANTS     5
+
+// Below this size memcpy/memset use the word loop: rep string
+// instructions have a startup cost of a few dozen cycles
+#define KLIB_SMALL_SIZE 64
+
+// SSE2 paths pay for kernel_fpu_begin() (possibly a 512-byte fxsave)
+#define KLIB_SSE2_MIN_SIZE 512
+
+// Memory routines
+void* memcpy(void* dest, const void* src, size_t n);
+void* memmove(void* dest, const void* src, size_t n);
+void* memset(void* dest, int c, size_t n);
+int memcmp(const void* a, const void* b, size_t n);
+
+// String routines
+size_t strlen(const char* str);
+char* strchr(const char* str, int c);
+char* strcpy(char* dest, const char* src);
+int strcmp(const char* str1, const char* str2);
+int strncmp(const char* str1, const char* str2, size_t n);
+char* strstr(const char* haystack, const char* needle);
+
+// Variant selection and benchmark
+void klib_init(void);
+void klib_benchmark(const char* routine);
+
+#endif // KLIB_H
@@ -0,0 +1,76 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include "terminal.h"
+
+// Kernel log (dmesg). Kernel messages go into a ring of fixed-size
+// records instead of straight to the screen, so logging from an interrupt
+// or exception handler costs a copy rather than a VGA update, and the
+// last KLOG_RECORDS messages can be read back with dmesg.
+//
+// Producers never lock or disable interrupts for the record itself: one
+// atomic add (lock xadd) on the sequence counter claims a sequence number,
+// which also selects the slot, the record is copied in and its commit
+// word is written last. Producers may interrupt each other anywhere.
+// Readers copy a record and check the commit word before and after, so a
+// record still being written or overwritten under them is never shown.
+//
+// The klogd thread renders new records at or above the console level to
+// KLOG_CONSOLE, at most KLOG_CONSOLE_BURST of them every
+// KLOG_CONSOLE_INTERVAL_MS. When more than KLOG_CONSOLE_BACKLOG are
+// waiting, the older ones are skipped on screen (they stay in the ring).
+
+// Levels, most severe first
+#define KLOG_ERR   0
+#define KLOG_WARN  1
+#define KLOG_INFO  2
+#define KLOG_DEBUG 3
+#define KLOG_LEVELS 4
+
+#define KLOG_RECORDS      512               // Power of two
+#define KLOG_RECORD_SIZE  128
+#define KLOG_SUBSYS_MAX   10                // Including the terminating NUL
+#define KLOG_TEXT_MAX     (KLOG_RECORD_SIZE - 28)
+
+// Console rendering
+#define KLOG_CONSOLE              0
+#define KLOG_CONSOLE_LEVEL        KLOG_WARN // Default; dmesg -n changes it
+#define KLOG_CONSOLE_BURST        8
+#define KLOG_CONSOLE_INTERVAL_MS  50
+#define KLOG_CONSOLE_BACKLOG      64
+
+typedef struct {
+    volatile uint32_t commit;       // seq + 1 once complete, 0 while being written
+    uint32_t seq;
+    uint64_t time_ns;               // Monotonic time since boot
+    uint8_t level;
+    uint8_t length;                 // Bytes of text, not NUL-terminated
+    char subsystem[KLOG_SUBSYS_MAX];
+    char text[KLOG_TEXT_MAX];
+} klog_record_t;
+
+typedef struct {
+    uint32_t logged;                // Records written
+    uint32_t truncated;             // Messages cut to KLOG_TEXT_MAX
+    uint32_t rendered;              // Records shown on the console
+    uint32_t skipped;               // Not shown: console backlog too long
+    uint32_t lost;                  // Overwritten before the console got to them
+    uint64_t log_cycles;            // Spent in producers
+    uint64_t render_cycles;         // Spent rendering on the console
+    uint32_t max_log_cycles;
+} klog_stats_t;
+
+// Function declarations. klog() takes %s, %c, %d, %u and %x (printed
+// like terminal_print_hex); text past KLOG_TEXT_MAX is cut off.
+void klog_init(void);
+void klog(uint32_t level, const char* subsystem, const char* format, ...);
+void klog_write(uint32_t level, const char* subsystem, const char* text, size_t length);
+void klog_flush(void);
+void klog_set_console_level(uint32_t level);
+void klog_get_stats(klog_stats_t* stats);
+
+// Shell: dmesg [-n LEVEL] [LEVEL] [SUBSYSTEM], klogstat
+void klog_dmesg(const char* args);
+void klog_print_stats(void);
+
+#endif // KLOG_H
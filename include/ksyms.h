@@ -0,0 +1,25 @@
+#ifndef KSYMS_H
+#define KSYMS_H
+
+#include "terminal.h"
+
+// Kernel symbol table: the address and name of every function, sorted by
+// address. The build generates it from the linked kernel (tools/mksyms.awk)
+// and links the kernel a second time with it. It lives in its own section
+// after all code, including .init, so no function moves between the two
+// links.
+#define KSYMS_SECTION __attribute__((section(".ksyms")))
+
+typedef struct {
+    uint32_t addr;
+    uint32_t name;                  // Offset in ksyms_names
+} ksym_t;
+
+extern const ksym_t ksyms[];
+extern const uint32_t ksyms_count;
+extern const char ksyms_names[];
+
+// Function declarations
+const char* ksyms_lookup(uint32_t addr, uint32_t* offset);
+
+#endif // KSYMS_H
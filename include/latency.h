@@ -0,0 +1,39 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "terminal.h"
+
+// Latency histograms in TSC cycles with logarithmic buckets: values below
+// LATENCY_SUB_BUCKETS get a bucket each, and every power of two above is
+// split into LATENCY_SUB_BUCKETS equal buckets, so a percentile read back
+// is within 1/LATENCY_SUB_BUCKETS of the true value at any magnitude.
+#define LATENCY_SUB_BITS    3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS     ((32 - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+typedef struct {
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+} latency_hist_t;
+
+// Keystroke-to-glyph latency: from the keyboard interrupt to the echoed
+// character being on screen. In VGA text mode that is as soon as the cell
+// and the cursor are written; a backend that draws later (fbcon) reports
+// the keystrokes its flush showed. Keystrokes waiting for a flush beyond
+// LATENCY_INPUT_PENDING are not measured.
+#define LATENCY_INPUT_PENDING 16
+
+// Function declarations
+void latency_hist_record(latency_hist_t* hist, uint64_t cycles);
+uint32_t latency_hist_percentile(const latency_hist_t* hist, uint32_t permille);
+void latency_hist_reset(latency_hist_t* hist);
+
+void latency_input_echoed(uint64_t tsc);
+uint32_t latency_input_pending(void);
+void latency_input_shown(uint32_t count);
+
+// Shell: latency prints p50/p99/max and starts over
+void latency_print(void);
+
+#endif // LATENCY_H
@@ -0,0 +1,53 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include "terminal.h"
+
+// Page size
+#define PAGE_SIZE  4096
+#define PAGE_SHIFT 12
+#define PAGE_ALIGN_DOWN(addr) ((uint32_t)(addr) & ~(PAGE_SIZE - 1))
+#define PAGE_ALIGN_UP(addr)   (((uint32_t)(addr) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1))
+
+// Physical memory below 1MB (BIOS data, boot stack, VGA) is never handed out
+#define LOW_MEMORY_END 0x100000
+
+// Physical memory the allocator manages is identity mapped in kernel space
+// (see paging.h), so it is capped at the size of that window
+#define PMM_MAX_MEMORY 0x40000000
+
+// CMOS registers holding the BIOS memory size
+#define CMOS_ADDRESS_PORT   0x70
+#define CMOS_DATA_PORT      0x71
+#define CMOS_EXT_MEM_LOW    0x30   // KB above 1MB (up to 64MB)
+#define CMOS_EXT_MEM_HIGH   0x31
+#define CMOS_EXT_MEM2_LOW   0x34   // 64KB blocks above 16MB
+#define CMOS_EXT_MEM2_HIGH  0x35
+
+// Per-frame metadata, kept next to the allocation bitmap. The reference
+// count tracks how many mappings share a frame (copy-on-write); frames
+// handed out by pmm_alloc() start with a count of 1.
+typedef struct {
+    uint16_t refcount;
+    uint16_t flags;
+} pmm_frame_t;
+
+// Physical memory manager (bitmap based, one bit per 4KB frame)
+void memory_init(void);
+void memory_free_init(void);
+void* pmm_alloc(size_t pages);
+void pmm_free(void* addr, size_t pages);
+
+// Frame reference counting
+void pmm_frame_ref(uint32_t phys);
+uint32_t pmm_frame_unref(uint32_t phys);
+uint32_t pmm_frame_refcount(uint32_t phys);
+
+// Memory information
+uint32_t memory_get_size(void);
+size_t pmm_get_total_pages(void);
+size_t pmm_get_free_pages(void);
+size_t pmm_get_used_pages(void);
+size_t pmm_get_init_freed_pages(void);
+
+#endif // MEMORY_H
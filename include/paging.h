@@ -0,0 +1,114 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include "interrupts.h"
+#include "memory.h"
+#include "errors.h"
+
+// Page table entry flags
+#define PTE_PRESENT       0x001
+#define PTE_WRITABLE      0x002
+#define PTE_USER          0x004
+#define PTE_WRITE_THROUGH 0x008
+#define PTE_CACHE_DISABLE 0x010
+#define PTE_ACCESSED      0x020
+#define PTE_DIRTY         0x040
+#define PTE_GLOBAL        0x100
+#define PTE_COW           0x200     // Available bit: read-only until first write
+#define PTE_FRAME_MASK    0xFFFFF000
+
+// Page attribute table. PWT alone selects PAT entry 1, which paging_init()
+// changes from write-through to write-combining; nothing else maps pages
+// write-through.
+#define MSR_PAT           0x277
+#define PAT_DEFAULT       0x0007040600070406ULL  // WB, WT, UC-, UC twice
+#define PAT_ENTRY1_WC     0x0007040600070106ULL  // Entry 1 write-combining
+#define PTE_WRITE_COMBINE PTE_WRITE_THROUGH
+
+// Page fault error code bits
+#define PF_PRESENT 0x01     // Protection violation (page was present)
+#define PF_WRITE   0x02     // Fault on a write
+#define PF_USER    0x04     // Fault in ring 3
+
+// Virtual address space layout
+//   0x00000000 - 0x3FFFFFFF  kernel: physical memory, identity mapped
+//   0x40000000 - 0xBFFFFFFF  user: private to each address space
+//   0xC0000000 - 0xFFFFFFFF  kernel: device memory (MMIO), identity mapped
+// Kernel page tables are shared by every address space.
+#define KERNEL_SPACE_END   0x40000000
+#define USER_SPACE_START   0x40000000
+#define USER_SPACE_END     0xC0000000
+#define USER_KDATA_ADDR    (USER_SPACE_END - PAGE_SIZE)      // Shared kernel data page
+#define USER_STACK_TOP     (USER_KDATA_ADDR - PAGE_SIZE)     // Guard page in between
+
+#define PDE_INDEX(addr) ((uint32_t)(addr) >> 22)
+#define PTE_INDEX(addr) (((uint32_t)(addr) >> 12) & 0x3FF)
+#define PAGE_ENTRIES 1024
+
+// Range operations touching more pages than this reload CR3 instead of
+// invalidating page by page
+#define PAGING_INVLPG_MAX 32
+
+// Maximum number of live address spaces
+#define ADDRESS_SPACE_MAX 64
+
+// Lazily populated regions per address space
+#define VM_AREA_MAX 8
+
+struct address_space;
+struct vm_area;
+
+// Pages of an area are mapped on first access: a not-present fault inside
+// it calls fault(), which maps the page or returns an error. open() is
+// called when the area is added to a space (or copied into a clone),
+// close() when the space is destroyed.
+typedef struct {
+    int32_t (*fault)(struct address_space* space, struct vm_area* area, uint32_t addr, uint32_t err_code);
+    void (*open)(struct vm_area* area);
+    void (*close)(struct vm_area* area);
+} vm_ops_t;
+
+typedef struct vm_area {
+    uint32_t start;                 // Page aligned
+    uint32_t end;
+    const vm_ops_t* ops;
+    void* data;                     // Owner's object and sub-object
+    uint32_t index;
+} vm_area_t;
+
+// An address space is a page directory plus its user mappings
+typedef struct address_space {
+    uint32_t* page_directory;       // Physical address == kernel virtual address
+    struct address_space* next;     // All address spaces, for kernel PDE updates
+    uint8_t in_use;
+    vm_area_t areas[VM_AREA_MAX];
+    uint32_t area_count;
+} address_space_t;
+
+// Function declarations
+void paging_init(void);
+address_space_t* paging_kernel_space(void);
+address_space_t* address_space_current(void);
+address_space_t* address_space_create(void);
+void address_space_destroy(address_space_t* space);
+void address_space_switch(address_space_t* space);
+address_space_t* address_space_clone(address_space_t* src);
+address_space_t* address_space_copy(address_space_t* src);
+int address_space_alloc_region(address_space_t* space, uint32_t virt, uint32_t size, uint32_t flags);
+int address_space_add_area(address_space_t* space, uint32_t start, uint32_t end,
+                           const vm_ops_t* ops, void* data, uint32_t index);
+
+int paging_map(address_space_t* space, uint32_t virt, uint32_t phys, uint32_t flags);
+void paging_unmap(address_space_t* space, uint32_t virt);
+uint32_t* paging_get_pte(address_space_t* space, uint32_t virt, int create);
+uint32_t paging_transfer(address_space_t* from, uint32_t from_addr,
+                         address_space_t* to, uint32_t to_addr, uint32_t pages);
+void* paging_map_mmio(uint32_t phys, uint32_t size);
+void* paging_map_framebuffer(uint32_t phys, uint32_t size);
+void* virtual_to_physical(void* virtual_addr);
+int paging_user_buffer(uint32_t addr, uint32_t size);
+
+void page_fault_handler(interrupt_frame_t* frame);
+void paging_clone_benchmark(void);
+
+#endif // PAGING_H
@@ -0,0 +1,93 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include "terminal.h"
+
+// PCI configuration mechanism #1
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+// Configuration space registers (type 0 header)
+#define PCI_VENDOR_ID      0x00
+#define PCI_DEVICE_ID      0x02
+#define PCI_COMMAND        0x04
+#define PCI_STATUS         0x06
+#define PCI_REVISION       0x08
+#define PCI_PROG_IF        0x09
+#define PCI_SUBCLASS       0x0A
+#define PCI_CLASS          0x0B
+#define PCI_HEADER_TYPE    0x0E
+#define PCI_BAR0           0x10
+#define PCI_SUBSYSTEM_ID   0x2E
+#define PCI_INTERRUPT_LINE 0x3C
+#define PCI_INTERRUPT_PIN  0x3D
+
+// Command register bits
+#define PCI_COMMAND_IO          0x0001
+#define PCI_COMMAND_MEMORY      0x0002
+#define PCI_COMMAND_BUS_MASTER  0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+// BAR bits
+#define PCI_BAR_IO       0x1
+#define PCI_BAR_IO_MASK  0xFFFFFFFCu
+#define PCI_BAR_MEM_MASK 0xFFFFFFF0u
+
+#define PCI_HEADER_MULTIFUNCTION 0x80
+#define PCI_NO_IRQ               0xFF
+
+// Device table and driver matching
+#define PCI_MAX_DEVICES 64
+#define PCI_MAX_DRIVERS 16
+#define PCI_BAR_COUNT   6
+#define PCI_ANY_ID      0xFFFF          // Wildcard for vendor, device and class
+#define PCI_CLASS_ID(cls, sub) ((uint16_t)(((cls) << 8) | (sub)))
+
+struct pci_driver;
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t revision;
+    uint8_t irq_line;               // Legacy PIC line, PCI_NO_IRQ if none
+    uint32_t bar[PCI_BAR_COUNT];    // Raw BAR values
+    const struct pci_driver* driver;
+    void* driver_data;
+} pci_device_t;
+
+// A driver matches on vendor/device and/or class/subclass; fields left at
+// PCI_ANY_ID match anything. probe() returns 0 to claim the device.
+typedef struct pci_driver {
+    const char* name;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint16_t class_id;              // PCI_CLASS_ID(class, subclass)
+    int (*probe)(pci_device_t* dev);
+} pci_driver_t;
+
+// Configuration space access
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+uint8_t pci_config_read8(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value);
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint16_t value);
+
+// Enumeration and drivers
+void pci_init(void);
+int pci_register_driver(const pci_driver_t* driver);
+size_t pci_device_count(void);
+pci_device_t* pci_get_device(size_t index);
+void pci_list(void);
+
+// Device helpers
+int pci_bar_is_io(pci_device_t* dev, int bar);
+uint32_t pci_bar_address(pci_device_t* dev, int bar);
+void pci_enable(pci_device_t* dev, int bus_master);
+
+#endif // PCI_H
@@ -0,0 +1,93 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include "terminal.h"
+#include "paging.h"
+#include "fpu.h"
+
+// Thread limits
+#define THREAD_MAX          64
+#define THREAD_STACK_PAGES  2                   // 8 KB kernel stack per thread
+#define THREAD_TIMESLICE    10                  // Timer ticks before preemption
+
+typedef enum {
+    THREAD_UNUSED = 0,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD
+} thread_state_t;
+
+struct thread;
+
+// FIFO of blocked threads
+typedef struct {
+    struct thread* head;
+    struct thread* tail;
+} wait_queue_t;
+
+typedef struct thread {
+    uint32_t esp;                   // Saved kernel stack pointer
+    uint32_t kernel_stack;          // Base of the kernel stack (0 for the boot thread)
+    uint32_t kernel_stack_top;      // Loaded into tss.esp0 when the thread runs
+    address_space_t* space;         // Address space, or 0 to keep whatever is loaded
+    uint8_t owns_space;             // Destroy space when the thread is reaped
+    uint8_t detached;               // Reap automatically on exit
+    thread_state_t state;
+    uint32_t id;
+    const char* name;
+    uint32_t timeslice;
+    uint8_t console;                // Virtual console SYS_WRITE goes to
+    struct stream* output;          // Stream SYS_WRITE goes to instead, if set
+    uint8_t in_syscall;             // Inside syscall_dispatch() (see page_fault_handler)
+
+    // Start-up parameters
+    void (*entry)(uint32_t arg);
+    uint32_t arg;
+    uint32_t user_entry;
+    uint32_t user_stack_top;
+
+    struct thread* next;            // Run queue / wait queue link
+    wait_queue_t join_waiters;
+    int32_t exit_code;
+
+    // IPC state (see ipc.c)
+    interrupt_frame_t* ipc_frame;   // Registers of the system call blocked in IPC
+    struct thread* ipc_caller;      // Client waiting for this thread's reply
+    uint32_t ipc_window;            // Where granted pages land (address | pages)
+    uint8_t ipc_op;                 // Operation the thread is blocked in
+
+    // FPU/SSE registers, saved lazily (see fpu.c)
+    uint8_t fpu_used;               // fpu_state holds a saved state
+    uint8_t fpu_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+} thread_t;
+
+// Scheduler
+void sched_init(void);
+thread_t* sched_current(void);
+void sched_yield(void);
+void sched_tick(void);
+void sched_preempt(int returning_to_user);
+void sched_wake(thread_t* thread);
+void sched_switch_to(thread_t* thread);
+void sched_block(wait_queue_t* queue, thread_t* next);
+void sched_set_kernel_stack(uint32_t top);
+
+// Threads
+thread_t* thread_create(const char* name, void (*entry)(uint32_t), uint32_t arg);
+thread_t* thread_create_user(const char* name, address_space_t* space, uint32_t entry,
+                             uint32_t user_stack_top, uint32_t arg);
+void thread_exit(int32_t code) __attribute__((noreturn));
+int32_t thread_join(thread_t* thread);
+void thread_detach(thread_t* thread);
+
+// Wait queues (callers disable interrupts around the condition check and
+// the sleep so a wake-up cannot be lost)
+void wait_queue_init(wait_queue_t* queue);
+void wait_queue_sleep(wait_queue_t* queue);
+thread_t* wait_queue_wake_one(wait_queue_t* queue);
+void wait_queue_wake_all(wait_queue_t* queue);
+thread_t* wait_queue_dequeue(wait_queue_t* queue);
+int wait_queue_empty(wait_queue_t* queue);
+
+#endif // SCHED_H
@@ -0,0 +1,32 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "terminal.h"
+
+// 16550 UART on COM1, transmit only and polled: enough for shell output
+// sent to /dev/serial (QEMU shows it as serial0, or on stdio with
+// -serial stdio). No interrupts are enabled.
+#define SERIAL_COM1        0x3F8
+#define SERIAL_BAUD        115200
+
+// Register offsets from the base port
+#define SERIAL_DATA        0        // Transmit holding / divisor low with DLAB
+#define SERIAL_IER         1        // Interrupt enable / divisor high with DLAB
+#define SERIAL_FCR         2        // FIFO control
+#define SERIAL_LCR         3        // Line control
+#define SERIAL_MCR         4        // Modem control
+#define SERIAL_LSR         5        // Line status
+
+#define SERIAL_LCR_8N1     0x03
+#define SERIAL_LCR_DLAB    0x80
+#define SERIAL_FCR_ENABLE  0xC7     // Enable and clear FIFOs, 14-byte trigger
+#define SERIAL_MCR_READY   0x03     // DTR and RTS
+#define SERIAL_MCR_LOOP    0x10
+#define SERIAL_LSR_THRE    0x20     // Transmit holding register empty
+
+// Function declarations
+void serial_init(void);
+int serial_present(void);
+void serial_write(const char* data, size_t size);
+
+#endif // SERIAL_H
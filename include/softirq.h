@@ -0,0 +1,74 @@
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include "terminal.h"
+
+// Deferred interrupt work. A device's interrupt handler (the top half)
+// only acknowledges the device and raises a softirq or schedules a
+// tasklet; the work itself (the bottom half) runs when the outermost
+// interrupt handler exits, after EOI and with interrupts enabled. An
+// interrupt that arrives while bottom halves run only runs its top half
+// and returns to them. Each exit runs softirqs for a bounded time; work
+// left over after that is handed to the ksoftirqd thread, which runs it
+// between other threads so an interrupt flood cannot starve them.
+//
+// Bottom halves never run concurrently with each other or with a thread
+// that has interrupts disabled, so data shared with threads is protected
+// as before by disabling interrupts in the thread. Only data shared with
+// a top half needs interrupts disabled in the bottom half. Bottom halves
+// must not sleep.
+
+// Softirq vectors, run in this order
+#define SOFTIRQ_TIMER   0                   // Timer wheel (timer_wheel.c)
+#define SOFTIRQ_TASKLET 1                   // Tasklets
+#define SOFTIRQ_COUNT   2
+
+// Budgets per run, at interrupt exit or in ksoftirqd
+#define SOFTIRQ_MAX_RESTART    10           // Passes over the pending vectors
+#define SOFTIRQ_MAX_US         2000
+#define SOFTIRQ_TASKLET_BUDGET 32           // Tasklets per pass
+
+typedef void (*softirq_handler_t)(void);
+
+// A tasklet runs fn(arg) once after each tasklet_schedule(); scheduling it
+// again while it is queued does nothing, and scheduling it while it runs
+// queues it to run again
+typedef struct tasklet {
+    struct tasklet* next;
+    void (*fn)(void* arg);
+    void* arg;
+    volatile uint8_t scheduled;
+} tasklet_t;
+
+typedef struct {
+    uint32_t runs[SOFTIRQ_COUNT];
+    uint64_t cycles[SOFTIRQ_COUNT];
+    uint32_t tasklets;              // Tasklet functions run
+    uint32_t exits;                 // Runs at interrupt exit
+    uint32_t thread_runs;           // Runs in ksoftirqd
+    uint32_t thread_wakeups;        // Budget spent, work handed to ksoftirqd
+} softirq_stats_t;
+
+// Function declarations
+void softirq_init(void);
+void softirq_register(uint32_t nr, softirq_handler_t handler);
+void softirq_raise(uint32_t nr);
+void tasklet_init(tasklet_t* tasklet, void (*fn)(void* arg), void* arg);
+void tasklet_schedule(tasklet_t* tasklet);
+
+// Interrupt exit (interrupts.c): softirq_active() is 1 when the interrupt
+// arrived while bottom halves were running; otherwise softirq_irq_exit()
+// runs the pending ones
+int softirq_active(void);
+void softirq_irq_exit(void);
+
+// 0 runs bottom halves inside the hard interrupt handler with interrupts
+// disabled, as before this layer existed (irqbench baseline)
+void softirq_set_deferred(int deferred);
+
+// Statistics (irqstat command) and benchmark (irqbench command)
+void softirq_get_stats(softirq_stats_t* stats);
+void softirq_print_stats(void);
+void softirq_benchmark(void);
+
+#endif // SOFTIRQ_H
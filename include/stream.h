@@ -0,0 +1,34 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "terminal.h"
+
+// Where a shell command's output goes. While a stream is set with
+// terminal_set_output(), everything the shell thread writes through
+// terminal_write() and terminal_putchar() (and the print helpers built on
+// them) goes to write() instead of the screen, and so does SYS_WRITE from
+// user programs it starts (exec):
+//   null    discarded (cmd > /dev/null, repeat)
+//   pipe    kept in a RAM buffer for the next command (cmd | grep x);
+//           what does not fit is counted in dropped
+//   serial  sent to COM1 (cmd > /dev/serial)
+#define STREAM_PIPE_PAGES 16                // 64 KB per pipe
+
+typedef struct stream {
+    void (*write)(struct stream* stream, const char* data, size_t size);
+    char* buffer;                   // Pipe: RAM buffer
+    uint32_t capacity;
+    uint32_t length;                // Bytes written
+    uint32_t read_pos;              // Bytes consumed by stream_read_line()
+    uint32_t dropped;               // Bytes that did not fit
+} stream_t;
+
+// Function declarations
+void stream_null(stream_t* stream);
+int stream_serial(stream_t* stream);
+int stream_pipe(stream_t* stream);
+void stream_rewind(stream_t* stream);
+void stream_free(stream_t* stream);
+int32_t stream_read_line(stream_t* stream, char* line, size_t size);
+
+#endif // STREAM_H
@@ -0,0 +1,49 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "interrupts.h"
+#include "errors.h"
+
+// System call ABI
+//   EAX      system call number, return value on exit
+//   EBX      argument 1
+//   ESI      argument 2
+//   EDI      argument 3
+//   EBP      argument 4 (the caller saves its frame pointer around the call)
+// ECX and EDX are clobbered: the sysenter path uses them to carry the
+// user stack pointer and return address. Both entry paths (sysenter and
+// the int 0x80 fallback) build an interrupt_frame_t and end up in
+// syscall_dispatch(), so handlers never know which one was used.
+#define SYSCALL_VECTOR 0x80
+
+// System call numbers
+#define SYS_NULL            0   // Does nothing; used to measure entry/exit cost
+#define SYS_EXIT            1   // exit(code)
+#define SYS_WRITE           2   // write(buffer, length) to the console
+#define SYS_CLOCK           3   // Monotonic ns; low half in EAX, high half in EBX
+#define SYS_IPC_SEND        4   // send(endpoint, w0, w1, grant)
+#define SYS_IPC_RECV        5   // recv(endpoint, -, -, window)
+#define SYS_IPC_CALL        6   // call(endpoint, w0, w1, grant): send, wait for reply
+#define SYS_IPC_REPLY_RECV  7   // reply_recv(endpoint, w0, w1, grant)
+#define SYS_FUTEX_WAIT      8   // wait(addr, expected, timeout_ms)
+#define SYS_FUTEX_WAKE      9   // wake(addr, count): returns threads woken
+#define SYS_MUTEX_LOCK     10   // lock(addr): kernel-side mutex (futexbench baseline)
+#define SYS_MUTEX_UNLOCK   11   // unlock(addr)
+#define SYSCALL_COUNT 64
+
+// SYSENTER model specific registers
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+
+// Handlers receive the saved user registers and may update them
+typedef int32_t (*syscall_fn_t)(interrupt_frame_t* frame);
+
+// Function declarations
+void syscall_init(void);
+void syscall_register(uint32_t num, syscall_fn_t handler);
+void syscall_dispatch(interrupt_frame_t* frame);
+int syscall_sysenter_supported(void);
+void syscall_benchmark(void);
+
+#endif // SYSCALL_H
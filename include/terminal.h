@@ -14,9 +14,6 @@ typedef signed long long int64_t;
 // Size type
 typedef uint32_t size_t;
 
-// String length function declaration
-size_t strlen(const char* str);
-
 // VGA text mode constants
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
@@ -45,6 +42,40 @@ size_t strlen(const char* str);
 #define VGA_COLOR(fg, bg) ((bg) << 4 | (fg))
 #define VGA_ENTRY(ch, color) ((uint16_t)(ch) | (uint16_t)(color) << 8)
 
+#define TERMINAL_DEFAULT_COLOR VGA_COLOR(VGA_LIGHT_GREY, VGA_BLACK)
+
+// VGA CRT controller registers for the hardware cursor
+#define VGA_CRTC_INDEX        0x3D4
+#define VGA_CRTC_DATA         0x3D5
+#define VGA_CRTC_CURSOR_START 0x0A
+#define VGA_CRTC_CURSOR_HIGH  0x0E
+#define VGA_CRTC_CURSOR_LOW   0x0F
+#define VGA_CRTC_START_HIGH   0x0C      // First cell displayed
+#define VGA_CRTC_START_LOW    0x0D
+#define VGA_CURSOR_DISABLE    0x20      // In VGA_CRTC_CURSOR_START
+
+// Text memory holds eight 4 KB pages; a screen uses 4000 bytes of one
+#define VGA_PAGES      8
+#define VGA_PAGE_SIZE  0x1000
+#define VGA_PAGE_CELLS (VGA_PAGE_SIZE / 2)
+
+// Virtual consoles, one text page each (Alt+F1 - Alt+F6). A console that
+// is not on screen is written with interrupts disabled; SYS_WRITE passes
+// user buffers on TERMINAL_CONSOLE_CHUNK bytes at a time and lets
+// interrupts in between chunks.
+#define TERMINAL_CONSOLES 6
+#define TERMINAL_CONSOLE_CHUNK 128
+
+// Scrollback per console (Shift+PageUp/PageDown), shown from a spare page.
+// Line offsets are 16 bits, so at most 64 KB of text.
+#define TERMINAL_SCROLLBACK_BYTES 0x10000
+#define TERMINAL_SCROLLBACK_LINES 4096
+#define TERMINAL_SCROLLBACK_PAGE  (VGA_PAGES - 1)
+
+// Escape sequence parameters: at most this many, each clamped
+#define TERMINAL_ESC_PARAMS    8
+#define TERMINAL_ESC_PARAM_MAX 9999
+
 // Terminal position structure
 typedef struct {
     uint16_t x;
@@ -57,8 +88,38 @@ typedef struct {
     terminal_pos_t cursor;
     uint8_t saved_color;
     terminal_pos_t saved_cursor;
+    uint8_t cursor_hidden;
+    uint8_t reverse;                // SGR 7 swapped the colors
+    uint16_t scroll_top;            // Scroll region, inclusive
+    uint16_t scroll_bottom;
+
+    // Escape sequence parser
+    uint8_t esc_state;
+    uint8_t esc_private;            // Marker after CSI ('?'), 0 if none
+    uint8_t esc_count;              // Parameters started
+    uint16_t esc_params[TERMINAL_ESC_PARAMS];
 } terminal_state_t;
 
+typedef struct {
+    uint32_t chars;                 // Bytes written
+    uint32_t sequences;             // Escape sequences carried out
+    uint32_t cursor_writes;         // Hardware cursor updates (CRTC writes)
+    uint32_t switches;              // Console switches
+} terminal_stats_t;
+
+// Where the terminal keeps its cells. The default is VGA text memory,
+// which the hardware displays by itself; another backend (fbcon.c) hands
+// in a RAM grid of any size and is told when cells change so it can draw
+// them. Callbacks may be 0.
+typedef struct {
+    uint16_t* cells;                // width * height VGA_ENTRY() values
+    uint16_t width;
+    uint16_t height;
+    void (*changed)(void);          // Cells or the cursor changed
+    void (*scrolled)(void);         // All cells moved up one line
+    void (*flush)(void);            // Show the cells now
+} terminal_backend_t;
+
 // Basic terminal functions
 void terminal_initialize(void);
 void terminal_clear(void);
@@ -81,6 +142,7 @@ void terminal_save_cursor(void);
 void terminal_restore_cursor(void);
 void terminal_hide_cursor(void);
 void terminal_show_cursor(void);
+int terminal_cursor_visible(void);
 
 // Character output
 void terminal_putchar(char c);
@@ -98,6 +160,7 @@ void terminal_printf(const char* format, ...);
 void terminal_println(const char* str);
 void terminal_print_hex(uint32_t value);
 void terminal_print_dec(uint32_t value);
+void terminal_print_dec64(uint64_t value);
 void terminal_print_bin(uint32_t value);
 
 // Screen management
@@ -106,9 +169,36 @@ void terminal_draw_box(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, char
 void terminal_draw_line_horizontal(uint16_t x, uint16_t y, uint16_t length, char c, uint8_t color);
 void terminal_draw_line_vertical(uint16_t x, uint16_t y, uint16_t length, char c, uint8_t color);
 
+// Output backend; 0 goes back to VGA text memory
+void terminal_set_backend(const terminal_backend_t* backend);
+const terminal_backend_t* terminal_get_backend(void);
+uint16_t terminal_get_width(void);
+uint16_t terminal_get_height(void);
+void terminal_flush(void);
+
+// Virtual consoles; output goes to the one on screen unless written
+// with terminal_write_console()
+int terminal_switch_console(uint32_t console);
+uint32_t terminal_get_console(void);
+void terminal_write_console(uint32_t console, const char* data, size_t size);
+
+// Output redirection for the calling thread (stream.h); 0 is the screen
+struct stream;
+struct stream* terminal_set_output(struct stream* stream);
+struct stream* terminal_get_output(void);
+
+// Scrollback: positive lines go back in history, negative forward
+void terminal_scrollback(int32_t lines);
+void terminal_scrollback_print_stats(void);
+
 // Utility functions
 uint16_t terminal_get_index(uint16_t x, uint16_t y);
 void terminal_update_cursor(void);
 void terminal_handle_escape_sequence(const char* sequence);
 
+// Statistics and benchmarks (ansibench, vcbench commands)
+void terminal_get_stats(terminal_stats_t* stats);
+void terminal_benchmark(void);
+void terminal_console_benchmark(void);
+
 #endif // TERMINAL_H 
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "terminal.h"
+
+// Programmable Interval Timer (8253/8254)
+#define PIT_CHANNEL0      0x40
+#define PIT_COMMAND       0x43
+#define PIT_BASE_FREQUENCY 1193182
+#define PIT_MODE_RATE_GEN 0x34      // Channel 0, lobyte/hibyte, mode 2
+
+// Timer interrupt frequency
+#define TIMER_HZ 1000
+
+// TSC calibration window
+#define TIMER_CALIBRATE_TICKS 50
+
+// CMOS real-time clock registers
+#define RTC_SECONDS  0x00
+#define RTC_MINUTES  0x02
+#define RTC_HOURS    0x04
+#define RTC_DAY      0x07
+#define RTC_MONTH    0x08
+#define RTC_YEAR     0x09
+#define RTC_STATUS_A 0x0A
+#define RTC_STATUS_B 0x0B
+
+// Function declarations
+void timer_init(void);
+void timer_handler(void);
+uint64_t timer_get_ticks(void);
+uint32_t timer_get_tsc_khz(void);
+
+// TSC cycles measured over count events to microseconds or nanoseconds
+// per event (count 1 for a single span); 0 until the TSC is calibrated
+uint32_t timer_cycles_to_us(uint64_t cycles, uint32_t count);
+uint32_t timer_cycles_to_ns(uint64_t cycles, uint32_t count);
+uint32_t rtc_read_unix_time(void);
+
+#endif // TIMER_H
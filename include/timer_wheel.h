@@ -0,0 +1,56 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "terminal.h"
+
+// Kernel timers on a hierarchical timing wheel driven by IRQ0. The first
+// level has one bucket per tick for the next 256 ticks; each of the four
+// levels above covers 64 times the span of the one below, so any 32-bit
+// delay has a bucket. Adding and cancelling a timer is a list insert or
+// unlink. Every tick moves one bucket; when level 1 wraps, the next
+// bucket of level 2 is redistributed (cascaded) into level 1, and so on
+// up. Expired timers are spliced out of their bucket in one go and their
+// callbacks run from the timer softirq with interrupts enabled.
+#define TIMER_WHEEL_ROOT_BITS 8
+#define TIMER_WHEEL_ROOT_SIZE (1 << TIMER_WHEEL_ROOT_BITS)
+#define TIMER_WHEEL_BITS      6
+#define TIMER_WHEEL_SIZE      (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS    4             // Above the root level
+
+// Timers handed out by timer_add()
+#define TIMER_POOL_SIZE 4096
+
+// Callbacks run in softirq context and must not sleep
+typedef void (*timer_fn_t)(void* arg);
+
+typedef struct timer {
+    struct timer* next;             // Bucket list, or free list
+    struct timer** pprev;           // Whatever points at this timer, 0 when idle
+    uint32_t expires;               // Wheel tick
+    timer_fn_t fn;
+    void* arg;
+    uint16_t generation;            // Bumped on reuse so stale ids miss
+} timer_t;
+
+typedef struct {
+    uint32_t added;
+    uint32_t cancelled;
+    uint32_t expired;
+    uint32_t cascaded;              // Timers moved down a level
+} timer_wheel_stats_t;
+
+// Function declarations
+void timer_wheel_init(void);
+void timer_wheel_run(uint64_t now);
+
+// Run fn(arg) from the timer softirq after at least delay_ms; returns an
+// id for timer_cancel(), or 0 when all TIMER_POOL_SIZE timers are in use
+uint32_t timer_add(uint32_t delay_ms, timer_fn_t fn, void* arg);
+int timer_cancel(uint32_t id);
+void sleep_ms(uint32_t ms);
+
+// Statistics and benchmark (timerbench command)
+void timer_wheel_get_stats(timer_wheel_stats_t* stats);
+void timer_wheel_benchmark(void);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,102 @@
+#ifndef USER_H
+#define USER_H
+
+#include "terminal.h"
+#include "syscall.h"
+
+// User-side runtime for ring 3 code linked into the kernel image.
+//
+// Ring 3 code and its data must live in the .user sections (see
+// kernel/linker.ld) and may only call functions that are also there, so
+// every helper in this header is forced inline. Avoid string literals and
+// struct copies in user code: they land in kernel .rodata or turn into
+// calls to kernel routines.
+#define USER_TEXT __attribute__((section(".user.text"), noinline))
+#define USER_DATA __attribute__((section(".user.data")))
+#define USER_INLINE static inline __attribute__((always_inline))
+
+// System calls through the int 0x80 gate
+USER_INLINE int32_t user_syscall_int80(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3) {
+    int32_t ret;
+    __asm__ volatile("int $0x80"
+                     : "=a"(ret)
+                     : "a"(num), "b"(a1), "S"(a2), "D"(a3)
+                     : "ecx", "edx", "memory");
+    return ret;
+}
+
+// System calls through sysenter: ECX carries the stack pointer and EDX the
+// address sysexit returns to
+USER_INLINE int32_t user_syscall_sysenter(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3) {
+    int32_t ret;
+    __asm__ volatile("movl %%esp, %%ecx\n\t"
+                     "movl $1f, %%edx\n\t"
+                     "sysenter\n"
+                     "1:"
+                     : "=a"(ret)
+                     : "a"(num), "b"(a1), "S"(a2), "D"(a3)
+                     : "ecx", "edx", "memory");
+    return ret;
+}
+
+// Set by syscall_init(); lives in .user.data so ring 3 can read it
+extern uint32_t user_sysenter_available;
+
+// Default entry path: sysenter when the CPU has it, int 0x80 otherwise
+USER_INLINE int32_t user_syscall(uint32_t num, uint32_t a1, uint32_t a2, uint32_t a3) {
+    if (user_sysenter_available) {
+        return user_syscall_sysenter(num, a1, a2, a3);
+    }
+    return user_syscall_int80(num, a1, a2, a3);
+}
+
+// Four-argument system calls whose handler may also return values in EBX,
+// ESI, EDI and EBP; every argument is updated in place. EBP is the frame
+// pointer, so it is saved on the stack and argument 4 travels through ECX
+// into it; on the way back it is moved out before being restored.
+USER_INLINE int32_t user_syscall_regs(uint32_t num, uint32_t* a1, uint32_t* a2, uint32_t* a3, uint32_t* a4) {
+    uint32_t b = *a1, s = *a2, d = *a3, c = *a4;
+    if (user_sysenter_available) {
+        __asm__ volatile("pushl %%ebp\n\t"
+                         "movl %%ecx, %%ebp\n\t"
+                         "movl %%esp, %%ecx\n\t"
+                         "movl $1f, %%edx\n\t"
+                         "sysenter\n"
+                         "1:\n\t"
+                         "movl %%ebp, %%ecx\n\t"
+                         "popl %%ebp"
+                         : "+a"(num), "+b"(b), "+S"(s), "+D"(d), "+c"(c)
+                         :
+                         : "edx", "memory");
+    } else {
+        __asm__ volatile("pushl %%ebp\n\t"
+                         "movl %%ecx, %%ebp\n\t"
+                         "int $0x80\n\t"
+                         "movl %%ebp, %%ecx\n\t"
+                         "popl %%ebp"
+                         : "+a"(num), "+b"(b), "+S"(s), "+D"(d), "+c"(c)
+                         :
+                         : "edx", "memory");
+    }
+    *a1 = b;
+    *a2 = s;
+    *a3 = d;
+    *a4 = c;
+    return (int32_t)num;
+}
+
+USER_INLINE void user_exit(int32_t code) {
+    user_syscall(SYS_EXIT, (uint32_t)code, 0, 0);
+}
+
+USER_INLINE int32_t user_write(const char* buffer, size_t length) {
+    return user_syscall(SYS_WRITE, (uint32_t)buffer, length, 0);
+}
+
+USER_INLINE uint64_t user_rdtsc(void) {
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
+#endif // USER_H
@@ -0,0 +1,33 @@
+#ifndef USER_IPC_H
+#define USER_IPC_H
+
+#include "user.h"
+#include "ipc.h"
+
+// Ring 3 side of the IPC system calls (see ipc.h). Message words and the
+// grant are passed by pointer and updated with what was received.
+
+// Send and continue once a receiver has taken the message
+USER_INLINE int32_t user_ipc_send(uint32_t endpoint, uint32_t w0, uint32_t w1, uint32_t grant) {
+    return user_syscall_regs(SYS_IPC_SEND, &endpoint, &w0, &w1, &grant);
+}
+
+// Wait for a message. *grant is the window for incoming pages on entry and
+// the pages received on return. Returns the sender's thread id.
+USER_INLINE int32_t user_ipc_recv(uint32_t endpoint, uint32_t* w0, uint32_t* w1, uint32_t* grant) {
+    return user_syscall_regs(SYS_IPC_RECV, &endpoint, w0, w1, grant);
+}
+
+// Send and wait for the reply. Reply pages are mapped where the granted
+// pages were, so a buffer lent to a server comes back in place.
+USER_INLINE int32_t user_ipc_call(uint32_t endpoint, uint32_t* w0, uint32_t* w1, uint32_t* grant) {
+    return user_syscall_regs(SYS_IPC_CALL, &endpoint, w0, w1, grant);
+}
+
+// Reply to the last caller and wait for the next message in one system
+// call. Incoming pages use the window given to the last user_ipc_recv().
+USER_INLINE int32_t user_ipc_reply_recv(uint32_t endpoint, uint32_t* w0, uint32_t* w1, uint32_t* grant) {
+    return user_syscall_regs(SYS_IPC_REPLY_RECV, &endpoint, w0, w1, grant);
+}
+
+#endif // USER_IPC_H
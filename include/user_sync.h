@@ -0,0 +1,123 @@
+#ifndef USER_SYNC_H
+#define USER_SYNC_H
+
+#include "user.h"
+#include "futex.h"
+
+// Ring 3 mutex, condition variable and semaphore on the futex system
+// calls (see futex.h). Uncontended operations are one atomic instruction
+// on a word in user memory; the kernel is entered only to sleep on a busy
+// lock or to wake a thread that may be sleeping. All objects start out
+// zeroed.
+
+USER_INLINE int32_t user_futex_wait(volatile uint32_t* addr, uint32_t expected, uint32_t timeout_ms) {
+    return user_syscall(SYS_FUTEX_WAIT, (uint32_t)addr, expected, timeout_ms);
+}
+
+USER_INLINE int32_t user_futex_wake(volatile uint32_t* addr, uint32_t count) {
+    return user_syscall(SYS_FUTEX_WAKE, (uint32_t)addr, count, 0);
+}
+
+// Mutex word: 0 unlocked, 1 locked, 2 locked and threads may be waiting
+typedef struct {
+    volatile uint32_t state;
+} user_mutex_t;
+
+USER_INLINE int user_mutex_trylock(user_mutex_t* mutex) {
+    uint32_t state = 0;
+    return __atomic_compare_exchange_n(&mutex->state, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+// Take the lock marked as contended, so whoever unlocks it next calls
+// wake: we cannot tell whether other threads are still waiting
+USER_INLINE void user_mutex_lock_contended(user_mutex_t* mutex) {
+    while (__atomic_exchange_n(&mutex->state, 2, __ATOMIC_ACQUIRE) != 0) {
+        user_futex_wait(&mutex->state, 2, FUTEX_WAIT_FOREVER);
+    }
+}
+
+USER_INLINE void user_mutex_lock(user_mutex_t* mutex) {
+    if (!user_mutex_trylock(mutex)) {
+        user_mutex_lock_contended(mutex);
+    }
+}
+
+USER_INLINE void user_mutex_unlock(user_mutex_t* mutex) {
+    if (__atomic_fetch_sub(&mutex->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&mutex->state, 0, __ATOMIC_RELEASE);
+        user_futex_wake(&mutex->state, 1);
+    }
+}
+
+// Condition variable: waiters sleep on seq, which every signal bumps, so
+// a signal between unlocking the mutex and sleeping is not lost
+typedef struct {
+    volatile uint32_t seq;
+    volatile uint32_t waiters;
+} user_cond_t;
+
+// Returns E_OK when signalled (or spuriously) and E_TIMEDOUT; the mutex
+// is held again either way
+USER_INLINE int32_t user_cond_timedwait(user_cond_t* cond, user_mutex_t* mutex, uint32_t timeout_ms) {
+    uint32_t seq = cond->seq;
+    __atomic_fetch_add(&cond->waiters, 1, __ATOMIC_RELAXED);
+    user_mutex_unlock(mutex);
+    int32_t result = user_futex_wait(&cond->seq, seq, timeout_ms);
+    __atomic_fetch_sub(&cond->waiters, 1, __ATOMIC_RELAXED);
+    user_mutex_lock_contended(mutex);
+    return result == E_TIMEDOUT ? E_TIMEDOUT : E_OK;
+}
+
+USER_INLINE void user_cond_wait(user_cond_t* cond, user_mutex_t* mutex) {
+    user_cond_timedwait(cond, mutex, FUTEX_WAIT_FOREVER);
+}
+
+USER_INLINE void user_cond_signal(user_cond_t* cond) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+    if (cond->waiters) {
+        user_futex_wake(&cond->seq, 1);
+    }
+}
+
+USER_INLINE void user_cond_broadcast(user_cond_t* cond) {
+    __atomic_fetch_add(&cond->seq, 1, __ATOMIC_RELEASE);
+    if (cond->waiters) {
+        user_futex_wake(&cond->seq, FUTEX_WAKE_ALL);
+    }
+}
+
+// Counting semaphore; waiters sleep while value is 0
+typedef struct {
+    volatile uint32_t value;
+    volatile uint32_t waiters;
+} user_sem_t;
+
+USER_INLINE int user_sem_trywait(user_sem_t* sem) {
+    uint32_t value = sem->value;
+    while (value) {
+        if (__atomic_compare_exchange_n(&sem->value, &value, value - 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A post between the failed trywait and the futex wait makes the wait
+// return E_AGAIN, and we try again
+USER_INLINE void user_sem_wait(user_sem_t* sem) {
+    while (!user_sem_trywait(sem)) {
+        __atomic_fetch_add(&sem->waiters, 1, __ATOMIC_RELAXED);
+        user_futex_wait(&sem->value, 0, FUTEX_WAIT_FOREVER);
+        __atomic_fetch_sub(&sem->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+USER_INLINE void user_sem_post(user_sem_t* sem) {
+    __atomic_fetch_add(&sem->value, 1, __ATOMIC_RELEASE);
+    if (sem->waiters) {
+        user_futex_wake(&sem->value, 1);
+    }
+}
+
+#endif // USER_SYNC_H
@@ -0,0 +1,81 @@
+#ifndef USER_TIME_H
+#define USER_TIME_H
+
+#include "user.h"
+#include "kdata.h"
+#include "paging.h"
+
+// User-side clock and system information, read from the shared kernel
+// data page without entering the kernel. See kdata.h for the protocol.
+
+USER_INLINE const kdata_page_t* user_kdata(void) {
+    return (const kdata_page_t*)USER_KDATA_ADDR;
+}
+
+// Begin/retry pair for the kernel data sequence lock
+USER_INLINE uint32_t user_kdata_read_begin(const kdata_page_t* kd) {
+    uint32_t seq;
+    do {
+        seq = kd->seq;
+    } while (seq & 1);
+    __asm__ volatile("" : : : "memory");
+    return seq;
+}
+
+USER_INLINE int user_kdata_read_retry(const kdata_page_t* kd, uint32_t seq) {
+    __asm__ volatile("" : : : "memory");
+    return kd->seq != seq;
+}
+
+// Nanoseconds since boot
+USER_INLINE uint64_t user_clock_monotonic_ns(void) {
+    const kdata_page_t* kd = user_kdata();
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = user_kdata_read_begin(kd);
+        ns = kd->mono_ns_base + (((user_rdtsc() - kd->tsc_base) * kd->tsc_mult) >> kd->tsc_shift);
+    } while (user_kdata_read_retry(kd, seq));
+    return ns;
+}
+
+// Nanoseconds since 1970-01-01 UTC
+USER_INLINE uint64_t user_clock_realtime_ns(void) {
+    const kdata_page_t* kd = user_kdata();
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = user_kdata_read_begin(kd);
+        ns = kd->wall_ns_base + (((user_rdtsc() - kd->tsc_base) * kd->tsc_mult) >> kd->tsc_shift);
+    } while (user_kdata_read_retry(kd, seq));
+    return ns;
+}
+
+// Timer ticks since boot
+USER_INLINE uint64_t user_get_ticks(void) {
+    const kdata_page_t* kd = user_kdata();
+    uint32_t seq;
+    uint64_t ticks;
+    do {
+        seq = user_kdata_read_begin(kd);
+        ticks = kd->ticks;
+    } while (user_kdata_read_retry(kd, seq));
+    return ticks;
+}
+
+USER_INLINE uint32_t user_cpu_count(void) {
+    return user_kdata()->cpu_count;
+}
+
+// Monotonic clock through a system call, for comparison: the result
+// comes back in EAX (low half) and EBX (high half)
+USER_INLINE uint64_t user_clock_monotonic_ns_syscall(void) {
+    uint32_t low, high;
+    __asm__ volatile("int $0x80"
+                     : "=a"(low), "=b"(high)
+                     : "a"(SYS_CLOCK), "b"(0)
+                     : "ecx", "edx", "esi", "edi", "memory");
+    return ((uint64_t)high << 32) | low;
+}
+
+#endif // USER_TIME_H
@@ -0,0 +1,25 @@
+#ifndef USERMODE_H
+#define USERMODE_H
+
+#include "terminal.h"
+
+// Size of the ring 0 stack used while a ring 3 task runs
+#define USERMODE_KERNEL_STACK_SIZE 8192
+
+// Run entry() in ring 3 on the given user stack until it calls SYS_EXIT.
+// Returns the exit code. The caller's context (including EFLAGS.IF) is
+// restored exactly as it was on return.
+int32_t usermode_run(void (*entry)(void), uint32_t user_stack_top);
+
+// Abandon the running ring 3 task and return from usermode_run(); called
+// from the SYS_EXIT handler
+void usermode_return(int32_t code) __attribute__((noreturn));
+
+// Enter ring 3 at entry with the given stack, never to return (user threads)
+void usermode_jump(uint32_t entry, uint32_t user_stack_top) __attribute__((noreturn));
+
+// Terminate whatever ring 3 code the current thread is running: either a
+// usermode_run() task or a user thread. Used by SYS_EXIT and fault handlers.
+void usermode_exit(int32_t code) __attribute__((noreturn));
+
+#endif // USERMODE_H
@@ -0,0 +1,108 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include "terminal.h"
+
+// Virtio over the legacy PCI transport (I/O BAR 0) with split virtqueues.
+// Transitional devices (device IDs 0x1000-0x103F) support this interface.
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+// Legacy register offsets from BAR 0
+#define VIRTIO_PCI_HOST_FEATURES  0x00  // 32-bit, device features
+#define VIRTIO_PCI_GUEST_FEATURES 0x04  // 32-bit, accepted features
+#define VIRTIO_PCI_QUEUE_PFN      0x08  // 32-bit, ring address >> 12
+#define VIRTIO_PCI_QUEUE_SIZE     0x0C  // 16-bit, read-only
+#define VIRTIO_PCI_QUEUE_SELECT   0x0E  // 16-bit
+#define VIRTIO_PCI_QUEUE_NOTIFY   0x10  // 16-bit, queue index doorbell
+#define VIRTIO_PCI_STATUS         0x12  // 8-bit
+#define VIRTIO_PCI_ISR            0x13  // 8-bit, read to acknowledge
+#define VIRTIO_PCI_CONFIG         0x14  // Device-specific config (no MSI-X)
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FAILED      0x80
+
+// ISR bits
+#define VIRTIO_ISR_QUEUE  0x01
+#define VIRTIO_ISR_CONFIG 0x02
+
+// Transport feature bits
+#define VIRTIO_RING_F_EVENT_IDX (1u << 29)
+
+// Ring layout
+#define VRING_DESC_F_NEXT        1
+#define VRING_DESC_F_WRITE       2      // Device writes the buffer
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY   1
+#define VIRTQUEUE_MAX_SIZE       1024
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} vring_desc_t;
+
+// Followed by used_event (uint16_t) after ring[size]
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} vring_avail_t;
+
+typedef struct {
+    uint32_t id;                        // Head of the completed chain
+    uint32_t len;                       // Bytes written by the device
+} vring_used_elem_t;
+
+// Followed by avail_event (uint16_t) after ring[size]
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem_t ring[];
+} vring_used_t;
+
+// One buffer of a descriptor chain
+typedef struct {
+    void* addr;                         // Identity-mapped kernel memory
+    uint32_t len;
+    uint8_t writable;                   // Device writes into it
+} virtq_buffer_t;
+
+typedef struct {
+    uint16_t io_base;
+    uint16_t index;
+    uint16_t size;
+    uint8_t event_idx;                  // VIRTIO_RING_F_EVENT_IDX negotiated
+    vring_desc_t* desc;
+    vring_avail_t* avail;
+    vring_used_t* used;
+    uint32_t pages;
+    uint16_t free_head;                 // Free descriptors are chained by next
+    uint16_t num_free;
+    uint16_t last_used;                 // Next used entry to consume
+    uint16_t avail_idx;                 // Private copy, published by kick
+    uint16_t kicked_idx;                // avail idx at the last publish
+} virtqueue_t;
+
+// Device setup
+void virtio_reset(uint16_t io_base);
+void virtio_add_status(uint16_t io_base, uint8_t status);
+uint32_t virtio_negotiate(uint16_t io_base, uint32_t supported);
+
+// Virtqueues
+int32_t virtqueue_init(virtqueue_t* vq, uint16_t io_base, uint16_t index, uint8_t event_idx);
+int32_t virtqueue_add(virtqueue_t* vq, const virtq_buffer_t* bufs, uint32_t count);
+int virtqueue_kick_prepare(virtqueue_t* vq);
+void virtqueue_notify(virtqueue_t* vq);
+int32_t virtqueue_get_used(virtqueue_t* vq, uint32_t* len);
+int virtqueue_enable_cb(virtqueue_t* vq, uint16_t batch);
+
+// Head descriptor the next virtqueue_add() will return
+static inline uint16_t virtqueue_next_head(virtqueue_t* vq) {
+    return vq->free_head;
+}
+
+#endif // VIRTIO_H
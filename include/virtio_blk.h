@@ -0,0 +1,48 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include "terminal.h"
+
+// Legacy (transitional) virtio block device, QEMU -drive if=virtio
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+#define VIRTIO_BLK_MAX_DEVICES 4
+
+// Feature bits
+#define VIRTIO_BLK_F_SIZE_MAX (1u << 1)     // size_max limits one segment
+#define VIRTIO_BLK_F_RO       (1u << 5)
+#define VIRTIO_BLK_F_FLUSH    (1u << 9)
+
+// Device configuration, from VIRTIO_PCI_CONFIG
+#define VIRTIO_BLK_CONFIG_CAPACITY 0x00     // 64-bit, 512-byte sectors
+#define VIRTIO_BLK_CONFIG_SIZE_MAX 0x08
+
+// Request header types and status byte values
+#define VIRTIO_BLK_T_IN     0
+#define VIRTIO_BLK_T_OUT    1
+#define VIRTIO_BLK_T_FLUSH  4
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+// Largest request the driver issues, and data descriptors per request
+// (merged requests bring one buffer each)
+#define VIRTIO_BLK_MAX_SECTORS  2048
+#define VIRTIO_BLK_MAX_SEGMENTS 32
+
+// Completion interrupts are requested once per this many requests (at
+// most half of those in flight) when the device supports event indices
+#define VIRTIO_BLK_COALESCE_MAX 8
+
+// Completions handled per run of the bottom half
+#define VIRTIO_BLK_BH_BUDGET 64
+
+typedef struct {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_header_t;
+
+// Function declarations
+void virtio_blk_init(void);
+
+#endif // VIRTIO_BLK_H
@@ -0,0 +1,485 @@
+#include "ata.h"
+#include "pci.h"
+#include "interrupts.h"
+#include "cpu.h"
+#include "errors.h"
+#include "memory.h"
+#include "softirq.h"
+#include "init.h"
+
+// One IDE channel runs one command at a time for both of its drives, so
+// requests wait in per-drive FIFOs and the interrupt's bottom half starts
+// the next one (alternating between drives) as each finishes. Small transfers
+// use READ/WRITE MULTIPLE, one interrupt per DRQ block of `multiple`
+// sectors; larger ones use bus-master DMA and a single interrupt.
+struct ata_channel;
+
+typedef struct {
+    block_device_t blk;
+    struct ata_channel* channel;
+    uint8_t slave;
+    uint8_t lba48;
+    uint8_t dma;                    // Drive supports DMA
+    uint8_t multiple;               // Sectors per DRQ block
+    blk_request_t* head;
+    blk_request_t* tail;
+} ata_drive_t;
+
+typedef struct ata_channel {
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bmide;                 // Bus master registers, 0 if PIO only
+    uint8_t irq;
+    uint8_t selected;               // Last drive select value
+    ata_drive_t* drives[2];
+    ata_prd_t* prdt;
+
+    // Request in progress
+    ata_drive_t* active;
+    blk_request_t* current;
+    uint8_t using_dma;
+    blk_request_t* segment;         // Merged piece being transferred by PIO
+    uint8_t* pos;
+    uint32_t segment_left;          // Sectors left in that piece
+    uint32_t remaining;             // Sectors left to transfer by PIO
+    uint8_t next_drive;
+
+    // Interrupt acknowledged by the top half, handled by the tasklet
+    uint8_t irq_status;
+    uint8_t irq_bm_status;
+    tasklet_t tasklet;
+} ata_channel_t;
+
+static int32_t ata_submit(block_device_t* dev, blk_request_t* req);
+static void ata_kick(block_device_t* dev);
+
+// Global variables
+static ata_channel_t primary;
+static ata_drive_t drives[2];
+static const blk_ops_t ata_ops = { ata_submit, ata_kick };
+
+// Reading the alternate status register four times gives the 400 ns the
+// drive needs after a select
+static void ata_delay(ata_channel_t* ch) {
+    for (int i = 0; i < 4; i++) {
+        inb(ch->ctrl);
+    }
+}
+
+static void ata_select(ata_channel_t* ch, uint8_t value) {
+    outb(ch->io + ATA_REG_DRIVE, value);
+    if ((value & 0x10) != (ch->selected & 0x10)) {
+        ata_delay(ch);
+    }
+    ch->selected = value;
+}
+
+// Poll until BSY clears; returns the status or -1 on timeout
+static int32_t ata_wait(ata_channel_t* ch) {
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT; i++) {
+        uint8_t status = inb(ch->ctrl);
+        if (!(status & ATA_SR_BSY)) {
+            return status;
+        }
+    }
+    return -1;
+}
+
+// Poll until the drive is ready for data (or failed)
+static int32_t ata_wait_drq(ata_channel_t* ch) {
+    for (uint32_t i = 0; i < ATA_POLL_LIMIT; i++) {
+        uint8_t status = inb(ch->ctrl);
+        if (!(status & ATA_SR_BSY) && (status & (ATA_SR_DRQ | ATA_SR_ERR | ATA_SR_DF))) {
+            return (status & (ATA_SR_ERR | ATA_SR_DF)) ? -1 : status;
+        }
+    }
+    return -1;
+}
+
+// Load the task file and issue a command. LBA48 writes each register
+// twice: high-order bytes first, then low-order.
+static void ata_command(ata_channel_t* ch, ata_drive_t* drive, uint8_t command,
+                        uint64_t lba, uint32_t count, int ext) {
+    if (ext) {
+        ata_select(ch, 0x40 | (drive->slave << 4));
+        outb(ch->io + ATA_REG_COUNT, (uint8_t)(count >> 8));
+        outb(ch->io + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(ch->io + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(ch->io + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+    } else {
+        ata_select(ch, 0xE0 | (drive->slave << 4) | ((uint8_t)(lba >> 24) & 0x0F));
+    }
+    outb(ch->io + ATA_REG_COUNT, (uint8_t)count);
+    outb(ch->io + ATA_REG_LBA0, (uint8_t)lba);
+    outb(ch->io + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(ch->io + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+    outb(ch->io + ATA_REG_COMMAND, command);
+    drive->blk.stats.notifications++;
+}
+
+// Describe every merged piece in the PRD table, splitting at 64 KB
+// boundaries
+static int ata_build_prdt(ata_channel_t* ch, blk_request_t* req) {
+    uint32_t max_entries = PAGE_SIZE / sizeof(ata_prd_t);
+    uint32_t n = 0;
+    for (blk_request_t* seg = req; seg; seg = seg->merge_next) {
+        uint32_t addr = (uint32_t)seg->buffer;
+        uint32_t bytes = seg->count << BLK_SECTOR_SHIFT;
+        while (bytes) {
+            if (n == max_entries) {
+                return 0;
+            }
+            uint32_t chunk = ATA_PRD_BOUNDARY - (addr & (ATA_PRD_BOUNDARY - 1));
+            if (chunk > bytes) {
+                chunk = bytes;
+            }
+            ch->prdt[n].addr = addr;
+            ch->prdt[n].bytes = (uint16_t)chunk;
+            ch->prdt[n].flags = 0;
+            addr += chunk;
+            bytes -= chunk;
+            n++;
+        }
+    }
+    ch->prdt[n - 1].flags = ATA_PRD_EOT;
+    return 1;
+}
+
+// Move one DRQ block by PIO. Merged pieces have their own buffers, so the
+// block is split wherever it crosses from one piece into the next.
+static void ata_pio_block(ata_channel_t* ch, int read) {
+    uint32_t n = ch->remaining < ch->active->multiple ? ch->remaining : ch->active->multiple;
+    ch->remaining -= n;
+    while (n) {
+        if (ch->segment_left == 0) {
+            ch->segment = ch->segment->merge_next;
+            ch->pos = (uint8_t*)ch->segment->buffer;
+            ch->segment_left = ch->segment->count;
+        }
+        uint32_t chunk = n < ch->segment_left ? n : ch->segment_left;
+        if (read) {
+            insw(ch->io + ATA_REG_DATA, ch->pos, chunk * (BLK_SECTOR_SIZE / 2));
+        } else {
+            outsw(ch->io + ATA_REG_DATA, ch->pos, chunk * (BLK_SECTOR_SIZE / 2));
+        }
+        ch->pos += chunk * BLK_SECTOR_SIZE;
+        ch->segment_left -= chunk;
+        n -= chunk;
+    }
+}
+
+static void ata_start(ata_channel_t* ch);
+
+static void ata_finish(ata_channel_t* ch, int32_t status) {
+    blk_request_t* req = ch->current;
+    ata_drive_t* drive = ch->active;
+    ch->current = 0;
+    ch->active = 0;
+    ch->using_dma = 0;
+    blkdev_complete(&drive->blk, req, status);
+    ata_start(ch);
+}
+
+// Start the next queued request if the channel is idle (interrupts off)
+static void ata_start(ata_channel_t* ch) {
+    if (ch->current) {
+        return;
+    }
+
+    ata_drive_t* drive = 0;
+    for (int i = 0; i < 2 && !drive; i++) {
+        ata_drive_t* candidate = ch->drives[(ch->next_drive + i) & 1];
+        if (candidate && candidate->head) {
+            drive = candidate;
+        }
+    }
+    if (!drive) {
+        return;
+    }
+
+    blk_request_t* req = drive->head;
+    drive->head = req->next;
+    if (!drive->head) {
+        drive->tail = 0;
+    }
+    ch->current = req;
+    ch->active = drive;
+    ch->next_drive = drive->slave ^ 1;
+
+    if (req->op == BLK_OP_FLUSH) {
+        ch->remaining = 0;
+        ata_command(ch, drive, drive->lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE, 0, 0, drive->lba48);
+        return;
+    }
+
+    int read = req->op == BLK_OP_READ;
+    int ext = drive->lba48 && req->sector + req->nr_sectors > ATA_LBA28_LIMIT;
+    ch->segment = req;
+    ch->pos = (uint8_t*)req->buffer;
+    ch->segment_left = req->count;
+    ch->remaining = req->nr_sectors;
+
+    if (ch->bmide && drive->dma && req->nr_sectors >= ATA_DMA_MIN_SECTORS && ata_build_prdt(ch, req)) {
+        ch->using_dma = 1;
+        outl(ch->bmide + ATA_BM_PRDT, (uint32_t)ch->prdt);
+        outb(ch->bmide + ATA_BM_COMMAND, read ? ATA_BM_CMD_READ : 0);
+        outb(ch->bmide + ATA_BM_STATUS, inb(ch->bmide + ATA_BM_STATUS) | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+        ata_command(ch, drive, read ? (ext ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA) :
+                                      (ext ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA),
+                    req->sector, req->nr_sectors, ext);
+        outb(ch->bmide + ATA_BM_COMMAND, (read ? ATA_BM_CMD_READ : 0) | ATA_BM_CMD_START);
+        return;
+    }
+
+    uint8_t command;
+    if (drive->multiple > 1) {
+        command = read ? (ext ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_MULTIPLE) :
+                         (ext ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_MULTIPLE);
+    } else {
+        command = read ? (ext ? ATA_CMD_READ_SECTORS_EXT : ATA_CMD_READ_SECTORS) :
+                         (ext ? ATA_CMD_WRITE_SECTORS_EXT : ATA_CMD_WRITE_SECTORS);
+    }
+    ata_command(ch, drive, command, req->sector, req->nr_sectors, ext);
+
+    // Writes supply the first block without waiting for an interrupt
+    if (!read) {
+        if (ata_wait_drq(ch) < 0) {
+            ata_finish(ch, E_IO);
+            return;
+        }
+        ata_pio_block(ch, 0);
+    }
+}
+
+// Top half: acknowledge the interrupt and save the status for the tasklet
+static void ata_irq(void* context) {
+    ata_channel_t* ch = (ata_channel_t*)context;
+    uint8_t bm_status = 0;
+
+    if (ch->using_dma) {
+        bm_status = inb(ch->bmide + ATA_BM_STATUS);
+        if (!(bm_status & ATA_BM_SR_IRQ)) {
+            return;
+        }
+        outb(ch->bmide + ATA_BM_COMMAND, 0);
+    }
+
+    // Reading the status register acknowledges the drive's interrupt
+    uint8_t status = inb(ch->io + ATA_REG_STATUS);
+    if (!ch->current) {
+        return;
+    }
+    ch->active->blk.stats.interrupts++;
+    if (ch->using_dma) {
+        outb(ch->bmide + ATA_BM_STATUS, bm_status | ATA_BM_SR_ERR | ATA_BM_SR_IRQ);
+    }
+    ch->irq_status = status;
+    ch->irq_bm_status = bm_status;
+    tasklet_schedule(&ch->tasklet);
+}
+
+// Bottom half: move the next PIO block or finish the request. The drive
+// raises its next interrupt only after this, so one status is pending at
+// a time.
+static void ata_bottom_half(void* context) {
+    ata_channel_t* ch = (ata_channel_t*)context;
+    uint8_t status = ch->irq_status;
+    blk_request_t* req = ch->current;
+    if (!req) {
+        return;
+    }
+
+    if (ch->using_dma) {
+        ata_finish(ch, ((status & (ATA_SR_ERR | ATA_SR_DF)) || (ch->irq_bm_status & ATA_BM_SR_ERR)) ? E_IO : E_OK);
+        return;
+    }
+    if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+        ata_finish(ch, E_IO);
+        return;
+    }
+
+    if (req->op == BLK_OP_READ) {
+        if (!(status & ATA_SR_DRQ)) {
+            ata_finish(ch, E_IO);
+            return;
+        }
+        ata_pio_block(ch, 1);
+    } else if (ch->remaining) {
+        ata_pio_block(ch, 0);
+        return;
+    }
+
+    if (ch->remaining == 0) {
+        ata_finish(ch, E_OK);
+    }
+}
+
+// Called with interrupts disabled (blkdev_submit)
+static int32_t ata_submit(block_device_t* dev, blk_request_t* req) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver_data;
+    if (drive->tail) {
+        drive->tail->next = req;
+    } else {
+        drive->head = req;
+    }
+    drive->tail = req;
+    return E_OK;
+}
+
+static void ata_kick(block_device_t* dev) {
+    ata_drive_t* drive = (ata_drive_t*)dev->driver_data;
+    uint32_t flags = irq_save();
+    ata_start(drive->channel);
+    irq_restore(flags);
+}
+
+// IDENTIFY DEVICE by polling (the drive's interrupt is masked)
+static int ata_identify(ata_channel_t* ch, uint8_t slave, uint16_t* id) {
+    ata_select(ch, 0xA0 | (slave << 4));
+    outb(ch->io + ATA_REG_COUNT, 0);
+    outb(ch->io + ATA_REG_LBA0, 0);
+    outb(ch->io + ATA_REG_LBA1, 0);
+    outb(ch->io + ATA_REG_LBA2, 0);
+    outb(ch->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+    // 0 means no drive; 0xFF is a floating bus with no drives at all
+    uint8_t status = inb(ch->io + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF || ata_wait(ch) < 0) {
+        return -1;
+    }
+
+    // ATAPI and SATA devices report a signature here and abort IDENTIFY
+    if (inb(ch->io + ATA_REG_LBA1) || inb(ch->io + ATA_REG_LBA2)) {
+        return -1;
+    }
+    if (ata_wait_drq(ch) < 0) {
+        return -1;
+    }
+    insw(ch->io + ATA_REG_DATA, id, 256);
+    return 0;
+}
+
+static void ata_probe_drive(ata_channel_t* ch, uint8_t slave) {
+    uint16_t id[256];
+    if (ata_identify(ch, slave, id) < 0 || !(id[49] & (1 << 9))) {
+        return;                     // Absent, ATAPI or no LBA
+    }
+
+    ata_drive_t* drive = &drives[slave];
+    drive->channel = ch;
+    drive->slave = slave;
+    drive->lba48 = (id[83] & (1 << 10)) != 0;
+    drive->dma = (id[49] & (1 << 8)) != 0;
+    drive->head = 0;
+    drive->tail = 0;
+
+    block_device_t* blk = &drive->blk;
+    if (drive->lba48) {
+        blk->sector_count = ((uint64_t)id[103] << 48) | ((uint64_t)id[102] << 32) |
+                            ((uint32_t)id[101] << 16) | id[100];
+    } else {
+        blk->sector_count = ((uint32_t)id[61] << 16) | id[60];
+    }
+
+    // Largest DRQ block the drive supports for READ/WRITE MULTIPLE
+    drive->multiple = 1;
+    uint8_t multiple = id[47] & 0xFF;
+    if (multiple > 1) {
+        ata_select(ch, 0xA0 | (slave << 4));
+        outb(ch->io + ATA_REG_COUNT, multiple);
+        outb(ch->io + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+        int32_t status = ata_wait(ch);
+        if (status >= 0 && !(status & ATA_SR_ERR)) {
+            drive->multiple = multiple;
+        }
+    }
+
+    blk->name[0] = 'h';
+    blk->name[1] = 'd';
+    blk->name[2] = (char)('a' + slave);
+    blk->name[3] = '\0';
+    blk->max_sectors = ATA_MAX_SECTORS;
+    blk->max_segments = ATA_MAX_SEGMENTS;
+    blk->queue_depth = 1;
+    blk->read_only = 0;
+    blk->ops = &ata_ops;
+    blk->driver_data = drive;
+    ch->drives[slave] = drive;
+}
+
+static int ata_channel_init(ata_channel_t* ch, uint16_t io, uint16_t ctrl, uint16_t bmide, uint8_t irq) {
+    ch->io = io;
+    ch->ctrl = ctrl;
+    ch->bmide = bmide;
+    ch->irq = irq;
+    ch->selected = 0xFF;
+    ch->current = 0;
+    ch->next_drive = 0;
+    tasklet_init(&ch->tasklet, ata_bottom_half, ch);
+
+    // Probe with the interrupt masked
+    outb(ctrl, ATA_CTRL_NIEN);
+    ata_probe_drive(ch, 0);
+    ata_probe_drive(ch, 1);
+    if (!ch->drives[0] && !ch->drives[1]) {
+        return -1;
+    }
+
+    if (bmide) {
+        ch->prdt = (ata_prd_t*)pmm_alloc(1);
+        if (!ch->prdt) {
+            ch->bmide = 0;
+        }
+    }
+    if (irq_register_handler(irq, ata_irq, ch) != E_OK) {
+        return -1;
+    }
+    outb(ctrl, 0);
+
+    for (int i = 0; i < 2; i++) {
+        if (ch->drives[i]) {
+            blkdev_register(&ch->drives[i]->blk);
+        }
+    }
+    return 0;
+}
+
+// PCI IDE controller: compatibility-mode channels use the legacy ports,
+// native-mode ones BAR 0/1 and the PCI interrupt. Bus mastering is in BAR 4.
+static int ata_pci_probe(pci_device_t* pci) {
+    if (primary.io) {
+        return -1;
+    }
+
+    uint16_t io = ATA_PRIMARY_IO;
+    uint16_t ctrl = ATA_PRIMARY_CTRL;
+    uint8_t irq = ATA_PRIMARY_IRQ;
+    if (pci->prog_if & 0x01) {
+        if (pci->irq_line == PCI_NO_IRQ) {
+            return -1;
+        }
+        io = (uint16_t)pci_bar_address(pci, 0);
+        ctrl = (uint16_t)pci_bar_address(pci, 1) + 2;
+        irq = pci->irq_line;
+    }
+    uint16_t bmide = 0;
+    if ((pci->prog_if & 0x80) && pci_bar_is_io(pci, 4)) {
+        bmide = (uint16_t)pci_bar_address(pci, 4);
+    }
+
+    pci_enable(pci, bmide != 0);
+    return ata_channel_init(&primary, io, ctrl, bmide, irq);
+}
+
+static const pci_driver_t ata_pci_driver = {
+    "ata", PCI_ANY_ID, PCI_ANY_ID, PCI_CLASS_ID(0x01, 0x01), ata_pci_probe
+};
+
+void __init ata_init(void) {
+    pci_register_driver(&ata_pci_driver);
+
+    // No PCI IDE controller: try the legacy ports without DMA
+    if (!primary.io) {
+        ata_channel_init(&primary, ATA_PRIMARY_IO, ATA_PRIMARY_CTRL, 0, ATA_PRIMARY_IRQ);
+    }
+}
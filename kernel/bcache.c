@@ -0,0 +1,587 @@
+#include "bcache.h"
+#include "cpu.h"
+#include "klib.h"
+#include "memory.h"
+#include "timer.h"
+#include "klog.h"
+#include "crc32c.h"
+#include "init.h"
+
+// Global variables
+static bcache_buf_t bufs[BCACHE_BLOCKS];
+static bcache_buf_t* hash_table[BCACHE_HASH_BUCKETS];
+static bcache_buf_t* lru_head = 0;     // Most recently used
+static bcache_buf_t* lru_tail = 0;     // Eviction candidates
+static bcache_stats_t stats;
+static int initialized = 0;
+
+// All list manipulation happens with interrupts disabled: completions run
+// in softirq context, and a thread holding the lists may sleep on I/O.
+
+static inline uint32_t bcache_hash(block_device_t* dev, uint32_t block) {
+    return ((block ^ ((uint32_t)dev >> 4)) * 2654435761u) >> (32 - BCACHE_HASH_BITS);
+}
+
+static bcache_buf_t* hash_find(block_device_t* dev, uint32_t block) {
+    bcache_buf_t* buf = hash_table[bcache_hash(dev, block)];
+    while (buf && (buf->dev != dev || buf->block != block)) {
+        buf = buf->hash_next;
+    }
+    return buf;
+}
+
+static void hash_insert(bcache_buf_t* buf) {
+    uint32_t bucket = bcache_hash(buf->dev, buf->block);
+    buf->hash_next = hash_table[bucket];
+    hash_table[bucket] = buf;
+}
+
+static void hash_remove(bcache_buf_t* buf) {
+    bcache_buf_t** link = &hash_table[bcache_hash(buf->dev, buf->block)];
+    while (*link && *link != buf) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = buf->hash_next;
+    }
+    buf->hash_next = 0;
+}
+
+static void lru_remove(bcache_buf_t* buf) {
+    if (buf->lru_prev) {
+        buf->lru_prev->lru_next = buf->lru_next;
+    } else {
+        lru_head = buf->lru_next;
+    }
+    if (buf->lru_next) {
+        buf->lru_next->lru_prev = buf->lru_prev;
+    } else {
+        lru_tail = buf->lru_prev;
+    }
+}
+
+static void lru_push_front(bcache_buf_t* buf) {
+    buf->lru_prev = 0;
+    buf->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = buf;
+    } else {
+        lru_tail = buf;
+    }
+    lru_head = buf;
+}
+
+static void lru_touch(bcache_buf_t* buf) {
+    if (buf != lru_head) {
+        lru_remove(buf);
+        lru_push_front(buf);
+    }
+}
+
+void __init bcache_init(void) {
+    uint8_t* data = (uint8_t*)pmm_alloc(BCACHE_BLOCKS * BCACHE_BLOCK_SIZE / PAGE_SIZE);
+    if (!data) {
+        return;
+    }
+
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bufs[i].dev = 0;
+        bufs[i].flags = 0;
+        bufs[i].refcount = 0;
+        bufs[i].data = data + i * BCACHE_BLOCK_SIZE;
+        bufs[i].hash_next = 0;
+        wait_queue_init(&bufs[i].waiters);
+        lru_push_front(&bufs[i]);
+    }
+    initialized = 1;
+}
+
+static uint32_t bcache_block_count(block_device_t* dev) {
+    uint64_t blocks = (dev->sector_count + BCACHE_BLOCK_SECTORS - 1) >> (BCACHE_BLOCK_SHIFT - BLK_SECTOR_SHIFT);
+    return blocks > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)blocks;
+}
+
+static void bcache_io_done(blk_request_t* req) {
+    bcache_buf_t* buf = (bcache_buf_t*)req->private_data;
+    if (req->op == BLK_OP_READ && req->status == E_OK) {
+        buf->crc = crc32c(0, buf->data, BCACHE_BLOCK_SIZE);
+        buf->flags |= BCACHE_VALID | BCACHE_CSUM;
+    }
+    buf->flags &= ~BCACHE_BUSY;
+    wait_queue_wake_all(&buf->waiters);
+}
+
+// Queue a read or write of the whole block (the last block of a device
+// may be short)
+static int32_t bcache_submit(bcache_buf_t* buf, uint8_t op) {
+    uint64_t sector = (uint64_t)buf->block * BCACHE_BLOCK_SECTORS;
+    uint64_t left = buf->dev->sector_count - sector;
+    buf->req.op = op;
+    buf->req.sector = sector;
+    buf->req.count = left < BCACHE_BLOCK_SECTORS ? (uint32_t)left : BCACHE_BLOCK_SECTORS;
+    buf->req.buffer = buf->data;
+    buf->req.complete = bcache_io_done;
+    buf->req.private_data = buf;
+    buf->flags |= BCACHE_BUSY;
+
+    int32_t result = blkdev_submit(buf->dev, &buf->req);
+    if (result != E_OK) {
+        buf->flags &= ~BCACHE_BUSY;
+    }
+    return result;
+}
+
+static void bcache_wait(bcache_buf_t* buf) {
+    while (buf->flags & BCACHE_BUSY) {
+        wait_queue_sleep(&buf->waiters);
+    }
+}
+
+// Write back up to BCACHE_WRITEBACK_BATCH dirty blocks, least recently
+// used first, for one device or all (dev == 0). The batch is sorted by
+// device and block so each device sees ascending LBAs, submitted as a
+// whole and started with one kick per device. Returns the number of
+// blocks written or a negative error.
+static int32_t bcache_writeback(block_device_t* dev) {
+    bcache_buf_t* batch[BCACHE_WRITEBACK_BATCH];
+    uint32_t n = 0;
+    for (bcache_buf_t* buf = lru_tail; buf && n < BCACHE_WRITEBACK_BATCH; buf = buf->lru_prev) {
+        if ((buf->flags & (BCACHE_DIRTY | BCACHE_BUSY)) == BCACHE_DIRTY && (!dev || buf->dev == dev)) {
+            batch[n++] = buf;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    for (uint32_t i = 1; i < n; i++) {
+        bcache_buf_t* buf = batch[i];
+        uint32_t j = i;
+        while (j > 0 && ((uint32_t)batch[j - 1]->dev > (uint32_t)buf->dev ||
+                         (batch[j - 1]->dev == buf->dev && batch[j - 1]->block > buf->block))) {
+            batch[j] = batch[j - 1];
+            j--;
+        }
+        batch[j] = buf;
+    }
+
+    // A block dirtied again while its write is in flight keeps DIRTY
+    int32_t result = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        batch[i]->refcount++;
+        batch[i]->flags &= ~BCACHE_DIRTY;
+        if (bcache_submit(batch[i], BLK_OP_WRITE) != E_OK) {
+            batch[i]->flags |= BCACHE_DIRTY;
+            result = E_IO;
+        }
+        if (i + 1 == n || batch[i + 1]->dev != batch[i]->dev) {
+            blkdev_kick(batch[i]->dev);
+        }
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        bcache_wait(batch[i]);
+        if (batch[i]->req.status != E_OK) {
+            batch[i]->flags |= BCACHE_DIRTY;
+            stats.errors++;
+            result = E_IO;
+        } else if (batch[i]->refcount == 1 && !(batch[i]->flags & BCACHE_DIRTY)) {
+            batch[i]->crc = crc32c(0, batch[i]->data, BCACHE_BLOCK_SIZE);
+            batch[i]->flags |= BCACHE_CSUM;
+        }
+        batch[i]->refcount--;
+    }
+    stats.writebacks += n;
+    stats.writeback_batches++;
+    return result < 0 ? result : (int32_t)n;
+}
+
+// Find the least recently used clean, unreferenced buffer and detach it
+static bcache_buf_t* bcache_take_clean(void) {
+    for (bcache_buf_t* buf = lru_tail; buf; buf = buf->lru_prev) {
+        if (buf->refcount == 0 && !(buf->flags & (BCACHE_BUSY | BCACHE_DIRTY))) {
+            if (buf->dev) {
+                hash_remove(buf);
+                stats.evictions++;
+            }
+            return buf;
+        }
+    }
+    return 0;
+}
+
+// Like bcache_take_clean(), but if only dirty buffers are left, write a
+// batch back and return 0 with *retry set: the lists may have changed
+// while sleeping.
+static bcache_buf_t* bcache_evict(int* retry) {
+    *retry = 0;
+    bcache_buf_t* buf = bcache_take_clean();
+    if (!buf) {
+        *retry = bcache_writeback(0) > 0;
+    }
+    return buf;
+}
+
+// Check a clean block nobody else holds against its checksum
+static int bcache_corrupt(bcache_buf_t* buf) {
+    if (buf->refcount != 1 || !(buf->flags & BCACHE_CSUM)) {
+        return 0;
+    }
+    stats.verified++;
+    uint32_t crc = crc32c(0, buf->data, BCACHE_BLOCK_SIZE);
+    if (crc == buf->crc) {
+        return 0;
+    }
+    stats.corrupt++;
+    klog(KLOG_ERR, "bcache", "%s block %u corrupt in memory (crc %x, expected %x), reading it again",
+         buf->dev->name, buf->block, crc, buf->crc);
+    return 1;
+}
+
+// Look up a block and take a reference, reading it from disk on a miss
+// unless the caller is about to overwrite all of it
+static bcache_buf_t* bcache_acquire(block_device_t* dev, uint32_t block, int read) {
+    if (!initialized || block >= bcache_block_count(dev)) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    stats.lookups++;
+
+    bcache_buf_t* buf;
+    for (;;) {
+        buf = hash_find(dev, block);
+        if (buf) {
+            // A hit may still be waiting for another thread's read or a
+            // readahead. If that failed, drop the block and read it again.
+            // It leaves the hash even while other waiters still hold it,
+            // or the retry would find it again and never sleep.
+            buf->refcount++;
+            lru_touch(buf);
+            bcache_wait(buf);
+            if ((buf->flags & BCACHE_VALID) && !bcache_corrupt(buf)) {
+                stats.hits++;
+                irq_restore(flags);
+                return buf;
+            }
+            buf->flags &= ~(BCACHE_VALID | BCACHE_CSUM);
+            buf->refcount--;
+            if (hash_find(dev, block) == buf) {
+                hash_remove(buf);
+                buf->dev = 0;
+            }
+            continue;
+        }
+
+        int retry;
+        buf = bcache_evict(&retry);
+        if (buf) {
+            break;
+        }
+        if (!retry) {
+            irq_restore(flags);
+            return 0;
+        }
+    }
+
+    stats.misses++;
+    buf->dev = dev;
+    buf->block = block;
+    buf->refcount = 1;
+    buf->flags = 0;
+    hash_insert(buf);
+    lru_touch(buf);
+
+    if (!read) {
+        buf->flags = BCACHE_VALID;
+        irq_restore(flags);
+        return buf;
+    }
+
+    int32_t result = bcache_submit(buf, BLK_OP_READ);
+    if (result == E_OK) {
+        blkdev_kick(dev);
+        bcache_wait(buf);
+        result = buf->req.status;
+    }
+    if (result != E_OK) {
+        // Threads that found the block meanwhile see it invalid
+        stats.errors++;
+        hash_remove(buf);
+        buf->dev = 0;
+        buf->flags = 0;
+        buf->refcount--;
+        irq_restore(flags);
+        return 0;
+    }
+
+    buf->flags = BCACHE_VALID | BCACHE_CSUM;
+    irq_restore(flags);
+    return buf;
+}
+
+bcache_buf_t* bcache_get(block_device_t* dev, uint32_t block) {
+    return bcache_acquire(dev, block, 1);
+}
+
+// Start reading up to count blocks from block on that are not cached,
+// without waiting; bcache_get() later finds them in flight or ready.
+// Only clean buffers are taken, so readahead never writes back or sleeps,
+// and the reads go out together so the request queue can merge them.
+void bcache_readahead(block_device_t* dev, uint32_t block, uint32_t count) {
+    if (!initialized) {
+        return;
+    }
+    uint32_t blocks = bcache_block_count(dev);
+    uint32_t flags = irq_save();
+    uint32_t started = 0;
+    for (; count && block < blocks; block++, count--) {
+        if (hash_find(dev, block)) {
+            continue;
+        }
+        bcache_buf_t* buf = bcache_take_clean();
+        if (!buf) {
+            break;
+        }
+        buf->dev = dev;
+        buf->block = block;
+        buf->refcount = 0;
+        buf->flags = 0;
+        hash_insert(buf);
+        lru_touch(buf);
+        if (bcache_submit(buf, BLK_OP_READ) != E_OK) {
+            hash_remove(buf);
+            buf->dev = 0;
+            break;
+        }
+        started++;
+    }
+    stats.readaheads += started;
+    if (started) {
+        blkdev_kick(dev);
+    }
+    irq_restore(flags);
+}
+
+void bcache_put(bcache_buf_t* buf) {
+    uint32_t flags = irq_save();
+    buf->refcount--;
+    irq_restore(flags);
+}
+
+void bcache_mark_dirty(bcache_buf_t* buf) {
+    uint32_t flags = irq_save();
+    buf->flags = (buf->flags | BCACHE_DIRTY) & ~BCACHE_CSUM;
+    irq_restore(flags);
+}
+
+static int bcache_range_valid(block_device_t* dev, uint64_t offset, uint32_t size) {
+    uint64_t bytes = dev->sector_count << BLK_SECTOR_SHIFT;
+    return offset <= bytes && size <= bytes - offset;
+}
+
+// Byte-granular access through the cache
+int32_t bcache_read(block_device_t* dev, uint64_t offset, void* buffer, uint32_t size) {
+    if (!bcache_range_valid(dev, offset, size)) {
+        return E_INVAL;
+    }
+
+    uint8_t* out = (uint8_t*)buffer;
+    while (size) {
+        uint32_t in_block = (uint32_t)offset & (BCACHE_BLOCK_SIZE - 1);
+        uint32_t chunk = BCACHE_BLOCK_SIZE - in_block;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        bcache_buf_t* buf = bcache_get(dev, (uint32_t)(offset >> BCACHE_BLOCK_SHIFT));
+        if (!buf) {
+            return E_IO;
+        }
+        memcpy(out, buf->data + in_block, chunk);
+        bcache_put(buf);
+
+        out += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return E_OK;
+}
+
+int32_t bcache_write(block_device_t* dev, uint64_t offset, const void* buffer, uint32_t size) {
+    if (!bcache_range_valid(dev, offset, size)) {
+        return E_INVAL;
+    }
+    if (dev->read_only) {
+        return E_PERM;
+    }
+
+    const uint8_t* in = (const uint8_t*)buffer;
+    while (size) {
+        uint32_t in_block = (uint32_t)offset & (BCACHE_BLOCK_SIZE - 1);
+        uint32_t chunk = BCACHE_BLOCK_SIZE - in_block;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        // Whole-block writes skip reading the old contents
+        int whole = in_block == 0 && chunk == BCACHE_BLOCK_SIZE;
+        bcache_buf_t* buf = bcache_acquire(dev, (uint32_t)(offset >> BCACHE_BLOCK_SHIFT), !whole);
+        if (!buf) {
+            return E_IO;
+        }
+        memcpy(buf->data + in_block, in, chunk);
+        bcache_mark_dirty(buf);
+        bcache_put(buf);
+
+        in += chunk;
+        offset += chunk;
+        size -= chunk;
+    }
+    return E_OK;
+}
+
+// Write back every dirty block of a device (or of all devices) and flush
+// the device write caches
+int32_t bcache_sync(block_device_t* dev) {
+    int32_t result;
+    uint32_t flags = irq_save();
+    do {
+        result = bcache_writeback(dev);
+    } while (result > 0);
+    irq_restore(flags);
+
+    for (size_t i = 0; i < blkdev_count(); i++) {
+        block_device_t* target = blkdev_get(i);
+        if (!dev || target == dev) {
+            int32_t flushed = blkdev_flush(target);
+            if (result == E_OK) {
+                result = flushed;
+            }
+        }
+    }
+    return result;
+}
+
+void bcache_get_stats(bcache_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+void bcache_print_stats(void) {
+    bcache_stats_t s;
+    bcache_get_stats(&s);
+
+    uint32_t dirty = 0;
+    uint32_t cached = 0;
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        if (bufs[i].flags & BCACHE_VALID) {
+            cached++;
+        }
+        if (bufs[i].flags & BCACHE_DIRTY) {
+            dirty++;
+        }
+    }
+
+    terminal_writestring("Block cache: ");
+    terminal_print_dec(cached);
+    terminal_writestring("/");
+    terminal_print_dec(BCACHE_BLOCKS);
+    terminal_writestring(" blocks of 4 KB, ");
+    terminal_print_dec(dirty);
+    terminal_println(" dirty");
+    terminal_writestring("  lookups: ");
+    terminal_print_dec(s.lookups);
+    terminal_writestring("  hits: ");
+    terminal_print_dec(s.hits);
+    terminal_writestring(" (");
+    terminal_print_dec(s.lookups ? (uint32_t)div64_32((uint64_t)s.hits * 100, s.lookups) : 0);
+    terminal_writestring("%)  misses: ");
+    terminal_print_dec(s.misses);
+    terminal_putchar('\n');
+    terminal_writestring("  readahead: ");
+    terminal_print_dec(s.readaheads);
+    terminal_writestring("  evictions: ");
+    terminal_print_dec(s.evictions);
+    terminal_writestring("  written: ");
+    terminal_print_dec(s.writebacks);
+    terminal_writestring(" in ");
+    terminal_print_dec(s.writeback_batches);
+    terminal_writestring(" batches  errors: ");
+    terminal_print_dec(s.errors);
+    terminal_putchar('\n');
+    terminal_writestring("  checksums verified: ");
+    terminal_print_dec(s.verified);
+    terminal_writestring("  corrupt: ");
+    terminal_print_dec(s.corrupt);
+    terminal_putchar('\n');
+}
+
+// Drop the clean, unreferenced blocks of a device so the next read is cold
+void bcache_drop_clean(block_device_t* dev) {
+    uint32_t flags = irq_save();
+    for (int i = 0; i < BCACHE_BLOCKS; i++) {
+        bcache_buf_t* buf = &bufs[i];
+        if (buf->dev == dev && buf->refcount == 0 &&
+            (buf->flags & ~BCACHE_CSUM) == BCACHE_VALID) {
+            hash_remove(buf);
+            buf->dev = 0;
+            buf->flags = 0;
+        }
+    }
+    irq_restore(flags);
+}
+
+// Read the same set of blocks twice: the first pass goes to the disk, the
+// second should be served entirely from the cache
+void bcache_benchmark(const char* name) {
+    block_device_t* dev = *name ? blkdev_find(name) : blkdev_get(0);
+    if (!dev) {
+        terminal_println(*name ? "cachebench: no such device" : "cachebench: no block device");
+        return;
+    }
+    if (!initialized) {
+        terminal_println("cachebench: block cache not initialized");
+        return;
+    }
+
+    uint32_t blocks = bcache_block_count(dev);
+    if (blocks > BCACHE_BLOCKS / 2) {
+        blocks = BCACHE_BLOCKS / 2;
+    }
+    bcache_sync(dev);
+    bcache_drop_clean(dev);
+
+    terminal_writestring("cachebench ");
+    terminal_writestring(dev->name);
+    terminal_writestring(": ");
+    terminal_print_dec(blocks);
+    terminal_println(" blocks of 4 KB per pass");
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t requests = dev->stats.requests;
+        bcache_stats_t before;
+        bcache_get_stats(&before);
+
+        uint64_t start = rdtsc();
+        for (uint32_t block = 0; block < blocks; block++) {
+            bcache_buf_t* buf = bcache_get(dev, block);
+            if (!buf) {
+                terminal_println("cachebench: read error");
+                return;
+            }
+            bcache_put(buf);
+        }
+        uint64_t cycles = rdtsc() - start;
+
+        bcache_stats_t after;
+        bcache_get_stats(&after);
+        terminal_writestring(pass == 0 ? "  cold: " : "  warm: ");
+        terminal_print_dec(timer_cycles_to_us(cycles, 1));
+        terminal_writestring(" us, ");
+        terminal_print_dec(after.hits - before.hits);
+        terminal_writestring(" hits, ");
+        terminal_print_dec(dev->stats.requests - requests);
+        terminal_println(" disk requests");
+    }
+}
@@ -0,0 +1,360 @@
+#include "blkdev.h"
+#include "blkqueue.h"
+#include "cpu.h"
+#include "klib.h"
+#include "memory.h"
+#include "sched.h"
+#include "timer.h"
+#include "klog.h"
+
+// Benchmark parameters
+#define BLKBENCH_MAX_DEPTH   32
+#define BLKBENCH_RANDOM_OPS  2048           // 8 MB of 4 KB reads per depth
+#define BLKBENCH_SEQ_OPS     64             // 64 MB of 1 MB reads per depth
+#define BLKBENCH_BUFFER_SIZE (1024 * 1024)
+
+// Global variables
+static block_device_t* devices[BLK_MAX_DEVICES];
+static size_t device_count = 0;
+
+int blkdev_register(block_device_t* dev) {
+    if (device_count >= BLK_MAX_DEVICES) {
+        return E_NOMEM;
+    }
+    blkqueue_init(dev);
+    devices[device_count++] = dev;
+    klog(KLOG_INFO, "blk", "%s: %u MB%s", dev->name, (uint32_t)(dev->sector_count >> 11),
+         dev->read_only ? ", read-only" : "");
+    return E_OK;
+}
+
+size_t blkdev_count(void) {
+    return device_count;
+}
+
+block_device_t* blkdev_get(size_t index) {
+    return index < device_count ? devices[index] : 0;
+}
+
+block_device_t* blkdev_find(const char* name) {
+    for (size_t i = 0; i < device_count; i++) {
+        if (strcmp(devices[i]->name, name) == 0) {
+            return devices[i];
+        }
+    }
+    return 0;
+}
+
+// Queue a request; it may not reach the device before blkdev_kick()
+int32_t blkdev_submit(block_device_t* dev, blk_request_t* req) {
+    if (req->op > BLK_OP_FLUSH) {
+        return E_INVAL;
+    }
+    if (req->op != BLK_OP_FLUSH) {
+        if (req->count == 0 || req->count > dev->max_sectors ||
+            req->sector >= dev->sector_count || req->count > dev->sector_count - req->sector) {
+            return E_INVAL;
+        }
+        if (req->op == BLK_OP_WRITE && dev->read_only) {
+            return E_PERM;
+        }
+    }
+
+    req->status = BLK_PENDING;
+
+    uint32_t flags = irq_save();
+    dev->stats.requests++;
+    blkqueue_insert(dev, req);
+    irq_restore(flags);
+    return E_OK;
+}
+
+// Start queued requests (unless the queue is plugged)
+void blkdev_kick(block_device_t* dev) {
+    uint32_t flags = irq_save();
+    blkqueue_dispatch(dev, 1);
+    irq_restore(flags);
+}
+
+// While plugged, submissions only collect in the queue where they can be
+// merged and sorted; the last unplug dispatches them together
+void blkdev_plug(block_device_t* dev) {
+    uint32_t flags = irq_save();
+    dev->queue.plug_depth++;
+    irq_restore(flags);
+}
+
+void blkdev_unplug(block_device_t* dev) {
+    uint32_t flags = irq_save();
+    if (dev->queue.plug_depth && --dev->queue.plug_depth == 0) {
+        blkqueue_dispatch(dev, 1);
+    }
+    irq_restore(flags);
+}
+
+// Called by drivers, from their interrupt bottom half, when a request
+// (the head of a merge chain) finishes
+void blkdev_complete(block_device_t* dev, blk_request_t* req, int32_t status) {
+    blkqueue_complete(dev, req, status);
+}
+
+// Per-device queue and driver statistics (blkstat command)
+void blkdev_print_stats(void) {
+    if (device_count == 0) {
+        terminal_println("No block devices");
+        return;
+    }
+
+    for (size_t i = 0; i < device_count; i++) {
+        block_device_t* dev = devices[i];
+        blk_stats_t s;
+        uint32_t flags = irq_save();
+        s = dev->stats;
+        uint32_t pending = dev->queue.pending;
+        uint32_t in_flight = dev->queue.in_flight;
+        irq_restore(flags);
+
+        terminal_writestring(dev->name);
+        terminal_writestring(": ");
+        terminal_print_dec((uint32_t)(dev->sector_count >> 11));
+        terminal_writestring(" MB, depth ");
+        terminal_print_dec(dev->queue_depth);
+        terminal_writestring(", queued ");
+        terminal_print_dec(pending);
+        terminal_writestring(", in flight ");
+        terminal_print_dec(in_flight);
+        terminal_putchar('\n');
+
+        terminal_writestring("  requests: ");
+        terminal_print_dec(s.requests);
+        terminal_writestring("  merges: ");
+        terminal_print_dec(s.merges);
+        terminal_writestring("  dispatched: ");
+        terminal_print_dec(s.dispatched);
+        terminal_writestring("  avg size: ");
+        terminal_print_dec(s.dispatched ? (uint32_t)div64_32(s.dispatched_sectors, s.dispatched) / 2 : 0);
+        terminal_println(" KB");
+
+        terminal_writestring("  avg queue wait: ");
+        terminal_print_dec(timer_cycles_to_us(s.queue_cycles, s.completed));
+        terminal_writestring(" us  avg service: ");
+        terminal_print_dec(timer_cycles_to_us(s.service_cycles, s.dispatched - in_flight));
+        terminal_println(" us");
+
+        terminal_writestring("  read: ");
+        terminal_print_dec(s.sectors_read >> 1);
+        terminal_writestring(" KB  written: ");
+        terminal_print_dec(s.sectors_written >> 1);
+        terminal_writestring(" KB  errors: ");
+        terminal_print_dec(s.errors);
+        terminal_writestring("  irqs: ");
+        terminal_print_dec(s.interrupts);
+        terminal_writestring("  kicks: ");
+        terminal_print_dec(s.notifications);
+        terminal_putchar('\n');
+    }
+}
+
+static void blkdev_wake(blk_request_t* req) {
+    wait_queue_wake_all((wait_queue_t*)req->private_data);
+}
+
+// Submit one request and sleep until it completes
+static int32_t blkdev_sync(block_device_t* dev, uint8_t op, uint64_t sector, uint32_t count, void* buffer) {
+    wait_queue_t done;
+    blk_request_t req;
+    wait_queue_init(&done);
+    req.op = op;
+    req.sector = sector;
+    req.count = count;
+    req.buffer = buffer;
+    req.complete = blkdev_wake;
+    req.private_data = &done;
+
+    uint32_t flags = irq_save();
+    int32_t result = blkdev_submit(dev, &req);
+    if (result == E_OK) {
+        blkdev_kick(dev);
+        while (req.status == BLK_PENDING) {
+            wait_queue_sleep(&done);
+        }
+        result = req.status;
+    }
+    irq_restore(flags);
+    return result;
+}
+
+int32_t blkdev_read(block_device_t* dev, uint64_t sector, uint32_t count, void* buffer) {
+    return blkdev_sync(dev, BLK_OP_READ, sector, count, buffer);
+}
+
+int32_t blkdev_write(block_device_t* dev, uint64_t sector, uint32_t count, const void* buffer) {
+    return blkdev_sync(dev, BLK_OP_WRITE, sector, count, (void*)buffer);
+}
+
+int32_t blkdev_flush(block_device_t* dev) {
+    return blkdev_sync(dev, BLK_OP_FLUSH, 0, 0, 0);
+}
+
+// Read benchmark: keep `depth` requests in flight by resubmitting from the
+// completion callback until `target` requests have finished
+static struct {
+    block_device_t* dev;
+    blk_request_t reqs[BLKBENCH_MAX_DEPTH];
+    uint32_t sectors;               // Per request
+    uint32_t slots;                 // Request-sized slots on the device
+    uint32_t random;
+    uint32_t cursor;                // Next sequential slot
+    uint32_t seed;
+    uint32_t target;
+    uint32_t submitted;
+    volatile uint32_t completed;
+    uint32_t errors;
+    wait_queue_t done;
+} bench;
+
+static void bench_prepare(blk_request_t* req) {
+    uint32_t slot;
+    if (bench.random) {
+        bench.seed = bench.seed * 1103515245 + 12345;
+        slot = (bench.seed >> 8) % bench.slots;
+    } else {
+        slot = bench.cursor;
+        bench.cursor = (bench.cursor + 1) % bench.slots;
+    }
+    req->op = BLK_OP_READ;
+    req->sector = (uint64_t)slot * bench.sectors;
+    req->count = bench.sectors;
+    bench.submitted++;
+}
+
+static void bench_complete(blk_request_t* req) {
+    bench.completed++;
+    if (req->status != E_OK) {
+        bench.errors++;
+    }
+    if (bench.submitted < bench.target) {
+        bench_prepare(req);
+        blkdev_submit(bench.dev, req);
+    } else if (bench.completed == bench.target) {
+        wait_queue_wake_all(&bench.done);
+    }
+}
+
+static void bench_run(uint32_t depth, uint32_t ops, uint8_t* buffer) {
+    block_device_t* dev = bench.dev;
+    uint32_t irqs = dev->stats.interrupts;
+    uint32_t kicks = dev->stats.notifications;
+
+    bench.target = ops;
+    bench.submitted = 0;
+    bench.completed = 0;
+    bench.errors = 0;
+    bench.cursor = 0;
+    wait_queue_init(&bench.done);
+
+    uint64_t start = rdtsc();
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < depth; i++) {
+        blk_request_t* req = &bench.reqs[i];
+        req->buffer = buffer + (i * (bench.sectors << BLK_SECTOR_SHIFT)) % BLKBENCH_BUFFER_SIZE;
+        req->complete = bench_complete;
+        bench_prepare(req);
+        if (blkdev_submit(dev, req) != E_OK) {
+            // Stop at the requests already started
+            bench.submitted--;
+            bench.target = bench.submitted;
+            bench.errors++;
+            break;
+        }
+    }
+    blkdev_kick(dev);
+    while (bench.completed < bench.target) {
+        wait_queue_sleep(&bench.done);
+    }
+    irq_restore(flags);
+    uint64_t cycles = rdtsc() - start;
+
+    uint32_t us = timer_cycles_to_us(cycles, 1);
+    if (us == 0) {
+        us = 1;
+    }
+    uint64_t bytes = (uint64_t)bench.target * (bench.sectors << BLK_SECTOR_SHIFT);
+
+    terminal_writestring("  ");
+    terminal_print_dec(depth);
+    terminal_writestring("\t ");
+    terminal_print_dec((uint32_t)div64_32((uint64_t)bench.target * 1000000, us));
+    terminal_writestring("\t  ");
+    terminal_print_dec((uint32_t)div64_32(bytes, us));
+    terminal_writestring("\t  ");
+    terminal_print_dec(dev->stats.interrupts - irqs);
+    terminal_writestring("\t");
+    terminal_print_dec(dev->stats.notifications - kicks);
+    if (bench.errors) {
+        terminal_writestring("\t");
+        terminal_print_dec(bench.errors);
+        terminal_writestring(" errors");
+    }
+    terminal_putchar('\n');
+}
+
+static void bench_pattern(const char* title, uint32_t bytes, int random, uint32_t ops, uint8_t* buffer) {
+    block_device_t* dev = bench.dev;
+    uint32_t sectors = bytes >> BLK_SECTOR_SHIFT;
+    if (sectors > dev->max_sectors) {
+        sectors = dev->max_sectors;
+    }
+    uint64_t capacity = dev->sector_count > 0xFFFFFFFFu ? 0xFFFFFFFFu : dev->sector_count;
+    if (capacity < sectors) {
+        return;
+    }
+
+    bench.sectors = sectors;
+    bench.slots = (uint32_t)capacity / sectors;
+    bench.random = random;
+    bench.seed = 12345;
+
+    terminal_writestring(title);
+    terminal_writestring(" (");
+    terminal_print_dec(sectors >> 1);
+    terminal_writestring(" KB requests, ");
+    terminal_print_dec(ops);
+    terminal_println(" per depth):");
+    terminal_println("  depth\t IOPS\t  MB/s\t  irqs\tkicks");
+
+    for (uint32_t depth = 1; depth <= BLKBENCH_MAX_DEPTH; depth *= 2) {
+        if (depth > dev->queue_depth) {
+            break;
+        }
+        bench_run(depth, ops, buffer);
+    }
+}
+
+void blkdev_benchmark(const char* name) {
+    block_device_t* dev = *name ? blkdev_find(name) : blkdev_get(0);
+    if (!dev) {
+        terminal_println(*name ? "blkbench: no such device" : "blkbench: no block device");
+        return;
+    }
+
+    uint8_t* buffer = (uint8_t*)pmm_alloc(BLKBENCH_BUFFER_SIZE / PAGE_SIZE);
+    if (!buffer) {
+        terminal_println("blkbench: out of memory");
+        return;
+    }
+
+    terminal_writestring("blkbench ");
+    terminal_writestring(dev->name);
+    terminal_writestring(": ");
+    terminal_print_dec((uint32_t)(dev->sector_count >> 11));
+    terminal_writestring(" MB, queue depth ");
+    terminal_print_dec(dev->queue_depth);
+    terminal_putchar('\n');
+
+    bench.dev = dev;
+    bench_pattern("Random read", 4096, 1, BLKBENCH_RANDOM_OPS, buffer);
+    bench_pattern("Sequential read", BLKBENCH_BUFFER_SIZE, 0, BLKBENCH_SEQ_OPS, buffer);
+
+    pmm_free(buffer, BLKBENCH_BUFFER_SIZE / PAGE_SIZE);
+}
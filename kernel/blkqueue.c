@@ -0,0 +1,332 @@
+#include "blkqueue.h"
+#include "cpu.h"
+#include "klib.h"
+#include "timer.h"
+
+#define DIR_READ  0
+#define DIR_WRITE 1
+
+static inline int blkq_dir(blk_request_t* req) {
+    return req->op == BLK_OP_WRITE ? DIR_WRITE : DIR_READ;
+}
+
+void blkqueue_init(block_device_t* dev) {
+    memset(&dev->queue, 0, sizeof(dev->queue));
+    if (dev->max_segments == 0) {
+        dev->max_segments = 1;
+    }
+    if (dev->queue_depth == 0) {
+        dev->queue_depth = 1;
+    }
+}
+
+// Sorted list
+static void sort_insert_after(blk_queue_t* q, int dir, blk_request_t* pred, blk_request_t* req) {
+    req->sort_prev = pred;
+    req->sort_next = pred ? pred->sort_next : q->sort_head[dir];
+    if (req->sort_next) {
+        req->sort_next->sort_prev = req;
+    }
+    if (pred) {
+        pred->sort_next = req;
+    } else {
+        q->sort_head[dir] = req;
+    }
+}
+
+static void sort_remove(blk_queue_t* q, int dir, blk_request_t* req) {
+    if (req->sort_prev) {
+        req->sort_prev->sort_next = req->sort_next;
+    } else {
+        q->sort_head[dir] = req->sort_next;
+    }
+    if (req->sort_next) {
+        req->sort_next->sort_prev = req->sort_prev;
+    }
+}
+
+// FIFO
+static void fifo_append(blk_queue_t* q, int dir, blk_request_t* req) {
+    req->fifo_next = 0;
+    req->fifo_prev = q->fifo_tail[dir];
+    if (q->fifo_tail[dir]) {
+        q->fifo_tail[dir]->fifo_next = req;
+    } else {
+        q->fifo_head[dir] = req;
+    }
+    q->fifo_tail[dir] = req;
+}
+
+static void fifo_remove(blk_queue_t* q, int dir, blk_request_t* req) {
+    if (req->fifo_prev) {
+        req->fifo_prev->fifo_next = req->fifo_next;
+    } else {
+        q->fifo_head[dir] = req->fifo_next;
+    }
+    if (req->fifo_next) {
+        req->fifo_next->fifo_prev = req->fifo_prev;
+    } else {
+        q->fifo_tail[dir] = req->fifo_prev;
+    }
+}
+
+// Put req where old is in the sorted list / the FIFO
+static void sort_replace(blk_queue_t* q, int dir, blk_request_t* old, blk_request_t* req) {
+    req->sort_prev = old->sort_prev;
+    req->sort_next = old->sort_next;
+    if (req->sort_prev) {
+        req->sort_prev->sort_next = req;
+    } else {
+        q->sort_head[dir] = req;
+    }
+    if (req->sort_next) {
+        req->sort_next->sort_prev = req;
+    }
+}
+
+static void fifo_replace(blk_queue_t* q, int dir, blk_request_t* old, blk_request_t* req) {
+    req->fifo_prev = old->fifo_prev;
+    req->fifo_next = old->fifo_next;
+    if (req->fifo_prev) {
+        req->fifo_prev->fifo_next = req;
+    } else {
+        q->fifo_head[dir] = req;
+    }
+    if (req->fifo_next) {
+        req->fifo_next->fifo_prev = req;
+    } else {
+        q->fifo_tail[dir] = req;
+    }
+}
+
+static int blkq_can_merge(block_device_t* dev, blk_request_t* front, blk_request_t* back) {
+    return front->op == back->op &&
+           front->sector + front->nr_sectors == back->sector &&
+           front->nr_sectors + back->nr_sectors <= dev->max_sectors &&
+           front->nr_segments + back->nr_segments <= dev->max_segments;
+}
+
+// Append back's chain to front's; the result keeps the earlier deadline
+static void blkq_merge(block_device_t* dev, blk_request_t* front, blk_request_t* back) {
+    front->merge_tail->merge_next = back;
+    front->merge_tail = back->merge_tail;
+    front->nr_sectors += back->nr_sectors;
+    front->nr_segments += back->nr_segments;
+    if (back->deadline < front->deadline) {
+        front->deadline = back->deadline;
+    }
+    dev->stats.merges++;
+}
+
+// A back merge can close the gap to the next queued request
+static void blkq_absorb_next(block_device_t* dev, int dir, blk_request_t* req) {
+    blk_queue_t* q = &dev->queue;
+    blk_request_t* next = req->sort_next;
+    if (!next || !blkq_can_merge(dev, req, next)) {
+        return;
+    }
+
+    // The merged request takes the older FIFO position
+    sort_remove(q, dir, next);
+    if (next->deadline < req->deadline) {
+        fifo_remove(q, dir, req);
+        fifo_replace(q, dir, next, req);
+    } else {
+        fifo_remove(q, dir, next);
+    }
+    if (q->last_merge == next) {
+        q->last_merge = req;
+    }
+    blkq_merge(dev, req, next);
+    q->pending--;
+}
+
+void blkqueue_insert(block_device_t* dev, blk_request_t* req) {
+    blk_queue_t* q = &dev->queue;
+    int dir = blkq_dir(req);
+
+    req->merge_next = 0;
+    req->merge_tail = req;
+    req->nr_sectors = req->count;
+    req->nr_segments = 1;
+    req->submit_tsc = rdtsc();
+    req->deadline = timer_get_ticks() +
+                    (dir == DIR_WRITE ? BLKQ_WRITE_EXPIRE_MS : BLKQ_READ_EXPIRE_MS) * TIMER_HZ / 1000;
+
+    if (req->op == BLK_OP_FLUSH) {
+        req->fifo_next = 0;
+        if (q->special_tail) {
+            q->special_tail->fifo_next = req;
+        } else {
+            q->special_head = req;
+        }
+        q->special_tail = req;
+        q->pending++;
+        return;
+    }
+
+    // Sequential streams usually extend the request merged last
+    blk_request_t* hint = q->last_merge;
+    if (hint && blkq_can_merge(dev, hint, req)) {
+        blkq_merge(dev, hint, req);
+        blkq_absorb_next(dev, dir, hint);
+        return;
+    }
+
+    blk_request_t* pred = 0;
+    for (blk_request_t* r = q->sort_head[dir]; r && r->sector < req->sector; r = r->sort_next) {
+        pred = r;
+    }
+    blk_request_t* succ = pred ? pred->sort_next : q->sort_head[dir];
+
+    if (pred && blkq_can_merge(dev, pred, req)) {
+        blkq_merge(dev, pred, req);
+        blkq_absorb_next(dev, dir, pred);
+        q->last_merge = pred;
+        return;
+    }
+    if (succ && blkq_can_merge(dev, req, succ)) {
+        sort_replace(q, dir, succ, req);
+        fifo_replace(q, dir, succ, req);
+        if (q->last_merge == succ) {
+            q->last_merge = 0;
+        }
+        blkq_merge(dev, req, succ);
+        q->last_merge = req;
+        return;
+    }
+
+    sort_insert_after(q, dir, pred, req);
+    fifo_append(q, dir, req);
+    q->pending++;
+    q->last_merge = req;
+}
+
+// First queued request at or after the elevator position
+static blk_request_t* blkq_from_head(blk_queue_t* q, int dir) {
+    blk_request_t* req = q->sort_head[dir];
+    while (req && req->sector < q->head_sector) {
+        req = req->sort_next;
+    }
+    return req;
+}
+
+static blk_request_t* blkq_next(blk_queue_t* q) {
+    blk_request_t* req = q->special_head;
+    if (req) {
+        q->special_head = req->fifo_next;
+        if (!q->special_head) {
+            q->special_tail = 0;
+        }
+        q->pending--;
+        return req;
+    }
+
+    int dir = q->batch_dir;
+    req = 0;
+    if (q->batch_count && q->batch_count < BLKQ_FIFO_BATCH) {
+        req = blkq_from_head(q, dir);
+    }
+
+    if (!req) {
+        int reads = q->sort_head[DIR_READ] != 0;
+        int writes = q->sort_head[DIR_WRITE] != 0;
+        if (reads && (!writes || q->starved < BLKQ_WRITES_STARVED)) {
+            dir = DIR_READ;
+            if (writes) {
+                q->starved++;
+            }
+        } else if (writes) {
+            dir = DIR_WRITE;
+            q->starved = 0;
+        } else {
+            return 0;
+        }
+        q->batch_dir = dir;
+        q->batch_count = 0;
+
+        // Start at an expired request, otherwise keep sweeping upwards
+        // and wrap to the lowest sector
+        if (q->fifo_head[dir]->deadline <= timer_get_ticks()) {
+            req = q->fifo_head[dir];
+        } else {
+            req = blkq_from_head(q, dir);
+            if (!req) {
+                req = q->sort_head[dir];
+            }
+        }
+    }
+
+    sort_remove(q, dir, req);
+    fifo_remove(q, dir, req);
+    if (q->last_merge == req) {
+        q->last_merge = 0;
+    }
+    q->pending--;
+    q->batch_count++;
+    q->head_sector = req->sector + req->nr_sectors;
+    return req;
+}
+
+static void blkq_finish(block_device_t* dev, blk_request_t* req, int32_t status) {
+    if (status != E_OK) {
+        dev->stats.errors++;
+    }
+    dev->stats.service_cycles += rdtsc() - req->dispatch_tsc;
+    uint64_t dispatched = req->dispatch_tsc;
+
+    // A completion callback may resubmit its request, so read the link first
+    while (req) {
+        blk_request_t* next = req->merge_next;
+        dev->stats.queue_cycles += dispatched - req->submit_tsc;
+        dev->stats.completed++;
+        if (status == E_OK && req->op == BLK_OP_READ) {
+            dev->stats.sectors_read += req->count;
+        } else if (status == E_OK && req->op == BLK_OP_WRITE) {
+            dev->stats.sectors_written += req->count;
+        }
+        req->status = status;
+        if (req->complete) {
+            req->complete(req);
+        }
+        req = next;
+    }
+}
+
+// Hand queued requests to the driver while it has room. kick is 0 when
+// called from a completion, where the driver starts them itself.
+void blkqueue_dispatch(block_device_t* dev, int kick) {
+    blk_queue_t* q = &dev->queue;
+    if (q->plug_depth) {
+        return;
+    }
+
+    while (q->in_flight < dev->queue_depth) {
+        blk_request_t* req = blkq_next(q);
+        if (!req) {
+            break;
+        }
+
+        req->dispatch_tsc = rdtsc();
+        dev->stats.dispatched++;
+        dev->stats.dispatched_sectors += req->nr_sectors;
+        req->next = 0;
+
+        q->in_flight++;
+        int32_t result = dev->ops->submit(dev, req);
+        if (result != E_OK) {
+            q->in_flight--;
+            blkq_finish(dev, req, result);
+        }
+    }
+
+    if (kick) {
+        dev->ops->kick(dev);
+    }
+}
+
+void blkqueue_complete(block_device_t* dev, blk_request_t* req, int32_t status) {
+    dev->queue.in_flight--;
+    blkq_finish(dev, req, status);
+    blkqueue_dispatch(dev, 0);
+}
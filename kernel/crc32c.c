@@ -0,0 +1,320 @@
+#include "crc32c.h"
+#include "memory.h"
+#include "timer.h"
+#include "klog.h"
+#include "klib.h"
+#include "cpu.h"
+#include "errors.h"
+#include "init.h"
+
+// Checksum of "123456789", the usual check value
+#define CRC32C_CHECK 0xE3069283
+
+// Benchmark: buffer sizes from 64 B to 1 MB, about CRC32C_BENCH_BYTES each
+#define CRC32C_BENCH_SIZES 8
+#define CRC32C_BENCH_MAX   0x100000
+#define CRC32C_BENCH_BYTES 0x800000
+
+// The engines work on the CRC register, without the inversion before and
+// after that crc32c() applies
+typedef uint32_t (*crc32c_fn_t)(uint32_t reg, const uint8_t* p, size_t length);
+
+// Loads at any alignment
+typedef uint32_t unaligned_u32 __attribute__((may_alias, aligned(1)));
+
+// Start of the kernel image (linker.ld) and its trailer, the last bytes
+// of the image. crc32c_init() checks the image before anything in .data
+// is written, so everything here that it sets lives in .bss.
+extern uint8_t __kernel_start[];
+static const volatile crc32c_trailer_t image_trailer __attribute__((section(".imagecrc"), used)) = {
+    CRC32C_IMAGE_MAGIC, 0
+};
+
+static uint32_t slice8_table[8][256];
+static uint32_t x2n_table[32];              // x^(2^n) mod P
+static uint32_t shift_long[4][256];         // Multiply by x^(8 * CRC32C_LONG_STREAM)
+static uint32_t shift_short[4][256];        // and by x^(8 * CRC32C_SHORT_STREAM)
+static int sse42;
+static uint32_t selected;
+
+static int32_t image_status;
+static uint32_t image_computed;
+static uint64_t image_cycles;
+
+// a * b mod P, bit reflected (x^0 is the top bit)
+static uint32_t multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return p;
+}
+
+// x^(8 * bytes) mod P: the factor that moves a CRC register past that
+// many bytes
+static uint32_t x8nmodp(uint32_t bytes) {
+    uint32_t p = 1u << 31;
+    for (uint32_t k = 3; bytes; bytes >>= 1, k++) {
+        if (bytes & 1) {
+            p = multmodp(x2n_table[k & 31], p);
+        }
+    }
+    return p;
+}
+
+// Multiplication by a constant is linear, so it splits into one table
+// per byte of the other factor
+static void __init shift_table_init(uint32_t table[4][256], uint32_t bytes) {
+    uint32_t factor = x8nmodp(bytes);
+    for (uint32_t byte = 0; byte < 4; byte++) {
+        for (uint32_t i = 0; i < 256; i++) {
+            table[byte][i] = multmodp(factor, i << (8 * byte));
+        }
+    }
+}
+
+static inline uint32_t shift(const uint32_t table[4][256], uint32_t reg) {
+    return table[0][reg & 0xFF] ^ table[1][(reg >> 8) & 0xFF] ^
+           table[2][(reg >> 16) & 0xFF] ^ table[3][reg >> 24];
+}
+
+static uint32_t crc_slice8(uint32_t reg, const uint8_t* p, size_t length) {
+    for (; length && ((uint32_t)p & 3); length--) {
+        reg = (reg >> 8) ^ slice8_table[0][(reg ^ *p++) & 0xFF];
+    }
+    for (; length >= 8; length -= 8, p += 8) {
+        uint32_t one = *(const unaligned_u32*)p ^ reg;
+        uint32_t two = *(const unaligned_u32*)(p + 4);
+        reg = slice8_table[7][one & 0xFF] ^ slice8_table[6][(one >> 8) & 0xFF] ^
+              slice8_table[5][(one >> 16) & 0xFF] ^ slice8_table[4][one >> 24] ^
+              slice8_table[3][two & 0xFF] ^ slice8_table[2][(two >> 8) & 0xFF] ^
+              slice8_table[1][(two >> 16) & 0xFF] ^ slice8_table[0][two >> 24];
+    }
+    for (; length; length--) {
+        reg = (reg >> 8) ^ slice8_table[0][(reg ^ *p++) & 0xFF];
+    }
+    return reg;
+}
+
+static inline uint32_t crc32_u8(uint32_t reg, uint8_t value) {
+    __asm__("crc32b %1, %0" : "+r"(reg) : "qm"(value));
+    return reg;
+}
+
+static inline uint32_t crc32_u32(uint32_t reg, uint32_t value) {
+    __asm__("crc32l %1, %0" : "+r"(reg) : "rm"(value));
+    return reg;
+}
+
+static uint32_t crc_sse4(uint32_t reg, const uint8_t* p, size_t length) {
+    for (; length && ((uint32_t)p & 3); length--) {
+        reg = crc32_u8(reg, *p++);
+    }
+    for (; length >= 4; length -= 4, p += 4) {
+        reg = crc32_u32(reg, *(const unaligned_u32*)p);
+    }
+    for (; length; length--) {
+        reg = crc32_u8(reg, *p++);
+    }
+    return reg;
+}
+
+// Three streams of stream bytes each, the first continuing reg and the
+// others starting from 0, then combined:
+//   reg(A B C) = shift(shift(reg(A)) ^ reg(B)) ^ reg(C)
+static inline uint32_t crc_three(uint32_t reg, const uint8_t* p, size_t stream,
+                                 const uint32_t table[4][256]) {
+    uint32_t b = 0;
+    uint32_t c = 0;
+    for (const uint8_t* end = p + stream; p < end; p += 4) {
+        reg = crc32_u32(reg, *(const unaligned_u32*)p);
+        b = crc32_u32(b, *(const unaligned_u32*)(p + stream));
+        c = crc32_u32(c, *(const unaligned_u32*)(p + 2 * stream));
+    }
+    return shift(table, shift(table, reg) ^ b) ^ c;
+}
+
+static uint32_t crc_sse4x3(uint32_t reg, const uint8_t* p, size_t length) {
+    for (; length >= 3 * CRC32C_LONG_STREAM; length -= 3 * CRC32C_LONG_STREAM) {
+        reg = crc_three(reg, p, CRC32C_LONG_STREAM, shift_long);
+        p += 3 * CRC32C_LONG_STREAM;
+    }
+    for (; length >= 3 * CRC32C_SHORT_STREAM; length -= 3 * CRC32C_SHORT_STREAM) {
+        reg = crc_three(reg, p, CRC32C_SHORT_STREAM, shift_short);
+        p += 3 * CRC32C_SHORT_STREAM;
+    }
+    return crc_sse4(reg, p, length);
+}
+
+static const crc32c_fn_t engines[CRC32C_ENGINES] = { crc_slice8, crc_sse4, crc_sse4x3 };
+static const char* const engine_names[CRC32C_ENGINES] = { "slice8", "sse4", "sse4x3" };
+
+int crc32c_engine_available(uint32_t engine) {
+    return engine == CRC32C_SLICE8 || (engine < CRC32C_ENGINES && sse42);
+}
+
+const char* crc32c_engine_name(uint32_t engine) {
+    return engine < CRC32C_ENGINES ? engine_names[engine] : "?";
+}
+
+uint32_t crc32c_engine(uint32_t engine, uint32_t crc, const void* data, size_t length) {
+    return ~engines[engine](~crc, (const uint8_t*)data, length);
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t length) {
+    return ~engines[selected](~crc, (const uint8_t*)data, length);
+}
+
+// Build the tables, pick an engine and checksum the kernel image. Runs
+// first thing at boot, while .data is still as loaded; crc32c_log_image()
+// reports the result once the kernel log is up.
+void __init crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t reg = i;
+        for (int bit = 0; bit < 8; bit++) {
+            reg = reg & 1 ? (reg >> 1) ^ CRC32C_POLY : reg >> 1;
+        }
+        slice8_table[0][i] = reg;
+    }
+    for (uint32_t t = 1; t < 8; t++) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t prev = slice8_table[t - 1][i];
+            slice8_table[t][i] = (prev >> 8) ^ slice8_table[0][prev & 0xFF];
+        }
+    }
+    uint32_t p = 1u << 30;                  // x^1
+    for (uint32_t n = 0; n < 32; n++) {
+        x2n_table[n] = p;
+        p = multmodp(p, p);
+    }
+    shift_table_init(shift_long, CRC32C_LONG_STREAM);
+    shift_table_init(shift_short, CRC32C_SHORT_STREAM);
+
+    uint32_t ecx;
+    cpuid(1, 0, 0, &ecx, 0);
+    sse42 = (ecx & CPUID_ECX_SSE42) != 0;
+    if (sse42 && crc32c_engine(CRC32C_SSE4X3, 0, "123456789", 9) == CRC32C_CHECK) {
+        selected = CRC32C_SSE4X3;
+    }
+
+    if (image_trailer.magic != CRC32C_IMAGE_MAGIC) {
+        image_status = E_NOENT;
+        return;
+    }
+    uint64_t start = rdtsc();
+    image_computed = crc32c(0, __kernel_start, (uint32_t)&image_trailer - (uint32_t)__kernel_start);
+    image_cycles = rdtsc() - start;
+    image_status = image_computed == image_trailer.crc ? E_OK : E_IO;
+}
+
+void __init crc32c_log_image(void) {
+    uint32_t size = (uint32_t)&image_trailer - (uint32_t)__kernel_start;
+    uint32_t us = timer_cycles_to_us(image_cycles, 1);
+    if (image_status == E_OK) {
+        klog(KLOG_INFO, "crc32c", "%s, kernel image %u KB checksum %x ok in %u us",
+             engine_names[selected], size / 1024, image_computed, us);
+    } else if (image_status == E_IO) {
+        klog(KLOG_ERR, "crc32c", "kernel image corrupt: checksum %x, expected %x",
+             image_computed, image_trailer.crc);
+    } else {
+        klog(KLOG_WARN, "crc32c", "kernel image has no checksum trailer");
+    }
+}
+
+static void bench_print_padded(uint32_t value, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    for (; digits < width; digits++) {
+        terminal_putchar(' ');
+    }
+    terminal_print_dec(value);
+}
+
+static void bench_print_size(uint32_t size) {
+    if (size >= 0x100000) {
+        bench_print_padded(size >> 20, 6);
+        terminal_writestring(" MB ");
+    } else if (size >= 1024) {
+        bench_print_padded(size >> 10, 6);
+        terminal_writestring(" KB ");
+    } else {
+        bench_print_padded(size, 6);
+        terminal_writestring(" B  ");
+    }
+}
+
+// Print hundredths as "d.dd" in a column of width characters
+static void bench_print_hundredths(uint32_t hundredths, uint32_t width) {
+    bench_print_padded(hundredths / 100, width - 3);
+    terminal_putchar('.');
+    terminal_putchar('0' + (hundredths / 10) % 10);
+    terminal_putchar('0' + hundredths % 10);
+}
+
+// GB/s of each engine at buffer sizes from 64 B to 1 MB (crcbench command)
+void crc32c_benchmark(void) {
+    uint32_t pages = CRC32C_BENCH_MAX / PAGE_SIZE;
+    uint8_t* buffer = (uint8_t*)pmm_alloc(pages);
+    if (!buffer) {
+        terminal_println("crcbench: out of memory");
+        return;
+    }
+    uint32_t seed = 1;
+    for (uint32_t i = 0; i < CRC32C_BENCH_MAX; i++) {
+        seed = seed * 1103515245 + 12345;
+        buffer[i] = seed >> 16;
+    }
+
+    // Every engine must agree with the check value and with slice8 on an
+    // odd length at an odd address
+    uint32_t expected = crc32c_engine(CRC32C_SLICE8, 0, buffer + 1, 3 * CRC32C_LONG_STREAM + 999);
+    terminal_writestring("CRC-32C GB/s (* = used by the kernel)\n      size");
+    for (uint32_t e = 0; e < CRC32C_ENGINES; e++) {
+        for (size_t pad = strlen(engine_names[e]); pad < 7; pad++) {
+            terminal_putchar(' ');
+        }
+        terminal_writestring(engine_names[e]);
+        terminal_putchar(' ');
+        if (crc32c_engine_available(e) &&
+            (crc32c_engine(e, 0, "123456789", 9) != CRC32C_CHECK ||
+             crc32c_engine(e, 0, buffer + 1, 3 * CRC32C_LONG_STREAM + 999) != expected)) {
+            terminal_writestring("(wrong!)");
+        }
+    }
+    terminal_putchar('\n');
+
+    uint32_t khz = timer_get_tsc_khz();
+    for (uint32_t size = 64, n = 0; n < CRC32C_BENCH_SIZES; size <<= 2, n++) {
+        uint32_t iterations = CRC32C_BENCH_BYTES / size;
+        bench_print_size(size);
+        for (uint32_t e = 0; e < CRC32C_ENGINES; e++) {
+            if (!crc32c_engine_available(e)) {
+                terminal_writestring("       -");
+                continue;
+            }
+            uint32_t crc = 0;
+            uint64_t start = rdtsc();
+            for (uint32_t i = 0; i < iterations; i++) {
+                crc = crc32c_engine(e, crc, buffer, size);
+            }
+            uint64_t cycles = rdtsc() - start;
+            uint64_t bytes = (uint64_t)size * iterations;
+            uint32_t hundredths = cycles && khz ?
+                (uint32_t)div64_32(div64_32(bytes * khz, (uint32_t)cycles), 10000) : 0;
+            bench_print_hundredths(hundredths, 7);
+            terminal_putchar(e == selected ? '*' : ' ');
+        }
+        terminal_putchar('\n');
+    }
+    pmm_free(buffer, pages);
+}
@@ -0,0 +1,498 @@
+#include "elf.h"
+#include "cpu.h"
+#include "klib.h"
+#include "memory.h"
+#include "paging.h"
+#include "timer.h"
+
+// Benchmark parameters
+#define ELF_BENCH_RUNS       20             // Lazy runs averaged per program
+#define ELF_BENCH_EAGER_RUNS 5
+
+// Global variables
+static elf_image_t images[ELF_IMAGE_MAX];
+static elf_stats_t stats;
+
+static int32_t elf_fault(address_space_t* space, vm_area_t* area, uint32_t addr, uint32_t err_code);
+static void elf_area_open(vm_area_t* area);
+static void elf_area_close(vm_area_t* area);
+
+static const vm_ops_t elf_vm_ops = {
+    .fault = elf_fault,
+    .open = elf_area_open,
+    .close = elf_area_close,
+};
+
+// Backing file access
+
+// Read size bytes at offset straight from the file (may sleep on I/O)
+static int32_t image_read(elf_image_t* image, uint32_t offset, void* buffer, uint32_t size) {
+    if (image->node) {
+        const void* data = 0;
+        if (initrd_read(image->node, offset, size, &data) != size) {
+            return E_IO;
+        }
+        memcpy(buffer, data, size);
+        return E_OK;
+    }
+
+    // Private cursor: faults on the same binary may read concurrently
+    fat_file_t file = image->file;
+    fat_seek(&file, offset);
+    uint8_t* out = (uint8_t*)buffer;
+    while (size) {
+        int32_t count = fat_read(&file, out, size);
+        if (count <= 0) {
+            return E_IO;
+        }
+        out += count;
+        size -= (uint32_t)count;
+    }
+    return E_OK;
+}
+
+// Frame holding file page index, read on first use. The cache keeps one
+// reference to it; every mapping adds its own.
+static uint32_t image_page(elf_image_t* image, uint32_t index) {
+    if (image->pages[index]) {
+        stats.cache_hits++;
+        return image->pages[index];
+    }
+
+    uint8_t* frame = (uint8_t*)pmm_alloc(1);
+    if (!frame) {
+        return 0;
+    }
+    uint32_t offset = index << PAGE_SHIFT;
+    uint32_t length = image->size - offset < PAGE_SIZE ? image->size - offset : PAGE_SIZE;
+    if (image_read(image, offset, frame, length) != E_OK) {
+        pmm_free(frame, 1);
+        return 0;
+    }
+    memset(frame + length, 0, PAGE_SIZE - length);
+
+    // Another fault may have filled the slot while the read slept
+    if (image->pages[index]) {
+        pmm_free(frame, 1);
+        return image->pages[index];
+    }
+    image->pages[index] = (uint32_t)frame;
+    stats.cache_fills++;
+    return (uint32_t)frame;
+}
+
+// Image cache
+
+static void image_free(elf_image_t* image) {
+    if (image->pages) {
+        for (uint32_t i = 0; i < image->page_count; i++) {
+            if (image->pages[i]) {
+                pmm_frame_unref(image->pages[i]);
+            }
+        }
+        pmm_free(image->pages, image->table_pages);
+        image->pages = 0;
+    }
+    image->path[0] = '\0';
+    image->in_use = 0;
+}
+
+// Drop binaries no program is using (benchmark: start from a cold cache)
+static void image_flush(void) {
+    for (int i = 0; i < ELF_IMAGE_MAX; i++) {
+        if (images[i].in_use && images[i].users == 0 && images[i].path[0]) {
+            image_free(&images[i]);
+        }
+    }
+}
+
+// Free slot, evicting the least recently used binary without users
+static elf_image_t* image_alloc(void) {
+    elf_image_t* victim = 0;
+    for (int i = 0; i < ELF_IMAGE_MAX; i++) {
+        elf_image_t* image = &images[i];
+        if (!image->in_use) {
+            victim = image;
+            break;
+        }
+        if (image->users == 0 && image->path[0] && (!victim || image->last_used < victim->last_used)) {
+            victim = image;
+        }
+    }
+    if (victim && victim->in_use) {
+        image_free(victim);
+        stats.evictions++;
+    }
+    if (victim) {
+        memset(victim, 0, sizeof(*victim));
+        victim->in_use = 1;
+    }
+    return victim;
+}
+
+// Check the file header and collect the PT_LOAD segments. Segments must
+// lie in user space below the stack, keep file offset and address
+// congruent modulo the page size (so file pages map whole) and not share
+// pages with each other.
+static int32_t image_parse(elf_image_t* image) {
+    elf32_header_t header;
+    if (image->size < sizeof(header) || image_read(image, 0, &header, sizeof(header)) != E_OK) {
+        return E_INVAL;
+    }
+    if (*(uint32_t*)header.ident != ELF_MAGIC || header.ident[4] != ELF_CLASS_32 ||
+        header.ident[5] != ELF_DATA_LSB || header.type != ELF_ET_EXEC ||
+        header.machine != ELF_EM_386 || header.version != ELF_VERSION ||
+        header.phentsize != sizeof(elf32_phdr_t) || header.phnum == 0 || header.phnum > ELF_PHDR_MAX ||
+        header.phoff > image->size || header.phnum * sizeof(elf32_phdr_t) > image->size - header.phoff) {
+        return E_INVAL;
+    }
+
+    elf32_phdr_t phdrs[ELF_PHDR_MAX];
+    if (image_read(image, header.phoff, phdrs, header.phnum * sizeof(elf32_phdr_t)) != E_OK) {
+        return E_IO;
+    }
+
+    uint32_t limit = USER_STACK_TOP - ELF_STACK_SIZE;
+    int entry_ok = 0;
+    for (uint32_t i = 0; i < header.phnum; i++) {
+        const elf32_phdr_t* phdr = &phdrs[i];
+        if (phdr->type != ELF_PT_LOAD || phdr->memsz == 0) {
+            continue;
+        }
+        if (image->segment_count == ELF_SEGMENT_MAX || phdr->filesz > phdr->memsz ||
+            phdr->vaddr < USER_SPACE_START || phdr->vaddr >= limit || phdr->memsz > limit - phdr->vaddr ||
+            phdr->offset > image->size || phdr->filesz > image->size - phdr->offset ||
+            ((phdr->vaddr ^ phdr->offset) & (PAGE_SIZE - 1))) {
+            return E_INVAL;
+        }
+        uint32_t start = PAGE_ALIGN_DOWN(phdr->vaddr);
+        uint32_t end = PAGE_ALIGN_UP(phdr->vaddr + phdr->memsz);
+        for (uint32_t j = 0; j < image->segment_count; j++) {
+            const elf_segment_t* other = &image->segments[j];
+            if (start < PAGE_ALIGN_UP(other->vaddr + other->memsz) && PAGE_ALIGN_DOWN(other->vaddr) < end) {
+                return E_INVAL;
+            }
+        }
+
+        elf_segment_t* segment = &image->segments[image->segment_count++];
+        segment->vaddr = phdr->vaddr;
+        segment->memsz = phdr->memsz;
+        segment->offset = phdr->offset;
+        segment->filesz = phdr->filesz;
+        segment->flags = phdr->flags;
+        if ((phdr->flags & ELF_PF_X) && header.entry >= phdr->vaddr && header.entry - phdr->vaddr < phdr->memsz) {
+            entry_ok = 1;
+        }
+    }
+    if (!entry_ok) {
+        return E_INVAL;
+    }
+    image->entry = header.entry;
+    return E_OK;
+}
+
+// Find the binary at path in the cache or open, check and add it
+static int32_t image_get(const char* path, elf_image_t** result) {
+    uint32_t length = strlen(path);
+    if (length == 0 || length >= ELF_PATH_MAX) {
+        return E_INVAL;
+    }
+    for (int i = 0; i < ELF_IMAGE_MAX; i++) {
+        if (images[i].in_use && strcmp(images[i].path, path) == 0) {
+            images[i].last_used = rdtsc();
+            *result = &images[i];
+            return E_OK;
+        }
+    }
+
+    elf_image_t* image = image_alloc();
+    if (!image) {
+        return E_BUSY;
+    }
+    const char* fat_rest = fat_path(path);
+    int32_t error = E_OK;
+    if (fat_rest) {
+        error = fat_open(fat_rest, &image->file);
+        if (error == E_OK && (image->file.entry.attr & FAT_ATTR_DIRECTORY)) {
+            error = E_INVAL;
+        }
+        image->size = image->file.entry.size;
+    } else {
+        image->node = initrd_lookup(path);
+        if (!image->node) {
+            error = E_NOENT;
+        } else if (image->node->type != INITRD_FILE) {
+            error = E_INVAL;
+        } else {
+            image->size = image->node->size;
+        }
+    }
+    if (error == E_OK) {
+        error = image_parse(image);
+    }
+    if (error == E_OK) {
+        image->page_count = PAGE_ALIGN_UP(image->size) >> PAGE_SHIFT;
+        image->table_pages = PAGE_ALIGN_UP(image->page_count * sizeof(uint32_t)) >> PAGE_SHIFT;
+        image->pages = (uint32_t*)pmm_alloc(image->table_pages);
+        if (image->pages) {
+            memset(image->pages, 0, image->table_pages * PAGE_SIZE);
+        } else {
+            error = E_NOMEM;
+        }
+    }
+    if (error != E_OK) {
+        image_free(image);
+        return error;
+    }
+
+    strcpy(image->path, path);
+    image->last_used = rdtsc();
+    *result = image;
+    return E_OK;
+}
+
+// Segment areas
+
+static void elf_area_open(vm_area_t* area) {
+    ((elf_image_t*)area->data)->users++;
+}
+
+static void elf_area_close(vm_area_t* area) {
+    ((elf_image_t*)area->data)->users--;
+}
+
+// Map frame (whose reference the caller owns) at page unless another
+// thread in the same space mapped it first
+static int32_t elf_map(address_space_t* space, uint32_t page, uint32_t frame, uint32_t flags) {
+    uint32_t* pte = paging_get_pte(space, page, 0);
+    if (pte && (*pte & PTE_PRESENT)) {
+        pmm_frame_unref(frame);
+        return E_OK;
+    }
+    if (paging_map(space, page, frame, flags) != 0) {
+        pmm_frame_unref(frame);
+        return E_NOMEM;
+    }
+    return E_OK;
+}
+
+// File offset of the first byte of page (congruence holds, see image_parse)
+static uint32_t segment_file_offset(const elf_segment_t* segment, uint32_t page) {
+    return segment->offset - (segment->vaddr - page);
+}
+
+// Give page a private frame: the segment's file bytes in it, zeros around
+// them. cached takes the bytes from the page cache, otherwise they are
+// read from the file.
+static int32_t elf_private_page(address_space_t* space, elf_image_t* image, const elf_segment_t* segment,
+                                uint32_t page, uint32_t flags, int cached) {
+    uint8_t* frame = (uint8_t*)pmm_alloc(1);
+    if (!frame) {
+        return E_NOMEM;
+    }
+    memset(frame, 0, PAGE_SIZE);
+
+    uint32_t file_end = segment->vaddr + segment->filesz;
+    uint32_t start = page > segment->vaddr ? page : segment->vaddr;
+    uint32_t end = page + PAGE_SIZE < file_end ? page + PAGE_SIZE : file_end;
+    if (start < end) {
+        uint32_t offset = segment_file_offset(segment, page) + (start - page);
+        int32_t result = E_OK;
+        if (cached) {
+            uint32_t source = image_page(image, offset >> PAGE_SHIFT);
+            if (source) {
+                memcpy(frame + (start - page), (const uint8_t*)source + (offset & (PAGE_SIZE - 1)), end - start);
+            } else {
+                result = E_NOMEM;
+            }
+        } else {
+            result = image_read(image, offset, frame + (start - page), end - start);
+        }
+        if (result != E_OK) {
+            pmm_free(frame, 1);
+            return result;
+        }
+        stats.private_pages++;
+    } else {
+        stats.zero_pages++;
+    }
+    return elf_map(space, page, (uint32_t)frame, flags);
+}
+
+// First touch of a segment page. Pages whose bytes all come from the file
+// map the cached frame: read-only, or copy-on-write for writable segments
+// (paging_handle_cow() copies it on the first write). A first touch that
+// is a write, bss, and the page where file data meets bss get a private
+// frame.
+static int32_t elf_fault(address_space_t* space, vm_area_t* area, uint32_t addr, uint32_t err_code) {
+    elf_image_t* image = (elf_image_t*)area->data;
+    const elf_segment_t* segment = &image->segments[area->index];
+    uint32_t page = PAGE_ALIGN_DOWN(addr);
+    int writable = segment->flags & ELF_PF_W;
+    if ((err_code & PF_WRITE) && !writable) {
+        return E_FAULT;
+    }
+
+    uint32_t file_end = segment->vaddr + segment->filesz;
+    uint32_t flags = PTE_PRESENT | PTE_USER;
+    int whole = page < file_end && (page + PAGE_SIZE <= file_end || segment->memsz == segment->filesz);
+    if (whole && !(err_code & PF_WRITE)) {
+        uint32_t frame = image_page(image, segment_file_offset(segment, page) >> PAGE_SHIFT);
+        if (!frame) {
+            return E_NOMEM;
+        }
+        pmm_frame_ref(frame);
+        return elf_map(space, page, frame, writable ? flags | PTE_COW : flags);
+    }
+    return elf_private_page(space, image, segment, page, writable ? flags | PTE_WRITABLE : flags, 1);
+}
+
+// Read every page of the area up front into private frames (the loader
+// without demand paging, for the benchmark)
+static int32_t elf_populate(address_space_t* space, vm_area_t* area) {
+    elf_image_t* image = (elf_image_t*)area->data;
+    const elf_segment_t* segment = &image->segments[area->index];
+    uint32_t flags = PTE_PRESENT | PTE_USER | ((segment->flags & ELF_PF_W) ? PTE_WRITABLE : 0);
+    for (uint32_t page = area->start; page < area->end; page += PAGE_SIZE) {
+        int32_t result = elf_private_page(space, image, segment, page, flags, 0);
+        if (result != E_OK) {
+            return result;
+        }
+    }
+    return E_OK;
+}
+
+// Start the program at path in a new address space on a new user thread,
+// which the caller joins. Only the headers are read here.
+int32_t elf_spawn(const char* path, uint32_t flags, thread_t** thread) {
+    elf_image_t* image;
+    int32_t result = image_get(path, &image);
+    if (result != E_OK) {
+        return result;
+    }
+
+    address_space_t* space = address_space_create();
+    if (!space) {
+        return E_NOMEM;
+    }
+    for (uint32_t i = 0; i < image->segment_count && result == E_OK; i++) {
+        const elf_segment_t* segment = &image->segments[i];
+        result = address_space_add_area(space, PAGE_ALIGN_DOWN(segment->vaddr),
+                                        PAGE_ALIGN_UP(segment->vaddr + segment->memsz), &elf_vm_ops, image, i);
+        if (result == E_OK && (flags & ELF_EXEC_EAGER)) {
+            result = elf_populate(space, &space->areas[space->area_count - 1]);
+        }
+    }
+    if (result == E_OK) {
+        result = address_space_alloc_region(space, USER_STACK_TOP - ELF_STACK_SIZE, ELF_STACK_SIZE, PTE_WRITABLE);
+    }
+    if (result == E_OK) {
+        *thread = thread_create_user(image->path, space, image->entry, USER_STACK_TOP, 0);
+        if (!*thread) {
+            result = E_NOMEM;
+        }
+    }
+    if (result != E_OK) {
+        address_space_destroy(space);
+        return result;
+    }
+    stats.execs++;
+    return E_OK;
+}
+
+void elf_get_stats(elf_stats_t* out) {
+    *out = stats;
+}
+
+// Shell support
+
+static const char* elf_error(int32_t error) {
+    return error == E_NOENT ? "no such file" :
+           error == E_NODEV ? "no FAT filesystem mounted" :
+           error == E_INVAL ? "not an i386 ELF executable" :
+           error == E_NOMEM ? "out of memory" :
+           error == E_BUSY  ? "too many binaries in use" : "read error";
+}
+
+// Run a program and wait for it to exit
+void elf_exec(const char* path) {
+    thread_t* thread;
+    int32_t result = elf_spawn(path, 0, &thread);
+    if (result != E_OK) {
+        terminal_writestring("exec: ");
+        terminal_println(elf_error(result));
+        return;
+    }
+    int32_t code = thread_join(thread);
+    terminal_writestring("exec: exited with code ");
+    if (code < 0) {
+        terminal_putchar('-');
+        code = -code;
+    }
+    terminal_print_dec((uint32_t)code);
+    terminal_putchar('\n');
+}
+
+static const char* const bench_paths[] = {
+    "/bin/hello", FAT_MOUNT_POINT "/bin/hello", FAT_MOUNT_POINT "/bin/big"
+};
+
+// Spawn and join runs times; returns the average cycles or 0 on failure
+static uint64_t bench_exec(const char* path, uint32_t flags, uint32_t runs) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < runs; i++) {
+        thread_t* thread;
+        uint64_t start = rdtsc();
+        if (elf_spawn(path, flags, &thread) != E_OK || thread_join(thread) != 0) {
+            return 0;
+        }
+        total += rdtsc() - start;
+    }
+    return div64_32(total, runs);
+}
+
+static void bench_print_us(uint64_t cycles) {
+    if (cycles) {
+        terminal_print_dec(timer_cycles_to_us(cycles, 1));
+    } else {
+        terminal_writestring("-");
+    }
+    terminal_writestring("\t");
+}
+
+// Start-to-exit time of the same small program linked with little and
+// with a lot of read-only data: with a cold and a warm page cache, and
+// read up front (no demand paging). The cold run also starts without the
+// disk's blocks in the block cache.
+void elf_benchmark(void) {
+    terminal_println("Program start to exit (us):");
+    terminal_println("  size KB   cold  lazy  faults  eager  program");
+
+    for (uint32_t n = 0; n < sizeof(bench_paths) / sizeof(bench_paths[0]); n++) {
+        const char* path = bench_paths[n];
+        elf_image_t* image;
+        image_flush();
+        if (image_get(path, &image) != E_OK) {
+            continue;
+        }
+        uint32_t size = image->size;
+        image_flush();
+        fat_drop_cache();
+
+        uint64_t cold = bench_exec(path, 0, 1);
+        uint32_t faults = stats.cache_hits + stats.cache_fills + stats.private_pages + stats.zero_pages;
+        uint64_t lazy = bench_exec(path, 0, ELF_BENCH_RUNS);
+        faults = stats.cache_hits + stats.cache_fills + stats.private_pages + stats.zero_pages - faults;
+        uint64_t eager = bench_exec(path, ELF_EXEC_EAGER, ELF_BENCH_EAGER_RUNS);
+
+        terminal_writestring("  ");
+        terminal_print_dec(size >> 10);
+        terminal_writestring("\t    ");
+        bench_print_us(cold);
+        bench_print_us(lazy);
+        terminal_print_dec(faults / ELF_BENCH_RUNS);
+        terminal_writestring("\t  ");
+        bench_print_us(eager);
+        terminal_println(path);
+    }
+}
@@ -0,0 +1,864 @@
+#include "fat.h"
+#include "bcache.h"
+#include "blkdev.h"
+#include "cpu.h"
+#include "klib.h"
+#include "memory.h"
+#include "timer.h"
+#include "klog.h"
+#include "init.h"
+
+// Long names are spread over up to 20 directory entries of 13 characters
+#define FAT_LFN_ENTRIES 20
+#define FAT_LFN_CHARS   13
+
+// Benchmark parameters
+#define FATBENCH_DEFAULT "/large.bin"
+#define FATBENCH_CHUNK   (64 * 1024)        // Bytes per read call
+
+// Mounted filesystem. Sector numbers are in BLK_SECTOR_SIZE units, which
+// the boot sector must match.
+typedef struct {
+    block_device_t* dev;
+    uint8_t bits;                   // 12 or 16
+    uint32_t cluster_shift;         // log2 of the cluster size in bytes
+    uint32_t sectors_per_cluster;
+    uint32_t fat_start;
+    uint32_t fat_sectors;
+    uint32_t root_start;
+    uint32_t root_entries;
+    uint32_t data_start;
+    uint32_t cluster_count;         // Data clusters, numbered from 2
+    uint16_t* next;                 // Decoded FAT: next cluster, FAT_EOC or FAT_BAD
+    uint16_t* run;                  // Chain-contiguous clusters starting here
+    uint32_t table_pages;
+} fat_fs_t;
+
+// Dentry cache entry: child `name` of the directory starting at `parent`
+typedef struct fat_dentry {
+    uint32_t parent;
+    uint32_t hash;
+    char name[FAT_DCACHE_NAME_MAX + 1];
+    uint8_t attr;
+    uint32_t cluster;
+    uint32_t size;
+    uint8_t in_use;
+    struct fat_dentry* hash_next;
+    struct fat_dentry* lru_prev;
+    struct fat_dentry* lru_next;
+} fat_dentry_t;
+
+// Directory reader
+typedef struct {
+    uint32_t start;                 // First cluster, 0 for the root directory
+    uint32_t index;                 // Next entry
+    fat_cursor_t cursor;
+    uint32_t loaded;                // Sector held in `sector`, 0 if none
+    uint8_t sector[BLK_SECTOR_SIZE];
+    char lfn[FAT_LFN_ENTRIES * FAT_LFN_CHARS + 1];
+    uint8_t lfn_checksum;
+    uint8_t lfn_next;               // Sequence number expected next
+    uint8_t lfn_done;               // lfn holds a complete name
+} fat_dir_t;
+
+// Global variables
+static fat_fs_t fs;
+static int mounted = 0;
+static fat_dentry_t dentries[FAT_DCACHE_ENTRIES];
+static fat_dentry_t* dentry_hash[1 << FAT_DCACHE_HASH_BITS];
+static fat_dentry_t* dentry_lru_head = 0;  // Most recently used
+static fat_dentry_t* dentry_lru_tail = 0;
+static uint32_t dcache_lookups = 0;
+static uint32_t dcache_hits = 0;
+
+static inline uint16_t le16(const uint8_t* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline char fat_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? (char)(c + ('a' - 'A')) : c;
+}
+
+static inline int cluster_valid(uint32_t cluster) {
+    return cluster >= 2 && cluster < fs.cluster_count + 2;
+}
+
+static inline uint64_t cluster_offset(uint32_t cluster) {
+    return ((uint64_t)fs.data_start << BLK_SECTOR_SHIFT) + ((uint64_t)(cluster - 2) << fs.cluster_shift);
+}
+
+// Move a cursor to chain[index], a whole run at a time. Returns E_NOENT
+// if the chain ends first and E_IO if it is broken.
+static int32_t chain_seek(fat_cursor_t* cursor, uint32_t first, uint32_t index) {
+    if (!cursor->cluster || index < cursor->index) {
+        cursor->index = 0;
+        cursor->cluster = first;
+    }
+    while (cursor->index < index) {
+        uint32_t cluster = cursor->cluster;
+        if (!cluster_valid(cluster)) {
+            break;
+        }
+        uint32_t run = fs.run[cluster];
+        if (index - cursor->index < run) {
+            cursor->cluster = cluster + (index - cursor->index);
+            cursor->index = index;
+            return E_OK;
+        }
+        cursor->cluster = fs.next[cluster + run - 1];
+        cursor->index += run;
+    }
+    if (cluster_valid(cursor->cluster)) {
+        return E_OK;
+    }
+    return cursor->cluster == FAT_EOC ? E_NOENT : E_IO;
+}
+
+// Mount
+
+// Read the first FAT copy and decode it, normalising end-of-chain and bad
+// or out-of-range links
+static int32_t __init fat_load_table(void) {
+    uint32_t entries = fs.cluster_count + 2;
+    fs.table_pages = PAGE_ALIGN_UP(entries * 2 * sizeof(uint16_t)) / PAGE_SIZE;
+    fs.next = (uint16_t*)pmm_alloc(fs.table_pages);
+    uint32_t raw_pages = PAGE_ALIGN_UP(fs.fat_sectors << BLK_SECTOR_SHIFT) / PAGE_SIZE;
+    uint8_t* raw = (uint8_t*)pmm_alloc(raw_pages);
+    if (!fs.next || !raw) {
+        if (fs.next) {
+            pmm_free(fs.next, fs.table_pages);
+        }
+        if (raw) {
+            pmm_free(raw, raw_pages);
+        }
+        return E_NOMEM;
+    }
+    fs.run = fs.next + entries;
+
+    // Straight from the device: the table is read once and kept decoded
+    for (uint32_t done = 0; done < fs.fat_sectors;) {
+        uint32_t count = fs.fat_sectors - done;
+        if (count > fs.dev->max_sectors) {
+            count = fs.dev->max_sectors;
+        }
+        if (blkdev_read(fs.dev, fs.fat_start + done, count, raw + (done << BLK_SECTOR_SHIFT)) != E_OK) {
+            pmm_free(raw, raw_pages);
+            pmm_free(fs.next, fs.table_pages);
+            return E_IO;
+        }
+        done += count;
+    }
+
+    for (uint32_t n = 0; n < entries; n++) {
+        uint32_t value;
+        if (fs.bits == 12) {
+            value = le16(raw + n + n / 2);
+            value = (n & 1) ? value >> 4 : value & 0xFFF;
+            if (value >= 0xFF8) {
+                value = FAT_EOC;
+            } else if (value == 0xFF7) {
+                value = FAT_BAD;
+            }
+        } else {
+            value = le16(raw + n * 2);
+            if (value >= 0xFFF8) {
+                value = FAT_EOC;
+            }
+        }
+        if (value != FAT_FREE && value != FAT_EOC && !cluster_valid(value)) {
+            value = FAT_BAD;
+        }
+        fs.next[n] = (uint16_t)value;
+    }
+    pmm_free(raw, raw_pages);
+
+    fs.run[entries - 1] = 1;
+    for (uint32_t n = entries - 1; n-- > 0;) {
+        fs.run[n] = fs.next[n] == n + 1 && fs.run[n + 1] < 0xFFFF ? fs.run[n + 1] + 1 : 1;
+    }
+    return E_OK;
+}
+
+static int32_t __init fat_mount(block_device_t* dev) {
+    uint8_t boot[BLK_SECTOR_SIZE];
+    if (bcache_read(dev, 0, boot, sizeof(boot)) != E_OK) {
+        return E_IO;
+    }
+
+    uint32_t bytes_per_sector = le16(boot + 11);
+    uint32_t sectors_per_cluster = boot[13];
+    uint32_t reserved = le16(boot + 14);
+    uint32_t fats = boot[16];
+    uint32_t root_entries = le16(boot + 17);
+    uint32_t total = le16(boot + 19) ? le16(boot + 19) : le32(boot + 32);
+    uint32_t fat_sectors = le16(boot + 22);     // 0 on FAT32
+    if (boot[510] != 0x55 || boot[511] != 0xAA || bytes_per_sector != BLK_SECTOR_SIZE ||
+        sectors_per_cluster == 0 || (sectors_per_cluster & (sectors_per_cluster - 1)) ||
+        reserved == 0 || fats == 0 || fat_sectors == 0 || root_entries == 0 || total > dev->sector_count) {
+        return E_INVAL;
+    }
+
+    uint32_t root_sectors = (root_entries * FAT_ENTRY_SIZE + BLK_SECTOR_SIZE - 1) >> BLK_SECTOR_SHIFT;
+    uint32_t data_start = reserved + fats * fat_sectors + root_sectors;
+    if (data_start >= total) {
+        return E_INVAL;
+    }
+    uint32_t shift = BLK_SECTOR_SHIFT;
+    while ((1u << (shift - BLK_SECTOR_SHIFT)) < sectors_per_cluster) {
+        shift++;
+    }
+    uint32_t clusters = (total - data_start) >> (shift - BLK_SECTOR_SHIFT);
+
+    // The cluster count alone decides the FAT type
+    uint8_t bits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+    if (bits == 32 || (fat_sectors << (BLK_SECTOR_SHIFT + 3)) / bits < clusters + 2) {
+        return E_INVAL;
+    }
+
+    fs.dev = dev;
+    fs.bits = bits;
+    fs.cluster_shift = shift;
+    fs.sectors_per_cluster = sectors_per_cluster;
+    fs.fat_start = reserved;
+    fs.fat_sectors = fat_sectors;
+    fs.root_start = reserved + fats * fat_sectors;
+    fs.root_entries = root_entries;
+    fs.data_start = data_start;
+    fs.cluster_count = clusters;
+    return fat_load_table();
+}
+
+void __init fat_init(void) {
+    for (int i = 0; i < FAT_DCACHE_ENTRIES; i++) {
+        fat_dentry_t* d = &dentries[i];
+        d->lru_prev = i ? &dentries[i - 1] : 0;
+        d->lru_next = i + 1 < FAT_DCACHE_ENTRIES ? &dentries[i + 1] : 0;
+    }
+    dentry_lru_head = &dentries[0];
+    dentry_lru_tail = &dentries[FAT_DCACHE_ENTRIES - 1];
+
+    for (size_t i = 0; i < blkdev_count(); i++) {
+        if (fat_mount(blkdev_get(i)) == E_OK) {
+            mounted = 1;
+            klog(KLOG_INFO, "fat", "FAT%u on %s mounted at " FAT_MOUNT_POINT, fs.bits, fs.dev->name);
+            return;
+        }
+    }
+}
+
+int fat_mounted(void) {
+    return mounted;
+}
+
+// Write back and drop the disk's clean cached blocks, so the next read
+// goes to the device (benchmarks)
+void fat_drop_cache(void) {
+    if (mounted) {
+        bcache_sync(fs.dev);
+        bcache_drop_clean(fs.dev);
+    }
+}
+
+// Paths under FAT_MOUNT_POINT belong to the filesystem: returns the rest
+// of the path (possibly empty, the root), or 0 for any other path
+const char* fat_path(const char* path) {
+    const char* mount = FAT_MOUNT_POINT + 1;
+    uint32_t len = strlen(mount);
+    if (*path == '/') {
+        path++;
+    }
+    if (strncmp(path, mount, len) != 0 || (path[len] != '\0' && path[len] != '/')) {
+        return 0;
+    }
+    return path + len;
+}
+
+// Directories
+
+static void dir_open(fat_dir_t* dir, uint32_t start) {
+    dir->start = start;
+    dir->index = 0;
+    dir->cursor.index = 0;
+    dir->cursor.cluster = 0;
+    dir->loaded = 0;
+    dir->lfn_next = 0;
+    dir->lfn_done = 0;
+}
+
+static uint8_t lfn_checksum(const uint8_t* short_name) {
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; i++) {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + short_name[i]);
+    }
+    return sum;
+}
+
+// Long name entries come in reverse order, the last piece first (flagged
+// 0x40), each holding 13 UCS-2 characters. Non-ASCII becomes '?'.
+static void dir_lfn(fat_dir_t* dir, const uint8_t* e) {
+    static const uint8_t offsets[FAT_LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+    uint32_t seq = e[0] & 0x1F;
+    if (e[0] & 0x40) {
+        dir->lfn_next = (uint8_t)seq;
+        dir->lfn_checksum = e[13];
+        dir->lfn_done = 0;
+        if (seq && seq <= FAT_LFN_ENTRIES) {
+            dir->lfn[seq * FAT_LFN_CHARS] = '\0';
+        }
+    }
+    if (seq == 0 || seq > FAT_LFN_ENTRIES || seq != dir->lfn_next || e[13] != dir->lfn_checksum) {
+        dir->lfn_next = 0;
+        dir->lfn_done = 0;
+        return;
+    }
+
+    char* out = dir->lfn + (seq - 1) * FAT_LFN_CHARS;
+    for (uint32_t i = 0; i < FAT_LFN_CHARS; i++) {
+        uint16_t c = le16(e + offsets[i]);
+        if (c == 0) {
+            out[i] = '\0';
+            break;
+        }
+        out[i] = c < 0x80 ? (char)c : '?';
+    }
+    dir->lfn_next = (uint8_t)(seq - 1);
+    dir->lfn_done = seq == 1;
+}
+
+static void short_name(const uint8_t* e, char* name) {
+    uint32_t n = 0;
+    uint32_t base = 8;
+    while (base && e[base - 1] == ' ') {
+        base--;
+    }
+    for (uint32_t i = 0; i < base; i++) {
+        char c = (i == 0 && e[0] == 0x05) ? (char)0xE5 : (char)e[i];
+        name[n++] = (e[12] & 0x08) ? fat_lower(c) : c;
+    }
+    uint32_t ext = 3;
+    while (ext && e[8 + ext - 1] == ' ') {
+        ext--;
+    }
+    if (ext) {
+        name[n++] = '.';
+        for (uint32_t i = 0; i < ext; i++) {
+            name[n++] = (e[12] & 0x10) ? fat_lower((char)e[8 + i]) : (char)e[8 + i];
+        }
+    }
+    name[n] = '\0';
+}
+
+// Read the next entry, skipping deleted entries, volume labels, "." and
+// "..". Returns 1, 0 at the end of the directory, or an error.
+static int32_t dir_next(fat_dir_t* dir, fat_dirent_t* out) {
+    uint32_t per_sector_shift = BLK_SECTOR_SHIFT - 5;
+    for (;; dir->index++) {
+        uint32_t sector;
+        if (dir->start == 0) {
+            if (dir->index >= fs.root_entries) {
+                return 0;
+            }
+            sector = fs.root_start + (dir->index >> per_sector_shift);
+        } else {
+            int32_t result = chain_seek(&dir->cursor, dir->start, dir->index >> (fs.cluster_shift - 5));
+            if (result != E_OK) {
+                return result == E_NOENT ? 0 : result;
+            }
+            sector = (uint32_t)(cluster_offset(dir->cursor.cluster) >> BLK_SECTOR_SHIFT) +
+                     ((dir->index >> per_sector_shift) & (fs.sectors_per_cluster - 1));
+        }
+        if (sector != dir->loaded) {
+            if (bcache_read(fs.dev, (uint64_t)sector << BLK_SECTOR_SHIFT, dir->sector, BLK_SECTOR_SIZE) != E_OK) {
+                return E_IO;
+            }
+            dir->loaded = sector;
+        }
+
+        const uint8_t* e = dir->sector + ((dir->index & ((1u << per_sector_shift) - 1)) * FAT_ENTRY_SIZE);
+        if (e[0] == 0) {
+            return 0;
+        }
+        if (e[0] == 0xE5) {
+            dir->lfn_done = 0;
+            continue;
+        }
+        if ((e[11] & 0x3F) == FAT_ATTR_LFN) {
+            dir_lfn(dir, e);
+            continue;
+        }
+        int use_lfn = dir->lfn_done && dir->lfn_checksum == lfn_checksum(e);
+        dir->lfn_next = 0;
+        dir->lfn_done = 0;
+        if ((e[11] & FAT_ATTR_VOLUME_ID) || e[0] == '.') {
+            continue;
+        }
+
+        if (use_lfn) {
+            uint32_t len = strlen(dir->lfn);
+            if (len > FAT_NAME_MAX) {
+                len = FAT_NAME_MAX;
+            }
+            memcpy(out->name, dir->lfn, len);
+            out->name[len] = '\0';
+        } else {
+            short_name(e, out->name);
+        }
+        out->attr = e[11];
+        out->cluster = le16(e + 26);
+        out->size = (e[11] & FAT_ATTR_DIRECTORY) ? 0 : le32(e + 28);
+        dir->index++;
+        return 1;
+    }
+}
+
+// FAT names compare without regard to case
+static int name_equal(const char* entry, const char* name, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (fat_lower(entry[i]) != fat_lower(name[i])) {
+            return 0;
+        }
+    }
+    return entry[len] == '\0';
+}
+
+static int32_t dir_lookup(uint32_t start, const char* name, uint32_t len, fat_dirent_t* out) {
+    fat_dir_t dir;
+    dir_open(&dir, start);
+    int32_t result;
+    while ((result = dir_next(&dir, out)) == 1) {
+        if (name_equal(out->name, name, len)) {
+            return E_OK;
+        }
+    }
+    return result < 0 ? result : E_NOENT;
+}
+
+// Dentry cache
+
+static uint32_t dentry_hash_name(uint32_t parent, const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u ^ parent;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)fat_lower(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+static void dentry_touch(fat_dentry_t* d) {
+    if (d == dentry_lru_head) {
+        return;
+    }
+    d->lru_prev->lru_next = d->lru_next;
+    if (d->lru_next) {
+        d->lru_next->lru_prev = d->lru_prev;
+    } else {
+        dentry_lru_tail = d->lru_prev;
+    }
+    d->lru_prev = 0;
+    d->lru_next = dentry_lru_head;
+    dentry_lru_head->lru_prev = d;
+    dentry_lru_head = d;
+}
+
+static fat_dentry_t* dcache_find(uint32_t parent, const char* name, uint32_t len, uint32_t hash) {
+    fat_dentry_t* d = dentry_hash[hash & ((1 << FAT_DCACHE_HASH_BITS) - 1)];
+    while (d && (d->hash != hash || d->parent != parent || !name_equal(d->name, name, len))) {
+        d = d->hash_next;
+    }
+    return d;
+}
+
+// Reuse the least recently used entry
+static void dcache_insert(uint32_t parent, uint32_t hash, const fat_dirent_t* entry) {
+    uint32_t len = strlen(entry->name);
+    if (len > FAT_DCACHE_NAME_MAX) {
+        return;
+    }
+
+    fat_dentry_t* d = dentry_lru_tail;
+    if (d->in_use) {
+        fat_dentry_t** link = &dentry_hash[d->hash & ((1 << FAT_DCACHE_HASH_BITS) - 1)];
+        while (*link != d) {
+            link = &(*link)->hash_next;
+        }
+        *link = d->hash_next;
+    }
+    d->parent = parent;
+    d->hash = hash;
+    memcpy(d->name, entry->name, len + 1);
+    d->attr = entry->attr;
+    d->cluster = entry->cluster;
+    d->size = entry->size;
+    d->in_use = 1;
+    d->hash_next = dentry_hash[hash & ((1 << FAT_DCACHE_HASH_BITS) - 1)];
+    dentry_hash[hash & ((1 << FAT_DCACHE_HASH_BITS) - 1)] = d;
+    dentry_touch(d);
+}
+
+// Walk a path from the root one component at a time, through the dentry
+// cache where possible
+static int32_t fat_resolve(const char* path, fat_dirent_t* out) {
+    if (!mounted) {
+        return E_NODEV;
+    }
+    strcpy(out->name, "/");
+    out->attr = FAT_ATTR_DIRECTORY;
+    out->cluster = 0;
+    out->size = 0;
+
+    for (;;) {
+        while (*path == '/') {
+            path++;
+        }
+        if (*path == '\0') {
+            return E_OK;
+        }
+        const char* name = path;
+        while (*path && *path != '/') {
+            path++;
+        }
+        uint32_t len = (uint32_t)(path - name);
+        if (!(out->attr & FAT_ATTR_DIRECTORY) || len > FAT_NAME_MAX) {
+            return E_NOENT;
+        }
+
+        uint32_t parent = out->cluster;
+        uint32_t hash = dentry_hash_name(parent, name, len);
+        dcache_lookups++;
+        fat_dentry_t* d = dcache_find(parent, name, len, hash);
+        if (d) {
+            dcache_hits++;
+            dentry_touch(d);
+            memcpy(out->name, d->name, strlen(d->name) + 1);
+            out->attr = d->attr;
+            out->cluster = d->cluster;
+            out->size = d->size;
+            continue;
+        }
+
+        int32_t result = dir_lookup(parent, name, len, out);
+        if (result != E_OK) {
+            return result;
+        }
+        dcache_insert(parent, hash, out);
+    }
+}
+
+// Files
+
+int32_t fat_open(const char* path, fat_file_t* file) {
+    memset(file, 0, sizeof(*file));
+    int32_t result = fat_resolve(path, &file->entry);
+    if (result != E_OK) {
+        return result;
+    }
+    file->readahead = 1;
+    file->ra_window = FAT_READAHEAD_MIN;
+    return E_OK;
+}
+
+void fat_seek(fat_file_t* file, uint32_t position) {
+    file->position = position;
+}
+
+// A read that starts where the previous one ended is sequential and keeps
+// readahead going: once the read is not covered or less than half the
+// window is left in front of it, the window doubles and the rest of it is
+// started, one request span per contiguous cluster run. Any other read
+// starts over with the smallest window.
+static void fat_readahead(fat_file_t* file, uint32_t size) {
+    uint32_t pos = file->position;
+    int sequential = pos == file->last_end;
+    if (!sequential) {
+        file->ra_window = FAT_READAHEAD_MIN;
+        file->ra_end = pos;
+    } else if (file->ra_end < pos) {
+        file->ra_end = pos;
+    }
+    if (file->ra_end - pos >= size && file->ra_end - pos >= file->ra_window / 2) {
+        return;
+    }
+    if (sequential && pos && file->ra_window < FAT_READAHEAD_MAX) {
+        file->ra_window *= 2;
+    }
+
+    // Never more than FAT_READAHEAD_MAX: blocks read ahead must survive in
+    // the cache until they are used
+    uint32_t want = size > file->ra_window ? size : file->ra_window;
+    if (want > FAT_READAHEAD_MAX) {
+        want = FAT_READAHEAD_MAX;
+    }
+    uint32_t end = file->entry.size - pos > want ? pos + want : file->entry.size;
+    if (end <= file->ra_end) {
+        return;
+    }
+    uint32_t start = file->ra_end;
+    uint32_t cluster_mask = (1u << fs.cluster_shift) - 1;
+    while (start < end) {
+        if (chain_seek(&file->ra_cursor, file->entry.cluster, start >> fs.cluster_shift) != E_OK) {
+            break;
+        }
+        uint32_t cluster = file->ra_cursor.cluster;
+        uint64_t span = ((uint64_t)fs.run[cluster] << fs.cluster_shift) - (start & cluster_mask);
+        if (span > end - start) {
+            span = end - start;
+        }
+        uint64_t offset = cluster_offset(cluster) + (start & cluster_mask);
+        uint32_t first = (uint32_t)(offset >> BCACHE_BLOCK_SHIFT);
+        uint32_t last = (uint32_t)((offset + span - 1) >> BCACHE_BLOCK_SHIFT);
+        bcache_readahead(fs.dev, first, last - first + 1);
+        start += (uint32_t)span;
+    }
+    file->ra_end = end;
+}
+
+// Read from the current position; returns the bytes read (0 at the end of
+// the file) or an error. Each contiguous run goes to the cache in one call.
+int32_t fat_read(fat_file_t* file, void* buffer, uint32_t size) {
+    if (!mounted) {
+        return E_NODEV;
+    }
+    if (file->entry.attr & FAT_ATTR_DIRECTORY) {
+        return E_INVAL;
+    }
+    if (size == 0 || file->position >= file->entry.size) {
+        return 0;
+    }
+    if (size > file->entry.size - file->position) {
+        size = file->entry.size - file->position;
+    }
+    if (file->readahead) {
+        fat_readahead(file, size);
+    }
+
+    uint8_t* out = (uint8_t*)buffer;
+    uint32_t done = 0;
+    uint32_t cluster_mask = (1u << fs.cluster_shift) - 1;
+    while (done < size) {
+        uint32_t pos = file->position;
+        if (chain_seek(&file->cursor, file->entry.cluster, pos >> fs.cluster_shift) != E_OK) {
+            break;
+        }
+        uint32_t cluster = file->cursor.cluster;
+        uint64_t span = ((uint64_t)fs.run[cluster] << fs.cluster_shift) - (pos & cluster_mask);
+        uint32_t chunk = span < size - done ? (uint32_t)span : size - done;
+        if (bcache_read(fs.dev, cluster_offset(cluster) + (pos & cluster_mask), out + done, chunk) != E_OK) {
+            break;
+        }
+        done += chunk;
+        file->position += chunk;
+    }
+    file->last_end = file->position;
+    return done ? (int32_t)done : E_IO;
+}
+
+// Shell support
+
+static int32_t fat_resolve_or_report(const char* command, const char* path, fat_dirent_t* entry) {
+    int32_t result = fat_resolve(path, entry);
+    if (result != E_OK) {
+        terminal_writestring(command);
+        terminal_println(result == E_NODEV ? ": no FAT filesystem mounted" :
+                         result == E_NOENT ? ": no such file or directory" : ": read error");
+    }
+    return result;
+}
+
+static void fat_print_entry(const fat_dirent_t* entry) {
+    terminal_writestring("  ");
+    terminal_writestring(entry->name);
+    if (entry->attr & FAT_ATTR_DIRECTORY) {
+        terminal_println("/");
+    } else {
+        terminal_writestring("  ");
+        terminal_print_dec(entry->size);
+        terminal_println(" bytes");
+    }
+}
+
+void fat_ls(const char* path) {
+    fat_dirent_t entry;
+    if (fat_resolve_or_report("ls", path, &entry) != E_OK) {
+        return;
+    }
+    if (!(entry.attr & FAT_ATTR_DIRECTORY)) {
+        fat_print_entry(&entry);
+        return;
+    }
+
+    fat_dir_t dir;
+    dir_open(&dir, entry.cluster);
+    int32_t result;
+    while ((result = dir_next(&dir, &entry)) == 1) {
+        fat_print_entry(&entry);
+    }
+    if (result < 0) {
+        terminal_println("ls: read error");
+    }
+}
+
+void fat_cat(const char* path) {
+    fat_file_t file;
+    int32_t result = fat_open(path, &file);
+    if (result != E_OK) {
+        terminal_println(result == E_NODEV ? "cat: no FAT filesystem mounted" :
+                         result == E_NOENT ? "cat: no such file" : "cat: read error");
+        return;
+    }
+    if (file.entry.attr & FAT_ATTR_DIRECTORY) {
+        terminal_println("cat: is a directory");
+        return;
+    }
+
+    char buffer[BLK_SECTOR_SIZE];
+    char last = '\n';
+    while ((result = fat_read(&file, buffer, sizeof(buffer))) > 0) {
+        terminal_write(buffer, (size_t)result);
+        last = buffer[result - 1];
+    }
+    if (result < 0) {
+        terminal_println("cat: read error");
+    } else if (last != '\n') {
+        terminal_putchar('\n');
+    }
+}
+
+void fat_stat(const char* path) {
+    fat_dirent_t entry;
+    if (fat_resolve_or_report("stat", path, &entry) != E_OK) {
+        return;
+    }
+
+    terminal_writestring("  name: ");
+    terminal_println(entry.name);
+    terminal_writestring(entry.attr & FAT_ATTR_DIRECTORY ? "  type: directory" : "  type: file, ");
+    if (!(entry.attr & FAT_ATTR_DIRECTORY)) {
+        terminal_print_dec(entry.size);
+        terminal_writestring(" bytes");
+    }
+    terminal_putchar('\n');
+
+    // Count clusters and the contiguous runs (extents) they form
+    if (entry.cluster) {
+        uint32_t clusters = 0;
+        uint32_t runs = 0;
+        uint32_t cluster = entry.cluster;
+        while (cluster_valid(cluster) && clusters <= fs.cluster_count) {
+            clusters += fs.run[cluster];
+            runs++;
+            cluster = fs.next[cluster + fs.run[cluster] - 1];
+        }
+        terminal_writestring("  first cluster: ");
+        terminal_print_dec(entry.cluster);
+        terminal_writestring(", ");
+        terminal_print_dec(clusters);
+        terminal_writestring(" clusters in ");
+        terminal_print_dec(runs);
+        terminal_println(runs == 1 ? " run" : " runs");
+    }
+    terminal_writestring("  filesystem: FAT");
+    terminal_print_dec(fs.bits);
+    terminal_writestring(" on ");
+    terminal_writestring(fs.dev->name);
+    terminal_writestring(", ");
+    terminal_print_dec(1u << fs.cluster_shift);
+    terminal_writestring(" byte clusters, dentry cache ");
+    terminal_print_dec(dcache_hits);
+    terminal_writestring("/");
+    terminal_print_dec(dcache_lookups);
+    terminal_println(" hits");
+}
+
+// Benchmark
+
+static void bench_report(const char* label, uint32_t bytes, uint64_t cycles, uint32_t requests, uint32_t dispatched) {
+    // KB/s, scaled so the divisor fits 32 bits
+    uint64_t scaled = (uint64_t)(bytes >> 10) * timer_get_tsc_khz() * 1000;
+    while (cycles >> 32) {
+        cycles >>= 1;
+        scaled >>= 1;
+    }
+    uint32_t kbps = cycles ? (uint32_t)div64_32(scaled, (uint32_t)cycles) : 0;
+
+    terminal_writestring(label);
+    terminal_print_dec(kbps / 1024);
+    terminal_putchar('.');
+    terminal_print_dec((kbps % 1024) * 10 / 1024);
+    terminal_writestring(" MB/s, ");
+    terminal_print_dec(requests);
+    terminal_writestring(" requests, ");
+    terminal_print_dec(dispatched);
+    terminal_println(" to the device");
+}
+
+static int32_t bench_file(fat_file_t* file, uint8_t* buffer, int readahead) {
+    fat_seek(file, 0);
+    file->last_end = 0;
+    file->ra_end = 0;
+    file->readahead = (uint8_t)readahead;
+    int32_t result;
+    while ((result = fat_read(file, buffer, FATBENCH_CHUNK)) > 0) {
+    }
+    return result;
+}
+
+// Read one file cold without and with readahead, and the same number of
+// bytes straight from the device in FATBENCH_CHUNK requests
+void fat_benchmark(const char* path) {
+    fat_file_t file;
+    int32_t result = fat_open(*path ? path : FATBENCH_DEFAULT, &file);
+    if (result != E_OK || (file.entry.attr & FAT_ATTR_DIRECTORY) || file.entry.size == 0) {
+        terminal_println(result == E_NODEV ? "fatbench: no FAT filesystem mounted" : "fatbench: need a non-empty file");
+        return;
+    }
+    uint8_t* buffer = (uint8_t*)pmm_alloc(FATBENCH_CHUNK / PAGE_SIZE);
+    if (!buffer) {
+        terminal_println("fatbench: out of memory");
+        return;
+    }
+
+    block_device_t* dev = fs.dev;
+    uint32_t bytes = file.entry.size;
+    terminal_writestring("fatbench: ");
+    terminal_print_dec(bytes >> 10);
+    terminal_writestring(" KB from ");
+    terminal_writestring(dev->name);
+    terminal_println(", cold cache");
+
+    for (int pass = 0; pass < 3; pass++) {
+        bcache_sync(dev);
+        bcache_drop_clean(dev);
+        uint32_t requests = dev->stats.requests;
+        uint32_t dispatched = dev->stats.dispatched;
+        uint64_t start = rdtsc();
+        if (pass == 0) {
+            uint32_t chunk_sectors = FATBENCH_CHUNK >> BLK_SECTOR_SHIFT;
+            if (chunk_sectors > dev->max_sectors) {
+                chunk_sectors = dev->max_sectors;
+            }
+            uint32_t sectors = (bytes + BLK_SECTOR_SIZE - 1) >> BLK_SECTOR_SHIFT;
+            uint64_t sector = fs.data_start;
+            result = E_OK;
+            for (uint32_t done = 0; done < sectors && result == E_OK; done += chunk_sectors) {
+                uint32_t count = sectors - done < chunk_sectors ? sectors - done : chunk_sectors;
+                if (sector + done + count > dev->sector_count) {
+                    break;
+                }
+                result = blkdev_read(dev, sector + done, count, buffer);
+            }
+        } else {
+            result = bench_file(&file, buffer, pass == 2);
+        }
+        uint64_t cycles = rdtsc() - start;
+        if (result < 0) {
+            terminal_println("fatbench: read error");
+            break;
+        }
+        bench_report(pass == 0 ? "  raw device:    " : pass == 1 ? "  no readahead:  " : "  readahead:     ",
+                     bytes, cycles, dev->stats.requests - requests, dev->stats.dispatched - dispatched);
+    }
+    pmm_free(buffer, FATBENCH_CHUNK / PAGE_SIZE);
+}
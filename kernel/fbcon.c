@@ -0,0 +1,777 @@
+#include "fbcon.h"
+#include "font.h"
+#include "pci.h"
+#include "paging.h"
+#include "memory.h"
+#include "sched.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "fpu.h"
+#include "cpu.h"
+#include "klib.h"
+#include "errors.h"
+#include "latency.h"
+
+#define FBCON_NO_CELL      0xFFFFFFFF       // shown[] value no cell matches
+#define FBCON_NO_SLOT      0xFF
+#define FBCON_BLANK_GLYPH  FONT_GLYPHS      // Characters outside the font
+#define FBCON_GLYPH_PIXELS (FONT_WIDTH * FONT_HEIGHT)
+#define FBCON_SLOT_PAGES   (PAGE_ALIGN_UP((FONT_GLYPHS + 1) * FBCON_GLYPH_PIXELS * 4) / PAGE_SIZE)
+#define FBCON_CURSOR_LINES 2                // Underline at the bottom of the cell
+
+// Benchmark parameters
+#define FBBENCH_FRAMES 32
+#define FBBENCH_LINES  2000
+
+// VGA text mode palette as 32-bit RGB
+static const uint32_t palette[16] = {
+    0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+    0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+};
+
+// Standard 80x25 text mode (mode 3) registers. Enabling the BGA reprograms
+// the VGA for graphics and disabling it does not undo that.
+static const uint8_t vga_text_misc = 0x67;
+static const uint8_t vga_text_seq[5] = {0x03, 0x00, 0x03, 0x00, 0x02};
+static const uint8_t vga_text_crtc[25] = {
+    0x5F, 0x4F, 0x50, 0x82, 0x55, 0x81, 0xBF, 0x1F, 0x00, 0x4F, 0x0D, 0x0E, 0x00,
+    0x00, 0x00, 0x50, 0x9C, 0x0E, 0x8F, 0x28, 0x1F, 0x96, 0xB9, 0xA3, 0xFF,
+};
+static const uint8_t vga_text_gc[9] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x0E, 0x00, 0xFF};
+static const uint8_t vga_text_ac[21] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x14, 0x07, 0x38, 0x39, 0x3A,
+    0x3B, 0x3C, 0x3D, 0x3E, 0x3F, 0x0C, 0x00, 0x0F, 0x08, 0x00,
+};
+
+// Every glyph of the font in one color pair, rendered on first use
+typedef struct {
+    uint32_t* pixels;               // FONT_GLYPHS + 1 glyphs of FBCON_GLYPH_PIXELS
+    uint32_t rendered[(FONT_GLYPHS + 1 + 31) / 32];
+    uint32_t last_used;             // Frame number
+    uint8_t attr;
+} glyph_slot_t;
+
+// Console state. The terminal changes cells and scrolled from threads;
+// flushes run from the frame timer (softirq) or ksoftirqd and own
+// everything else while flushing is set.
+static struct {
+    volatile uint8_t active;
+    volatile uint8_t flushing;
+    volatile uint8_t frame_pending; // Frame timer armed
+    volatile uint8_t hold;          // fbbench flushes by itself
+    uint8_t use_sse2;
+    uint32_t width;                 // Pixels
+    uint32_t height;
+    uint32_t lfb_phys;
+    uint32_t* lfb;                  // Visible framebuffer, pitch width * 4
+    uint32_t* back;                 // Back buffer, same layout
+    uint16_t* cells;                // Terminal cells
+    uint32_t* shown;                // Cell drawn at each position of back
+    uint32_t back_pages;
+    uint32_t cell_pages;
+    uint32_t shown_pages;
+    terminal_backend_t term;
+    const terminal_backend_t* text;  // Text page of the console taken over
+    volatile uint32_t scrolled;     // Lines scrolled since the last flush
+    uint16_t cursor_x;              // Where the cursor was drawn
+    uint16_t cursor_y;
+    uint8_t cursor_drawn;
+    uint32_t frame;
+    glyph_slot_t slots[FBCON_GLYPH_SLOTS];
+    uint8_t slot_of[256];           // Attribute to slot, FBCON_NO_SLOT if none
+} fb;
+
+static fbcon_stats_t stats;
+
+static void bga_write(uint16_t reg, uint16_t value) {
+    outw(BGA_INDEX_PORT, reg);
+    outw(BGA_DATA_PORT, value);
+}
+
+static uint16_t bga_read(uint16_t reg) {
+    outw(BGA_INDEX_PORT, reg);
+    return inw(BGA_DATA_PORT);
+}
+
+// Linear framebuffer address from the std-VGA's first BAR
+static uint32_t bga_lfb_address(void) {
+    for (size_t i = 0; i < pci_device_count(); i++) {
+        pci_device_t* dev = pci_get_device(i);
+        if (dev->vendor_id == BGA_PCI_VENDOR && dev->device_id == BGA_PCI_DEVICE) {
+            return pci_bar_is_io(dev, 0) ? 0 : pci_bar_address(dev, 0);
+        }
+    }
+    return 0;
+}
+
+static void vga_restore_text_mode(void) {
+    outb(0x3C2, vga_text_misc);
+    for (uint8_t i = 0; i < sizeof(vga_text_seq); i++) {
+        outb(0x3C4, i);
+        outb(0x3C5, vga_text_seq[i]);
+    }
+
+    // Unlock CRTC registers 0-7
+    outb(0x3D4, 0x03);
+    outb(0x3D5, inb(0x3D5) | 0x80);
+    outb(0x3D4, 0x11);
+    outb(0x3D5, inb(0x3D5) & ~0x80);
+    for (uint8_t i = 0; i < sizeof(vga_text_crtc); i++) {
+        outb(0x3D4, i);
+        outb(0x3D5, vga_text_crtc[i]);
+    }
+
+    for (uint8_t i = 0; i < sizeof(vga_text_gc); i++) {
+        outb(0x3CE, i);
+        outb(0x3CF, vga_text_gc[i]);
+    }
+
+    // Reading input status 1 resets the attribute controller's flip-flop
+    for (uint8_t i = 0; i < sizeof(vga_text_ac); i++) {
+        inb(0x3DA);
+        outb(0x3C0, i);
+        outb(0x3C0, vga_text_ac[i]);
+    }
+    inb(0x3DA);
+    outb(0x3C0, 0x20);              // Palette loaded, display on
+}
+
+// Slot holding glyphs for an attribute byte, taking the least recently
+// used one if it has none
+static glyph_slot_t* glyph_slot(uint8_t attr) {
+    uint8_t index = fb.slot_of[attr];
+    if (index == FBCON_NO_SLOT) {
+        index = 0;
+        for (uint8_t i = 1; i < FBCON_GLYPH_SLOTS; i++) {
+            if (fb.slots[i].last_used < fb.slots[index].last_used) {
+                index = i;
+            }
+        }
+        glyph_slot_t* slot = &fb.slots[index];
+        if (fb.slot_of[slot->attr] == index) {
+            fb.slot_of[slot->attr] = FBCON_NO_SLOT;
+            stats.evictions++;
+        }
+        memset(slot->rendered, 0, sizeof(slot->rendered));
+        slot->attr = attr;
+        fb.slot_of[attr] = index;
+    }
+    fb.slots[index].last_used = fb.frame;
+    return &fb.slots[index];
+}
+
+static const uint32_t* glyph_pixels(glyph_slot_t* slot, uint8_t c) {
+    uint32_t glyph = FBCON_BLANK_GLYPH;
+    if (c >= FONT_FIRST && c < FONT_FIRST + FONT_GLYPHS) {
+        glyph = c - FONT_FIRST;
+    }
+
+    uint32_t* pixels = slot->pixels + glyph * FBCON_GLYPH_PIXELS;
+    if (!(slot->rendered[glyph / 32] & (1u << (glyph % 32)))) {
+        uint32_t fg = palette[slot->attr & 0x0F];
+        uint32_t bg = palette[slot->attr >> 4];
+        uint32_t* p = pixels;
+        for (uint32_t y = 0; y < FONT_HEIGHT; y++) {
+            uint8_t bits = glyph < FONT_GLYPHS ? font_8x16[glyph][y] : 0;
+            for (uint32_t x = 0; x < FONT_WIDTH; x++) {
+                *p++ = (bits & (0x80 >> x)) ? fg : bg;
+            }
+        }
+        slot->rendered[glyph / 32] |= 1u << (glyph % 32);
+        stats.glyphs++;
+    }
+    return pixels;
+}
+
+// Copy a cached glyph into the back buffer. Glyphs and cells are 32-byte
+// rows at 16-byte aligned addresses.
+static void draw_cell(uint32_t col, uint32_t row, uint16_t cell, int sse2) {
+    const uint32_t* src = glyph_pixels(glyph_slot(cell >> 8), cell & 0xFF);
+    uint32_t* dst = fb.back + row * FONT_HEIGHT * fb.width + col * FONT_WIDTH;
+
+    if (sse2) {
+        uint32_t stride = fb.width * 4;
+        uint32_t lines = FONT_HEIGHT;
+        __asm__ volatile("1:\n\t"
+                         "movdqa (%1), %%xmm0\n\t"
+                         "movdqa 16(%1), %%xmm1\n\t"
+                         "movdqa %%xmm0, (%0)\n\t"
+                         "movdqa %%xmm1, 16(%0)\n\t"
+                         "addl $32, %1\n\t"
+                         "addl %3, %0\n\t"
+                         "decl %2\n\t"
+                         "jnz 1b"
+                         : "+r"(dst), "+r"(src), "+r"(lines)
+                         : "r"(stride)
+                         : "memory", "cc");
+    } else {
+        for (uint32_t y = 0; y < FONT_HEIGHT; y++) {
+            for (uint32_t x = 0; x < FONT_WIDTH; x++) {
+                dst[x] = src[x];
+            }
+            src += FONT_WIDTH;
+            dst += fb.width;
+        }
+    }
+}
+
+static void draw_cursor(uint32_t col, uint32_t row) {
+    uint16_t cell = fb.cells[row * fb.term.width + col];
+    uint32_t fg = palette[(cell >> 8) & 0x0F];
+    uint32_t* dst = fb.back + ((row + 1) * FONT_HEIGHT - FBCON_CURSOR_LINES) * fb.width + col * FONT_WIDTH;
+    for (uint32_t y = 0; y < FBCON_CURSOR_LINES; y++) {
+        for (uint32_t x = 0; x < FONT_WIDTH; x++) {
+            dst[x] = fg;
+        }
+        dst += fb.width;
+    }
+}
+
+// Move back buffer lines up: a forward copy, 64 bytes per iteration.
+// Sizes are whole cell rows, so a multiple of 64 bytes.
+static void move_lines(uint32_t* dst, const uint32_t* src, uint32_t bytes, int sse2) {
+    if (!sse2) {
+        memmove(dst, src, bytes);
+        return;
+    }
+    uint32_t blocks = bytes / 64;
+    __asm__ volatile("1:\n\t"
+                     "movdqa (%1), %%xmm0\n\t"
+                     "movdqa 16(%1), %%xmm1\n\t"
+                     "movdqa 32(%1), %%xmm2\n\t"
+                     "movdqa 48(%1), %%xmm3\n\t"
+                     "movdqa %%xmm0, (%0)\n\t"
+                     "movdqa %%xmm1, 16(%0)\n\t"
+                     "movdqa %%xmm2, 32(%0)\n\t"
+                     "movdqa %%xmm3, 48(%0)\n\t"
+                     "addl $64, %1\n\t"
+                     "addl $64, %0\n\t"
+                     "decl %2\n\t"
+                     "jnz 1b"
+                     : "+r"(dst), "+r"(src), "+r"(blocks)
+                     :
+                     : "memory", "cc");
+}
+
+// Copy a rectangle of cells from the back buffer to the framebuffer.
+// Non-temporal stores go straight to the (write-combining) framebuffer
+// without pulling its lines into the cache.
+static uint32_t blit(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1, int sse2) {
+    uint32_t offset = y0 * FONT_HEIGHT * fb.width + x0 * FONT_WIDTH;
+    const uint32_t* src = fb.back + offset;
+    uint32_t* dst = fb.lfb + offset;
+    uint32_t lines = (y1 - y0) * FONT_HEIGHT;
+    uint32_t pixels = (x1 - x0) * FONT_WIDTH;
+
+    for (uint32_t y = 0; y < lines; y++) {
+        if (sse2) {
+            const uint32_t* s = src;
+            uint32_t* d = dst;
+            uint32_t blocks = x1 - x0;      // One 32-byte glyph row per cell
+            __asm__ volatile("1:\n\t"
+                             "movdqa (%1), %%xmm0\n\t"
+                             "movdqa 16(%1), %%xmm1\n\t"
+                             "movntdq %%xmm0, (%0)\n\t"
+                             "movntdq %%xmm1, 16(%0)\n\t"
+                             "addl $32, %1\n\t"
+                             "addl $32, %0\n\t"
+                             "decl %2\n\t"
+                             "jnz 1b"
+                             : "+r"(d), "+r"(s), "+r"(blocks)
+                             :
+                             : "memory", "cc");
+        } else {
+            for (uint32_t x = 0; x < pixels; x++) {
+                dst[x] = src[x];
+            }
+        }
+        src += fb.width;
+        dst += fb.width;
+    }
+    if (sse2) {
+        __asm__ volatile("sfence" : : : "memory");
+    }
+    return lines * pixels * 4;
+}
+
+// Bring the framebuffer up to date with the cells: apply batched scrolls
+// to the back buffer, draw the cells that differ from what it shows, then
+// copy the bounding rectangle of what changed
+void fbcon_flush(void) {
+    uint32_t flags = irq_save();
+    if (!fb.active || fb.flushing) {
+        irq_restore(flags);
+        return;
+    }
+    fb.flushing = 1;
+    uint32_t scrolled = fb.scrolled;
+    fb.scrolled = 0;
+    uint32_t echoes = latency_input_pending();  // Typed characters this frame shows
+    irq_restore(flags);
+
+    uint64_t start = rdtsc();
+    int sse2 = fb.use_sse2 && kernel_fpu_try_begin();
+    uint32_t cols = fb.term.width;
+    uint32_t rows = fb.term.height;
+    uint16_t cursor_x, cursor_y;
+    terminal_get_cursor(&cursor_x, &cursor_y);
+    if (!terminal_cursor_visible()) {
+        cursor_x = cols;            // Off screen: nothing to draw
+    }
+    fb.frame++;
+
+    // Take the cursor off its old cell if it moved or is scrolled away
+    if (fb.cursor_drawn && (scrolled || cursor_x != fb.cursor_x || cursor_y != fb.cursor_y)) {
+        fb.shown[fb.cursor_y * cols + fb.cursor_x] = FBCON_NO_CELL;
+        fb.cursor_drawn = 0;
+    }
+
+    // Dirty rectangle in cells, [x0, x1) x [y0, y1)
+    uint32_t x0 = cols, x1 = 0, y0 = rows, y1 = 0;
+    if (scrolled) {
+        if (scrolled > rows) {
+            scrolled = rows;
+        }
+        uint32_t keep = rows - scrolled;
+        if (keep) {
+            move_lines(fb.back, fb.back + scrolled * FONT_HEIGHT * fb.width,
+                       keep * FONT_HEIGHT * fb.width * 4, sse2);
+            memmove(fb.shown, fb.shown + scrolled * cols, keep * cols * sizeof(uint32_t));
+        }
+        for (uint32_t i = keep * cols; i < rows * cols; i++) {
+            fb.shown[i] = FBCON_NO_CELL;
+        }
+        x0 = 0;
+        x1 = cols;
+        y0 = 0;
+        y1 = rows;
+        stats.scrolls += scrolled;
+    }
+
+    uint32_t cursor = cursor_x < cols && cursor_y < rows ? cursor_y * cols + cursor_x : FBCON_NO_CELL;
+    uint32_t drawn = 0;
+    for (uint32_t row = 0; row < rows; row++) {
+        uint32_t i = row * cols;
+        for (uint32_t col = 0; col < cols; col++, i++) {
+            uint16_t cell = fb.cells[i];
+            if (cell == fb.shown[i]) {
+                continue;
+            }
+            draw_cell(col, row, cell, sse2);
+            fb.shown[i] = cell;
+            drawn++;
+            if (i == cursor) {
+                fb.cursor_drawn = 0;
+            }
+            if (col < x0) x0 = col;
+            if (col >= x1) x1 = col + 1;
+            if (row < y0) y0 = row;
+            if (row >= y1) y1 = row + 1;
+        }
+    }
+
+    if (!fb.cursor_drawn && cursor_x < cols && cursor_y < rows) {
+        draw_cursor(cursor_x, cursor_y);
+        fb.cursor_x = cursor_x;
+        fb.cursor_y = cursor_y;
+        fb.cursor_drawn = 1;
+        if (cursor_x < x0) x0 = cursor_x;
+        if (cursor_x >= x1) x1 = cursor_x + 1;
+        if (cursor_y < y0) y0 = cursor_y;
+        if (cursor_y >= y1) y1 = cursor_y + 1;
+    }
+
+    if (x0 < x1) {
+        stats.bytes += blit(x0, y0, x1, y1, sse2);
+        stats.cells += drawn;
+        stats.frames++;
+        if (sse2) {
+            stats.sse2_frames++;
+        }
+        uint64_t cycles = rdtsc() - start;
+        stats.cycles += cycles;
+        if (cycles > stats.max_cycles) {
+            stats.max_cycles = cycles;
+        }
+    }
+
+    if (sse2) {
+        kernel_fpu_end();
+    }
+    latency_input_shown(echoes);
+    fb.flushing = 0;
+}
+
+static void fbcon_frame(void* arg) {
+    (void)arg;
+    fb.frame_pending = 0;
+    if (!fb.hold) {
+        fbcon_flush();
+    }
+}
+
+// Terminal backend callbacks: output is drawn by the next frame, at most
+// FBCON_FRAME_MS from now, or right away if no timer is free
+static void fbcon_changed(void) {
+    if (fb.frame_pending || fb.hold) {
+        return;
+    }
+    uint32_t flags = irq_save();
+    int now = 0;
+    if (fb.active && !fb.frame_pending) {
+        fb.frame_pending = 1;
+        if (!timer_add(FBCON_FRAME_MS, fbcon_frame, 0)) {
+            fb.frame_pending = 0;
+            now = 1;
+        }
+    }
+    irq_restore(flags);
+    if (now) {
+        fbcon_flush();
+    }
+}
+
+static void fbcon_scrolled(void) {
+    uint32_t flags = irq_save();
+    fb.scrolled++;
+    irq_restore(flags);
+}
+
+static void fbcon_free(void) {
+    if (fb.back) pmm_free(fb.back, fb.back_pages);
+    if (fb.cells) pmm_free(fb.cells, fb.cell_pages);
+    if (fb.shown) pmm_free(fb.shown, fb.shown_pages);
+    for (int i = 0; i < FBCON_GLYPH_SLOTS; i++) {
+        if (fb.slots[i].pixels) {
+            pmm_free(fb.slots[i].pixels, FBCON_SLOT_PAGES);
+        }
+    }
+    memset(&fb, 0, sizeof(fb));
+}
+
+static int fbcon_alloc(uint32_t cols, uint32_t rows) {
+    fb.back_pages = PAGE_ALIGN_UP(fb.width * fb.height * 4) / PAGE_SIZE;
+    fb.cell_pages = PAGE_ALIGN_UP(cols * rows * sizeof(uint16_t)) / PAGE_SIZE;
+    fb.shown_pages = PAGE_ALIGN_UP(cols * rows * sizeof(uint32_t)) / PAGE_SIZE;
+    fb.back = (uint32_t*)pmm_alloc(fb.back_pages);
+    fb.cells = (uint16_t*)pmm_alloc(fb.cell_pages);
+    fb.shown = (uint32_t*)pmm_alloc(fb.shown_pages);
+    if (!fb.back || !fb.cells || !fb.shown) {
+        return E_NOMEM;
+    }
+    for (int i = 0; i < FBCON_GLYPH_SLOTS; i++) {
+        fb.slots[i].pixels = (uint32_t*)pmm_alloc(FBCON_SLOT_PAGES);
+        if (!fb.slots[i].pixels) {
+            return E_NOMEM;
+        }
+    }
+    return E_OK;
+}
+
+// Switch to a width x height, 32 bpp mode and move the terminal onto it.
+// What is on the text screen is carried over.
+int fbcon_enable(uint32_t width, uint32_t height) {
+    if (width < FBCON_MIN_WIDTH || width > FBCON_MAX_WIDTH || width % FONT_WIDTH ||
+        height < FBCON_MIN_HEIGHT || height > FBCON_MAX_HEIGHT) {
+        return E_INVAL;
+    }
+    fbcon_disable();
+
+    uint16_t id = bga_read(BGA_REG_ID);
+    uint32_t lfb_phys = bga_lfb_address();
+    if (id < BGA_ID_32BPP || id > BGA_ID_MAX || !lfb_phys) {
+        return E_NODEV;
+    }
+
+    // Lines skipped at the start of video memory to keep the text planes
+    uint32_t pitch = width * 4;
+    uint32_t skip = (FBCON_TEXT_RESERVE + pitch - 1) / pitch;
+    if ((skip + height) * pitch > FBCON_VRAM_SIZE) {
+        return E_INVAL;
+    }
+
+    fb.width = width;
+    fb.height = height;
+    uint32_t cols = width / FONT_WIDTH;
+    uint32_t rows = height / FONT_HEIGHT;
+    uint32_t* lfb = (uint32_t*)paging_map_framebuffer(lfb_phys, (skip + height) * pitch);
+    if (!lfb || fbcon_alloc(cols, rows) != E_OK) {
+        fbcon_free();
+        return E_NOMEM;
+    }
+
+    // QEMU resets the virtual width and offsets on enable, so set them after
+    bga_write(BGA_REG_ENABLE, 0);
+    bga_write(BGA_REG_XRES, width);
+    bga_write(BGA_REG_YRES, height);
+    bga_write(BGA_REG_BPP, 32);
+    bga_write(BGA_REG_ENABLE, BGA_ENABLED | BGA_LFB_ENABLED | BGA_NO_CLEAR_MEM);
+    bga_write(BGA_REG_VIRT_WIDTH, width);
+    bga_write(BGA_REG_X_OFFSET, 0);
+    bga_write(BGA_REG_Y_OFFSET, skip);
+    if (bga_read(BGA_REG_XRES) != width || bga_read(BGA_REG_YRES) != height ||
+        bga_read(BGA_REG_BPP) != 32 || bga_read(BGA_REG_Y_OFFSET) != skip) {
+        bga_write(BGA_REG_ENABLE, 0);
+        vga_restore_text_mode();
+        fbcon_free();
+        return E_NODEV;
+    }
+
+    fb.lfb_phys = lfb_phys;
+    fb.lfb = lfb + skip * width;
+    fb.use_sse2 = fpu_sse2_available();
+    memset(fb.back, 0, width * height * 4);
+    memset(fb.lfb, 0, height * pitch);
+    memset(fb.slot_of, FBCON_NO_SLOT, sizeof(fb.slot_of));
+    for (uint32_t i = 0; i < cols * rows; i++) {
+        fb.cells[i] = VGA_ENTRY(' ', terminal_getcolor());
+        fb.shown[i] = FBCON_NO_CELL;
+    }
+
+    // Carry the text screen over
+    const terminal_backend_t* text = terminal_get_backend();
+    for (uint32_t y = 0; y < text->height && y < rows; y++) {
+        for (uint32_t x = 0; x < text->width && x < cols; x++) {
+            fb.cells[y * cols + x] = text->cells[y * text->width + x];
+        }
+    }
+    fb.text = text;
+
+    fb.term.cells = fb.cells;
+    fb.term.width = cols;
+    fb.term.height = rows;
+    fb.term.changed = fbcon_changed;
+    fb.term.scrolled = fbcon_scrolled;
+    fb.term.flush = fbcon_flush;
+    fb.active = 1;
+    terminal_set_backend(&fb.term);
+    fbcon_flush();
+    return E_OK;
+}
+
+// Back to VGA text mode with the lines around the cursor
+void fbcon_disable(void) {
+    if (!fb.active) {
+        return;
+    }
+
+    // A flush in ksoftirqd may have been preempted
+    uint32_t flags = irq_save();
+    while (fb.flushing) {
+        irq_restore(flags);
+        sched_yield();
+        flags = irq_save();
+    }
+    fb.active = 0;
+    irq_restore(flags);
+
+    uint16_t cursor_x, cursor_y;
+    terminal_get_cursor(&cursor_x, &cursor_y);
+    uint32_t first = cursor_y >= VGA_HEIGHT ? cursor_y - (VGA_HEIGHT - 1) : 0;
+    uint16_t* text = fb.text->cells;
+    for (uint32_t y = 0; y < VGA_HEIGHT; y++) {
+        for (uint32_t x = 0; x < VGA_WIDTH; x++) {
+            uint32_t row = first + y;
+            text[y * VGA_WIDTH + x] = row < fb.term.height && x < fb.term.width ?
+                                      fb.cells[row * fb.term.width + x] :
+                                      VGA_ENTRY(' ', terminal_getcolor());
+        }
+    }
+
+    bga_write(BGA_REG_ENABLE, 0);
+    vga_restore_text_mode();
+    terminal_set_backend(0);
+    terminal_set_cursor(cursor_x < VGA_WIDTH ? cursor_x : VGA_WIDTH - 1, cursor_y - first);
+
+    // A frame timer still armed finds the console inactive
+    fbcon_free();
+}
+
+int fbcon_active(void) {
+    return fb.active;
+}
+
+void fbcon_get_stats(fbcon_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+// Parse "WIDTHxHEIGHT"
+static int parse_mode(const char* s, uint32_t* width, uint32_t* height) {
+    uint32_t* value = width;
+    *width = 0;
+    *height = 0;
+    for (; *s; s++) {
+        if (*s >= '0' && *s <= '9') {
+            *value = *value * 10 + (*s - '0');
+        } else if (*s == 'x' && value == width) {
+            value = height;
+        } else {
+            return 0;
+        }
+    }
+    return *width && *height;
+}
+
+void fbcon_command(const char* args) {
+    uint32_t width = FBCON_DEFAULT_WIDTH;
+    uint32_t height = FBCON_DEFAULT_HEIGHT;
+    if (strcmp(args, "off") == 0) {
+        fbcon_disable();
+        return;
+    }
+    if (*args && !parse_mode(args, &width, &height)) {
+        terminal_println("Usage: fbcon [WIDTHxHEIGHT|off]");
+        return;
+    }
+
+    int err = fbcon_enable(width, height);
+    if (err == E_NODEV) {
+        terminal_println("fbcon: no Bochs/QEMU std-VGA adapter");
+    } else if (err == E_INVAL) {
+        terminal_println("fbcon: unsupported mode");
+    } else if (err != E_OK) {
+        terminal_println("fbcon: out of memory");
+    } else {
+        terminal_writestring("fbcon: ");
+        terminal_print_dec(fb.width);
+        terminal_putchar('x');
+        terminal_print_dec(fb.height);
+        terminal_writestring(", ");
+        terminal_print_dec(fb.term.width);
+        terminal_putchar('x');
+        terminal_print_dec(fb.term.height);
+        terminal_println(" cells");
+    }
+}
+
+void fbcon_print_stats(void) {
+    if (!fb.active) {
+        terminal_println("fbcon: off (VGA text mode)");
+        return;
+    }
+    fbcon_stats_t s;
+    fbcon_get_stats(&s);
+    terminal_writestring("Mode: ");
+    terminal_print_dec(fb.width);
+    terminal_putchar('x');
+    terminal_print_dec(fb.height);
+    terminal_writestring("x32, ");
+    terminal_print_dec(fb.term.width);
+    terminal_putchar('x');
+    terminal_print_dec(fb.term.height);
+    terminal_writestring(" cells, framebuffer at ");
+    terminal_print_hex(fb.lfb_phys);
+    terminal_putchar('\n');
+    terminal_writestring("Frames: ");
+    terminal_print_dec(s.frames);
+    terminal_writestring(" (");
+    terminal_print_dec(s.sse2_frames);
+    terminal_writestring(" SSE2), avg ");
+    terminal_print_dec(timer_cycles_to_us(s.cycles, s.frames));
+    terminal_writestring(" us, max ");
+    terminal_print_dec(timer_cycles_to_us(s.max_cycles, 1));
+    terminal_println(" us");
+    terminal_writestring("Cells drawn: ");
+    terminal_print_dec(s.cells);
+    terminal_writestring(", lines scrolled: ");
+    terminal_print_dec(s.scrolls);
+    terminal_writestring(", KB copied: ");
+    terminal_print_dec((uint32_t)(s.bytes >> 10));
+    terminal_putchar('\n');
+    terminal_writestring("Glyphs rendered: ");
+    terminal_print_dec(s.glyphs);
+    terminal_writestring(", color pairs evicted: ");
+    terminal_print_dec(s.evictions);
+    terminal_putchar('\n');
+}
+
+// Average cost of one synchronous flush after `setup` changed the cells
+static uint32_t bench_flush(void (*setup)(uint32_t i)) {
+    uint64_t total = 0;
+    fbcon_flush();
+    for (uint32_t i = 0; i < FBBENCH_FRAMES; i++) {
+        setup(i);
+        uint64_t start = rdtsc();
+        fbcon_flush();
+        total += rdtsc() - start;
+    }
+    return timer_cycles_to_us(total, FBBENCH_FRAMES);
+}
+
+static void bench_redraw(uint32_t i) {
+    (void)i;
+    for (uint32_t c = 0; c < fb.term.width * fb.term.height; c++) {
+        fb.shown[c] = FBCON_NO_CELL;
+    }
+}
+
+static void bench_scroll(uint32_t i) {
+    terminal_writestring("fbbench scroll line ");
+    terminal_print_dec(i);
+    terminal_putchar('\n');
+}
+
+static void bench_cell(uint32_t i) {
+    terminal_putchar_at('0' + i % 10, fb.term.width - 1, 0);
+}
+
+static void print_result(const char* label, uint32_t value, const char* unit) {
+    terminal_writestring(label);
+    terminal_print_dec(value);
+    terminal_println(unit);
+}
+
+void fbcon_benchmark(void) {
+    if (!fb.active) {
+        terminal_println("fbbench: run fbcon first");
+        return;
+    }
+
+    // Keep the frame timer from drawing what the measured flushes should
+    uint8_t sse2 = fb.use_sse2;
+    fb.hold = 1;
+    fb.use_sse2 = 0;
+    uint32_t redraw_int = bench_flush(bench_redraw);
+    fb.use_sse2 = sse2;
+    uint32_t redraw = bench_flush(bench_redraw);
+    uint32_t scroll = bench_flush(bench_scroll);
+    uint32_t cell = bench_flush(bench_cell);
+    fb.hold = 0;
+
+    // Text throughput with frame pacing: lines cost a cell update each and
+    // the screen is drawn once per frame
+    fbcon_stats_t before, after;
+    fbcon_get_stats(&before);
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < FBBENCH_LINES; i++) {
+        terminal_writestring("fbbench paced output line ");
+        terminal_print_dec(i);
+        terminal_putchar('\n');
+    }
+    fbcon_flush();
+    uint32_t paced = timer_cycles_to_us(rdtsc() - start, 1);
+    fbcon_get_stats(&after);
+
+    terminal_writestring("fbbench: ");
+    terminal_print_dec(fb.width);
+    terminal_putchar('x');
+    terminal_print_dec(fb.height);
+    terminal_writestring(", ");
+    terminal_print_dec(fb.term.width);
+    terminal_putchar('x');
+    terminal_print_dec(fb.term.height);
+    terminal_println(" cells, time per flush:");
+    print_result("  Full redraw, integer: ", redraw_int, " us");
+    print_result("  Full redraw, SSE2:    ", redraw, sse2 ? " us" : " us (no SSE2)");
+    print_result("  Scroll one line:      ", scroll, " us");
+    print_result("  One cell:             ", cell, " us");
+    terminal_writestring("  ");
+    terminal_print_dec(FBBENCH_LINES);
+    terminal_writestring(" lines paced: ");
+    terminal_print_dec(paced / 1000);
+    terminal_writestring(" ms, ");
+    terminal_print_dec(after.frames - before.frames);
+    terminal_println(" frames drawn");
+}
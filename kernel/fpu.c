@@ -0,0 +1,170 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "sched.h"
+#include "init.h"
+
+// MXCSR after reset: all SIMD exceptions masked, round to nearest
+#define MXCSR_DEFAULT 0x1F80
+
+// Global variables
+static int fxsr_supported = 0;
+static int sse_supported = 0;
+static int sse2_supported = 0;
+static thread_t* fpu_owner = 0;         // Thread whose state is in the registers
+static int ts_set = 0;                  // Mirror of CR0.TS
+static uint32_t kernel_depth = 0;       // Nesting of kernel_fpu_begin()
+static fpu_stats_t stats;
+static uint8_t fpu_initial_state[FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+// Without FXSR only the x87 state (fnsave format) is switched
+static inline void fpu_save(uint8_t* area) {
+    if (fxsr_supported) {
+        __asm__ volatile("fxsave (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ volatile("fnsave (%0)\n\tfwait" : : "r"(area) : "memory");
+    }
+}
+
+static inline void fpu_restore(const uint8_t* area) {
+    if (fxsr_supported) {
+        __asm__ volatile("fxrstor (%0)" : : "r"(area) : "memory");
+    } else {
+        __asm__ volatile("frstor (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline void fpu_set_ts(void) {
+    if (!ts_set) {
+        write_cr0(read_cr0() | CR0_TS);
+        ts_set = 1;
+    }
+}
+
+static inline void fpu_clear_ts(void) {
+    if (ts_set) {
+        __asm__ volatile("clts");
+        ts_set = 0;
+    }
+}
+
+// Enable the FPU and SSE, capture a clean state for new threads and set
+// CR0.TS so the first use traps. Must run after sched_init().
+void __init fpu_init(void) {
+    uint32_t edx;
+    cpuid(1, 0, 0, 0, &edx);
+    fxsr_supported = (edx & CPUID_EDX_FXSR) != 0;
+    sse_supported = fxsr_supported && (edx & CPUID_EDX_SSE);
+    sse2_supported = sse_supported && (edx & CPUID_EDX_SSE2);
+
+    uint32_t cr0 = read_cr0();
+    cr0 &= ~(CR0_EM | CR0_TS);
+    cr0 |= CR0_MP | CR0_NE;
+    write_cr0(cr0);
+    ts_set = 0;
+
+    if (fxsr_supported) {
+        uint32_t cr4 = read_cr4() | CR4_OSFXSR;
+        if (sse_supported) {
+            cr4 |= CR4_OSXMMEXCPT;
+        }
+        write_cr4(cr4);
+    }
+
+    __asm__ volatile("fninit");
+    if (sse_supported) {
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        __asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }
+    fpu_save(fpu_initial_state);
+
+    fpu_owner = 0;
+    fpu_set_ts();
+}
+
+int fpu_sse_available(void) {
+    return sse_supported;
+}
+
+int fpu_sse2_available(void) {
+    return sse2_supported;
+}
+
+// #NM: the running thread touched the FPU while CR0.TS was set. Save the
+// previous owner's registers and load this thread's (or a clean state on
+// its first use).
+void fpu_handle_nm(void) {
+    thread_t* current = sched_current();
+    stats.nm_traps++;
+    fpu_clear_ts();
+
+    if (fpu_owner == current) {
+        return;
+    }
+    if (fpu_owner) {
+        fpu_save(fpu_owner->fpu_state);
+        stats.saves++;
+    }
+    fpu_restore(current->fpu_used ? current->fpu_state : fpu_initial_state);
+    current->fpu_used = 1;
+    stats.restores++;
+    fpu_owner = current;
+}
+
+// Context switch hook: only the owner may run with CR0.TS clear
+void fpu_switch(thread_t* next) {
+    if (next == fpu_owner && kernel_depth == 0) {
+        fpu_clear_ts();
+    } else {
+        fpu_set_ts();
+    }
+}
+
+// The registers of an exiting thread are simply dropped
+void fpu_thread_exit(thread_t* thread) {
+    if (fpu_owner == thread) {
+        fpu_owner = 0;
+    }
+}
+
+// Let the kernel use FPU/SSE registers: the current owner's state is
+// saved first and reloaded lazily after kernel_fpu_end(). The section may
+// nest but must not block or yield.
+void kernel_fpu_begin(void) {
+    uint32_t flags = irq_save();
+    if (kernel_depth++ == 0) {
+        fpu_clear_ts();
+        if (fpu_owner) {
+            fpu_save(fpu_owner->fpu_state);
+            stats.saves++;
+            fpu_owner = 0;
+        }
+        stats.kernel_sections++;
+    }
+    irq_restore(flags);
+}
+
+// Like kernel_fpu_begin(), but refuses (returns 0) when a section is
+// already open, e.g. when an interrupt handler lands inside one: the
+// caller then falls back to integer code instead of clobbering registers
+// the interrupted section is using
+int kernel_fpu_try_begin(void) {
+    uint32_t flags = irq_save();
+    int ok = kernel_depth == 0;
+    if (ok) {
+        kernel_fpu_begin();
+    }
+    irq_restore(flags);
+    return ok;
+}
+
+void kernel_fpu_end(void) {
+    uint32_t flags = irq_save();
+    if (kernel_depth && --kernel_depth == 0) {
+        fpu_set_ts();
+    }
+    irq_restore(flags);
+}
+
+const fpu_stats_t* fpu_get_stats(void) {
+    return &stats;
+}
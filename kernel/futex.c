@@ -0,0 +1,360 @@
+#include "futex.h"
+#include "syscall.h"
+#include "sched.h"
+#include "paging.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "cpu.h"
+#include "user_sync.h"
+#include "init.h"
+
+// A waiter lives on the kernel stack of the thread sleeping in
+// futex_wait(); it is linked into its bucket until it is woken
+typedef struct futex_waiter {
+    struct futex_waiter* next;
+    thread_t* thread;
+    uint32_t key;                   // Physical address of the futex word
+    uint8_t woken;
+    uint8_t timed_out;
+} futex_waiter_t;
+
+// Global variables. The buckets are only touched with interrupts disabled.
+static futex_waiter_t* buckets[FUTEX_HASH_BUCKETS];
+static futex_stats_t stats;
+
+static futex_waiter_t** futex_bucket(uint32_t key) {
+    return &buckets[((key >> 2) * 0x9E3779B1u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+// Physical address of the word at addr in the current address space, or 0
+// if addr is not an aligned word in a present user page
+static uint32_t futex_key(uint32_t addr) {
+    if (!addr || (addr & 3)) {
+        return 0;
+    }
+    uint32_t* pte = paging_get_pte(address_space_current(), addr, 0);
+    if (!pte || (*pte & (PTE_PRESENT | PTE_USER)) != (PTE_PRESENT | PTE_USER)) {
+        return 0;
+    }
+    return (*pte & PTE_FRAME_MASK) | (addr & (PAGE_SIZE - 1));
+}
+
+static void futex_unlink(futex_waiter_t* waiter) {
+    futex_waiter_t** link = futex_bucket(waiter->key);
+    while (*link && *link != waiter) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = waiter->next;
+    }
+}
+
+// Timer callback (softirq context)
+static void futex_timeout(void* arg) {
+    futex_waiter_t* waiter = arg;
+    uint32_t flags = irq_save();
+    if (!waiter->woken) {
+        futex_unlink(waiter);
+        waiter->woken = 1;
+        waiter->timed_out = 1;
+        stats.timeouts++;
+        sched_wake(waiter->thread);
+    }
+    irq_restore(flags);
+}
+
+int32_t futex_wait(uint32_t addr, uint32_t expected, uint32_t timeout_ms) {
+    uint32_t key = futex_key(addr);
+    if (!key) {
+        return E_FAULT;
+    }
+
+    uint32_t flags = irq_save();
+    if (*(volatile uint32_t*)addr != expected) {
+        stats.mismatches++;
+        irq_restore(flags);
+        return E_AGAIN;
+    }
+    if (timeout_ms == 0) {
+        irq_restore(flags);
+        return E_TIMEDOUT;
+    }
+
+    // Queue at the tail, so waiters are woken in arrival order
+    futex_waiter_t waiter = { 0, sched_current(), key, 0, 0 };
+    futex_waiter_t** link = futex_bucket(key);
+    while (*link) {
+        link = &(*link)->next;
+    }
+    *link = &waiter;
+
+    uint32_t timer = 0;
+    if (timeout_ms != FUTEX_WAIT_FOREVER) {
+        timer = timer_add(timeout_ms, futex_timeout, &waiter);
+        if (!timer) {
+            futex_unlink(&waiter);
+            irq_restore(flags);
+            return E_NOMEM;
+        }
+    }
+
+    stats.waits++;
+    while (!waiter.woken) {
+        sched_block(0, 0);
+    }
+    if (timer && !waiter.timed_out) {
+        timer_cancel(timer);
+    }
+    irq_restore(flags);
+    return waiter.timed_out ? E_TIMEDOUT : E_OK;
+}
+
+int32_t futex_wake(uint32_t addr, uint32_t count) {
+    uint32_t key = futex_key(addr);
+    if (!key) {
+        return E_FAULT;
+    }
+
+    uint32_t flags = irq_save();
+    uint32_t woken = 0;
+    futex_waiter_t** link = futex_bucket(key);
+    while (*link && woken < count) {
+        futex_waiter_t* waiter = *link;
+        if (waiter->key != key) {
+            link = &waiter->next;
+            continue;
+        }
+        *link = waiter->next;
+        waiter->woken = 1;
+        sched_wake(waiter->thread);
+        woken++;
+    }
+    stats.wakes++;
+    stats.woken += woken;
+    irq_restore(flags);
+    return (int32_t)woken;
+}
+
+void futex_get_stats(futex_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+static int32_t sys_futex_wait(interrupt_frame_t* frame) {
+    return futex_wait(frame->ebx, frame->esi, frame->edi);
+}
+
+static int32_t sys_futex_wake(interrupt_frame_t* frame) {
+    return futex_wake(frame->ebx, frame->esi);
+}
+
+// The futexbench baseline: the same three-state mutex word, but every lock
+// and unlock is a system call. System calls run with interrupts disabled,
+// which makes the test-and-set below atomic.
+static int32_t sys_mutex_lock(interrupt_frame_t* frame) {
+    uint32_t addr = frame->ebx;
+    if (!futex_key(addr)) {
+        return E_FAULT;
+    }
+    volatile uint32_t* word = (volatile uint32_t*)addr;
+    uint32_t state = 1;
+    while (*word) {
+        *word = 2;
+        futex_wait(addr, 2, FUTEX_WAIT_FOREVER);
+        state = 2;
+    }
+    *word = state;
+    return E_OK;
+}
+
+static int32_t sys_mutex_unlock(interrupt_frame_t* frame) {
+    uint32_t addr = frame->ebx;
+    if (!futex_key(addr)) {
+        return E_FAULT;
+    }
+    volatile uint32_t* word = (volatile uint32_t*)addr;
+    uint32_t state = *word;
+    *word = 0;
+    if (state == 2) {
+        futex_wake(addr, 1);
+    }
+    return E_OK;
+}
+
+void __init futex_init(void) {
+    syscall_register(SYS_FUTEX_WAIT, sys_futex_wait);
+    syscall_register(SYS_FUTEX_WAKE, sys_futex_wake);
+    syscall_register(SYS_MUTEX_LOCK, sys_mutex_lock);
+    syscall_register(SYS_MUTEX_UNLOCK, sys_mutex_unlock);
+}
+
+// Lock throughput benchmark. Ring 3 threads in the kernel image take one
+// mutex around a short critical section, first alone and then
+// FUTEXBENCH_THREADS at once, with the futex mutex and with the system
+// call per operation baseline. Contention only happens when a thread is
+// preempted while holding the lock, as on any single CPU. Then two
+// threads hand a token back and forth through semaphores and through a
+// condition variable, which sleeps and wakes on every round.
+#define FUTEXBENCH_THREADS   4
+#define FUTEXBENCH_OPS       200000         // Lock/unlock pairs per test
+#define FUTEXBENCH_HOLD      20             // Loop iterations inside the lock
+#define FUTEXBENCH_ROUNDS    5000           // Ping-pong round trips
+#define FUTEXBENCH_TIMEOUT   20             // ms, timed wait check
+#define FUTEXBENCH_STACK     2048
+
+// Tests run by the threads
+#define FUTEXBENCH_MUTEX     0
+#define FUTEXBENCH_SYSCALL   1
+#define FUTEXBENCH_SEM       2
+#define FUTEXBENCH_COND      3
+#define FUTEXBENCH_TIMED     4
+
+USER_DATA static user_mutex_t bench_mutex;
+USER_DATA static user_sem_t bench_sems[2];
+USER_DATA static user_cond_t bench_cond;
+USER_DATA static volatile uint32_t bench_turn;
+USER_DATA static volatile uint32_t bench_counter;
+USER_DATA static uint32_t bench_ops;            // Per thread
+USER_DATA static uint32_t bench_test;
+USER_DATA static int32_t bench_result;
+USER_DATA static uint8_t bench_stacks[FUTEXBENCH_THREADS][FUTEXBENCH_STACK] __attribute__((aligned(16)));
+
+USER_TEXT static void futex_bench_thread(uint32_t index) {
+    if (bench_test == FUTEXBENCH_MUTEX) {
+        for (uint32_t i = 0; i < bench_ops; i++) {
+            user_mutex_lock(&bench_mutex);
+            for (volatile uint32_t n = 0; n < FUTEXBENCH_HOLD; n++) {
+            }
+            bench_counter++;
+            user_mutex_unlock(&bench_mutex);
+        }
+    } else if (bench_test == FUTEXBENCH_SYSCALL) {
+        for (uint32_t i = 0; i < bench_ops; i++) {
+            user_syscall(SYS_MUTEX_LOCK, (uint32_t)&bench_mutex.state, 0, 0);
+            for (volatile uint32_t n = 0; n < FUTEXBENCH_HOLD; n++) {
+            }
+            bench_counter++;
+            user_syscall(SYS_MUTEX_UNLOCK, (uint32_t)&bench_mutex.state, 0, 0);
+        }
+    } else if (bench_test == FUTEXBENCH_SEM) {
+        // Thread 0 serves first; each waits on its own semaphore
+        for (uint32_t i = 0; i < bench_ops; i++) {
+            user_sem_wait(&bench_sems[index]);
+            bench_counter++;
+            user_sem_post(&bench_sems[index ^ 1]);
+        }
+    } else if (bench_test == FUTEXBENCH_COND) {
+        for (uint32_t i = 0; i < bench_ops; i++) {
+            user_mutex_lock(&bench_mutex);
+            while (bench_turn != index) {
+                user_cond_wait(&bench_cond, &bench_mutex);
+            }
+            bench_turn = index ^ 1;
+            bench_counter++;
+            user_cond_signal(&bench_cond);
+            user_mutex_unlock(&bench_mutex);
+        }
+    } else {
+        bench_result = user_futex_wait(&bench_turn, bench_turn, FUTEXBENCH_TIMEOUT);
+    }
+    user_exit(0);
+}
+
+// Run test on threads threads doing ops operations each; returns the
+// cycles from start to the last exit, or 0 if the threads could not start
+// or the count came out wrong
+static uint64_t futex_bench_run(uint32_t test, uint32_t threads, uint32_t ops, futex_stats_t* delta) {
+    thread_t* started[FUTEXBENCH_THREADS];
+    futex_stats_t before;
+    futex_stats_t after;
+
+    bench_mutex.state = 0;
+    bench_sems[0].value = 1;
+    bench_sems[0].waiters = 0;
+    bench_sems[1].value = 0;
+    bench_sems[1].waiters = 0;
+    bench_cond.seq = 0;
+    bench_cond.waiters = 0;
+    bench_turn = 0;
+    bench_counter = 0;
+    bench_ops = ops;
+    bench_test = test;
+    bench_result = E_OK;
+
+    futex_get_stats(&before);
+    uint64_t start = rdtsc();
+    uint32_t count = 0;
+    for (; count < threads; count++) {
+        started[count] = thread_create_user("futexbench", 0, (uint32_t)futex_bench_thread,
+                                            (uint32_t)&bench_stacks[count][FUTEXBENCH_STACK], count);
+        if (!started[count]) {
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        thread_join(started[i]);
+    }
+    uint64_t cycles = rdtsc() - start;
+    futex_get_stats(&after);
+
+    delta->waits = after.waits - before.waits;
+    delta->mismatches = after.mismatches - before.mismatches;
+    delta->timeouts = after.timeouts - before.timeouts;
+    delta->wakes = after.wakes - before.wakes;
+    delta->woken = after.woken - before.woken;
+    if (count < threads || bench_counter != threads * ops) {
+        return 0;
+    }
+    return cycles;
+}
+
+// One line: ns per operation and how often the kernel was entered
+static void futex_bench_line(const char* label, uint32_t test, uint32_t threads, uint32_t ops) {
+    futex_stats_t delta;
+    uint64_t cycles = futex_bench_run(test, threads, ops, &delta);
+    terminal_writestring(label);
+    if (!cycles) {
+        terminal_println("failed");
+        return;
+    }
+    terminal_print_dec(timer_cycles_to_ns(cycles, threads * ops));
+    terminal_writestring(" ns/op, ");
+    if (test == FUTEXBENCH_SYSCALL) {
+        terminal_print_dec(threads * ops * 2);
+        terminal_writestring(" syscalls");
+    } else {
+        terminal_print_dec(delta.waits + delta.mismatches + delta.wakes);
+        terminal_writestring(" syscalls (");
+        terminal_print_dec(delta.waits);
+        terminal_writestring(" sleeps)");
+    }
+    terminal_putchar('\n');
+}
+
+void futex_benchmark(void) {
+    uint32_t ops = FUTEXBENCH_OPS / FUTEXBENCH_THREADS;
+
+    terminal_println("Mutex lock/unlock, futex vs one system call per operation:");
+    futex_bench_line("  1 thread,  futex:   ", FUTEXBENCH_MUTEX, 1, FUTEXBENCH_OPS);
+    futex_bench_line("  1 thread,  syscall: ", FUTEXBENCH_SYSCALL, 1, FUTEXBENCH_OPS);
+    futex_bench_line("  4 threads, futex:   ", FUTEXBENCH_MUTEX, FUTEXBENCH_THREADS, ops);
+    futex_bench_line("  4 threads, syscall: ", FUTEXBENCH_SYSCALL, FUTEXBENCH_THREADS, ops);
+
+    terminal_println("Ping-pong between two threads (per handoff):");
+    futex_bench_line("  semaphores:         ", FUTEXBENCH_SEM, 2, FUTEXBENCH_ROUNDS);
+    futex_bench_line("  condition variable: ", FUTEXBENCH_COND, 2, FUTEXBENCH_ROUNDS);
+
+    futex_stats_t delta;
+    uint64_t cycles = futex_bench_run(FUTEXBENCH_TIMED, 1, 0, &delta);
+    terminal_writestring("Timed wait of ");
+    terminal_print_dec(FUTEXBENCH_TIMEOUT);
+    terminal_writestring(" ms: ");
+    if (!cycles || bench_result != E_TIMEDOUT) {
+        terminal_println("failed");
+        return;
+    }
+    terminal_writestring("timed out after ");
+    terminal_print_dec(timer_cycles_to_ns(cycles, 1000000));
+    terminal_println(" ms");
+}
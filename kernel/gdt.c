@@ -0,0 +1,72 @@
+#include "gdt.h"
+#include "init.h"
+
+// Global variables
+static gdt_entry_t gdt[GDT_ENTRIES];
+static gdt_ptr_t gdt_ptr;
+tss_t tss;
+
+// Stack used for ring 3 -> ring 0 transitions until a task installs its own
+static uint8_t boot_kernel_stack[4096] __attribute__((aligned(16)));
+
+// Replace the bootloader's two-entry GDT with one that also has ring 3
+// segments and a TSS, then reload every segment register.
+void __init gdt_init(void) {
+    gdt_ptr.limit = sizeof(gdt_entry_t) * GDT_ENTRIES - 1;
+    gdt_ptr.base = (uint32_t)&gdt;
+
+    gdt_set_gate(0, 0, 0, 0, 0);                                              // Null
+    gdt_set_gate(1, 0, 0xFFFFFFFF, GDT_ACCESS_KERNEL_CODE, GDT_GRAN_4K_32BIT); // Kernel code
+    gdt_set_gate(2, 0, 0xFFFFFFFF, GDT_ACCESS_KERNEL_DATA, GDT_GRAN_4K_32BIT); // Kernel data
+    gdt_set_gate(3, 0, 0xFFFFFFFF, GDT_ACCESS_USER_CODE, GDT_GRAN_4K_32BIT);   // User code
+    gdt_set_gate(4, 0, 0xFFFFFFFF, GDT_ACCESS_USER_DATA, GDT_GRAN_4K_32BIT);   // User data
+
+    // TSS: only the ring 0 stack is meaningful. An I/O map base past the
+    // segment limit means "no I/O permission bitmap", so ring 3 port
+    // access always faults.
+    uint8_t* p = (uint8_t*)&tss;
+    for (size_t i = 0; i < sizeof(tss_t); i++) {
+        p[i] = 0;
+    }
+    tss.ss0 = GDT_KERNEL_DATA;
+    tss.esp0 = (uint32_t)&boot_kernel_stack[sizeof(boot_kernel_stack)];
+    tss.iomap_base = sizeof(tss_t);
+    gdt_set_gate(5, (uint32_t)&tss, sizeof(tss_t) - 1, GDT_ACCESS_TSS, GDT_GRAN_BYTE);
+
+    // Load GDT and reload segment registers (CS needs a far jump)
+    __asm__ volatile(
+        "lgdt %0\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "movw %2, %%ax\n\t"
+        "movw %%ax, %%ds\n\t"
+        "movw %%ax, %%es\n\t"
+        "movw %%ax, %%fs\n\t"
+        "movw %%ax, %%gs\n\t"
+        "movw %%ax, %%ss\n\t"
+        : : "m"(gdt_ptr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA) : "eax", "memory");
+
+    // Load task register
+    __asm__ volatile("ltr %%ax" : : "a"((uint16_t)GDT_TSS));
+}
+
+// Set up a GDT descriptor
+void __init gdt_set_gate(uint8_t num, uint32_t base, uint32_t limit, uint8_t access, uint8_t granularity) {
+    // Page-granular segments store the limit in 4 KB units
+    if (granularity & 0x80) {
+        limit >>= 12;
+    }
+
+    gdt[num].base_low = base & 0xFFFF;
+    gdt[num].base_middle = (base >> 16) & 0xFF;
+    gdt[num].base_high = (base >> 24) & 0xFF;
+    gdt[num].limit_low = limit & 0xFFFF;
+    gdt[num].granularity = (granularity & 0xF0) | ((limit >> 16) & 0x0F);
+    gdt[num].access = access;
+}
+
+// Set the stack the CPU switches to when entering ring 0 from ring 3.
+// sysenter_entry reads the same field, so both entry paths agree.
+void tss_set_kernel_stack(uint32_t esp0) {
+    tss.esp0 = esp0;
+}
@@ -0,0 +1,231 @@
+#include "heapprof.h"
+#include "memory.h"
+#include "ksyms.h"
+#include "timer.h"
+#include "cpu.h"
+#include "klib.h"
+
+#ifdef HEAPPROF
+
+// Everything here is updated with interrupts disabled: the hooks run
+// inside the page allocator's critical section
+static heapprof_block_t blocks[HEAPPROF_LIVE];
+static heapprof_site_t sites[HEAPPROF_SITES];
+static uint32_t live_blocks;
+static uint32_t untracked_allocs;           // Block table or site table full
+static uint32_t untracked_frees;            // Not allocated while tracked
+static uint64_t reset_tsc;                  // Start of the allocation rate window
+
+static inline uint32_t hash(uint32_t key) {
+    return key * 0x9E3779B1;                // Fibonacci hashing
+}
+
+static inline uint32_t block_slot(uint32_t addr) {
+    return hash(addr >> PAGE_SHIFT) >> (32 - HEAPPROF_LIVE_BITS);
+}
+
+// Site for a caller, added if new; HEAPPROF_SITES if the table is full
+static uint32_t site_find(uint32_t caller) {
+    uint32_t slot = hash(caller) >> (32 - HEAPPROF_SITE_BITS);
+    for (uint32_t probe = 0; probe < HEAPPROF_SITES; probe++) {
+        heapprof_site_t* site = &sites[slot];
+        if (site->caller == caller) {
+            return slot;
+        }
+        if (!site->caller) {
+            site->caller = caller;
+            return slot;
+        }
+        slot = (slot + 1) & (HEAPPROF_SITES - 1);
+    }
+    return HEAPPROF_SITES;
+}
+
+void heapprof_alloc(void* addr, size_t pages, void* caller) {
+    uint32_t site = site_find((uint32_t)caller);
+    if (site == HEAPPROF_SITES || live_blocks == HEAPPROF_LIVE - 1) {
+        untracked_allocs++;
+        return;
+    }
+    uint32_t slot = block_slot((uint32_t)addr);
+    while (blocks[slot].addr) {
+        slot = (slot + 1) & (HEAPPROF_LIVE - 1);
+    }
+    blocks[slot].addr = (uint32_t)addr;
+    blocks[slot].pages = pages > 0xFFFF ? 0xFFFF : pages;
+    blocks[slot].site = site;
+    blocks[slot].tsc = rdtsc();
+    live_blocks++;
+    sites[site].allocs++;
+    sites[site].live_blocks++;
+    sites[site].live_pages += blocks[slot].pages;
+}
+
+// Remove a block, moving later blocks of the same probe run back so that
+// lookups never need tombstones
+void heapprof_free(void* addr) {
+    uint32_t slot = block_slot((uint32_t)addr);
+    while (blocks[slot].addr != (uint32_t)addr) {
+        if (!blocks[slot].addr) {
+            untracked_frees++;
+            return;
+        }
+        slot = (slot + 1) & (HEAPPROF_LIVE - 1);
+    }
+    heapprof_site_t* site = &sites[blocks[slot].site];
+    site->frees++;
+    site->live_blocks--;
+    site->live_pages -= blocks[slot].pages;
+    live_blocks--;
+
+    uint32_t hole = slot;
+    for (uint32_t next = (slot + 1) & (HEAPPROF_LIVE - 1); blocks[next].addr;
+         next = (next + 1) & (HEAPPROF_LIVE - 1)) {
+        uint32_t home = block_slot(blocks[next].addr);
+        // Move it if its home slot is not between the hole and it
+        if (((next - home) & (HEAPPROF_LIVE - 1)) >= ((next - hole) & (HEAPPROF_LIVE - 1))) {
+            blocks[hole] = blocks[next];
+            hole = next;
+        }
+    }
+    blocks[hole].addr = 0;
+}
+
+static void print_site(uint32_t caller) {
+    uint32_t offset;
+    const char* name = ksyms_lookup(caller, &offset);
+    if (name) {
+        terminal_writestring(name);
+        terminal_writestring("+");
+        terminal_print_hex(offset);
+    } else {
+        terminal_print_hex(caller);
+    }
+}
+
+// The HEAPPROF_TOP sites with the largest key, largest first. taken marks
+// the sites already listed.
+static void print_top(const char* title, const uint32_t* key, uint32_t elapsed_ms) {
+    uint8_t taken[HEAPPROF_SITES];
+    memset(taken, 0, sizeof(taken));
+    terminal_println(title);
+    for (uint32_t rank = 0; rank < HEAPPROF_TOP; rank++) {
+        uint32_t best = HEAPPROF_SITES;
+        for (uint32_t i = 0; i < HEAPPROF_SITES; i++) {
+            if (sites[i].caller && !taken[i] && key[i] &&
+                (best == HEAPPROF_SITES || key[i] > key[best])) {
+                best = i;
+            }
+        }
+        if (best == HEAPPROF_SITES) {
+            break;
+        }
+        taken[best] = 1;
+        heapprof_site_t* site = &sites[best];
+        terminal_writestring("  ");
+        terminal_print_dec(site->live_pages * (PAGE_SIZE / 1024));
+        terminal_writestring(" KB live in ");
+        terminal_print_dec(site->live_blocks);
+        terminal_writestring(", ");
+        terminal_print_dec(elapsed_ms ? (uint32_t)div64_32((uint64_t)site->allocs * 1000, elapsed_ms) : 0);
+        terminal_writestring("/s (");
+        terminal_print_dec(site->allocs);
+        terminal_writestring(" allocs, ");
+        terminal_print_dec(site->frees);
+        terminal_writestring(" frees)  ");
+        print_site(site->caller);
+        terminal_putchar('\n');
+    }
+}
+
+// Top sites by live memory and by allocation rate, then sites holding
+// blocks older than HEAPPROF_OLD_SECONDS (heapprof command)
+void heapprof_print(const char* args) {
+    uint32_t khz = timer_get_tsc_khz();
+    uint64_t now = rdtsc();
+    if (strcmp(args, "reset") == 0) {
+        uint32_t flags = irq_save();
+        for (uint32_t i = 0; i < HEAPPROF_SITES; i++) {
+            sites[i].allocs = 0;
+            sites[i].frees = 0;
+        }
+        untracked_allocs = 0;
+        untracked_frees = 0;
+        reset_tsc = now;
+        irq_restore(flags);
+        terminal_println("heapprof: allocation counts reset");
+        return;
+    }
+    if (args[0]) {
+        terminal_println("Usage: heapprof [reset]");
+        return;
+    }
+
+    // Snapshot the per-site keys, and age the live blocks, in one pass
+    static uint32_t live_key[HEAPPROF_SITES];
+    static uint32_t rate_key[HEAPPROF_SITES];
+    static uint32_t old_blocks[HEAPPROF_SITES];
+    static uint32_t old_pages[HEAPPROF_SITES];
+    static uint32_t oldest_s[HEAPPROF_SITES];
+    uint64_t old_cycles = (uint64_t)HEAPPROF_OLD_SECONDS * khz * 1000;
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < HEAPPROF_SITES; i++) {
+        live_key[i] = sites[i].live_pages;
+        rate_key[i] = sites[i].allocs;
+        old_blocks[i] = old_pages[i] = oldest_s[i] = 0;
+    }
+    for (uint32_t i = 0; i < HEAPPROF_LIVE; i++) {
+        if (blocks[i].addr && khz && now - blocks[i].tsc >= old_cycles) {
+            uint32_t site = blocks[i].site;
+            uint32_t age_s = (uint32_t)div64_32(div64_32(now - blocks[i].tsc, khz), 1000);
+            old_blocks[site]++;
+            old_pages[site] += blocks[i].pages;
+            if (age_s > oldest_s[site]) {
+                oldest_s[site] = age_s;
+            }
+        }
+    }
+    uint32_t live = live_blocks;
+    uint32_t lost_allocs = untracked_allocs;
+    uint32_t lost_frees = untracked_frees;
+    uint32_t elapsed_ms = khz ? (uint32_t)div64_32(now - reset_tsc, khz) : 0;
+    irq_restore(flags);
+
+    terminal_writestring("Live blocks: ");
+    terminal_print_dec(live);
+    terminal_writestring(" of ");
+    terminal_print_dec(HEAPPROF_LIVE);
+    terminal_writestring(" tracked, untracked allocs ");
+    terminal_print_dec(lost_allocs);
+    terminal_writestring(", frees ");
+    terminal_print_dec(lost_frees);
+    terminal_putchar('\n');
+    print_top("By live memory:", live_key, elapsed_ms);
+    print_top("By allocation rate:", rate_key, elapsed_ms);
+
+    terminal_writestring("Older than ");
+    terminal_print_dec(HEAPPROF_OLD_SECONDS);
+    terminal_println(" s (possible leaks):");
+    for (uint32_t i = 0; i < HEAPPROF_SITES; i++) {
+        if (old_blocks[i]) {
+            terminal_writestring("  ");
+            terminal_print_dec(old_pages[i] * (PAGE_SIZE / 1024));
+            terminal_writestring(" KB in ");
+            terminal_print_dec(old_blocks[i]);
+            terminal_writestring(", oldest ");
+            terminal_print_dec(oldest_s[i]);
+            terminal_writestring(" s  ");
+            print_site(sites[i].caller);
+            terminal_putchar('\n');
+        }
+    }
+}
+
+#else
+
+void heapprof_print(const char* args) {
+    (void)args;
+    terminal_println("heapprof: not built in, rebuild with make HEAPPROF=1");
+}
+
+#endif
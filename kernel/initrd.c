@@ -0,0 +1,467 @@
+#include "initrd.h"
+#include "cpu.h"
+#include "klib.h"
+#include "memory.h"
+#include "timer.h"
+#include "klog.h"
+#include "init.h"
+
+// Benchmark parameters
+#define INITRD_BENCH_DIRS     100
+#define INITRD_BENCH_FILES    10000         // Spread evenly over the directories
+#define INITRD_BENCH_ROUNDS   10            // Hit lookups per file
+#define INITRD_BENCH_SCANS    200           // Linear-scan lookups, for comparison
+#define INITRD_BENCH_PATH_LEN 17            // "/bench/dNN/fNNNNN"
+#define INITRD_BENCH_SLOT     20            // Path plus NUL, padded
+
+// The archive, linked in by the build (kernel/linker.ld)
+extern const uint8_t __initrd_start[];
+extern const uint8_t __initrd_end[];
+
+// Global variables
+static initrd_index_t boot_index;
+static int initialized = 0;
+
+// FNV-1a
+static uint32_t initrd_hash(const char* path, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)path[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static initrd_node_t* index_find(const initrd_index_t* idx, const char* path, uint32_t len) {
+    uint32_t hash = initrd_hash(path, len);
+    initrd_node_t* node = idx->buckets[hash & idx->mask];
+    while (node && (node->hash != hash || node->path_len != len || memcmp(node->path, path, len) != 0)) {
+        node = node->hash_next;
+    }
+    return node;
+}
+
+static void index_insert(initrd_index_t* idx, initrd_node_t* node) {
+    node->hash = initrd_hash(node->path, node->path_len);
+    uint32_t bucket = node->hash & idx->mask;
+    node->hash_next = idx->buckets[bucket];
+    idx->buckets[bucket] = node;
+}
+
+static void index_add_child(initrd_node_t* parent, initrd_node_t* node) {
+    node->parent = parent;
+    if (parent->last_child) {
+        parent->last_child->next_sibling = node;
+    } else {
+        parent->children = node;
+    }
+    parent->last_child = node;
+}
+
+static void index_free(initrd_index_t* idx) {
+    if (idx->pages) {
+        pmm_free(idx->pages, idx->page_count);
+        idx->pages = 0;
+    }
+}
+
+// Check an archive and index every entry. Returns E_INVAL if the archive
+// is malformed and E_NOMEM if the index does not fit.
+static int32_t index_build(initrd_index_t* idx, const uint8_t* image, uint32_t size) {
+    const initrd_header_t* header = (const initrd_header_t*)image;
+    if (size < sizeof(*header) || header->magic != INITRD_MAGIC ||
+        header->version != INITRD_VERSION || header->size > size ||
+        header->count > header->size / sizeof(initrd_entry_t)) {
+        return E_INVAL;
+    }
+    size = header->size;
+
+    // One bucket per entry or more, plus a node for the root directory
+    uint32_t count = header->count + 1;
+    uint32_t buckets = 16;
+    while (buckets < count) {
+        buckets <<= 1;
+    }
+    uint32_t bytes = count * sizeof(initrd_node_t) + buckets * sizeof(initrd_node_t*);
+    idx->page_count = PAGE_ALIGN_UP(bytes) / PAGE_SIZE;
+    idx->pages = pmm_alloc(idx->page_count);
+    if (!idx->pages) {
+        return E_NOMEM;
+    }
+    memset(idx->pages, 0, bytes);
+    idx->image = image;
+    idx->size = size;
+    idx->nodes = (initrd_node_t*)idx->pages;
+    idx->buckets = (initrd_node_t**)(idx->nodes + count);
+    idx->mask = buckets - 1;
+
+    initrd_node_t* root = &idx->nodes[0];
+    root->path = "/";
+    root->path_len = 1;
+    root->type = INITRD_DIR;
+    index_insert(idx, root);
+    idx->count = 1;
+
+    uint32_t offset = sizeof(*header);
+    for (uint32_t i = 0; i < header->count; i++) {
+        if (offset > size - sizeof(initrd_entry_t)) {
+            goto bad;
+        }
+        const initrd_entry_t* entry = (const initrd_entry_t*)(image + offset);
+        const char* path = (const char*)(entry + 1);
+        uint32_t len = entry->path_len;
+        offset += sizeof(*entry);
+        if (len < 2 || len >= INITRD_PATH_MAX || len >= size - offset ||
+            path[0] != '/' || path[len - 1] == '/' || path[len] != '\0' ||
+            (entry->type != INITRD_FILE && entry->type != INITRD_DIR) ||
+            entry->data > size || entry->size > size - entry->data) {
+            goto bad;
+        }
+        offset += (len + 4) & ~3u;
+
+        // The parent is the path up to the last '/' and comes earlier
+        uint32_t parent_len = len - 1;
+        while (path[parent_len] != '/') {
+            parent_len--;
+        }
+        initrd_node_t* parent = parent_len ? index_find(idx, path, parent_len) : root;
+        if (!parent || parent->type != INITRD_DIR || index_find(idx, path, len)) {
+            goto bad;
+        }
+
+        initrd_node_t* node = &idx->nodes[idx->count++];
+        node->path = path;
+        node->path_len = len;
+        node->type = entry->type;
+        node->size = entry->type == INITRD_FILE ? entry->size : 0;
+        node->data = image + entry->data;
+        index_insert(idx, node);
+        index_add_child(parent, node);
+    }
+    return E_OK;
+
+bad:
+    index_free(idx);
+    return E_INVAL;
+}
+
+void __init initrd_init(void) {
+    uint32_t size = (uint32_t)(__initrd_end - __initrd_start);
+    if (size == 0) {
+        return;
+    }
+    int32_t result = index_build(&boot_index, __initrd_start, size);
+    if (result != E_OK) {
+        klog(KLOG_ERR, "initrd", result == E_NOMEM ? "out of memory for the index" : "bad archive");
+        return;
+    }
+    initialized = 1;
+    klog(KLOG_INFO, "initrd", "%u bytes, %u nodes", size, boot_index.count);
+}
+
+// Paths are absolute; a missing leading '/' or trailing '/'s are tolerated
+// at the cost of a copy
+const initrd_node_t* initrd_lookup(const char* path) {
+    if (!initialized) {
+        return 0;
+    }
+    uint32_t len = strlen(path);
+    if (path[0] == '/' && (len == 1 || path[len - 1] != '/')) {
+        return index_find(&boot_index, path, len);
+    }
+
+    char buffer[INITRD_PATH_MAX];
+    uint32_t n = 0;
+    if (path[0] != '/') {
+        buffer[n++] = '/';
+    }
+    if (len >= INITRD_PATH_MAX - n) {
+        return 0;
+    }
+    memcpy(buffer + n, path, len);
+    n += len;
+    while (n > 1 && buffer[n - 1] == '/') {
+        n--;
+    }
+    return index_find(&boot_index, buffer, n);
+}
+
+// Point *data at file bytes [offset, offset + size) inside the archive;
+// returns how many are available there (0 at or past the end)
+uint32_t initrd_read(const initrd_node_t* node, uint32_t offset, uint32_t size, const void** data) {
+    if (node->type != INITRD_FILE || offset >= node->size) {
+        return 0;
+    }
+    *data = node->data + offset;
+    return size < node->size - offset ? size : node->size - offset;
+}
+
+static const char* initrd_name(const initrd_node_t* node) {
+    const char* name = node->path + node->path_len;
+    while (name > node->path && name[-1] != '/') {
+        name--;
+    }
+    return name;
+}
+
+static void initrd_print_entry(const initrd_node_t* node) {
+    terminal_writestring("  ");
+    terminal_writestring(initrd_name(node));
+    if (node->type == INITRD_DIR) {
+        terminal_println("/");
+    } else {
+        terminal_writestring("  ");
+        terminal_print_dec(node->size);
+        terminal_println(" bytes");
+    }
+}
+
+// A directory's entries, or just the entry of a file
+void initrd_ls(const char* path) {
+    const initrd_node_t* node = initrd_lookup(path);
+    if (!node) {
+        terminal_println(initialized ? "ls: no such file or directory" : "ls: no initrd");
+        return;
+    }
+    if (node->type == INITRD_FILE) {
+        initrd_print_entry(node);
+        return;
+    }
+    for (const initrd_node_t* child = node->children; child; child = child->next_sibling) {
+        initrd_print_entry(child);
+    }
+}
+
+void initrd_cat(const char* path) {
+    const initrd_node_t* node = initrd_lookup(path);
+    if (!node) {
+        terminal_println(initialized ? "cat: no such file" : "cat: no initrd");
+        return;
+    }
+    if (node->type != INITRD_FILE) {
+        terminal_println("cat: is a directory");
+        return;
+    }
+
+    const void* data = 0;
+    uint32_t size = initrd_read(node, 0, node->size, &data);
+    terminal_write((const char*)data, size);
+    if (size && ((const char*)data)[size - 1] != '\n') {
+        terminal_putchar('\n');
+    }
+}
+
+void initrd_stat(const char* path) {
+    const initrd_node_t* node = initrd_lookup(path);
+    if (!node) {
+        terminal_println(initialized ? "stat: no such file or directory" : "stat: no initrd");
+        return;
+    }
+
+    terminal_writestring("  path: ");
+    terminal_println(node->path);
+    if (node->type == INITRD_DIR) {
+        uint32_t entries = 0;
+        for (const initrd_node_t* child = node->children; child; child = child->next_sibling) {
+            entries++;
+        }
+        terminal_writestring("  type: directory, ");
+        terminal_print_dec(entries);
+        terminal_println(" entries");
+    } else {
+        terminal_writestring("  type: file, ");
+        terminal_print_dec(node->size);
+        terminal_println(" bytes");
+        terminal_writestring("  data: ");
+        terminal_print_hex((uint32_t)node->data);
+        terminal_println(" (in the initrd image)");
+    }
+    terminal_writestring("  hash: ");
+    terminal_print_hex(node->hash);
+    terminal_writestring(", bucket ");
+    terminal_print_dec(node->hash & boot_index.mask);
+    terminal_writestring(" of ");
+    terminal_print_dec(boot_index.mask + 1);
+    terminal_putchar('\n');
+}
+
+// Benchmark
+
+static void put_dec(char* p, uint32_t value, int digits) {
+    while (digits--) {
+        p[digits] = (char)('0' + value % 10);
+        value /= 10;
+    }
+}
+
+static uint8_t* bench_entry(uint8_t* p, uint32_t type, const char* path, uint32_t len) {
+    initrd_entry_t* entry = (initrd_entry_t*)p;
+    entry->type = type;
+    entry->size = 0;
+    entry->data = 0;
+    entry->path_len = len;
+    memcpy(entry + 1, path, len);
+    ((char*)(entry + 1))[len] = '\0';
+    return p + sizeof(*entry) + ((len + 4) & ~3u);
+}
+
+// Write /bench/dNN/fNNNNN (empty files) into image and each file's path
+// into its query slot; returns the archive size
+static uint32_t bench_archive(uint8_t* image, char* queries) {
+    char path[INITRD_BENCH_SLOT];
+    memcpy(path, "/bench/d00/f00000", INITRD_BENCH_PATH_LEN + 1);
+    uint32_t per_dir = INITRD_BENCH_FILES / INITRD_BENCH_DIRS;
+
+    uint8_t* p = image + sizeof(initrd_header_t);
+    p = bench_entry(p, INITRD_DIR, path, 6);
+    for (uint32_t d = 0; d < INITRD_BENCH_DIRS; d++) {
+        put_dec(path + 8, d, 2);
+        p = bench_entry(p, INITRD_DIR, path, 10);
+        for (uint32_t j = 0; j < per_dir; j++) {
+            uint32_t n = d * per_dir + j;
+            put_dec(path + 12, n, 5);
+            p = bench_entry(p, INITRD_FILE, path, INITRD_BENCH_PATH_LEN);
+            memcpy(queries + n * INITRD_BENCH_SLOT, path, INITRD_BENCH_PATH_LEN + 1);
+        }
+    }
+
+    initrd_header_t* header = (initrd_header_t*)image;
+    header->magic = INITRD_MAGIC;
+    header->version = INITRD_VERSION;
+    header->count = 1 + INITRD_BENCH_DIRS + INITRD_BENCH_FILES;
+    header->size = (uint32_t)(p - image);
+    return header->size;
+}
+
+static initrd_node_t* scan_find(const initrd_index_t* idx, const char* path, uint32_t len) {
+    for (uint32_t i = 0; i < idx->count; i++) {
+        initrd_node_t* node = &idx->nodes[i];
+        if (node->path_len == len && memcmp(node->path, path, len) == 0) {
+            return node;
+        }
+    }
+    return 0;
+}
+
+static void bench_report(const char* label, uint32_t lookups, uint32_t found, uint64_t cycles) {
+    uint32_t khz = timer_get_tsc_khz();
+    uint32_t ns = timer_cycles_to_ns(cycles, lookups);
+
+    // Thousands of lookups per second, scaled so the divisor fits 32 bits
+    uint64_t scaled = (uint64_t)lookups * khz;
+    while (cycles >> 32) {
+        cycles >>= 1;
+        scaled >>= 1;
+    }
+    uint32_t rate = cycles ? (uint32_t)div64_32(scaled, (uint32_t)cycles) : 0;
+
+    terminal_writestring(label);
+    terminal_print_dec(rate);
+    terminal_writestring("K lookups/s, ");
+    terminal_print_dec(ns);
+    terminal_writestring(" ns each, ");
+    terminal_print_dec(found);
+    terminal_writestring(" of ");
+    terminal_print_dec(lookups);
+    terminal_println(" found");
+}
+
+// Index a synthetic archive of INITRD_BENCH_FILES files and time hits,
+// misses and (for comparison) a linear scan
+void initrd_benchmark(void) {
+    uint32_t entries = 1 + INITRD_BENCH_DIRS + INITRD_BENCH_FILES;
+    uint32_t image_pages = PAGE_ALIGN_UP(sizeof(initrd_header_t) +
+                                         entries * (sizeof(initrd_entry_t) + INITRD_BENCH_SLOT)) / PAGE_SIZE;
+    uint32_t query_pages = PAGE_ALIGN_UP(INITRD_BENCH_FILES * INITRD_BENCH_SLOT) / PAGE_SIZE;
+    uint8_t* image = (uint8_t*)pmm_alloc(image_pages);
+    char* queries = (char*)pmm_alloc(query_pages);
+    if (!image || !queries) {
+        if (image) {
+            pmm_free(image, image_pages);
+        }
+        if (queries) {
+            pmm_free(queries, query_pages);
+        }
+        terminal_println("initrdbench: out of memory");
+        return;
+    }
+
+    uint32_t size = bench_archive(image, queries);
+    initrd_index_t idx;
+    uint64_t start = rdtsc();
+    int32_t result = index_build(&idx, image, size);
+    uint64_t build = rdtsc() - start;
+    if (result != E_OK) {
+        pmm_free(image, image_pages);
+        pmm_free(queries, query_pages);
+        terminal_println("initrdbench: could not build the index");
+        return;
+    }
+
+    uint32_t longest = 0;
+    for (uint32_t b = 0; b <= idx.mask; b++) {
+        uint32_t chain = 0;
+        for (initrd_node_t* node = idx.buckets[b]; node; node = node->hash_next) {
+            chain++;
+        }
+        if (chain > longest) {
+            longest = chain;
+        }
+    }
+
+    terminal_writestring("initrdbench: ");
+    terminal_print_dec(INITRD_BENCH_FILES);
+    terminal_writestring(" files in ");
+    terminal_print_dec(INITRD_BENCH_DIRS);
+    terminal_writestring(" directories, ");
+    terminal_print_dec(idx.mask + 1);
+    terminal_writestring(" buckets, longest chain ");
+    terminal_print_dec(longest);
+    terminal_putchar('\n');
+    terminal_writestring("  index build: ");
+    terminal_print_dec(timer_cycles_to_us(build, 1));
+    terminal_writestring(" us, ");
+    terminal_print_dec(timer_cycles_to_ns(build, entries));
+    terminal_println(" ns per entry");
+
+    // Visit the files in a scattered order so neighbouring lookups do not
+    // share cache lines
+    uint32_t lookups = INITRD_BENCH_ROUNDS * INITRD_BENCH_FILES;
+    uint32_t found = 0;
+    start = rdtsc();
+    for (uint32_t round = 0; round < INITRD_BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < INITRD_BENCH_FILES; i++) {
+            const char* path = queries + (i * 7919 % INITRD_BENCH_FILES) * INITRD_BENCH_SLOT;
+            found += index_find(&idx, path, INITRD_BENCH_PATH_LEN) != 0;
+        }
+    }
+    bench_report("  hash hits:   ", lookups, found, rdtsc() - start);
+
+    // Same lengths and directories, different file names
+    for (uint32_t i = 0; i < INITRD_BENCH_FILES; i++) {
+        queries[i * INITRD_BENCH_SLOT + 11] = 'x';
+    }
+    found = 0;
+    start = rdtsc();
+    for (uint32_t round = 0; round < INITRD_BENCH_ROUNDS; round++) {
+        for (uint32_t i = 0; i < INITRD_BENCH_FILES; i++) {
+            const char* path = queries + (i * 7919 % INITRD_BENCH_FILES) * INITRD_BENCH_SLOT;
+            found += index_find(&idx, path, INITRD_BENCH_PATH_LEN) != 0;
+        }
+    }
+    bench_report("  hash misses: ", lookups, found, rdtsc() - start);
+
+    for (uint32_t i = 0; i < INITRD_BENCH_FILES; i++) {
+        queries[i * INITRD_BENCH_SLOT + 11] = 'f';
+    }
+    found = 0;
+    start = rdtsc();
+    for (uint32_t i = 0; i < INITRD_BENCH_SCANS; i++) {
+        const char* path = queries + (i * 7919 % INITRD_BENCH_FILES) * INITRD_BENCH_SLOT;
+        found += scan_find(&idx, path, INITRD_BENCH_PATH_LEN) != 0;
+    }
+    bench_report("  linear scan: ", INITRD_BENCH_SCANS, found, rdtsc() - start);
+
+    index_free(&idx);
+    pmm_free(image, image_pages);
+    pmm_free(queries, query_pages);
+}
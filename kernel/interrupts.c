@@ -1,27 +1,93 @@
 #include "interrupts.h"
 #include "keyboard.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "syscall.h"
+#include "paging.h"
+#include "timer.h"
+#include "sched.h"
+#include "fpu.h"
+#include "usermode.h"
+#include "errors.h"
+#include "softirq.h"
+#include "klib.h"
+#include "klog.h"
+#include "init.h"
 
 // Global variables
 static idt_entry_t idt[256];
 static idt_ptr_t idt_ptr;
+static struct {
+    irq_handler_t handler;
+    void* context;
+} irq_handlers[16][IRQ_HANDLERS_PER_LINE];
+static irq_stats_t irq_stats;
+static uint64_t irq_off_start;
 
-// Initialize interrupts (simplified version)
-void interrupts_init(void) {
+// Entry stubs. Every vector pushes (err_code, int_no) so that the common
+// path always builds the same interrupt_frame_t; exceptions for which the
+// CPU does not push an error code push a dummy zero first.
+#define ISR_NOERR(n) ".global isr" #n "\nisr" #n ":\n\tpushl $0\n\tpushl $" #n "\n\tjmp isr_common\n"
+#define ISR_ERR(n)   ".global isr" #n "\nisr" #n ":\n\tpushl $" #n "\n\tjmp isr_common\n"
+#define IRQ_STUB(n, vec) ".global irq" #n "\nirq" #n ":\n\tpushl $0\n\tpushl $" #vec "\n\tjmp isr_common\n"
+
+__asm__(
+    ".text\n"
+    ISR_NOERR(0)  ISR_NOERR(1)  ISR_NOERR(2)  ISR_NOERR(3)
+    ISR_NOERR(4)  ISR_NOERR(5)  ISR_NOERR(6)  ISR_NOERR(7)
+    ISR_ERR(8)    ISR_NOERR(9)  ISR_ERR(10)   ISR_ERR(11)
+    ISR_ERR(12)   ISR_ERR(13)   ISR_ERR(14)   ISR_NOERR(15)
+    ISR_NOERR(16) ISR_ERR(17)   ISR_NOERR(18) ISR_NOERR(19)
+    ISR_NOERR(20) ISR_NOERR(21) ISR_NOERR(22) ISR_NOERR(23)
+    ISR_NOERR(24) ISR_NOERR(25) ISR_NOERR(26) ISR_NOERR(27)
+    ISR_NOERR(28) ISR_NOERR(29) ISR_NOERR(30) ISR_NOERR(31)
+    IRQ_STUB(0, 32)  IRQ_STUB(1, 33)  IRQ_STUB(2, 34)  IRQ_STUB(3, 35)
+    IRQ_STUB(4, 36)  IRQ_STUB(5, 37)  IRQ_STUB(6, 38)  IRQ_STUB(7, 39)
+    IRQ_STUB(8, 40)  IRQ_STUB(9, 41)  IRQ_STUB(10, 42) IRQ_STUB(11, 43)
+    IRQ_STUB(12, 44) IRQ_STUB(13, 45) IRQ_STUB(14, 46) IRQ_STUB(15, 47)
+    ISR_NOERR(128)
+    "isr_common:\n"
+    "\tpushal\n"
+    "\tcld\n"
+    "\tpushl %esp\n"              // interrupt_frame_t* argument
+    "\tcall interrupt_handler\n"
+    "\taddl $4, %esp\n"
+    "\tpopal\n"
+    "\taddl $8, %esp\n"           // Drop int_no and err_code
+    "\tiret\n"
+);
+
+static void (*const isr_stubs[48])(void) __initdata = {
+    isr0,  isr1,  isr2,  isr3,  isr4,  isr5,  isr6,  isr7,
+    isr8,  isr9,  isr10, isr11, isr12, isr13, isr14, isr15,
+    isr16, isr17, isr18, isr19, isr20, isr21, isr22, isr23,
+    isr24, isr25, isr26, isr27, isr28, isr29, isr30, isr31,
+    irq0,  irq1,  irq2,  irq3,  irq4,  irq5,  irq6,  irq7,
+    irq8,  irq9,  irq10, irq11, irq12, irq13, irq14, irq15
+};
+
+// Initialize interrupts
+void __init interrupts_init(void) {
     // Set up IDT pointer
     idt_ptr.limit = sizeof(idt_entry_t) * 256 - 1;
     idt_ptr.base = (uint32_t)&idt;
-    
+
     // Clear IDT
     for (int i = 0; i < 256; i++) {
-        idt_set_gate(i, 0, 0x08, 0x8E);
+        idt_set_gate(i, 0, 0, 0);
+    }
+
+    // Exceptions and remapped IRQs
+    for (int i = 0; i < 48; i++) {
+        idt_set_gate(i, (uint32_t)isr_stubs[i], GDT_KERNEL_CODE, IDT_GATE_INTERRUPT);
     }
-    
+
     // Load IDT
     __asm__ volatile("lidt %0" : : "m"(idt_ptr));
-    
-    // Initialize PIC (simplified)
+
+    // Remap the PIC away from the CPU exception vectors
     pic_init();
-    
+
     // Enable interrupts
     __asm__ volatile("sti");
 }
@@ -35,50 +101,162 @@ void idt_set_gate(uint8_t num, uint32_t base, uint16_t selector, uint8_t flags)
     idt[num].flags = flags;
 }
 
-// Initialize PIC (simplified)
-void pic_init(void) {
-    // For now, just enable interrupts without PIC remapping
-    // This is a simplified version that should work for basic keyboard input
+// Initialize PIC: move IRQ 0-15 to vectors 32-47 (the BIOS default of 8-15
+// collides with CPU exceptions) and leave only timer, keyboard and the
+// cascade line unmasked. Drivers unmask their own lines.
+void __init pic_init(void) {
+    outb(PIC1_COMMAND, ICW1_INIT | ICW1_ICW4);
+    io_wait();
+    outb(PIC2_COMMAND, ICW1_INIT | ICW1_ICW4);
+    io_wait();
+    outb(PIC1_DATA, IRQ0);      // Master vector offset
+    io_wait();
+    outb(PIC2_DATA, IRQ8);      // Slave vector offset
+    io_wait();
+    outb(PIC1_DATA, 4);         // Slave on IRQ2
+    io_wait();
+    outb(PIC2_DATA, 2);         // Slave cascade identity
+    io_wait();
+    outb(PIC1_DATA, ICW4_8086);
+    io_wait();
+    outb(PIC2_DATA, ICW4_8086);
+    io_wait();
+
+    outb(PIC1_DATA, 0xF8);      // IRQ0, IRQ1, IRQ2 enabled
+    outb(PIC2_DATA, 0xFF);
 }
 
 // Send EOI (End of Interrupt) signal
-void pic_send_eoi(uint8_t irq) {
-    // Simplified EOI - just acknowledge the interrupt
-    (void)irq; // Suppress unused parameter warning
+void __hot pic_send_eoi(uint8_t irq) {
+    if (irq >= 8) {
+        outb(PIC2_COMMAND, PIC_EOI);
+    }
+    outb(PIC1_COMMAND, PIC_EOI);
+}
+
+void pic_mask_irq(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) | (1 << (irq & 7)));
+}
+
+void pic_unmask_irq(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outb(port, inb(port) & ~(1 << (irq & 7)));
+}
+
+// Attach a driver handler to an IRQ line and unmask it
+int irq_register_handler(uint8_t irq, irq_handler_t handler, void* context) {
+    if (irq >= 16) {
+        return E_INVAL;
+    }
+
+    uint32_t flags = irq_save();
+    for (int i = 0; i < IRQ_HANDLERS_PER_LINE; i++) {
+        if (!irq_handlers[irq][i].handler) {
+            irq_handlers[irq][i].context = context;
+            irq_handlers[irq][i].handler = handler;
+            if (irq >= 8) {
+                pic_unmask_irq(2);
+            }
+            pic_unmask_irq(irq);
+            irq_restore(flags);
+            return E_OK;
+        }
+    }
+    irq_restore(flags);
+    return E_BUSY;
+}
+
+// Interrupts-off accounting for IRQ handlers. Bottom halves end the span
+// when they enable interrupts and begin a new one when they disable them.
+void irq_off_begin(void) {
+    irq_off_start = rdtsc();
+}
+
+void irq_off_end(void) {
+    uint64_t cycles = rdtsc() - irq_off_start;
+    irq_stats.off_spans++;
+    irq_stats.off_cycles += cycles;
+    if (cycles > irq_stats.off_max) {
+        irq_stats.off_max = cycles;
+    }
+}
+
+void irq_get_stats(irq_stats_t* stats) {
+    uint32_t flags = irq_save();
+    *stats = irq_stats;
+    irq_restore(flags);
+}
+
+void irq_reset_stats(void) {
+    uint32_t flags = irq_save();
+    memset(&irq_stats, 0, sizeof(irq_stats));
+    irq_restore(flags);
 }
 
-// Generic interrupt handler (simplified)
-void interrupt_handler(interrupt_frame_t* frame) {
+// Generic interrupt handler (called from isr_common)
+__attribute__((used))
+void __hot interrupt_handler(interrupt_frame_t* frame) {
     // Handle different interrupt types
-    if (frame->int_no < 32) {
+    if (frame->int_no == 14) {
+        // Page fault
+        page_fault_handler(frame);
+    } else if (frame->int_no == FPU_NM_VECTOR) {
+        // First FPU/SSE use since the last context switch
+        fpu_handle_nm();
+    } else if (frame->int_no < 32) {
         // Exception occurred
-        terminal_setcolor(VGA_COLOR(VGA_LIGHT_RED, VGA_BLACK));
-        terminal_writestring("Exception: ");
-        terminal_print_dec(frame->int_no);
-        terminal_putchar('\n');
-        
-        // For now, just halt the system on exceptions
+        klog(KLOG_ERR, "cpu", "exception %u at eip %x", frame->int_no, frame->eip);
+
+        // A ring 3 task that raised it is terminated, like a user page fault
+        if ((frame->cs & 3) == 3) {
+            usermode_exit(E_FAULT);
+        }
+        klog_flush();
+
+        // In kernel mode, just halt the system
         __asm__ volatile("cli");
         __asm__ volatile("hlt");
     } else if (frame->int_no >= 32 && frame->int_no < 48) {
         // IRQ occurred
         uint8_t irq = frame->int_no - 32;
-        
-        // Handle specific IRQs
+        irq_off_begin();
+        irq_stats.count[irq]++;
+
+        // Top halves: acknowledge the device and queue the work
         switch (irq) {
             case 0:  // Timer
-                // Timer interrupt - could be used for scheduling
+                timer_handler();
                 break;
             case 1:  // Keyboard
                 // Call keyboard handler
                 keyboard_handler();
                 break;
             default:
-                // Other IRQs
+                // Driver handlers (see irq_register_handler)
+                for (int i = 0; i < IRQ_HANDLERS_PER_LINE && irq_handlers[irq][i].handler; i++) {
+                    irq_handlers[irq][i].handler(irq_handlers[irq][i].context);
+                }
                 break;
         }
-        
+
         // Send EOI
         pic_send_eoi(irq);
+
+        // An interrupt taken while bottom halves run returns straight to
+        // them; otherwise run them now
+        int nested = softirq_active();
+        if (!nested) {
+            softirq_irq_exit();
+        }
+        irq_off_end();
+
+        // Switch threads if the time slice ran out or the CPU was idle
+        if (!nested) {
+            sched_preempt((frame->cs & 3) == 3);
+        }
+    } else if (frame->int_no == SYSCALL_VECTOR) {
+        // System call through the int 0x80 fallback gate
+        syscall_dispatch(frame);
     }
-} 
\ No newline at end of file
+}
@@ -0,0 +1,364 @@
+#include "ipc.h"
+#include "sched.h"
+#include "syscall.h"
+#include "paging.h"
+#include "cpu.h"
+#include "timer.h"
+#include "user_ipc.h"
+#include "init.h"
+
+// An endpoint is a rendezvous point: whichever side arrives first blocks
+// until the other shows up. Blocked senders keep their message in their
+// saved registers, so nothing is buffered in the kernel.
+typedef struct {
+    uint8_t in_use;
+    wait_queue_t senders;       // Blocked in send or call
+    wait_queue_t receivers;     // Blocked in recv or reply_recv
+} ipc_endpoint_t;
+
+// Global variables
+static ipc_endpoint_t endpoints[IPC_ENDPOINT_MAX];
+
+static ipc_endpoint_t* endpoint_get(uint32_t id) {
+    if (id >= IPC_ENDPOINT_MAX || !endpoints[id].in_use) {
+        return 0;
+    }
+    return &endpoints[id];
+}
+
+static address_space_t* thread_space(thread_t* thread) {
+    return thread->space ? thread->space : address_space_current();
+}
+
+// Hand the message in from's registers to to: copy the two words and move
+// the granted pages into window. to's system call returns result.
+static void ipc_transfer(thread_t* from, thread_t* to, uint32_t window, int32_t result) {
+    interrupt_frame_t* src = from->ipc_frame;
+    interrupt_frame_t* dst = to->ipc_frame;
+    uint32_t grant = src->ebp;
+    uint32_t received = 0;
+
+    uint32_t pages = grant & IPC_GRANT_PAGES_MASK;
+    if (pages > (window & IPC_GRANT_PAGES_MASK)) {
+        pages = window & IPC_GRANT_PAGES_MASK;
+    }
+    if (pages) {
+        uint32_t base = window & ~IPC_GRANT_PAGES_MASK;
+        uint32_t moved = paging_transfer(thread_space(from), grant & ~IPC_GRANT_PAGES_MASK,
+                                         thread_space(to), base, pages);
+        if (moved) {
+            received = base | moved;
+        }
+    }
+
+    dst->esi = src->esi;
+    dst->edi = src->edi;
+    dst->ebp = received;
+    dst->eax = (uint32_t)result;
+}
+
+// Take the next message on ep, blocking if there is none. handoff, if
+// set, is a thread that just became runnable (a replied-to caller): when
+// we block it runs immediately instead of going through the run queue.
+static int32_t ipc_receive(thread_t* self, interrupt_frame_t* frame, ipc_endpoint_t* ep, thread_t* handoff) {
+    self->ipc_frame = frame;
+
+    thread_t* sender = wait_queue_dequeue(&ep->senders);
+    if (sender) {
+        ipc_transfer(sender, self, self->ipc_window, (int32_t)sender->id);
+        if (sender->ipc_op == IPC_OP_CALL) {
+            self->ipc_caller = sender;      // Stays blocked until the reply
+        } else {
+            sched_wake(sender);
+        }
+        if (handoff) {
+            sched_wake(handoff);
+        }
+    } else {
+        self->ipc_op = IPC_OP_RECV;
+        sched_block(&ep->receivers, handoff);
+        self->ipc_op = IPC_OP_NONE;
+    }
+    return (int32_t)frame->eax;
+}
+
+// System calls run with interrupts disabled on both entry paths, which is
+// all the locking the endpoint queues need
+static int32_t ipc_send(interrupt_frame_t* frame, uint8_t op) {
+    thread_t* self = sched_current();
+    ipc_endpoint_t* ep = endpoint_get(frame->ebx);
+    if (!ep) {
+        return E_INVAL;
+    }
+
+    self->ipc_frame = frame;
+    self->ipc_op = op;
+    if (op == IPC_OP_CALL) {
+        self->ipc_window = frame->ebp;      // Reply pages come back in place
+    }
+    frame->eax = E_OK;
+
+    thread_t* receiver = wait_queue_dequeue(&ep->receivers);
+    if (receiver) {
+        // Direct handoff: the receiver runs next without a trip through
+        // the run queue
+        ipc_transfer(self, receiver, receiver->ipc_window, (int32_t)self->id);
+        if (op == IPC_OP_CALL) {
+            receiver->ipc_caller = self;
+            sched_block(0, receiver);
+        } else {
+            sched_switch_to(receiver);
+        }
+    } else {
+        sched_block(&ep->senders, 0);
+    }
+
+    self->ipc_op = IPC_OP_NONE;
+    return (int32_t)frame->eax;
+}
+
+static int32_t sys_ipc_send(interrupt_frame_t* frame) {
+    return ipc_send(frame, IPC_OP_SEND);
+}
+
+static int32_t sys_ipc_call(interrupt_frame_t* frame) {
+    return ipc_send(frame, IPC_OP_CALL);
+}
+
+static int32_t sys_ipc_recv(interrupt_frame_t* frame) {
+    thread_t* self = sched_current();
+    ipc_endpoint_t* ep = endpoint_get(frame->ebx);
+    if (!ep) {
+        return E_INVAL;
+    }
+    self->ipc_window = frame->ebp;
+    return ipc_receive(self, frame, ep, 0);
+}
+
+static int32_t sys_ipc_reply_recv(interrupt_frame_t* frame) {
+    thread_t* self = sched_current();
+    ipc_endpoint_t* ep = endpoint_get(frame->ebx);
+    if (!ep) {
+        return E_INVAL;
+    }
+
+    thread_t* caller = self->ipc_caller;
+    self->ipc_frame = frame;
+    if (caller) {
+        self->ipc_caller = 0;
+        ipc_transfer(self, caller, caller->ipc_window, E_OK);
+    }
+    return ipc_receive(self, frame, ep, caller);
+}
+
+void __init ipc_init(void) {
+    for (int i = 0; i < IPC_ENDPOINT_MAX; i++) {
+        endpoints[i].in_use = 0;
+    }
+
+    syscall_register(SYS_IPC_SEND, sys_ipc_send);
+    syscall_register(SYS_IPC_RECV, sys_ipc_recv);
+    syscall_register(SYS_IPC_CALL, sys_ipc_call);
+    syscall_register(SYS_IPC_REPLY_RECV, sys_ipc_reply_recv);
+}
+
+// Returns the endpoint id or E_NOMEM
+int32_t ipc_endpoint_create(void) {
+    uint32_t flags = irq_save();
+    int32_t id = E_NOMEM;
+    for (int i = 0; i < IPC_ENDPOINT_MAX; i++) {
+        if (!endpoints[i].in_use) {
+            endpoints[i].in_use = 1;
+            wait_queue_init(&endpoints[i].senders);
+            wait_queue_init(&endpoints[i].receivers);
+            id = i;
+            break;
+        }
+    }
+    irq_restore(flags);
+    return id;
+}
+
+static void ipc_abort_waiters(wait_queue_t* queue) {
+    thread_t* thread;
+    while ((thread = wait_queue_dequeue(queue)) != 0) {
+        thread->ipc_frame->eax = (uint32_t)E_NOENT;
+        sched_wake(thread);
+    }
+}
+
+// Fail every thread still waiting on the endpoint with E_NOENT
+void ipc_endpoint_destroy(int32_t endpoint) {
+    uint32_t flags = irq_save();
+    ipc_endpoint_t* ep = endpoint_get((uint32_t)endpoint);
+    if (ep) {
+        ipc_abort_waiters(&ep->senders);
+        ipc_abort_waiters(&ep->receivers);
+        ep->in_use = 0;
+    }
+    irq_restore(flags);
+}
+
+// A server exiting without replying releases its caller with E_NOENT
+void ipc_thread_exit(thread_t* thread) {
+    thread_t* caller = thread->ipc_caller;
+    if (caller) {
+        thread->ipc_caller = 0;
+        caller->ipc_frame->eax = (uint32_t)E_NOENT;
+        sched_wake(caller);
+    }
+}
+
+// Ping-pong benchmark: a client and a server thread in separate address
+// spaces exchange messages through one endpoint. Messages of up to 8 bytes
+// travel in registers; larger ones are granted as whole pages, which the
+// server hands straight back in its reply.
+#define IPC_BENCH_SIZES      8
+#define IPC_BENCH_MAX_SIZE   (1024 * 1024)
+#define IPC_BENCH_BUFFER     USER_SPACE_START       // Client's payload pages
+#define IPC_BENCH_WINDOW     USER_SPACE_START       // Server's receive window
+#define IPC_BENCH_STACK_SIZE (4 * PAGE_SIZE)
+#define IPC_BENCH_QUIT       0xFFFFFFFF
+
+USER_DATA static uint32_t ipc_bench_sizes[IPC_BENCH_SIZES] = {
+    8, 64, 512, 4096, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024
+};
+USER_DATA static uint32_t ipc_bench_iterations[IPC_BENCH_SIZES] = {
+    10000, 10000, 10000, 10000, 2000, 1000, 500, 200
+};
+USER_DATA static uint64_t ipc_bench_cycles[IPC_BENCH_SIZES];
+USER_DATA static int32_t ipc_bench_error;
+
+USER_TEXT static void ipc_bench_server(uint32_t endpoint) {
+    uint32_t w0 = 0;
+    uint32_t w1 = 0;
+    uint32_t grant = IPC_GRANT(IPC_BENCH_WINDOW, IPC_BENCH_MAX_SIZE / PAGE_SIZE);
+
+    int32_t result = user_ipc_recv(endpoint, &w0, &w1, &grant);
+    while (result >= 0 && w0 != IPC_BENCH_QUIT) {
+        // Echo the words and give the received pages back
+        result = user_ipc_reply_recv(endpoint, &w0, &w1, &grant);
+    }
+    user_exit(result < 0 ? result : 0);
+}
+
+USER_TEXT static void ipc_bench_client(uint32_t endpoint) {
+    for (uint32_t n = 0; n < IPC_BENCH_SIZES; n++) {
+        uint32_t size = ipc_bench_sizes[n];
+        uint32_t pages = size <= 8 ? 0 : (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+        uint64_t start = user_rdtsc();
+        for (uint32_t i = 0; i < ipc_bench_iterations[n]; i++) {
+            uint32_t w0 = i;
+            uint32_t w1 = size;
+            uint32_t grant = pages ? IPC_GRANT(IPC_BENCH_BUFFER, pages) : 0;
+            int32_t result = user_ipc_call(endpoint, &w0, &w1, &grant);
+            if (result < 0 || w0 != i || (grant & IPC_GRANT_PAGES_MASK) != pages) {
+                ipc_bench_error = result < 0 ? result : E_IO;
+                user_ipc_send(endpoint, IPC_BENCH_QUIT, 0, 0);
+                user_exit(ipc_bench_error);
+            }
+        }
+        ipc_bench_cycles[n] = user_rdtsc() - start;
+    }
+
+    user_ipc_send(endpoint, IPC_BENCH_QUIT, 0, 0);
+    user_exit(0);
+}
+
+static void ipc_print_size(uint32_t size) {
+    if (size >= 1024 * 1024) {
+        terminal_print_dec(size / (1024 * 1024));
+        terminal_writestring(" MB");
+    } else if (size >= 1024) {
+        terminal_print_dec(size / 1024);
+        terminal_writestring(" KB");
+    } else {
+        terminal_print_dec(size);
+        terminal_writestring(" B");
+    }
+}
+
+static int ipc_bench_space_setup(address_space_t* space, int with_buffer) {
+    if (!space) {
+        return E_NOMEM;
+    }
+    if (address_space_alloc_region(space, USER_STACK_TOP - IPC_BENCH_STACK_SIZE,
+                                   IPC_BENCH_STACK_SIZE, PTE_WRITABLE) != 0) {
+        return E_NOMEM;
+    }
+    if (with_buffer &&
+        address_space_alloc_region(space, IPC_BENCH_BUFFER, IPC_BENCH_MAX_SIZE, PTE_WRITABLE) != 0) {
+        return E_NOMEM;
+    }
+    return 0;
+}
+
+void ipc_benchmark(void) {
+    for (int n = 0; n < IPC_BENCH_SIZES; n++) {
+        ipc_bench_cycles[n] = 0;
+    }
+    ipc_bench_error = 0;
+
+    int32_t endpoint = ipc_endpoint_create();
+    address_space_t* server_space = address_space_create();
+    address_space_t* client_space = address_space_create();
+    if (endpoint < 0 || ipc_bench_space_setup(server_space, 0) != 0 ||
+        ipc_bench_space_setup(client_space, 1) != 0) {
+        terminal_println("ipcbench: out of memory");
+        address_space_destroy(client_space);
+        address_space_destroy(server_space);
+        ipc_endpoint_destroy(endpoint);
+        return;
+    }
+
+    // The threads own their address spaces from here on
+    thread_t* server = thread_create_user("ipc-server", server_space, (uint32_t)ipc_bench_server,
+                                          USER_STACK_TOP, (uint32_t)endpoint);
+    if (!server) {
+        terminal_println("ipcbench: cannot create threads");
+        address_space_destroy(client_space);
+        address_space_destroy(server_space);
+        ipc_endpoint_destroy(endpoint);
+        return;
+    }
+    thread_t* client = thread_create_user("ipc-client", client_space, (uint32_t)ipc_bench_client,
+                                          USER_STACK_TOP, (uint32_t)endpoint);
+    if (!client) {
+        address_space_destroy(client_space);
+        ipc_endpoint_destroy(endpoint);     // Releases the server with E_NOENT
+    } else {
+        thread_join(client);
+    }
+    thread_join(server);
+    ipc_endpoint_destroy(endpoint);
+
+    if (!client || ipc_bench_error) {
+        terminal_writestring("ipcbench: failed (");
+        terminal_print_dec(client ? (uint32_t)-ipc_bench_error : (uint32_t)-E_NOMEM);
+        terminal_println(")");
+        return;
+    }
+
+    uint32_t khz = timer_get_tsc_khz();
+    terminal_println("IPC ping-pong between address spaces (per round trip):");
+    terminal_println("  size      cycles    ns        MB/s");
+    for (int n = 0; n < IPC_BENCH_SIZES; n++) {
+        uint32_t cycles = (uint32_t)div64_32(ipc_bench_cycles[n], ipc_bench_iterations[n]);
+        uint32_t ns = timer_cycles_to_ns(cycles, 1);
+
+        terminal_writestring("  ");
+        ipc_print_size(ipc_bench_sizes[n]);
+        terminal_writestring("\t    ");
+        terminal_print_dec(cycles);
+        terminal_writestring("\t      ");
+        terminal_print_dec(ns);
+        terminal_writestring("\t");
+        // The payload crosses twice per round trip
+        if (cycles) {
+            uint64_t bytes_per_sec_k = (uint64_t)ipc_bench_sizes[n] * 2 * khz;
+            terminal_print_dec((uint32_t)div64_32(div64_32(bytes_per_sec_k, cycles), 1000));
+        }
+        terminal_putchar('\n');
+    }
+}
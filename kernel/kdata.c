@@ -0,0 +1,102 @@
+#include "kdata.h"
+#include "memory.h"
+#include "cpu.h"
+#include "timer.h"
+#include "init.h"
+
+// Global variables
+static kdata_page_t* kdata;         // Kernel (identity mapped) view of the page
+static uint32_t rebase_countdown;   // Ticks until the next clock rebase
+
+static inline void kdata_write_begin(void) {
+    kdata->seq++;
+    __asm__ volatile("" : : : "memory");
+}
+
+static inline void kdata_write_end(void) {
+    __asm__ volatile("" : : : "memory");
+    kdata->seq++;
+}
+
+// Allocate and initialize the shared page. Must run before paging_init()
+// so the kernel address space maps it too.
+void __init kdata_init(void) {
+    kdata = (kdata_page_t*)pmm_alloc(1);
+    if (!kdata) {
+        return;
+    }
+
+    uint8_t* p = (uint8_t*)kdata;
+    for (size_t i = 0; i < PAGE_SIZE; i++) {
+        p[i] = 0;
+    }
+
+    kdata->version = KDATA_VERSION;
+    kdata->cpu_count = 1;
+    kdata->tick_hz = TIMER_HZ;
+    kdata->tsc_shift = KDATA_TSC_SHIFT;
+}
+
+uint32_t kdata_page_frame(void) {
+    return (uint32_t)kdata;
+}
+
+kdata_page_t* kdata_get(void) {
+    return kdata;
+}
+
+// Install the TSC calibration and the wall clock read from the RTC
+void kdata_set_clock(uint32_t tsc_khz, uint64_t wall_ns) {
+    if (!kdata || tsc_khz == 0) {
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    kdata_write_begin();
+    kdata->tsc_khz = tsc_khz;
+    kdata->tsc_mult = (uint32_t)div64_32(1000000ULL << KDATA_TSC_SHIFT, tsc_khz);
+    kdata->tsc_base = rdtsc();
+    kdata->wall_ns_base = wall_ns;
+    kdata_write_end();
+    irq_restore(flags);
+}
+
+// Called from the timer interrupt: bump the tick count and rebase the
+// clock once a second so readers' TSC deltas stay small
+void kdata_tick(void) {
+    if (!kdata) {
+        return;
+    }
+
+    kdata_write_begin();
+    kdata->ticks++;
+    if (kdata->tsc_mult && ++rebase_countdown >= kdata->tick_hz) {
+        rebase_countdown = 0;
+        uint64_t now = rdtsc();
+        uint64_t ns = ((now - kdata->tsc_base) * kdata->tsc_mult) >> kdata->tsc_shift;
+        kdata->tsc_base = now;
+        kdata->mono_ns_base += ns;
+        kdata->wall_ns_base += ns;
+    }
+    kdata_write_end();
+}
+
+// Kernel-side monotonic clock using the same parameters as user space
+uint64_t kdata_monotonic_ns(void) {
+    uint32_t seq;
+    uint64_t ns;
+
+    if (!kdata) {
+        return 0;
+    }
+
+    do {
+        seq = kdata->seq;
+        __asm__ volatile("" : : : "memory");
+        ns = kdata->mono_ns_base +
+             (((rdtsc() - kdata->tsc_base) * kdata->tsc_mult) >> kdata->tsc_shift);
+        __asm__ volatile("" : : : "memory");
+    } while ((seq & 1) || seq != kdata->seq);
+
+    return ns;
+}
@@ -2,17 +2,86 @@
 #include "terminal.h"
 #include "interrupts.h"
 #include "keyboard.h"
+#include "gdt.h"
+#include "syscall.h"
+#include "memory.h"
+#include "paging.h"
+#include "kdata.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "softirq.h"
+#include "sched.h"
+#include "ipc.h"
+#include "fpu.h"
+#include "klib.h"
+#include "pci.h"
+#include "virtio_blk.h"
+#include "ata.h"
+#include "bcache.h"
+#include "initrd.h"
+#include "fat.h"
+#include "klog.h"
+#include "futex.h"
+#include "crc32c.h"
+#include "serial.h"
+#include "init.h"
+
+// Bring the system up and show the welcome screen. Runs once; its pages
+// are freed afterwards.
+static void __init kernel_init(void) {
+    // Check the kernel image against its checksum while .data is still as
+    // loaded (reported once the kernel log and TSC are up)
+    crc32c_init();
 
-// Main kernel entry point
-void kernel_main(void) {
     // Initialize terminal
     terminal_initialize();
     
-    // Initialize interrupts
-    interrupts_init();
+    // Install GDT with user segments and TSS
+    gdt_init();
+    
+    // Initialize physical memory, the shared kernel data page and paging
+    memory_init();
+    kdata_init();
+    paging_init();
+    
+    // Turn the boot context into the first thread, then enable lazy
+    // FPU/SSE switching and pick the klib variants for this CPU
+    sched_init();
+    fpu_init();
+    klib_init();
     
-    // Initialize keyboard
+    // Initialize interrupts and the thread that runs their deferred work,
+    // and the thread that shows kernel log messages
+    interrupts_init();
+    softirq_init();
+    klog_init();
+    
+    // Start the system timer with its timer wheel and calibrate the TSC
+    timer_wheel_init();
+    timer_init();
+    crc32c_log_image();
+    
+    // Initialize system calls, IPC and futexes
+    syscall_init();
+    ipc_init();
+    futex_init();
+    
+    // Enumerate PCI devices, bind the disk drivers and set up the block cache
+    pci_init();
+    virtio_blk_init();
+    ata_init();
+    bcache_init();
+    
+    // Index the boot archive and mount the first FAT disk
+    initrd_init();
+    fat_init();
+    
+    // Initialize keyboard and the serial port for shell output
     keyboard_init();
+    serial_init();
+    
+    // Show boot warnings and errors before the welcome screen
+    klog_flush();
     
     // Welcome message with enhanced colors
     terminal_setcolor(VGA_COLOR(VGA_LIGHT_GREEN, VGA_BLACK));
@@ -110,10 +179,15 @@ void kernel_main(void) {
     terminal_set_cursor(0, 24);
     terminal_setcolor(VGA_COLOR(VGA_LIGHT_GREEN, VGA_BLACK));
     terminal_println("Enhanced terminal system ready! Press any key to continue...");
+}
+
+// Main kernel entry point (the bootloader jumps to the start of .text,
+// where linker.ld puts .text.entry)
+__attribute__((section(".text.entry")))
+void kernel_main(void) {
+    kernel_init();
+    memory_free_init();
     
-    // Infinite loop - kernel should never return
-    while (1) {
-        // Halt the CPU
-        __asm__ volatile("hlt");
-    }
+    // The boot thread becomes the shell - kernel should never return
+    keyboard_run();
 } 
\ No newline at end of file
@@ -1,8 +1,47 @@
 #include "keyboard.h"
+#include "klib.h"
+#include "syscall.h"
+#include "paging.h"
+#include "sched.h"
+#include "cpu.h"
+#include "timer.h"
+#include "ipc.h"
+#include "fpu.h"
+#include "pci.h"
+#include "blkdev.h"
+#include "bcache.h"
+#include "initrd.h"
+#include "fat.h"
+#include "elf.h"
+#include "timer_wheel.h"
+#include "softirq.h"
+#include "fbcon.h"
+#include "klog.h"
+#include "futex.h"
+#include "latency.h"
+#include "heapprof.h"
+#include "crc32c.h"
+#include "stream.h"
+#include "init.h"
 
 // Global variables
 static keyboard_state_t keyboard_state = {0};
-static command_line_t command_line = {0};
+static command_line_t command_lines[TERMINAL_CONSOLES];
+static command_line_t* command_line = &command_lines[0];  // Active console's
+
+// Scancodes queued by the interrupt handler for the shell thread, with
+// the TSC when each arrived for the keystroke latency histogram
+static volatile uint8_t scancode_buffer[KEYBOARD_BUFFER_SIZE];
+static volatile uint64_t scancode_tsc[KEYBOARD_BUFFER_SIZE];
+static volatile uint32_t scancode_head = 0;
+static volatile uint32_t scancode_tail = 0;
+static wait_queue_t keyboard_waiters;
+
+// Pipe the running command reads its input from (grep), 0 if none
+static stream_t* command_input;
+
+static void command_line_run_pipeline(const char* command);
+static void command_line_dispatch(const char* command);
 
 // Scancode to ASCII conversion table (US layout)
 static const char scancode_to_ascii[] = {
@@ -23,7 +62,7 @@ static const char scancode_to_ascii_shift[] = {
 };
 
 // Initialize keyboard
-void keyboard_init(void) {
+void __init keyboard_init(void) {
     // Clear keyboard state
     keyboard_state.shift_pressed = 0;
     keyboard_state.ctrl_pressed = 0;
@@ -33,6 +72,8 @@ void keyboard_init(void) {
     keyboard_state.scroll_lock = 0;
     keyboard_state.extended_key = 0;
     
+    wait_queue_init(&keyboard_waiters);
+
     // Initialize command line
     command_line_init();
     
@@ -40,10 +81,34 @@ void keyboard_init(void) {
     terminal_println("Keyboard initialized");
 }
 
-// Keyboard interrupt handler
-void keyboard_handler(void) {
+// Keyboard interrupt handler: queue the scancode and wake the shell.
+// Commands may block, so they must not run in interrupt context.
+void __hot keyboard_handler(void) {
+    uint64_t tsc = rdtsc();
     uint8_t scancode = keyboard_read_scancode();
-    keyboard_process_scancode(scancode);
+    uint32_t next = (scancode_head + 1) % KEYBOARD_BUFFER_SIZE;
+    if (next != scancode_tail) {
+        scancode_buffer[scancode_head] = scancode;
+        scancode_tsc[scancode_head] = tsc;
+        scancode_head = next;
+    }
+    wait_queue_wake_all(&keyboard_waiters);
+}
+
+// Shell loop, run by the boot thread: process keystrokes as they arrive
+void keyboard_run(void) {
+    while (1) {
+        uint32_t flags = irq_save();
+        while (scancode_tail == scancode_head) {
+            wait_queue_sleep(&keyboard_waiters);
+        }
+        uint8_t scancode = scancode_buffer[scancode_tail];
+        uint64_t tsc = scancode_tsc[scancode_tail];
+        scancode_tail = (scancode_tail + 1) % KEYBOARD_BUFFER_SIZE;
+        irq_restore(flags);
+
+        keyboard_process_scancode(scancode, tsc);
+    }
 }
 
 // Read scancode from keyboard
@@ -71,8 +136,8 @@ char keyboard_scancode_to_ascii(uint8_t scancode) {
     return c;
 }
 
-// Process scancode
-void keyboard_process_scancode(uint8_t scancode) {
+// Process scancode; tsc is when it arrived, 0 if it was not typed
+void keyboard_process_scancode(uint8_t scancode, uint64_t tsc) {
     // Check if key is released
     if (scancode & KEY_STATE_RELEASED) {
         scancode &= ~KEY_STATE_RELEASED;
@@ -114,16 +179,45 @@ void keyboard_process_scancode(uint8_t scancode) {
         case SCANCODE_ENTER:
             command_line_handle_enter();
             break;
+        case SCANCODE_PAGE_UP:
+        case SCANCODE_PAGE_DOWN:
+            if (keyboard_state.shift_pressed) {
+                int32_t lines = terminal_get_height() / 2;
+                terminal_scrollback(scancode == SCANCODE_PAGE_UP ? lines : -lines);
+            }
+            break;
+        case SCANCODE_F1:
+        case SCANCODE_F2:
+        case SCANCODE_F3:
+        case SCANCODE_F4:
+        case SCANCODE_F5:
+        case SCANCODE_F6:
+            if (keyboard_state.alt_pressed) {
+                keyboard_switch_console(scancode - SCANCODE_F1);
+            }
+            break;
         default:
             // Convert to ASCII and process
             char c = keyboard_scancode_to_ascii(scancode);
             if (c) {
-                command_line_process_input(c);
+                command_line_process_input(c, tsc);
             }
             break;
     }
 }
 
+// Show another virtual console; each has its own command line, started
+// the first time the console is shown
+void keyboard_switch_console(uint32_t console) {
+    if (terminal_switch_console(console) != E_OK) {
+        return;
+    }
+    command_line = &command_lines[console];
+    if (!command_line->started) {
+        command_line_init();
+    }
+}
+
 // Echo character to terminal
 void keyboard_echo_character(char c) {
     terminal_putchar(c);
@@ -137,38 +231,40 @@ void keyboard_handle_special_key(uint8_t scancode) {
 
 // Command line functions
 void command_line_init(void) {
-    command_line.position = 0;
-    command_line.length = 0;
-    command_line.history_count = 0;
-    command_line.history_position = 0;
+    command_line->position = 0;
+    command_line->length = 0;
+    command_line->history_count = 0;
+    command_line->history_position = 0;
+    command_line->started = 1;
     
     for (int i = 0; i < MAX_COMMAND_LENGTH; i++) {
-        command_line.buffer[i] = 0;
+        command_line->buffer[i] = 0;
     }
     
     for (int i = 0; i < MAX_COMMAND_HISTORY; i++) {
         for (int j = 0; j < MAX_COMMAND_LENGTH; j++) {
-            command_line.history[i][j] = 0;
+            command_line->history[i][j] = 0;
         }
     }
     
     command_line_display_prompt();
 }
 
-void command_line_process_input(char c) {
-    if (command_line.length < MAX_COMMAND_LENGTH - 1) {
-        command_line.buffer[command_line.length] = c;
-        command_line.length++;
-        command_line.position = command_line.length;
+void command_line_process_input(char c, uint64_t tsc) {
+    if (command_line->length < MAX_COMMAND_LENGTH - 1) {
+        command_line->buffer[command_line->length] = c;
+        command_line->length++;
+        command_line->position = command_line->length;
         keyboard_echo_character(c);
+        latency_input_echoed(tsc);
     }
 }
 
 void command_line_handle_backspace(void) {
-    if (command_line.length > 0) {
-        command_line.length--;
-        command_line.position = command_line.length;
-        command_line.buffer[command_line.length] = 0;
+    if (command_line->length > 0) {
+        command_line->length--;
+        command_line->position = command_line->length;
+        command_line->buffer[command_line->length] = 0;
         
         // Move cursor back and clear character
         terminal_move_cursor(-1, 0);
@@ -180,25 +276,184 @@ void command_line_handle_backspace(void) {
 void command_line_handle_enter(void) {
     terminal_putchar('\n');
     
-    if (command_line.length > 0) {
-        command_line_add_to_history(command_line.buffer);
-        command_line_execute_command(command_line.buffer);
+    if (command_line->length > 0) {
+        command_line_add_to_history(command_line->buffer);
+        command_line_execute_command(command_line->buffer);
     }
     
     // Clear buffer
-    command_line.length = 0;
-    command_line.position = 0;
+    command_line->length = 0;
+    command_line->position = 0;
     for (int i = 0; i < MAX_COMMAND_LENGTH; i++) {
-        command_line.buffer[i] = 0;
+        command_line->buffer[i] = 0;
     }
     
     command_line_display_prompt();
 }
 
+// Strip leading and trailing spaces in place
+static char* command_line_trim(char* str) {
+    while (*str == ' ') {
+        str++;
+    }
+    size_t length = strlen(str);
+    while (length > 0 && str[length - 1] == ' ') {
+        str[--length] = 0;
+    }
+    return str;
+}
+
+// A '>' that starts a word, 0 if there is none
+static char* command_line_find_redirect(char* command) {
+    for (char* p = strchr(command, '>'); p; p = strchr(p + 1, '>')) {
+        if (p == command || p[-1] == ' ') {
+            return p;
+        }
+    }
+    return 0;
+}
+
+// Run one command line: a time or repeat prefix applies to the rest of
+// the line, which is a pipeline of commands separated by | with an
+// optional "> /dev/null" or "> /dev/serial" ending the last one
 void command_line_execute_command(const char* command) {
+    while (*command == ' ') {
+        command++;
+    }
     if (strlen(command) == 0) return;
-    
-    // Simple command parsing
+
+    if (strncmp(command, "time ", 5) == 0) {
+        cmd_time(command + 5);
+    } else if (strncmp(command, "repeat ", 7) == 0) {
+        cmd_repeat(command + 7);
+    } else {
+        command_line_run_pipeline(command);
+    }
+}
+
+static void command_line_run_pipeline(const char* command) {
+    char line[MAX_COMMAND_LENGTH];
+    size_t length = strlen(command);
+    if (length >= MAX_COMMAND_LENGTH) {
+        length = MAX_COMMAND_LENGTH - 1;
+    }
+    memcpy(line, command, length);
+    line[length] = 0;
+
+    char* commands[MAX_PIPELINE_COMMANDS];
+    uint32_t count = 0;
+    for (char* next = line; next; ) {
+        char* bar = strchr(next, '|');
+        if (bar) {
+            *bar++ = 0;
+        }
+        if (count == MAX_PIPELINE_COMMANDS) {
+            terminal_writestring("Pipeline too long (at most ");
+            terminal_print_dec(MAX_PIPELINE_COMMANDS);
+            terminal_println(" commands)");
+            return;
+        }
+        commands[count] = command_line_trim(next);
+        if (!commands[count][0]) {
+            terminal_println("Syntax error: empty command in pipeline");
+            return;
+        }
+        count++;
+        next = bar;
+    }
+
+    // "> target" is a redirection only as a word of its own at the end of
+    // the last command, so text such as "echo a>b" is left alone
+    char* target = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        char* redirect = command_line_find_redirect(commands[i]);
+        if (!redirect) {
+            continue;
+        }
+        if (i < count - 1) {
+            terminal_println("Syntax error: only the last command of a pipeline can redirect");
+            return;
+        }
+        *redirect = 0;
+        commands[i] = command_line_trim(commands[i]);
+        target = command_line_trim(redirect + 1);
+        if (!commands[i][0] || !target[0]) {
+            terminal_println("Syntax error: redirection needs a command and a target");
+            return;
+        }
+        char* extra = strchr(target, ' ');
+        if (extra) {
+            *extra = 0;
+            terminal_writestring("Syntax error: unexpected ");
+            terminal_writestring(command_line_trim(extra + 1));
+            terminal_writestring(" after ");
+            terminal_println(target);
+            return;
+        }
+    }
+
+    stream_t sink;
+    stream_t* sink_output = 0;
+    if (target) {
+        if (strcmp(target, "/dev/null") == 0) {
+            stream_null(&sink);
+        } else if (strcmp(target, "/dev/serial") == 0) {
+            if (stream_serial(&sink) != E_OK) {
+                terminal_println("/dev/serial: no serial port");
+                return;
+            }
+        } else {
+            terminal_writestring("Cannot redirect to ");
+            terminal_writestring(target);
+            terminal_println(" (use /dev/null or /dev/serial)");
+            return;
+        }
+        sink_output = &sink;
+    }
+
+    // Two pipes are enough: a command reads one while writing the other
+    stream_t pipes[2] = {0};
+    if (count > 1 && (stream_pipe(&pipes[0]) != E_OK || stream_pipe(&pipes[1]) != E_OK)) {
+        stream_free(&pipes[0]);
+        terminal_println("Pipeline: out of memory for pipe buffers");
+        return;
+    }
+
+    // Without a redirection the last command writes wherever the line's
+    // output already goes (the screen, or a repeat's discard stream)
+    stream_t* previous = terminal_set_output(0);
+    stream_t* last_output = sink_output ? sink_output : previous;
+    stream_t* saved_input = command_input;
+    uint32_t dropped = 0;
+    command_input = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        stream_t* output = last_output;
+        if (i < count - 1) {
+            output = &pipes[i & 1];
+            stream_rewind(output);
+        }
+        terminal_set_output(output);
+        command_line_dispatch(commands[i]);
+        command_input = output;
+        if (i < count - 1) {
+            dropped += output->dropped;
+        }
+    }
+    command_input = saved_input;
+    terminal_set_output(previous);
+    stream_free(&pipes[0]);
+    stream_free(&pipes[1]);
+
+    if (dropped) {
+        terminal_writestring("Pipeline: ");
+        terminal_print_dec(dropped);
+        terminal_writestring(" bytes dropped (pipes hold ");
+        terminal_print_dec(STREAM_PIPE_PAGES * PAGE_SIZE / 1024);
+        terminal_println(" KB)");
+    }
+}
+
+static void command_line_dispatch(const char* command) {
     if (strcmp(command, "help") == 0) {
         cmd_help();
     } else if (strcmp(command, "clear") == 0) {
@@ -211,6 +466,90 @@ void command_line_execute_command(const char* command) {
         cmd_version();
     } else if (strcmp(command, "status") == 0) {
         cmd_status();
+    } else if (strcmp(command, "sysbench") == 0) {
+        cmd_sysbench();
+    } else if (strcmp(command, "cowbench") == 0) {
+        cmd_cowbench();
+    } else if (strcmp(command, "ipcbench") == 0) {
+        cmd_ipcbench();
+    } else if (strcmp(command, "futexbench") == 0) {
+        cmd_futexbench();
+    } else if (strcmp(command, "klibbench") == 0) {
+        cmd_klibbench("");
+    } else if (strncmp(command, "klibbench ", 10) == 0) {
+        cmd_klibbench(command + 10);
+    } else if (strcmp(command, "lspci") == 0) {
+        cmd_lspci();
+    } else if (strcmp(command, "blkbench") == 0) {
+        cmd_blkbench("");
+    } else if (strncmp(command, "blkbench ", 9) == 0) {
+        cmd_blkbench(command + 9);
+    } else if (strcmp(command, "ls") == 0) {
+        cmd_ls("/");
+    } else if (strncmp(command, "ls ", 3) == 0) {
+        cmd_ls(command + 3);
+    } else if (strncmp(command, "cat ", 4) == 0) {
+        cmd_cat(command + 4);
+    } else if (strncmp(command, "stat ", 5) == 0) {
+        cmd_stat(command + 5);
+    } else if (strcmp(command, "initrdbench") == 0) {
+        cmd_initrdbench();
+    } else if (strncmp(command, "exec ", 5) == 0) {
+        cmd_exec(command + 5);
+    } else if (strcmp(command, "execbench") == 0) {
+        cmd_execbench();
+    } else if (strcmp(command, "timerbench") == 0) {
+        cmd_timerbench();
+    } else if (strcmp(command, "irqstat") == 0) {
+        cmd_irqstat();
+    } else if (strcmp(command, "irqbench") == 0) {
+        cmd_irqbench();
+    } else if (strcmp(command, "fbcon") == 0) {
+        cmd_fbcon("");
+    } else if (strncmp(command, "fbcon ", 6) == 0) {
+        cmd_fbcon(command + 6);
+    } else if (strcmp(command, "fbstat") == 0) {
+        cmd_fbstat();
+    } else if (strcmp(command, "fbbench") == 0) {
+        cmd_fbbench();
+    } else if (strcmp(command, "ansibench") == 0) {
+        cmd_ansibench();
+    } else if (strcmp(command, "vcbench") == 0) {
+        cmd_vcbench();
+    } else if (strcmp(command, "sbstat") == 0) {
+        cmd_sbstat();
+    } else if (strcmp(command, "dmesg") == 0) {
+        cmd_dmesg("");
+    } else if (strncmp(command, "dmesg ", 6) == 0) {
+        cmd_dmesg(command + 6);
+    } else if (strcmp(command, "klogstat") == 0) {
+        cmd_klogstat();
+    } else if (strcmp(command, "latency") == 0) {
+        cmd_latency();
+    } else if (strcmp(command, "crcbench") == 0) {
+        cmd_crcbench();
+    } else if (strcmp(command, "grep") == 0) {
+        cmd_grep("");
+    } else if (strncmp(command, "grep ", 5) == 0) {
+        cmd_grep(command + 5);
+    } else if (strcmp(command, "heapprof") == 0) {
+        cmd_heapprof("");
+    } else if (strncmp(command, "heapprof ", 9) == 0) {
+        cmd_heapprof(command + 9);
+    } else if (strcmp(command, "fatbench") == 0) {
+        cmd_fatbench("");
+    } else if (strncmp(command, "fatbench ", 9) == 0) {
+        cmd_fatbench(command + 9);
+    } else if (strcmp(command, "blkstat") == 0) {
+        cmd_blkstat();
+    } else if (strcmp(command, "cachestat") == 0) {
+        cmd_cachestat();
+    } else if (strcmp(command, "sync") == 0) {
+        cmd_sync();
+    } else if (strcmp(command, "cachebench") == 0) {
+        cmd_cachebench("");
+    } else if (strncmp(command, "cachebench ", 11) == 0) {
+        cmd_cachebench(command + 11);
     } else {
         terminal_writestring("Unknown command: ");
         terminal_writestring(command);
@@ -225,17 +564,17 @@ void command_line_display_prompt(void) {
 }
 
 void command_line_add_to_history(const char* command) {
-    if (command_line.history_count < MAX_COMMAND_HISTORY) {
-        strcpy(command_line.history[command_line.history_count], command);
-        command_line.history_count++;
+    if (command_line->history_count < MAX_COMMAND_HISTORY) {
+        strcpy(command_line->history[command_line->history_count], command);
+        command_line->history_count++;
     } else {
         // Shift history up
         for (int i = 0; i < MAX_COMMAND_HISTORY - 1; i++) {
-            strcpy(command_line.history[i], command_line.history[i + 1]);
+            strcpy(command_line->history[i], command_line->history[i + 1]);
         }
-        strcpy(command_line.history[MAX_COMMAND_HISTORY - 1], command);
+        strcpy(command_line->history[MAX_COMMAND_HISTORY - 1], command);
     }
-    command_line.history_position = command_line.history_count;
+    command_line->history_position = command_line->history_count;
 }
 
 // Built-in commands
@@ -247,6 +586,44 @@ void cmd_help(void) {
     terminal_println("  reboot   - Reboot system");
     terminal_println("  version  - Show version");
     terminal_println("  status   - Show system status");
+    terminal_println("  sysbench - Benchmark null system calls");
+    terminal_println("  cowbench - Benchmark copy-on-write address space clone");
+    terminal_println("  ipcbench - Benchmark IPC ping-pong from 8 B to 1 MB");
+    terminal_println("  futexbench - Compare futex mutex throughput with a syscall per lock");
+    terminal_println("  klibbench [routine] - Benchmark memcpy/memset/memcmp/strlen/strchr");
+    terminal_println("  lspci    - List PCI devices and their drivers");
+    terminal_println("  blkbench [device] - Benchmark 4 KB random and 1 MB sequential reads");
+    terminal_println("  ls [path] - List a directory (initrd, FAT disk under /disk)");
+    terminal_println("  cat <path> - Print a file");
+    terminal_println("  stat <path> - Show a file's size and location");
+    terminal_println("  initrdbench - Benchmark initrd path lookups with 10k files");
+    terminal_println("  fatbench [path] - Compare FAT file reads (under /disk) with and without readahead");
+    terminal_println("  exec <path> - Run an ELF program (initrd, or FAT disk under /disk)");
+    terminal_println("  execbench - Compare program start time, demand paged and read up front");
+    terminal_println("  timerbench - Time timer add/cancel and measure expiry lateness");
+    terminal_println("  irqstat  - Show interrupt counts, interrupts-off time and softirqs");
+    terminal_println("  irqbench - Compare interrupts-off time with bottom halves inline and deferred");
+    terminal_println("  fbcon [WxH|off] - Switch the console to a framebuffer mode (default 1024x768)");
+    terminal_println("  fbstat   - Show framebuffer console mode and flush times");
+    terminal_println("  fbbench  - Time framebuffer console redraws, scrolls and paced output");
+    terminal_println("  ansibench - Time escape sequence output and hardware cursor updates");
+    terminal_println("  vcbench  - Time console switches and background console output");
+    terminal_println("  sbstat   - Show scrollback lines and bytes per character");
+    terminal_println("  dmesg [-n level] [level] [subsystem] - Show the kernel log, or set the console level");
+    terminal_println("  klogstat - Show kernel log records and logging/rendering times");
+    terminal_println("  latency  - Show keystroke-to-screen latency p50/p99/max and reset");
+    terminal_println("  heapprof [reset] - Show page allocations by call site (make HEAPPROF=1)");
+    terminal_println("  crcbench - Compare CRC-32C table and SSE4.2 throughput from 64 B to 1 MB");
+    terminal_println("  grep [-v] <pattern> - Show piped lines containing a pattern (cmd | grep x)");
+    terminal_println("  time <command> - Run a command and show its cycles and microseconds");
+    terminal_println("  repeat <n> <command> - Run a command n times, output discarded, and time it");
+    terminal_println("  cmd | cmd, cmd > /dev/null, cmd > /dev/serial - Pipe or redirect output");
+    terminal_println("  Alt+F1-F6 - Switch virtual console");
+    terminal_println("  Shift+PgUp/PgDn - Browse scrollback");
+    terminal_println("  blkstat  - Show block queue merges, depth and latency");
+    terminal_println("  cachestat - Show block cache statistics");
+    terminal_println("  sync     - Write dirty cached blocks to disk");
+    terminal_println("  cachebench [device] - Compare cold and warm reads through the block cache");
 }
 
 void cmd_clear(void) {
@@ -280,6 +657,259 @@ void cmd_status(void) {
     terminal_writestring("  Caps Lock: ");
     terminal_println(keyboard_state.caps_lock ? "ON" : "OFF");
     terminal_writestring("  Command History: ");
-    terminal_print_dec(command_line.history_count);
+    terminal_print_dec(command_line->history_count);
     terminal_println(" entries");
-} 
\ No newline at end of file
+
+    const fpu_stats_t* fpu = fpu_get_stats();
+    terminal_writestring("  FPU: ");
+    terminal_writestring(fpu_sse2_available() ? "SSE2" : (fpu_sse_available() ? "SSE" : "x87"));
+    terminal_writestring(", ");
+    terminal_print_dec(fpu->nm_traps);
+    terminal_writestring(" lazy traps, ");
+    terminal_print_dec(fpu->saves);
+    terminal_writestring(" saves, ");
+    terminal_print_dec(fpu->restores);
+    terminal_println(" restores");
+
+    terminal_writestring("  Boot code freed: ");
+    terminal_print_dec(pmm_get_init_freed_pages() * PAGE_SIZE / 1024);
+    terminal_println(" KB");
+} 
+
+void cmd_sysbench(void) {
+    syscall_benchmark();
+}
+
+void cmd_cowbench(void) {
+    paging_clone_benchmark();
+}
+
+void cmd_ipcbench(void) {
+    ipc_benchmark();
+}
+
+void cmd_futexbench(void) {
+    futex_benchmark();
+}
+
+void cmd_klibbench(const char* args) {
+    klib_benchmark(args);
+}
+
+void cmd_lspci(void) {
+    pci_list();
+}
+
+void cmd_blkbench(const char* args) {
+    blkdev_benchmark(args);
+}
+
+void cmd_cachestat(void) {
+    bcache_print_stats();
+}
+
+void cmd_sync(void) {
+    if (bcache_sync(0) != E_OK) {
+        terminal_println("sync: write error");
+    }
+}
+
+void cmd_cachebench(const char* args) {
+    bcache_benchmark(args);
+}
+
+void cmd_blkstat(void) {
+    blkdev_print_stats();
+}
+
+// Paths under FAT_MOUNT_POINT go to the FAT disk, the rest to the initrd.
+// The root listing shows the mount point with the initrd's entries.
+void cmd_ls(const char* args) {
+    const char* path = fat_path(args);
+    if (path) {
+        fat_ls(path);
+        return;
+    }
+    initrd_ls(args);
+
+    while (*args == '/') {
+        args++;
+    }
+    if (!*args && fat_mounted()) {
+        terminal_writestring("  ");
+        terminal_writestring(FAT_MOUNT_POINT + 1);
+        terminal_println("/");
+    }
+}
+
+void cmd_cat(const char* args) {
+    const char* path = fat_path(args);
+    if (path) {
+        fat_cat(path);
+    } else {
+        initrd_cat(args);
+    }
+}
+
+void cmd_stat(const char* args) {
+    const char* path = fat_path(args);
+    if (path) {
+        fat_stat(path);
+    } else {
+        initrd_stat(args);
+    }
+}
+
+void cmd_initrdbench(void) {
+    initrd_benchmark();
+}
+
+// Without a path fatbench reads its default file
+void cmd_fatbench(const char* args) {
+    if (!*args) {
+        fat_benchmark("");
+        return;
+    }
+    const char* path = fat_path(args);
+    if (!path) {
+        terminal_println("fatbench: path must be under " FAT_MOUNT_POINT);
+        return;
+    }
+    fat_benchmark(*path ? path : "/");
+}
+
+void cmd_exec(const char* args) {
+    elf_exec(args);
+}
+
+void cmd_execbench(void) {
+    elf_benchmark();
+}
+
+void cmd_timerbench(void) {
+    timer_wheel_benchmark();
+}
+
+void cmd_irqstat(void) {
+    softirq_print_stats();
+}
+
+void cmd_irqbench(void) {
+    softirq_benchmark();
+}
+
+void cmd_fbcon(const char* args) {
+    fbcon_command(args);
+}
+
+void cmd_fbstat(void) {
+    fbcon_print_stats();
+}
+
+void cmd_fbbench(void) {
+    fbcon_benchmark();
+}
+
+void cmd_ansibench(void) {
+    terminal_benchmark();
+}
+
+void cmd_vcbench(void) {
+    terminal_console_benchmark();
+}
+
+void cmd_sbstat(void) {
+    terminal_scrollback_print_stats();
+}
+
+void cmd_dmesg(const char* args) {
+    klog_dmesg(args);
+}
+
+void cmd_klogstat(void) {
+    klog_print_stats();
+}
+
+void cmd_latency(void) {
+    latency_print();
+}
+
+void cmd_heapprof(const char* args) {
+    heapprof_print(args);
+}
+
+void cmd_crcbench(void) {
+    crc32c_benchmark();
+}
+
+// Print the input lines that contain a pattern (-v: that do not)
+void cmd_grep(const char* args) {
+    static char line[MAX_COMMAND_LENGTH];
+    int invert = 0;
+    if (strncmp(args, "-v ", 3) == 0) {
+        invert = 1;
+        args += 3;
+    }
+    if (!args[0] || !command_input) {
+        terminal_println("Usage: <command> | grep [-v] <pattern>");
+        return;
+    }
+    while (stream_read_line(command_input, line, sizeof(line)) >= 0) {
+        if ((strstr(line, args) != 0) != invert) {
+            terminal_writestring(line);
+            terminal_putchar('\n');
+        }
+    }
+}
+
+// Run a command line and show how long it took
+void cmd_time(const char* args) {
+    uint64_t start = rdtsc();
+    command_line_execute_command(args);
+    uint64_t cycles = rdtsc() - start;
+
+    terminal_writestring("time: ");
+    terminal_print_dec64(cycles);
+    terminal_writestring(" cycles, ");
+    terminal_print_dec(timer_cycles_to_us(cycles, 1));
+    terminal_println(" us");
+}
+
+// Run a command line count times with its output discarded, so what is
+// timed is the command and not the screen
+void cmd_repeat(const char* args) {
+    uint32_t count = 0;
+    while (*args >= '0' && *args <= '9' && count <= MAX_REPEAT_COUNT) {
+        count = count * 10 + (*args++ - '0');
+    }
+    while (*args == ' ') {
+        args++;
+    }
+    if (count == 0 || count > MAX_REPEAT_COUNT || !args[0]) {
+        terminal_writestring("Usage: repeat <count> <command> (count 1-");
+        terminal_print_dec(MAX_REPEAT_COUNT);
+        terminal_println(")");
+        return;
+    }
+
+    stream_t discard;
+    stream_null(&discard);
+    stream_t* previous = terminal_set_output(&discard);
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < count; i++) {
+        command_line_execute_command(args);
+    }
+    uint64_t cycles = rdtsc() - start;
+    terminal_set_output(previous);
+
+    uint64_t per_run = div64_32(cycles, count);
+    terminal_writestring("repeat: ");
+    terminal_print_dec(count);
+    terminal_writestring(" runs in ");
+    terminal_print_dec(timer_cycles_to_us(cycles, 1));
+    terminal_writestring(" us, ");
+    terminal_print_dec64(per_run);
+    terminal_writestring(" cycles (");
+    terminal_print_dec(timer_cycles_to_us(cycles, count));
+    terminal_println(" us) per run");
+}
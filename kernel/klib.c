@@ -0,0 +1,686 @@
+#include "klib.h"
+#include "cpu.h"
+#include "fpu.h"
+#include "memory.h"
+#include "init.h"
+
+// CPUID leaf 7 feature bits (EBX)
+#define CPUID_7_EBX_ERMS (1 << 9)
+
+// Word access that may alias any other type
+typedef uint32_t __attribute__((may_alias)) klib_word_t;
+
+#define ONES  0x01010101u
+#define HIGHS 0x80808080u
+#define HAS_ZERO_BYTE(w) (((w) - ONES) & ~(w) & HIGHS)
+
+typedef void* (*memcpy_fn_t)(void* dest, const void* src, size_t n);
+typedef void* (*memset_fn_t)(void* dest, int c, size_t n);
+typedef int (*memcmp_fn_t)(const void* a, const void* b, size_t n);
+typedef size_t (*strlen_fn_t)(const char* str);
+typedef char* (*strchr_fn_t)(const char* str, int c);
+
+// memcpy
+
+static void* memcpy_byte(void* dest, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+static void* memcpy_swar(void* dest, const void* src, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    while (n >= 4) {
+        *(klib_word_t*)d = *(const klib_word_t*)s;
+        d += 4;
+        s += 4;
+        n -= 4;
+    }
+    while (n--) {
+        *d++ = *s++;
+    }
+    return dest;
+}
+
+static void* memcpy_rep(void* dest, const void* src, size_t n) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile("rep movsl\n\t"
+                     "movl %4, %%ecx\n\t"
+                     "andl $3, %%ecx\n\t"
+                     "jz 1f\n\t"
+                     "rep movsb\n"
+                     "1:"
+                     : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+                     : "0"(n / 4), "g"(n), "1"(dest), "2"(src)
+                     : "memory", "cc");
+    return dest;
+}
+
+static void* memcpy_erms(void* dest, const void* src, size_t n) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile("rep movsb"
+                     : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+                     : "0"(n), "1"(dest), "2"(src)
+                     : "memory");
+    return dest;
+}
+
+// Align the destination, then move 64 bytes per iteration with unaligned
+// loads and aligned stores
+static void* memcpy_sse2(void* dest, const void* src, size_t n) {
+    if (n < KLIB_SSE2_MIN_SIZE || !kernel_fpu_try_begin()) {
+        return memcpy_rep(dest, src, n);
+    }
+
+    uint8_t* d = (uint8_t*)dest;
+    const uint8_t* s = (const uint8_t*)src;
+    size_t head = (16 - ((uint32_t)d & 15)) & 15;
+    memcpy_swar(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    size_t blocks = n / 64;
+    if (blocks) {
+        __asm__ volatile("1:\n\t"
+                         "movdqu (%1), %%xmm0\n\t"
+                         "movdqu 16(%1), %%xmm1\n\t"
+                         "movdqu 32(%1), %%xmm2\n\t"
+                         "movdqu 48(%1), %%xmm3\n\t"
+                         "movdqa %%xmm0, (%0)\n\t"
+                         "movdqa %%xmm1, 16(%0)\n\t"
+                         "movdqa %%xmm2, 32(%0)\n\t"
+                         "movdqa %%xmm3, 48(%0)\n\t"
+                         "addl $64, %1\n\t"
+                         "addl $64, %0\n\t"
+                         "decl %2\n\t"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(s), "+r"(blocks)
+                         :
+                         : "memory", "cc");
+    }
+    kernel_fpu_end();
+
+    memcpy_swar(d, s, n & 63);
+    return dest;
+}
+
+// memset
+
+static void* memset_byte(void* dest, int c, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    while (n--) {
+        *d++ = (uint8_t)c;
+    }
+    return dest;
+}
+
+static void* memset_swar(void* dest, int c, size_t n) {
+    uint8_t* d = (uint8_t*)dest;
+    uint32_t pattern = (uint8_t)c * ONES;
+    while (n >= 4) {
+        *(klib_word_t*)d = pattern;
+        d += 4;
+        n -= 4;
+    }
+    while (n--) {
+        *d++ = (uint8_t)c;
+    }
+    return dest;
+}
+
+static void* memset_rep(void* dest, int c, size_t n) {
+    uint32_t d0, d1;
+    __asm__ volatile("rep stosl\n\t"
+                     "movl %3, %%ecx\n\t"
+                     "andl $3, %%ecx\n\t"
+                     "jz 1f\n\t"
+                     "rep stosb\n"
+                     "1:"
+                     : "=&c"(d0), "=&D"(d1)
+                     : "a"((uint8_t)c * ONES), "g"(n), "0"(n / 4), "1"(dest)
+                     : "memory", "cc");
+    return dest;
+}
+
+static void* memset_erms(void* dest, int c, size_t n) {
+    uint32_t d0, d1;
+    __asm__ volatile("rep stosb"
+                     : "=&c"(d0), "=&D"(d1)
+                     : "a"(c), "0"(n), "1"(dest)
+                     : "memory");
+    return dest;
+}
+
+static void* memset_sse2(void* dest, int c, size_t n) {
+    if (n < KLIB_SSE2_MIN_SIZE || !kernel_fpu_try_begin()) {
+        return memset_rep(dest, c, n);
+    }
+
+    uint8_t* d = (uint8_t*)dest;
+    size_t head = (16 - ((uint32_t)d & 15)) & 15;
+    memset_swar(d, c, head);
+    d += head;
+    n -= head;
+
+    size_t blocks = n / 64;
+    if (blocks) {
+        __asm__ volatile("movd %2, %%xmm0\n\t"
+                         "pshufd $0, %%xmm0, %%xmm0\n"
+                         "1:\n\t"
+                         "movdqa %%xmm0, (%0)\n\t"
+                         "movdqa %%xmm0, 16(%0)\n\t"
+                         "movdqa %%xmm0, 32(%0)\n\t"
+                         "movdqa %%xmm0, 48(%0)\n\t"
+                         "addl $64, %0\n\t"
+                         "decl %1\n\t"
+                         "jnz 1b"
+                         : "+r"(d), "+r"(blocks)
+                         : "r"((uint8_t)c * ONES)
+                         : "memory", "cc");
+    }
+    kernel_fpu_end();
+
+    memset_swar(d, c, n & 63);
+    return dest;
+}
+
+// memcmp
+
+static int memcmp_byte(const void* a, const void* b, size_t n) {
+    const uint8_t* p = (const uint8_t*)a;
+    const uint8_t* q = (const uint8_t*)b;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] != q[i]) {
+            return p[i] < q[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// Skip equal words, then let the byte loop order the first difference
+static int memcmp_swar(const void* a, const void* b, size_t n) {
+    const uint8_t* p = (const uint8_t*)a;
+    const uint8_t* q = (const uint8_t*)b;
+    while (n >= 4 && *(const klib_word_t*)p == *(const klib_word_t*)q) {
+        p += 4;
+        q += 4;
+        n -= 4;
+    }
+    return memcmp_byte(p, q, n);
+}
+
+static int memcmp_sse2(const void* a, const void* b, size_t n) {
+    if (n < KLIB_SSE2_MIN_SIZE || !kernel_fpu_try_begin()) {
+        return memcmp_swar(a, b, n);
+    }
+
+    // Stop at the first 16-byte block with a difference
+    const uint8_t* p = (const uint8_t*)a;
+    const uint8_t* q = (const uint8_t*)b;
+    size_t blocks = n / 16;
+    uint32_t mask;
+    __asm__ volatile("1:\n\t"
+                     "movdqu (%0), %%xmm0\n\t"
+                     "movdqu (%1), %%xmm1\n\t"
+                     "pcmpeqb %%xmm1, %%xmm0\n\t"
+                     "pmovmskb %%xmm0, %3\n\t"
+                     "cmpl $0xFFFF, %3\n\t"
+                     "jne 2f\n\t"
+                     "addl $16, %0\n\t"
+                     "addl $16, %1\n\t"
+                     "decl %2\n\t"
+                     "jnz 1b\n"
+                     "2:"
+                     : "+r"(p), "+r"(q), "+r"(blocks), "=&r"(mask)
+                     :
+                     : "memory", "cc");
+    kernel_fpu_end();
+
+    return memcmp_swar(p, q, n - (size_t)(p - (const uint8_t*)a));
+}
+
+// strlen
+
+static size_t strlen_byte(const char* str) {
+    size_t len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+// Aligned word reads never cross into an unmapped page
+static size_t strlen_swar(const char* str) {
+    const char* p = str;
+    while ((uint32_t)p & 3) {
+        if (!*p) {
+            return (size_t)(p - str);
+        }
+        p++;
+    }
+    const klib_word_t* w = (const klib_word_t*)p;
+    while (!HAS_ZERO_BYTE(*w)) {
+        w++;
+    }
+    for (p = (const char*)w; *p; p++) {
+    }
+    return (size_t)(p - str);
+}
+
+// Compare aligned 16-byte blocks against zero; bytes before str in the
+// first block are shifted out of the mask
+static size_t strlen_sse2(const char* str) {
+    if (!kernel_fpu_try_begin()) {
+        return strlen_swar(str);
+    }
+
+    const char* block = (const char*)((uint32_t)str & ~15u);
+    uint32_t mask;
+    __asm__ volatile("pxor %%xmm0, %%xmm0\n\t"
+                     "movdqa (%1), %%xmm1\n\t"
+                     "pcmpeqb %%xmm0, %%xmm1\n\t"
+                     "pmovmskb %%xmm1, %0"
+                     : "=r"(mask)
+                     : "r"(block)
+                     : "memory");
+    mask >>= (uint32_t)str & 15;
+
+    size_t len;
+    if (mask) {
+        len = __builtin_ctz(mask);
+    } else {
+        __asm__ volatile("1:\n\t"
+                         "addl $16, %1\n\t"
+                         "movdqa (%1), %%xmm1\n\t"
+                         "pcmpeqb %%xmm0, %%xmm1\n\t"
+                         "pmovmskb %%xmm1, %0\n\t"
+                         "testl %0, %0\n\t"
+                         "jz 1b"
+                         : "=&r"(mask), "+r"(block)
+                         :
+                         : "memory", "cc");
+        len = (size_t)(block - str) + __builtin_ctz(mask);
+    }
+    kernel_fpu_end();
+    return len;
+}
+
+// strchr
+
+static char* strchr_byte(const char* str, int c) {
+    for (;; str++) {
+        if (*str == (char)c) {
+            return (char*)str;
+        }
+        if (!*str) {
+            return 0;
+        }
+    }
+}
+
+static char* strchr_swar(const char* str, int c) {
+    while ((uint32_t)str & 3) {
+        if (*str == (char)c) {
+            return (char*)str;
+        }
+        if (!*str) {
+            return 0;
+        }
+        str++;
+    }
+    uint32_t pattern = (uint8_t)c * ONES;
+    const klib_word_t* w = (const klib_word_t*)str;
+    while (!HAS_ZERO_BYTE(*w) && !HAS_ZERO_BYTE(*w ^ pattern)) {
+        w++;
+    }
+    return strchr_byte((const char*)w, c);
+}
+
+static char* strchr_sse2(const char* str, int c) {
+    if (!kernel_fpu_try_begin()) {
+        return strchr_swar(str, c);
+    }
+
+    // Match the terminator or c in aligned 16-byte blocks
+    const char* block = (const char*)((uint32_t)str & ~15u);
+    uint32_t mask;
+    __asm__ volatile("movd %2, %%xmm2\n\t"
+                     "pshufd $0, %%xmm2, %%xmm2\n\t"
+                     "pxor %%xmm0, %%xmm0\n\t"
+                     "movdqa (%1), %%xmm1\n\t"
+                     "movdqa %%xmm1, %%xmm3\n\t"
+                     "pcmpeqb %%xmm0, %%xmm1\n\t"
+                     "pcmpeqb %%xmm2, %%xmm3\n\t"
+                     "por %%xmm3, %%xmm1\n\t"
+                     "pmovmskb %%xmm1, %0"
+                     : "=r"(mask)
+                     : "r"(block), "r"((uint8_t)c * ONES)
+                     : "memory");
+    mask >>= (uint32_t)str & 15;
+
+    const char* p;
+    if (mask) {
+        p = str + __builtin_ctz(mask);
+    } else {
+        __asm__ volatile("1:\n\t"
+                         "addl $16, %1\n\t"
+                         "movdqa (%1), %%xmm1\n\t"
+                         "movdqa %%xmm1, %%xmm3\n\t"
+                         "pcmpeqb %%xmm0, %%xmm1\n\t"
+                         "pcmpeqb %%xmm2, %%xmm3\n\t"
+                         "por %%xmm3, %%xmm1\n\t"
+                         "pmovmskb %%xmm1, %0\n\t"
+                         "testl %0, %0\n\t"
+                         "jz 1b"
+                         : "=&r"(mask), "+r"(block)
+                         :
+                         : "memory", "cc");
+        p = block + __builtin_ctz(mask);
+    }
+    kernel_fpu_end();
+    return *p == (char)c ? (char*)p : 0;
+}
+
+// Variant tables (0 = not implemented or not supported by this CPU)
+static memcpy_fn_t memcpy_variants[KLIB_VARIANTS] = {
+    memcpy_byte, memcpy_swar, memcpy_rep, memcpy_erms, memcpy_sse2
+};
+static memset_fn_t memset_variants[KLIB_VARIANTS] = {
+    memset_byte, memset_swar, memset_rep, memset_erms, memset_sse2
+};
+static memcmp_fn_t memcmp_variants[KLIB_VARIANTS] = {
+    memcmp_byte, memcmp_swar, 0, 0, memcmp_sse2
+};
+static strlen_fn_t strlen_variants[KLIB_VARIANTS] = {
+    strlen_byte, strlen_swar, 0, 0, strlen_sse2
+};
+static strchr_fn_t strchr_variants[KLIB_VARIANTS] = {
+    strchr_byte, strchr_swar, 0, 0, strchr_sse2
+};
+
+static const char* const variant_names[KLIB_VARIANTS] = {
+    "byte", "swar", "rep", "erms", "sse2"
+};
+
+// Selected variants (index into the tables above)
+static int memcpy_large = KLIB_VARIANT_REP;
+static int memset_large = KLIB_VARIANT_REP;
+static int memcmp_selected = KLIB_VARIANT_SWAR;
+static int strlen_selected = KLIB_VARIANT_SWAR;
+static int strchr_selected = KLIB_VARIANT_SWAR;
+
+// Pick the variants for this CPU. SSE2 needs fpu_init() to have run.
+// strlen/strchr stay on SWAR: kernel strings are short and the vector
+// versions would pay for kernel_fpu_begin() on every call.
+void __init klib_init(void) {
+    uint32_t max_leaf, ebx7 = 0;
+    cpuid(0, &max_leaf, 0, 0, 0);
+    if (max_leaf >= 7) {
+        cpuid(7, 0, &ebx7, 0, 0);
+    }
+    int erms = (ebx7 & CPUID_7_EBX_ERMS) != 0;
+    int sse2 = fpu_sse2_available();
+
+    if (!erms) {
+        memcpy_variants[KLIB_VARIANT_ERMS] = 0;
+        memset_variants[KLIB_VARIANT_ERMS] = 0;
+    }
+    if (!sse2) {
+        memcpy_variants[KLIB_VARIANT_SSE2] = 0;
+        memset_variants[KLIB_VARIANT_SSE2] = 0;
+        memcmp_variants[KLIB_VARIANT_SSE2] = 0;
+        strlen_variants[KLIB_VARIANT_SSE2] = 0;
+        strchr_variants[KLIB_VARIANT_SSE2] = 0;
+    }
+
+    // Fast strings win for large blocks when the CPU has them; otherwise
+    // SSE2 beats rep movsd/stosd once the FPU save is amortised
+    memcpy_large = erms ? KLIB_VARIANT_ERMS : (sse2 ? KLIB_VARIANT_SSE2 : KLIB_VARIANT_REP);
+    memset_large = erms ? KLIB_VARIANT_ERMS : (sse2 ? KLIB_VARIANT_SSE2 : KLIB_VARIANT_REP);
+    memcmp_selected = sse2 ? KLIB_VARIANT_SSE2 : KLIB_VARIANT_SWAR;
+}
+
+// Public entry points
+
+void* memcpy(void* dest, const void* src, size_t n) {
+    if (n < KLIB_SMALL_SIZE) {
+        return memcpy_swar(dest, src, n);
+    }
+    return memcpy_variants[memcpy_large](dest, src, n);
+}
+
+// Overlapping copies towards higher addresses run backwards
+void* memmove(void* dest, const void* src, size_t n) {
+    if ((uint32_t)dest - (uint32_t)src >= n) {
+        return memcpy(dest, src, n);
+    }
+
+    uint8_t* d = (uint8_t*)dest + n;
+    const uint8_t* s = (const uint8_t*)src + n;
+    while (n & 3) {
+        *--d = *--s;
+        n--;
+    }
+    if (n) {
+        uint32_t d0, d1, d2;
+        __asm__ volatile("std\n\t"
+                         "rep movsl\n\t"
+                         "cld"
+                         : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+                         : "0"(n / 4), "1"(d - 4), "2"(s - 4)
+                         : "memory");
+    }
+    return dest;
+}
+
+void* memset(void* dest, int c, size_t n) {
+    if (n < KLIB_SMALL_SIZE) {
+        return memset_swar(dest, c, n);
+    }
+    return memset_variants[memset_large](dest, c, n);
+}
+
+int memcmp(const void* a, const void* b, size_t n) {
+    return memcmp_variants[memcmp_selected](a, b, n);
+}
+
+size_t strlen(const char* str) {
+    return strlen_variants[strlen_selected](str);
+}
+
+char* strchr(const char* str, int c) {
+    return strchr_variants[strchr_selected](str, c);
+}
+
+// String copy function
+char* strcpy(char* dest, const char* src) {
+    char* ptr = dest;
+    while (*src) {
+        *ptr = *src;
+        ptr++;
+        src++;
+    }
+    *ptr = '\0';
+    return dest;
+}
+
+// String compare function
+int strcmp(const char* str1, const char* str2) {
+    while (*str1 && *str2) {
+        if (*str1 != *str2) {
+            return (*str1 < *str2) ? -1 : 1;
+        }
+        str1++;
+        str2++;
+    }
+    return (*str1 == *str2) ? 0 : (*str1 < *str2) ? -1 : 1;
+}
+
+// String compare with length function
+int strncmp(const char* str1, const char* str2, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (str1[i] != str2[i]) {
+            return (str1[i] < str2[i]) ? -1 : 1;
+        }
+        if (str1[i] == '\0') {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Substring search: first occurrence of needle in haystack, 0 if none
+char* strstr(const char* haystack, const char* needle) {
+    size_t length = strlen(needle);
+    if (length == 0) {
+        return (char*)haystack;
+    }
+    for (const char* p = strchr(haystack, needle[0]); p; p = strchr(p + 1, needle[0])) {
+        if (strncmp(p, needle, length) == 0) {
+            return (char*)p;
+        }
+    }
+    return 0;
+}
+
+// Benchmark: bytes per cycle for every available variant and size class.
+// Each measurement processes about KLIB_BENCH_BYTES bytes.
+#define KLIB_BENCH_ROUTINES 5
+#define KLIB_BENCH_SIZES    6
+#define KLIB_BENCH_MAX_SIZE (64 * 1024)
+#define KLIB_BENCH_BYTES    (1024 * 1024)
+
+static const char* const bench_routines[KLIB_BENCH_ROUTINES] = {
+    "memcpy", "memset", "memcmp", "strlen", "strchr"
+};
+static const uint32_t bench_sizes[KLIB_BENCH_SIZES] = {
+    16, 64, 256, 1024, 4096, 64 * 1024
+};
+
+static int bench_available(int routine, int variant) {
+    switch (routine) {
+        case 0: return memcpy_variants[variant] != 0;
+        case 1: return memset_variants[variant] != 0;
+        case 2: return memcmp_variants[variant] != 0;
+        case 3: return strlen_variants[variant] != 0;
+        default: return strchr_variants[variant] != 0;
+    }
+}
+
+// Variant the public entry point uses for a given size
+static int bench_selected(int routine, uint32_t size) {
+    switch (routine) {
+        case 0: return size < KLIB_SMALL_SIZE ? KLIB_VARIANT_SWAR : memcpy_large;
+        case 1: return size < KLIB_SMALL_SIZE ? KLIB_VARIANT_SWAR : memset_large;
+        case 2: return memcmp_selected;
+        case 3: return strlen_selected;
+        default: return strchr_selected;
+    }
+}
+
+static uint64_t bench_run(int routine, int variant, uint8_t* dst, uint8_t* src,
+                          uint32_t size, uint32_t iterations) {
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < iterations; i++) {
+        switch (routine) {
+            case 0: memcpy_variants[variant](dst, src, size); break;
+            case 1: memset_variants[variant](dst, 0, size); break;
+            case 2: memcmp_variants[variant](dst, src, size); break;
+            case 3: strlen_variants[variant]((const char*)src); break;
+            default: strchr_variants[variant]((const char*)src, 'b'); break;
+        }
+    }
+    return rdtsc() - start;
+}
+
+static void bench_print_padded(uint32_t value, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10) {
+        digits++;
+    }
+    for (; digits < width; digits++) {
+        terminal_putchar(' ');
+    }
+    terminal_print_dec(value);
+}
+
+// Print hundredths as "d.dd"
+static void bench_print_ratio(uint32_t hundredths) {
+    bench_print_padded(hundredths / 100, 4);
+    terminal_putchar('.');
+    terminal_putchar('0' + (hundredths / 10) % 10);
+    terminal_putchar('0' + hundredths % 10);
+}
+
+static void bench_routine(int routine, uint8_t* dst, uint8_t* src) {
+    terminal_writestring(bench_routines[routine]);
+    terminal_println(" bytes/cycle (* = used by the kernel)");
+    terminal_writestring("   size");
+    for (int v = 0; v < KLIB_VARIANTS; v++) {
+        terminal_writestring("     ");
+        terminal_writestring(variant_names[v]);
+    }
+    terminal_putchar('\n');
+
+    for (int n = 0; n < KLIB_BENCH_SIZES; n++) {
+        uint32_t size = bench_sizes[n];
+        uint32_t iterations = KLIB_BENCH_BYTES / size;
+
+        // String routines scan size bytes: no match, terminator at the end
+        memset(src, 'a', size);
+        src[size - 1] = 0;
+        memcpy(dst, src, size);
+
+        bench_print_padded(size, 7);
+        for (int v = 0; v < KLIB_VARIANTS; v++) {
+            if (!bench_available(routine, v)) {
+                terminal_writestring("        -");
+                continue;
+            }
+            uint64_t cycles = bench_run(routine, v, dst, src, size, iterations);
+            uint64_t hundredths = cycles ? div64_32((uint64_t)size * iterations * 100, (uint32_t)cycles) : 0;
+            terminal_putchar(' ');
+            bench_print_ratio((uint32_t)hundredths);
+            terminal_putchar(bench_selected(routine, size) == v ? '*' : ' ');
+        }
+        terminal_putchar('\n');
+    }
+}
+
+// Run the benchmark for one routine, or for all of them if routine is
+// empty
+void klib_benchmark(const char* routine) {
+    uint32_t pages = KLIB_BENCH_MAX_SIZE / PAGE_SIZE;
+    uint8_t* dst = (uint8_t*)pmm_alloc(pages);
+    uint8_t* src = (uint8_t*)pmm_alloc(pages);
+    if (!dst || !src) {
+        terminal_println("klibbench: out of memory");
+        if (dst) {
+            pmm_free(dst, pages);
+        }
+        if (src) {
+            pmm_free(src, pages);
+        }
+        return;
+    }
+
+    int found = 0;
+    for (int r = 0; r < KLIB_BENCH_ROUTINES; r++) {
+        if (*routine && strcmp(routine, bench_routines[r]) != 0) {
+            continue;
+        }
+        bench_routine(r, dst, src);
+        found = 1;
+    }
+    if (!found) {
+        terminal_println("Usage: klibbench [memcpy|memset|memcmp|strlen|strchr]");
+    }
+
+    pmm_free(dst, pages);
+    pmm_free(src, pages);
+}
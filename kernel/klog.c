@@ -0,0 +1,433 @@
+#include "klog.h"
+#include "kdata.h"
+#include "sched.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "cpu.h"
+#include "klib.h"
+#include "init.h"
+
+// Results of klog_read()
+#define KLOG_READ_OK       0
+#define KLOG_READ_PENDING  1                // Not complete yet
+#define KLOG_READ_LOST     2                // Overwritten by a newer record
+
+// Rendered line: "[sssss.uuuuuu] subsystem: text", color codes, newline
+#define KLOG_LINE_MAX (KLOG_TEXT_MAX + KLOG_SUBSYS_MAX + 40)
+
+static const char* const level_names[KLOG_LEVELS] = { "err", "warn", "info", "debug" };
+
+static klog_record_t ring[KLOG_RECORDS];
+static volatile uint32_t next_seq;          // Sequence number of the next record
+
+// Console consumer. console_seq only moves with interrupts disabled.
+static uint32_t console_seq;                // Next record for the console
+static volatile uint32_t console_level = KLOG_CONSOLE_LEVEL;
+static wait_queue_t klogd_wait;
+static thread_t* klogd;
+
+// Statistics are updated with interrupts disabled (there is one CPU)
+static klog_stats_t stats;
+
+static void klog_thread(uint32_t arg);
+
+void __init klog_init(void) {
+    wait_queue_init(&klogd_wait);
+    klogd = thread_create("klogd", klog_thread, 0);
+    if (!klogd) {
+        klog(KLOG_ERR, "klog", "cannot create klogd");
+    }
+}
+
+// Bounded string builder; length keeps counting past the end so callers
+// can tell the output was cut
+typedef struct {
+    char* data;
+    size_t size;
+    size_t length;
+} klog_buf_t;
+
+static void buf_putc(klog_buf_t* buf, char c) {
+    if (buf->length < buf->size) {
+        buf->data[buf->length] = c;
+    }
+    buf->length++;
+}
+
+static void buf_puts(klog_buf_t* buf, const char* str) {
+    while (*str) {
+        buf_putc(buf, *str++);
+    }
+}
+
+// Decimal, padded to width with pad
+static void buf_dec(klog_buf_t* buf, uint32_t value, uint32_t width, char pad) {
+    char digits[10];
+    uint32_t count = 0;
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (width > count) {
+        buf_putc(buf, pad);
+        width--;
+    }
+    while (count) {
+        buf_putc(buf, digits[--count]);
+    }
+}
+
+// Same format as terminal_print_hex
+static void buf_hex(klog_buf_t* buf, uint32_t value) {
+    buf_puts(buf, "0x");
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        buf_putc(buf, "0123456789ABCDEF"[(value >> shift) & 0xF]);
+    }
+}
+
+// %s, %c, %d, %u, %x and %%
+static void klog_format(klog_buf_t* buf, const char* format, __builtin_va_list args) {
+    for (; *format; format++) {
+        if (*format != '%' || !format[1]) {
+            buf_putc(buf, *format);
+            continue;
+        }
+        switch (*++format) {
+            case 's': {
+                const char* str = __builtin_va_arg(args, const char*);
+                buf_puts(buf, str ? str : "(null)");
+                break;
+            }
+            case 'c':
+                buf_putc(buf, (char)__builtin_va_arg(args, int));
+                break;
+            case 'd': {
+                int32_t value = __builtin_va_arg(args, int32_t);
+                if (value < 0) {
+                    buf_putc(buf, '-');
+                    buf_dec(buf, -(uint32_t)value, 0, 0);
+                } else {
+                    buf_dec(buf, value, 0, 0);
+                }
+                break;
+            }
+            case 'u':
+                buf_dec(buf, __builtin_va_arg(args, uint32_t), 0, 0);
+                break;
+            case 'x':
+                buf_hex(buf, __builtin_va_arg(args, uint32_t));
+                break;
+            default:
+                buf_putc(buf, *format);
+                break;
+        }
+    }
+}
+
+// Format into a buffer on the caller's stack, then copy into the ring
+void klog(uint32_t level, const char* subsystem, const char* format, ...) {
+    char text[KLOG_TEXT_MAX];
+    klog_buf_t buf = { text, sizeof(text), 0 };
+    __builtin_va_list args;
+    __builtin_va_start(args, format);
+    klog_format(&buf, format, args);
+    __builtin_va_end(args);
+    klog_write(level, subsystem, text, buf.length);
+}
+
+void klog_write(uint32_t level, const char* subsystem, const char* text, size_t length) {
+    uint64_t start = rdtsc();
+    int truncated = length > KLOG_TEXT_MAX;
+    if (truncated) {
+        length = KLOG_TEXT_MAX;
+    }
+
+    // Claim a sequence number and with it a slot (lock xadd)
+    uint32_t seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    klog_record_t* record = &ring[seq & (KLOG_RECORDS - 1)];
+
+    // x86 keeps stores in order, so readers see commit cleared before the
+    // new contents and set only after them
+    record->commit = 0;
+    __asm__ volatile("" : : : "memory");
+    record->seq = seq;
+    record->time_ns = kdata_monotonic_ns();
+    record->level = level < KLOG_LEVELS ? level : KLOG_DEBUG;
+    record->length = length;
+    size_t i = 0;
+    for (; i < KLOG_SUBSYS_MAX - 1 && subsystem[i]; i++) {
+        record->subsystem[i] = subsystem[i];
+    }
+    record->subsystem[i] = 0;
+    memcpy(record->text, text, length);
+    __asm__ volatile("" : : : "memory");
+    record->commit = seq + 1;
+
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    uint32_t flags = irq_save();
+    stats.logged++;
+    stats.truncated += truncated;
+    stats.log_cycles += cycles;
+    if (cycles > stats.max_log_cycles) {
+        stats.max_log_cycles = cycles;
+    }
+    irq_restore(flags);
+
+    if (level <= console_level && !wait_queue_empty(&klogd_wait)) {
+        wait_queue_wake_one(&klogd_wait);
+    }
+}
+
+// Copy record seq; the copy is good only if its commit word was the same
+// before and after
+static int klog_read(uint32_t seq, klog_record_t* out) {
+    const klog_record_t* record = &ring[seq & (KLOG_RECORDS - 1)];
+    uint32_t commit = record->commit;
+    if (commit == seq + 1) {
+        *out = *record;
+        __asm__ volatile("" : : : "memory");
+        return record->commit == commit ? KLOG_READ_OK : KLOG_READ_LOST;
+    }
+    if (commit && (int32_t)(commit - (seq + 1)) > 0) {
+        return KLOG_READ_LOST;
+    }
+    return next_seq - seq > KLOG_RECORDS ? KLOG_READ_LOST : KLOG_READ_PENDING;
+}
+
+// "[    1.234567] subsystem: text", errors in red and warnings in yellow
+static size_t klog_render(const klog_record_t* record, char* line) {
+    klog_buf_t buf = { line, KLOG_LINE_MAX, 0 };
+    uint64_t us = div64_32(record->time_ns, 1000);
+    uint32_t seconds = (uint32_t)div64_32(us, 1000000);
+
+    if (record->level == KLOG_ERR) {
+        buf_puts(&buf, "\033[91m");
+    } else if (record->level == KLOG_WARN) {
+        buf_puts(&buf, "\033[93m");
+    }
+    buf_putc(&buf, '[');
+    buf_dec(&buf, seconds, 5, ' ');
+    buf_putc(&buf, '.');
+    buf_dec(&buf, (uint32_t)(us - (uint64_t)seconds * 1000000), 6, '0');
+    buf_puts(&buf, "] ");
+    buf_puts(&buf, record->subsystem);
+    buf_puts(&buf, ": ");
+    for (uint32_t i = 0; i < record->length; i++) {
+        buf_putc(&buf, record->text[i]);
+    }
+    if (record->level <= KLOG_WARN) {
+        buf_puts(&buf, "\033[39m");
+    }
+    buf_putc(&buf, '\n');
+    return buf.length;
+}
+
+static void klog_console_write(const char* line, size_t length) {
+    uint64_t start = rdtsc();
+    terminal_write_console(KLOG_CONSOLE, line, length);
+    stats.render_cycles += rdtsc() - start;
+}
+
+// Drop records until at most backlog are waiting, with a note on how many
+// of them would have been shown
+static void klog_console_skip(uint32_t backlog) {
+    uint32_t skipped = 0;
+    while (next_seq - console_seq > backlog) {
+        klog_record_t record;
+        int result = klog_read(console_seq, &record);
+        if (result == KLOG_READ_LOST) {
+            stats.lost++;
+        } else if (result == KLOG_READ_OK && record.level <= console_level) {
+            skipped++;
+        }
+        console_seq++;
+    }
+    if (skipped) {
+        char line[64];
+        klog_buf_t buf = { line, sizeof(line), 0 };
+        buf_puts(&buf, "klog: ");
+        buf_dec(&buf, skipped, 0, 0);
+        buf_puts(&buf, " messages not shown, see dmesg\n");
+        klog_console_write(line, buf.length);
+        stats.skipped += skipped;
+    }
+}
+
+// Render up to budget records at or above the console level. Each record
+// is consumed with interrupts disabled, so another consumer (klog_flush)
+// can take over between any two of them.
+static void klog_console_flush(uint32_t budget, uint32_t backlog) {
+    char line[KLOG_LINE_MAX];
+    while (budget) {
+        uint32_t flags = irq_save();
+        klog_console_skip(backlog);
+        if (console_seq == next_seq) {
+            irq_restore(flags);
+            break;
+        }
+
+        klog_record_t record;
+        int result = klog_read(console_seq, &record);
+        if (result == KLOG_READ_PENDING) {
+            irq_restore(flags);     // Producer was interrupted, retry later
+            break;
+        }
+        console_seq++;
+        if (result == KLOG_READ_LOST) {
+            stats.lost++;
+        } else if (record.level <= console_level) {
+            size_t length = klog_render(&record, line);
+            klog_console_write(line, length < KLOG_LINE_MAX ? length : KLOG_LINE_MAX);
+            stats.rendered++;
+            budget--;
+        }
+        irq_restore(flags);
+    }
+}
+
+// Render everything pending now, without rate limiting (end of boot, and
+// before the system halts)
+void klog_flush(void) {
+    klog_console_flush(KLOG_RECORDS, KLOG_RECORDS);
+    terminal_flush();
+}
+
+// klogd: sleeps until a record for the console arrives, then renders at
+// most KLOG_CONSOLE_BURST records per KLOG_CONSOLE_INTERVAL_MS
+static void klog_thread(uint32_t arg) {
+    (void)arg;
+    while (1) {
+        uint32_t flags = irq_save();
+        while (console_seq == next_seq) {
+            wait_queue_sleep(&klogd_wait);
+        }
+        irq_restore(flags);
+
+        klog_console_flush(KLOG_CONSOLE_BURST, KLOG_CONSOLE_BACKLOG);
+        sleep_ms(KLOG_CONSOLE_INTERVAL_MS);
+    }
+}
+
+void klog_set_console_level(uint32_t level) {
+    console_level = level < KLOG_LEVELS ? level : KLOG_DEBUG;
+}
+
+void klog_get_stats(klog_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+// Shell support
+
+static int token_is(const char* token, size_t length, const char* word) {
+    return strncmp(token, word, length) == 0 && word[length] == 0;
+}
+
+static int parse_level(const char* token, size_t length) {
+    for (int level = 0; level < KLOG_LEVELS; level++) {
+        if (token_is(token, length, level_names[level])) {
+            return level;
+        }
+    }
+    if (length == 1 && *token >= '0' && *token < '0' + KLOG_LEVELS) {
+        return *token - '0';
+    }
+    return -1;
+}
+
+// dmesg [-n LEVEL] [LEVEL] [SUBSYSTEM]: print the ring, oldest first,
+// limited to LEVEL and more severe and to one subsystem; -n sets the
+// console level instead
+void klog_dmesg(const char* args) {
+    int max_level = KLOG_DEBUG;
+    const char* subsystem = 0;
+    size_t subsystem_length = 0;
+    int set_console = 0;
+    int bad = 0;
+
+    while (*args && !bad) {
+        while (*args == ' ') {
+            args++;
+        }
+        const char* token = args;
+        while (*args && *args != ' ') {
+            args++;
+        }
+        size_t length = args - token;
+        if (!length) {
+            break;
+        }
+        if (token_is(token, length, "-n")) {
+            set_console = 1;
+            continue;
+        }
+        int level = parse_level(token, length);
+        if (set_console) {
+            if (level < 0) {
+                bad = 1;
+                continue;
+            }
+            klog_set_console_level(level);
+            terminal_writestring("dmesg: console level ");
+            terminal_println(level_names[level]);
+            return;
+        }
+        if (level >= 0) {
+            max_level = level;
+        } else if (length < KLOG_SUBSYS_MAX) {
+            subsystem = token;
+            subsystem_length = length;
+        } else {
+            bad = 1;
+        }
+    }
+    if (set_console || bad) {
+        terminal_println("Usage: dmesg [-n LEVEL] [err|warn|info|debug] [SUBSYSTEM]");
+        return;
+    }
+
+    char line[KLOG_LINE_MAX];
+    uint32_t head = next_seq;
+    uint32_t seq = head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+    for (; seq != head; seq++) {
+        klog_record_t record;
+        if (klog_read(seq, &record) != KLOG_READ_OK || record.level > max_level ||
+            (subsystem && !token_is(subsystem, subsystem_length, record.subsystem))) {
+            continue;
+        }
+        size_t length = klog_render(&record, line);
+        terminal_write(line, length < KLOG_LINE_MAX ? length : KLOG_LINE_MAX);
+    }
+}
+
+// Records, console rendering and what each costs (klogstat command)
+void klog_print_stats(void) {
+    klog_stats_t s;
+    klog_get_stats(&s);
+    terminal_writestring("Records: ");
+    terminal_print_dec(s.logged);
+    terminal_writestring(" logged (");
+    terminal_print_dec(s.truncated);
+    terminal_writestring(" truncated), ");
+    terminal_print_dec(s.logged < KLOG_RECORDS ? s.logged : KLOG_RECORDS);
+    terminal_writestring(" of ");
+    terminal_print_dec(KLOG_RECORDS);
+    terminal_println(" in the ring");
+    terminal_writestring("Logging: avg ");
+    terminal_print_dec(timer_cycles_to_ns(s.log_cycles, s.logged));
+    terminal_writestring(" ns, max ");
+    terminal_print_dec(timer_cycles_to_ns(s.max_log_cycles, 1));
+    terminal_println(" ns");
+    terminal_writestring("Console (level ");
+    terminal_writestring(level_names[console_level]);
+    terminal_writestring("): ");
+    terminal_print_dec(s.rendered);
+    terminal_writestring(" rendered, avg ");
+    terminal_print_dec(timer_cycles_to_ns(s.render_cycles, s.rendered));
+    terminal_writestring(" ns; ");
+    terminal_print_dec(s.skipped);
+    terminal_writestring(" skipped, ");
+    terminal_print_dec(s.lost);
+    terminal_println(" overwritten");
+}
@@ -0,0 +1,23 @@
+#include "ksyms.h"
+
+// Name of the function containing addr and how far into it addr is, or 0
+// if addr is below the first function
+const char* ksyms_lookup(uint32_t addr, uint32_t* offset) {
+    uint32_t low = 0;
+    uint32_t high = ksyms_count;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (ksyms[mid].addr <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return 0;
+    }
+    if (offset) {
+        *offset = addr - ksyms[low - 1].addr;
+    }
+    return ksyms_names + ksyms[low - 1].name;
+}
@@ -0,0 +1,135 @@
+#include "latency.h"
+#include "timer.h"
+#include "cpu.h"
+
+// Keystroke-to-glyph latency, and keystrokes echoed into cells that the
+// backend has not drawn yet, oldest first. Updated with interrupts
+// disabled: fbcon flushes from a timer.
+static latency_hist_t input_hist;
+static uint64_t pending[LATENCY_INPUT_PENDING];
+static uint32_t pending_head;
+static uint32_t pending_count;
+static uint32_t input_dropped;
+
+static uint32_t bucket_index(uint32_t value) {
+    if (value < LATENCY_SUB_BUCKETS) {
+        return value;
+    }
+    uint32_t shift = 31 - __builtin_clz(value) - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_BUCKETS + ((value >> shift) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// Largest value that falls into a bucket
+static uint32_t bucket_limit(uint32_t index) {
+    if (index < LATENCY_SUB_BUCKETS) {
+        return index;
+    }
+    uint32_t shift = index / LATENCY_SUB_BUCKETS - 1;
+    uint32_t lower = (LATENCY_SUB_BUCKETS + index % LATENCY_SUB_BUCKETS) << shift;
+    return lower + ((1u << shift) - 1);
+}
+
+void latency_hist_record(latency_hist_t* hist, uint64_t cycles) {
+    uint32_t value = cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)cycles;
+    hist->buckets[bucket_index(value)]++;
+    hist->count++;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+// Value below which permille/1000 of the samples fall, rounded up to the
+// end of its bucket but never past the largest sample
+uint32_t latency_hist_percentile(const latency_hist_t* hist, uint32_t permille) {
+    if (!hist->count) {
+        return 0;
+    }
+    uint32_t rank = (uint32_t)div64_32((uint64_t)hist->count * permille + 999, 1000);
+    if (rank == 0) {
+        rank = 1;
+    }
+    uint32_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint32_t limit = bucket_limit(i);
+            return limit < hist->max ? limit : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void latency_hist_reset(latency_hist_t* hist) {
+    for (uint32_t i = 0; i < LATENCY_BUCKETS; i++) {
+        hist->buckets[i] = 0;
+    }
+    hist->count = 0;
+    hist->max = 0;
+}
+
+// A character typed at tsc (rdtsc() in the keyboard interrupt) has been
+// echoed into the terminal's cells
+void latency_input_echoed(uint64_t tsc) {
+    if (!tsc) {
+        return;                             // Not typed: nothing to measure
+    }
+    uint32_t flags = irq_save();
+    if (!terminal_get_backend()->flush) {
+        latency_hist_record(&input_hist, rdtsc() - tsc);
+    } else if (pending_count < LATENCY_INPUT_PENDING) {
+        pending[(pending_head + pending_count) % LATENCY_INPUT_PENDING] = tsc;
+        pending_count++;
+    } else {
+        input_dropped++;
+    }
+    irq_restore(flags);
+}
+
+// A backend that draws later takes this before it starts drawing and
+// passes it to latency_input_shown() when the frame is on screen, so
+// characters echoed during the flush wait for the next one
+uint32_t latency_input_pending(void) {
+    return pending_count;
+}
+
+void latency_input_shown(uint32_t count) {
+    uint64_t now = rdtsc();
+    uint32_t flags = irq_save();
+    while (count-- && pending_count) {
+        latency_hist_record(&input_hist, now - pending[pending_head]);
+        pending_head = (pending_head + 1) % LATENCY_INPUT_PENDING;
+        pending_count--;
+    }
+    irq_restore(flags);
+}
+
+// Keystroke-to-glyph percentiles since the last call (latency command)
+void latency_print(void) {
+    uint32_t flags = irq_save();
+    uint32_t count = input_hist.count;
+    uint32_t p50 = latency_hist_percentile(&input_hist, 500);
+    uint32_t p99 = latency_hist_percentile(&input_hist, 990);
+    uint32_t max = input_hist.max;
+    uint32_t dropped = input_dropped;
+    latency_hist_reset(&input_hist);
+    input_dropped = 0;
+    irq_restore(flags);
+
+    if (!count) {
+        terminal_println("latency: no keystrokes echoed since the last reset");
+        return;
+    }
+    terminal_writestring("Keystroke to glyph, ");
+    terminal_print_dec(count);
+    terminal_writestring(" keystrokes: p50 ");
+    terminal_print_dec(timer_cycles_to_us(p50, 1));
+    terminal_writestring(" us, p99 ");
+    terminal_print_dec(timer_cycles_to_us(p99, 1));
+    terminal_writestring(" us, max ");
+    terminal_print_dec(timer_cycles_to_us(max, 1));
+    terminal_println(" us");
+    if (dropped) {
+        terminal_print_dec(dropped);
+        terminal_println(" keystrokes not measured: too many waiting for a redraw");
+    }
+}
@@ -0,0 +1,242 @@
+#include "memory.h"
+#include "cpu.h"
+#include "klog.h"
+#include "init.h"
+#include "heapprof.h"
+
+// End of the kernel image including .bss, and the boot-only pages inside
+// it (from linker.ld)
+extern uint8_t __kernel_end[];
+extern uint8_t __init_start[];
+extern uint8_t __init_end[];
+
+// Global variables
+static uint32_t* frame_bitmap;      // One bit per frame, 1 = used
+static pmm_frame_t* frame_info;     // Metadata for every frame
+static size_t total_frames;
+static size_t free_frames;
+static size_t bitmap_words;
+static size_t search_hint;          // First bitmap word that may have a free frame
+static uint32_t memory_size;
+static size_t init_freed;           // Boot-only pages given back
+
+static uint8_t __init cmos_read(uint8_t reg) {
+    outb(CMOS_ADDRESS_PORT, reg);
+    return inb(CMOS_DATA_PORT);
+}
+
+// Ask the BIOS (through CMOS) how much memory the machine has
+static uint32_t __init memory_detect(void) {
+    uint32_t blocks_64k = cmos_read(CMOS_EXT_MEM2_LOW) | (cmos_read(CMOS_EXT_MEM2_HIGH) << 8);
+    if (blocks_64k) {
+        return 16 * 1024 * 1024 + blocks_64k * 64 * 1024;
+    }
+
+    uint32_t ext_kb = cmos_read(CMOS_EXT_MEM_LOW) | (cmos_read(CMOS_EXT_MEM_HIGH) << 8);
+    return LOW_MEMORY_END + ext_kb * 1024;
+}
+
+static inline void frame_set_used(size_t frame) {
+    frame_bitmap[frame / 32] |= 1u << (frame % 32);
+}
+
+static inline void frame_set_free(size_t frame) {
+    frame_bitmap[frame / 32] &= ~(1u << (frame % 32));
+}
+
+static inline int frame_is_used(size_t frame) {
+    return (frame_bitmap[frame / 32] >> (frame % 32)) & 1;
+}
+
+// Initialize the physical memory manager. The bitmap and the frame
+// metadata array are placed right after the kernel image; everything
+// below their end is reserved.
+void __init memory_init(void) {
+    memory_size = memory_detect();
+    if (memory_size > PMM_MAX_MEMORY) {
+        memory_size = PMM_MAX_MEMORY;
+    }
+
+    total_frames = memory_size / PAGE_SIZE;
+    bitmap_words = (total_frames + 31) / 32;
+    frame_bitmap = (uint32_t*)PAGE_ALIGN_UP(__kernel_end);
+
+    // Start with everything free, then reserve low memory, the kernel, the
+    // bitmap and the metadata array
+    for (size_t i = 0; i < bitmap_words; i++) {
+        frame_bitmap[i] = 0;
+    }
+    free_frames = total_frames;
+
+    frame_info = (pmm_frame_t*)((uint32_t)frame_bitmap + bitmap_words * sizeof(uint32_t));
+    for (size_t i = 0; i < total_frames; i++) {
+        frame_info[i].refcount = 0;
+        frame_info[i].flags = 0;
+    }
+
+    uint32_t reserved_end = PAGE_ALIGN_UP((uint32_t)&frame_info[total_frames]);
+    for (size_t frame = 0; frame < reserved_end / PAGE_SIZE; frame++) {
+        frame_set_used(frame);
+        free_frames--;
+    }
+
+    // Bits past the last real frame are permanently used
+    for (size_t frame = total_frames; frame < bitmap_words * 32; frame++) {
+        frame_set_used(frame);
+    }
+
+    search_hint = 0;
+    klog(KLOG_INFO, "memory", "%u KB, %u KB free", memory_size / 1024, free_frames * (PAGE_SIZE / 1024));
+}
+
+// Give the pages of __init code and __initdata to the allocator once the
+// kernel has booted. They are filled with int3 first, so a stray call
+// into them traps instead of running whatever is allocated there.
+void memory_free_init(void) {
+    size_t pages = (__init_end - __init_start) / PAGE_SIZE;
+    uint32_t* word = (uint32_t*)__init_start;
+    for (size_t i = 0; i < pages * PAGE_SIZE / sizeof(uint32_t); i++) {
+        word[i] = 0xCCCCCCCC;
+    }
+    pmm_free(__init_start, pages);
+    init_freed = pages;
+}
+
+// Allocate a single frame: find the first bitmap word with a clear bit
+static void* pmm_alloc_frame(void) {
+    for (size_t i = search_hint; i < bitmap_words; i++) {
+        if (frame_bitmap[i] != 0xFFFFFFFF) {
+            size_t frame = i * 32 + __builtin_ctz(~frame_bitmap[i]);
+            frame_set_used(frame);
+            frame_info[frame].refcount = 1;
+            free_frames--;
+            search_hint = i;
+            return (void*)(frame * PAGE_SIZE);
+        }
+    }
+    return 0;
+}
+
+// Allocate physically contiguous pages. Returns the physical address
+// (identical to the kernel virtual address) or 0 when out of memory.
+// Never inlined, so heapprof sees the caller as the return address.
+void* __attribute__((noinline)) pmm_alloc(size_t pages) {
+    if (pages == 0 || pages > free_frames) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    void* result = 0;
+
+    if (pages == 1) {
+        result = pmm_alloc_frame();
+    } else {
+        // First fit over the bitmap
+        size_t run_start = 0;
+        size_t run_length = 0;
+        for (size_t frame = search_hint * 32; frame < total_frames; frame++) {
+            if (frame_is_used(frame)) {
+                run_length = 0;
+                continue;
+            }
+            if (run_length == 0) {
+                run_start = frame;
+            }
+            if (++run_length == pages) {
+                for (size_t f = run_start; f < run_start + pages; f++) {
+                    frame_set_used(f);
+                    frame_info[f].refcount = 1;
+                }
+                free_frames -= pages;
+                result = (void*)(run_start * PAGE_SIZE);
+                break;
+            }
+        }
+    }
+
+    if (result) {
+        heapprof_alloc(result, pages, __builtin_return_address(0));
+    }
+    irq_restore(flags);
+    return result;
+}
+
+// Free pages obtained from pmm_alloc()
+void pmm_free(void* addr, size_t pages) {
+    size_t first = (uint32_t)addr / PAGE_SIZE;
+
+    uint32_t flags = irq_save();
+    heapprof_free(addr);
+    for (size_t frame = first; frame < first + pages && frame < total_frames; frame++) {
+        if (frame_is_used(frame)) {
+            frame_set_free(frame);
+            frame_info[frame].refcount = 0;
+            free_frames++;
+        }
+    }
+    if (first / 32 < search_hint) {
+        search_hint = first / 32;
+    }
+    irq_restore(flags);
+}
+
+// Add a mapping to a frame
+void pmm_frame_ref(uint32_t phys) {
+    size_t frame = phys / PAGE_SIZE;
+    if (frame < total_frames) {
+        uint32_t flags = irq_save();
+        frame_info[frame].refcount++;
+        irq_restore(flags);
+    }
+}
+
+// Drop a mapping of a frame, freeing it with the last one. Returns the
+// number of references left.
+uint32_t pmm_frame_unref(uint32_t phys) {
+    size_t frame = phys / PAGE_SIZE;
+    if (frame >= total_frames) {
+        return 0;
+    }
+
+    uint32_t flags = irq_save();
+    uint32_t remaining = 0;
+    if (frame_info[frame].refcount > 1) {
+        remaining = --frame_info[frame].refcount;
+    } else if (frame_is_used(frame)) {
+        heapprof_free((void*)PAGE_ALIGN_DOWN(phys));
+        frame_info[frame].refcount = 0;
+        frame_set_free(frame);
+        free_frames++;
+        if (frame / 32 < search_hint) {
+            search_hint = frame / 32;
+        }
+    }
+    irq_restore(flags);
+    return remaining;
+}
+
+uint32_t pmm_frame_refcount(uint32_t phys) {
+    size_t frame = phys / PAGE_SIZE;
+    return frame < total_frames ? frame_info[frame].refcount : 0;
+}
+
+// Memory information
+uint32_t memory_get_size(void) {
+    return memory_size;
+}
+
+size_t pmm_get_total_pages(void) {
+    return total_frames;
+}
+
+size_t pmm_get_free_pages(void) {
+    return free_frames;
+}
+
+size_t pmm_get_used_pages(void) {
+    return total_frames - free_frames;
+}
+
+size_t pmm_get_init_freed_pages(void) {
+    return init_freed;
+}
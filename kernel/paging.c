@@ -0,0 +1,622 @@
+#include "paging.h"
+#include "cpu.h"
+#include "kdata.h"
+#include "timer.h"
+#include "usermode.h"
+#include "sched.h"
+#include "klib.h"
+#include "klog.h"
+#include "init.h"
+
+// Ring 3 section of the kernel image (from linker.ld)
+extern uint8_t __user_start[];
+extern uint8_t __user_end[];
+extern uint8_t __initrd_start[];
+extern uint8_t __initrd_end[];
+
+// Global variables
+static address_space_t address_spaces[ADDRESS_SPACE_MAX];
+static address_space_t* kernel_space;
+static address_space_t* current_space;
+static int pat_write_combine;       // PTE_WRITE_COMBINE means write-combining
+
+static inline int pde_is_kernel(uint32_t index) {
+    return index < PDE_INDEX(KERNEL_SPACE_END) || index >= PDE_INDEX(USER_SPACE_END);
+}
+
+static uint32_t* page_alloc_zeroed(void) {
+    uint32_t* page = (uint32_t*)pmm_alloc(1);
+    if (page) {
+        memset(page, 0, PAGE_SIZE);
+    }
+    return page;
+}
+
+static address_space_t* address_space_alloc(void) {
+    for (int i = 0; i < ADDRESS_SPACE_MAX; i++) {
+        if (!address_spaces[i].in_use) {
+            address_spaces[i].in_use = 1;
+            address_spaces[i].next = 0;
+            address_spaces[i].area_count = 0;
+            return &address_spaces[i];
+        }
+    }
+    return 0;
+}
+
+// Build the kernel address space (identity map of all managed memory,
+// the .user section user-accessible) and turn paging on
+void __init paging_init(void) {
+    kernel_space = address_space_alloc();
+    kernel_space->page_directory = page_alloc_zeroed();
+
+    // Page 0 stays unmapped so null pointer dereferences fault. The initrd
+    // is read-only: files are read in place through pointers into it.
+    uint32_t memory_end = memory_get_size();
+    for (uint32_t addr = PAGE_SIZE; addr < memory_end; addr += PAGE_SIZE) {
+        uint32_t flags = PTE_PRESENT | PTE_WRITABLE;
+        if (addr >= (uint32_t)__user_start && addr < (uint32_t)__user_end) {
+            flags |= PTE_USER;
+        }
+        if (addr >= (uint32_t)__initrd_start && addr < PAGE_ALIGN_UP(__initrd_end)) {
+            flags &= ~PTE_WRITABLE;
+        }
+        paging_map(kernel_space, addr, addr, flags);
+    }
+
+    // Shared kernel data page
+    if (kdata_page_frame()) {
+        paging_map(kernel_space, USER_KDATA_ADDR, kdata_page_frame(), PTE_PRESENT | PTE_USER);
+    }
+
+    // Make PAT entry 1 write-combining for framebuffers. Nothing is mapped
+    // through it yet, so no cache flush is needed.
+    uint32_t edx;
+    cpuid(1, 0, 0, 0, &edx);
+    if (edx & CPUID_EDX_PAT) {
+        wrmsr(MSR_PAT, PAT_ENTRY1_WC);
+        pat_write_combine = 1;
+    }
+
+    current_space = kernel_space;
+    write_cr3((uint32_t)kernel_space->page_directory);
+
+    // Enable paging; WP makes read-only pages read-only for ring 0 too
+    write_cr0(read_cr0() | CR0_PG | CR0_WP);
+}
+
+address_space_t* paging_kernel_space(void) {
+    return kernel_space;
+}
+
+address_space_t* address_space_current(void) {
+    return current_space;
+}
+
+// Create an empty user address space sharing the kernel page tables
+address_space_t* address_space_create(void) {
+    uint32_t flags = irq_save();
+    address_space_t* space = address_space_alloc();
+    irq_restore(flags);
+    if (!space) {
+        return 0;
+    }
+
+    space->page_directory = page_alloc_zeroed();
+    if (!space->page_directory) {
+        space->in_use = 0;
+        return 0;
+    }
+
+    flags = irq_save();
+    for (uint32_t i = 0; i < PAGE_ENTRIES; i++) {
+        if (pde_is_kernel(i)) {
+            space->page_directory[i] = kernel_space->page_directory[i];
+        }
+    }
+    space->next = kernel_space->next;
+    kernel_space->next = space;
+    irq_restore(flags);
+
+    // Every address space sees the shared kernel data page
+    if (kdata_page_frame()) {
+        pmm_frame_ref(kdata_page_frame());
+        paging_map(space, USER_KDATA_ADDR, kdata_page_frame(), PTE_PRESENT | PTE_USER);
+    }
+
+    return space;
+}
+
+// Free a user address space: its user page tables and its references to
+// the frames they map
+void address_space_destroy(address_space_t* space) {
+    if (!space || space == kernel_space) {
+        return;
+    }
+    if (space == current_space) {
+        address_space_switch(kernel_space);
+    }
+
+    uint32_t flags = irq_save();
+    for (address_space_t* prev = kernel_space; prev; prev = prev->next) {
+        if (prev->next == space) {
+            prev->next = space->next;
+            break;
+        }
+    }
+    irq_restore(flags);
+
+    for (uint32_t i = 0; i < space->area_count; i++) {
+        vm_area_t* area = &space->areas[i];
+        if (area->ops->close) {
+            area->ops->close(area);
+        }
+    }
+    space->area_count = 0;
+
+    for (uint32_t i = PDE_INDEX(USER_SPACE_START); i < PDE_INDEX(USER_SPACE_END); i++) {
+        uint32_t pde = space->page_directory[i];
+        if (!(pde & PTE_PRESENT)) {
+            continue;
+        }
+        uint32_t* table = (uint32_t*)(pde & PTE_FRAME_MASK);
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            if (table[j] & PTE_PRESENT) {
+                pmm_frame_unref(table[j] & PTE_FRAME_MASK);
+            }
+        }
+        pmm_free(table, 1);
+    }
+
+    pmm_free(space->page_directory, 1);
+    space->page_directory = 0;
+    space->in_use = 0;
+}
+
+void address_space_switch(address_space_t* space) {
+    if (space && space != current_space) {
+        current_space = space;
+        write_cr3((uint32_t)space->page_directory);
+    }
+}
+
+static void page_copy(uint32_t dst, uint32_t src) {
+    memcpy((void*)dst, (const void*)src, PAGE_SIZE);
+}
+
+// Return dst's page table for directory slot index, creating it if needed
+static uint32_t* user_table_get(address_space_t* dst, uint32_t index) {
+    if (dst->page_directory[index] & PTE_PRESENT) {
+        return (uint32_t*)(dst->page_directory[index] & PTE_FRAME_MASK);
+    }
+    uint32_t* table = page_alloc_zeroed();
+    if (table) {
+        dst->page_directory[index] = (uint32_t)table | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+    }
+    return table;
+}
+
+// Give dst the same lazily populated areas as src
+static int address_space_copy_areas(address_space_t* dst, address_space_t* src) {
+    for (uint32_t i = 0; i < src->area_count; i++) {
+        const vm_area_t* area = &src->areas[i];
+        int result = address_space_add_area(dst, area->start, area->end, area->ops, area->data, area->index);
+        if (result != 0) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+// Clone src for a new task without copying any memory. Every user frame is
+// shared; writable pages become read-only + PTE_COW in both spaces and are
+// only duplicated by page_fault_handler() on the first write. Cost is
+// proportional to the number of page tables, not to the memory mapped.
+address_space_t* address_space_clone(address_space_t* src) {
+    address_space_t* dst = address_space_create();
+    if (!dst) {
+        return 0;
+    }
+    if (address_space_copy_areas(dst, src) != 0) {
+        address_space_destroy(dst);
+        return 0;
+    }
+
+    for (uint32_t i = PDE_INDEX(USER_SPACE_START); i < PDE_INDEX(USER_SPACE_END); i++) {
+        if (!(src->page_directory[i] & PTE_PRESENT)) {
+            continue;
+        }
+        uint32_t* src_table = (uint32_t*)(src->page_directory[i] & PTE_FRAME_MASK);
+        uint32_t* dst_table = user_table_get(dst, i);
+        if (!dst_table) {
+            address_space_destroy(dst);
+            return 0;
+        }
+
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            uint32_t pte = src_table[j];
+            if (!(pte & PTE_PRESENT) || (dst_table[j] & PTE_PRESENT)) {
+                continue;   // Empty, or already mapped (the kdata page)
+            }
+            if (pte & PTE_WRITABLE) {
+                pte = (pte & ~PTE_WRITABLE) | PTE_COW;
+                src_table[j] = pte;
+            }
+            dst_table[j] = pte;
+            pmm_frame_ref(pte & PTE_FRAME_MASK);
+        }
+    }
+
+    // src lost write access to its pages
+    if (src == current_space) {
+        write_cr3((uint32_t)src->page_directory);
+    }
+
+    return dst;
+}
+
+// Clone src by eagerly duplicating every user page (baseline for
+// address_space_clone())
+address_space_t* address_space_copy(address_space_t* src) {
+    address_space_t* dst = address_space_create();
+    if (!dst) {
+        return 0;
+    }
+    if (address_space_copy_areas(dst, src) != 0) {
+        address_space_destroy(dst);
+        return 0;
+    }
+
+    for (uint32_t i = PDE_INDEX(USER_SPACE_START); i < PDE_INDEX(USER_SPACE_END); i++) {
+        if (!(src->page_directory[i] & PTE_PRESENT)) {
+            continue;
+        }
+        uint32_t* src_table = (uint32_t*)(src->page_directory[i] & PTE_FRAME_MASK);
+        uint32_t* dst_table = user_table_get(dst, i);
+        if (!dst_table) {
+            address_space_destroy(dst);
+            return 0;
+        }
+
+        for (uint32_t j = 0; j < PAGE_ENTRIES; j++) {
+            uint32_t pte = src_table[j];
+            if (!(pte & PTE_PRESENT) || (dst_table[j] & PTE_PRESENT)) {
+                continue;
+            }
+            uint32_t frame = (uint32_t)pmm_alloc(1);
+            if (!frame) {
+                address_space_destroy(dst);
+                return 0;
+            }
+            page_copy(frame, pte & PTE_FRAME_MASK);
+            if (pte & PTE_COW) {
+                pte = (pte & ~PTE_COW) | PTE_WRITABLE;
+            }
+            dst_table[j] = frame | (pte & 0xFFF);
+        }
+    }
+
+    return dst;
+}
+
+// Back [virt, virt + size) with fresh zeroed frames
+int address_space_alloc_region(address_space_t* space, uint32_t virt, uint32_t size, uint32_t flags) {
+    for (uint32_t addr = PAGE_ALIGN_DOWN(virt); addr < virt + size; addr += PAGE_SIZE) {
+        uint32_t* frame = (uint32_t*)pmm_alloc(1);
+        if (!frame) {
+            return E_NOMEM;
+        }
+        memset(frame, 0, PAGE_SIZE);
+        if (paging_map(space, addr, (uint32_t)frame, flags | PTE_USER) != 0) {
+            pmm_free(frame, 1);
+            return E_NOMEM;
+        }
+    }
+    return 0;
+}
+
+// Map [start, end) on demand through ops (see vm_ops_t)
+int address_space_add_area(address_space_t* space, uint32_t start, uint32_t end,
+                           const vm_ops_t* ops, void* data, uint32_t index) {
+    if ((start | end) & (PAGE_SIZE - 1) || start < USER_SPACE_START || end > USER_SPACE_END || start >= end) {
+        return E_INVAL;
+    }
+    if (space->area_count == VM_AREA_MAX) {
+        return E_NOMEM;
+    }
+    vm_area_t* area = &space->areas[space->area_count++];
+    area->start = start;
+    area->end = end;
+    area->ops = ops;
+    area->data = data;
+    area->index = index;
+    if (ops->open) {
+        ops->open(area);
+    }
+    return 0;
+}
+
+// Return the page table entry for virt, creating the page table if asked.
+// New kernel page tables are propagated to every address space.
+uint32_t* paging_get_pte(address_space_t* space, uint32_t virt, int create) {
+    uint32_t index = PDE_INDEX(virt);
+    int is_kernel = pde_is_kernel(index);
+    uint32_t* directory = is_kernel ? kernel_space->page_directory : space->page_directory;
+
+    if (!(directory[index] & PTE_PRESENT)) {
+        if (!create) {
+            return 0;
+        }
+        uint32_t* table = page_alloc_zeroed();
+        if (!table) {
+            return 0;
+        }
+        // The PTE decides whether a page is user-accessible
+        uint32_t pde = (uint32_t)table | PTE_PRESENT | PTE_WRITABLE | PTE_USER;
+
+        uint32_t flags = irq_save();
+        directory[index] = pde;
+        if (is_kernel) {
+            for (address_space_t* other = kernel_space->next; other; other = other->next) {
+                other->page_directory[index] = pde;
+            }
+        }
+        irq_restore(flags);
+    }
+
+    uint32_t* table = (uint32_t*)(directory[index] & PTE_FRAME_MASK);
+    return &table[PTE_INDEX(virt)];
+}
+
+int paging_map(address_space_t* space, uint32_t virt, uint32_t phys, uint32_t flags) {
+    uint32_t* pte = paging_get_pte(space, virt, 1);
+    if (!pte) {
+        return E_NOMEM;
+    }
+    *pte = (phys & PTE_FRAME_MASK) | (flags & 0xFFF) | PTE_PRESENT;
+    if (space == current_space || pde_is_kernel(PDE_INDEX(virt))) {
+        invlpg(virt);
+    }
+    return 0;
+}
+
+void paging_unmap(address_space_t* space, uint32_t virt) {
+    uint32_t* pte = paging_get_pte(space, virt, 0);
+    if (pte) {
+        *pte = 0;
+        if (space == current_space || pde_is_kernel(PDE_INDEX(virt))) {
+            invlpg(virt);
+        }
+    }
+}
+
+// Page-aligned range of user memory below the shared kernel data page
+static int user_range_valid(uint32_t addr, uint32_t pages) {
+    return !(addr & (PAGE_SIZE - 1)) && addr >= USER_SPACE_START && addr < USER_KDATA_ADDR &&
+           pages <= (USER_KDATA_ADDR - addr) / PAGE_SIZE;
+}
+
+// Move the mappings of pages pages at from_addr in from to to_addr in to
+// without touching the memory: the frames change owner and whatever was
+// mapped at the destination is released. Stops at the first unmapped
+// source page; returns the number of pages moved.
+uint32_t paging_transfer(address_space_t* from, uint32_t from_addr,
+                         address_space_t* to, uint32_t to_addr, uint32_t pages) {
+    if (!user_range_valid(from_addr, pages) || !user_range_valid(to_addr, pages)) {
+        return 0;
+    }
+
+    // Past a handful of pages one CR3 reload is cheaper than invlpg each
+    int flush_all = pages > PAGING_INVLPG_MAX;
+    uint32_t moved;
+    for (moved = 0; moved < pages; moved++) {
+        uint32_t src = from_addr + moved * PAGE_SIZE;
+        uint32_t dst = to_addr + moved * PAGE_SIZE;
+        uint32_t* src_pte = paging_get_pte(from, src, 0);
+        if (!src_pte || !(*src_pte & PTE_PRESENT)) {
+            break;
+        }
+        uint32_t* dst_pte = paging_get_pte(to, dst, 1);
+        if (!dst_pte) {
+            break;
+        }
+        if (*dst_pte & PTE_PRESENT) {
+            pmm_frame_unref(*dst_pte & PTE_FRAME_MASK);
+        }
+        *dst_pte = *src_pte;
+        *src_pte = 0;
+        if (!flush_all) {
+            if (from == current_space) {
+                invlpg(src);
+            }
+            if (to == current_space) {
+                invlpg(dst);
+            }
+        }
+    }
+
+    if (flush_all && moved && (from == current_space || to == current_space)) {
+        write_cr3((uint32_t)current_space->page_directory);
+    }
+    return moved;
+}
+
+// Identity map device memory (uncached) in the kernel part of every
+// address space
+void* paging_map_mmio(uint32_t phys, uint32_t size) {
+    uint32_t start = PAGE_ALIGN_DOWN(phys);
+    uint32_t end = PAGE_ALIGN_UP(phys + size);
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        if (paging_map(kernel_space, addr, addr, PTE_PRESENT | PTE_WRITABLE | PTE_CACHE_DISABLE) != 0) {
+            return 0;
+        }
+    }
+    return (void*)phys;
+}
+
+// Like paging_map_mmio(), but write-combining where the CPU has a PAT:
+// stores are buffered and burst to the device instead of going out one by
+// one, which is what a linear framebuffer wants
+void* paging_map_framebuffer(uint32_t phys, uint32_t size) {
+    uint32_t cache = pat_write_combine ? PTE_WRITE_COMBINE : PTE_CACHE_DISABLE;
+    uint32_t start = PAGE_ALIGN_DOWN(phys);
+    uint32_t end = PAGE_ALIGN_UP(phys + size);
+    for (uint32_t addr = start; addr < end; addr += PAGE_SIZE) {
+        if (paging_map(kernel_space, addr, addr, PTE_PRESENT | PTE_WRITABLE | cache) != 0) {
+            return 0;
+        }
+    }
+    return (void*)phys;
+}
+
+// Translate through the current address space
+void* virtual_to_physical(void* virtual_addr) {
+    uint32_t* pte = paging_get_pte(current_space, (uint32_t)virtual_addr, 0);
+    if (!pte || !(*pte & PTE_PRESENT)) {
+        return 0;
+    }
+    return (void*)((*pte & PTE_FRAME_MASK) | ((uint32_t)virtual_addr & (PAGE_SIZE - 1)));
+}
+
+// Resolve a write to a copy-on-write page. The last sharer just gets its
+// write permission back; everyone else gets a private copy.
+static int paging_handle_cow(address_space_t* space, uint32_t addr) {
+    uint32_t* pte = paging_get_pte(space, addr, 0);
+    if (!pte || !(*pte & PTE_PRESENT) || !(*pte & PTE_COW)) {
+        return E_FAULT;
+    }
+
+    uint32_t page = PAGE_ALIGN_DOWN(addr);
+    uint32_t old_frame = *pte & PTE_FRAME_MASK;
+    uint32_t flags = (*pte & 0xFFF & ~PTE_COW) | PTE_WRITABLE;
+
+    if (pmm_frame_refcount(old_frame) == 1) {
+        *pte = old_frame | flags;
+        invlpg(page);
+        return 0;
+    }
+
+    uint32_t new_frame = (uint32_t)pmm_alloc(1);
+    if (!new_frame) {
+        return E_NOMEM;
+    }
+    page_copy(new_frame, old_frame);
+    *pte = new_frame | flags;
+    invlpg(page);
+    pmm_frame_unref(old_frame);
+    return 0;
+}
+
+// Populate the page at addr if it lies in one of space's areas. The area
+// owner may sleep on I/O.
+static int paging_handle_area(address_space_t* space, uint32_t addr, uint32_t err_code) {
+    for (uint32_t i = 0; i < space->area_count; i++) {
+        vm_area_t* area = &space->areas[i];
+        if (addr >= area->start && addr < area->end) {
+            return area->ops->fault(space, area, addr, err_code);
+        }
+    }
+    return E_FAULT;
+}
+
+// Whether ring 3 may hand the kernel [addr, addr + size): user space below
+// the kdata page, or the .user section for built-in tasks
+int paging_user_buffer(uint32_t addr, uint32_t size) {
+    if (addr >= USER_SPACE_START && addr <= USER_KDATA_ADDR) {
+        return size <= USER_KDATA_ADDR - addr;
+    }
+    return addr >= (uint32_t)__user_start && addr <= (uint32_t)__user_end &&
+           size <= (uint32_t)__user_end - addr;
+}
+
+// Page fault handler
+void page_fault_handler(interrupt_frame_t* frame) {
+    uint32_t fault_addr = read_cr2();
+
+    // First touch of a page in a lazily populated area, from ring 3 or
+    // from the kernel accessing user memory
+    if (!(frame->err_code & PF_PRESENT) &&
+        fault_addr >= USER_SPACE_START && fault_addr < USER_SPACE_END) {
+        if (paging_handle_area(current_space, fault_addr, frame->err_code) == 0) {
+            return;
+        }
+    }
+
+    // Write to a present page in user space: copy-on-write candidate. This
+    // also covers the kernel writing to user memory, since CR0.WP is set.
+    if ((frame->err_code & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE) &&
+        fault_addr >= USER_SPACE_START && fault_addr < USER_SPACE_END) {
+        if (paging_handle_cow(current_space, fault_addr) == 0) {
+            return;
+        }
+    }
+
+    klog(KLOG_ERR, "paging", "page fault at %x (eip %x, error %u)",
+         fault_addr, frame->eip, frame->err_code);
+
+    // A faulting ring 3 task is terminated, and so is one whose system call
+    // was handed a bad user pointer; any other kernel fault is fatal
+    if ((frame->err_code & PF_USER) ||
+        (sched_current() && sched_current()->in_syscall &&
+         fault_addr >= USER_SPACE_START && fault_addr < USER_SPACE_END)) {
+        usermode_exit(E_FAULT);
+    }
+    klog_flush();
+
+    __asm__ volatile("cli");
+    __asm__ volatile("hlt");
+}
+
+// Address space clone benchmark: copy-on-write clone versus eager copy
+// for address spaces from 64 KB to 64 MB
+static const uint32_t clone_bench_sizes[] = {
+    64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024
+};
+
+void paging_clone_benchmark(void) {
+    terminal_println("Address space clone (us):");
+    terminal_println("  size KB    cow clone    full copy");
+
+    for (uint32_t n = 0; n < sizeof(clone_bench_sizes) / sizeof(clone_bench_sizes[0]); n++) {
+        uint32_t size = clone_bench_sizes[n];
+        uint32_t pages = size / PAGE_SIZE;
+
+        terminal_writestring("  ");
+        terminal_print_dec(size / 1024);
+        terminal_writestring("\t     ");
+
+        // Source, full copy and page tables must all fit
+        if (pmm_get_free_pages() < pages * 2 + (pages / PAGE_ENTRIES + 1) * 3 + 8) {
+            terminal_println("skipped (not enough memory)");
+            continue;
+        }
+
+        address_space_t* src = address_space_create();
+        if (!src || address_space_alloc_region(src, USER_SPACE_START, size, PTE_WRITABLE) != 0) {
+            address_space_destroy(src);
+            terminal_println("skipped (not enough memory)");
+            continue;
+        }
+
+        uint64_t start = rdtsc();
+        address_space_t* clone = address_space_clone(src);
+        uint64_t clone_cycles = rdtsc() - start;
+
+        start = rdtsc();
+        address_space_t* copy = address_space_copy(src);
+        uint64_t copy_cycles = rdtsc() - start;
+
+        terminal_print_dec(timer_cycles_to_us(clone_cycles, 1));
+        terminal_writestring("\t\t  ");
+        if (copy) {
+            terminal_print_dec(timer_cycles_to_us(copy_cycles, 1));
+            terminal_putchar('\n');
+        } else {
+            terminal_println("out of memory");
+        }
+
+        address_space_destroy(copy);
+        address_space_destroy(clone);
+        address_space_destroy(src);
+    }
+}
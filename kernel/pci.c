@@ -0,0 +1,204 @@
+#include "pci.h"
+#include "cpu.h"
+#include "klog.h"
+#include "init.h"
+
+// Global variables
+static pci_device_t devices[PCI_MAX_DEVICES];
+static size_t device_count = 0;
+static const pci_driver_t* drivers[PCI_MAX_DRIVERS];
+static size_t driver_count = 0;
+
+static inline uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11) |
+           ((uint32_t)(function & 0x7) << 8) | (offset & 0xFC);
+}
+
+// Configuration space access. Interrupts are disabled so an IRQ handler
+// touching config space cannot change CONFIG_ADDRESS in between.
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    uint32_t flags = irq_save();
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    irq_restore(flags);
+    return value;
+}
+
+uint16_t pci_config_read16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return (uint16_t)(pci_config_read32(bus, slot, function, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_config_read8(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return (uint8_t)(pci_config_read32(bus, slot, function, offset) >> ((offset & 3) * 8));
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t flags = irq_save();
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+    outl(PCI_CONFIG_DATA, value);
+    irq_restore(flags);
+}
+
+void pci_config_write16(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint16_t value) {
+    uint32_t flags = irq_save();
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+    outw(PCI_CONFIG_DATA + (offset & 2), value);
+    irq_restore(flags);
+}
+
+static void __init pci_add_function(uint8_t bus, uint8_t slot, uint8_t function) {
+    if (device_count >= PCI_MAX_DEVICES) {
+        return;
+    }
+
+    pci_device_t* dev = &devices[device_count++];
+    uint32_t id = pci_config_read32(bus, slot, function, PCI_VENDOR_ID);
+    uint32_t class_reg = pci_config_read32(bus, slot, function, PCI_REVISION);
+    uint32_t irq_reg = pci_config_read32(bus, slot, function, PCI_INTERRUPT_LINE);
+
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->function = function;
+    dev->vendor_id = (uint16_t)id;
+    dev->device_id = (uint16_t)(id >> 16);
+    dev->revision = (uint8_t)class_reg;
+    dev->prog_if = (uint8_t)(class_reg >> 8);
+    dev->subclass = (uint8_t)(class_reg >> 16);
+    dev->class_code = (uint8_t)(class_reg >> 24);
+
+    // Line 0 or 0xFF means the firmware did not route an interrupt; pin 0
+    // means the function has none
+    uint8_t line = (uint8_t)irq_reg;
+    uint8_t pin = (uint8_t)(irq_reg >> 8);
+    dev->irq_line = (pin && line < 16) ? line : PCI_NO_IRQ;
+
+    // Bridges (header type 1) only have two BARs
+    uint8_t header = pci_config_read8(bus, slot, function, PCI_HEADER_TYPE) & 0x7F;
+    int bars = header == 0 ? PCI_BAR_COUNT : (header == 1 ? 2 : 0);
+    for (int i = 0; i < PCI_BAR_COUNT; i++) {
+        dev->bar[i] = i < bars ? pci_config_read32(bus, slot, function, PCI_BAR0 + i * 4) : 0;
+    }
+
+    dev->driver = 0;
+    dev->driver_data = 0;
+}
+
+static int pci_driver_matches(const pci_driver_t* driver, pci_device_t* dev) {
+    if (driver->vendor_id != PCI_ANY_ID && driver->vendor_id != dev->vendor_id) {
+        return 0;
+    }
+    if (driver->device_id != PCI_ANY_ID && driver->device_id != dev->device_id) {
+        return 0;
+    }
+    if (driver->class_id != PCI_ANY_ID &&
+        driver->class_id != PCI_CLASS_ID(dev->class_code, dev->subclass)) {
+        return 0;
+    }
+    return 1;
+}
+
+// Brute-force scan of every bus/slot. Functions 1-7 are only probed on
+// multi-function devices since single-function devices may alias function 0.
+void __init pci_init(void) {
+    device_count = 0;
+
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            if (pci_config_read16(bus, slot, 0, PCI_VENDOR_ID) == 0xFFFF) {
+                continue;
+            }
+            uint8_t header = pci_config_read8(bus, slot, 0, PCI_HEADER_TYPE);
+            uint8_t functions = (header & PCI_HEADER_MULTIFUNCTION) ? 8 : 1;
+            for (uint8_t function = 0; function < functions; function++) {
+                if (pci_config_read16(bus, slot, function, PCI_VENDOR_ID) != 0xFFFF) {
+                    pci_add_function(bus, slot, function);
+                }
+            }
+        }
+    }
+    klog(KLOG_INFO, "pci", "%u functions", device_count);
+}
+
+// Register a driver and probe every unclaimed device it matches
+int pci_register_driver(const pci_driver_t* driver) {
+    if (driver_count >= PCI_MAX_DRIVERS) {
+        return -1;
+    }
+    drivers[driver_count++] = driver;
+
+    int claimed = 0;
+    for (size_t i = 0; i < device_count; i++) {
+        pci_device_t* dev = &devices[i];
+        if (dev->driver || !pci_driver_matches(driver, dev)) {
+            continue;
+        }
+        if (driver->probe(dev) == 0) {
+            dev->driver = driver;
+            claimed++;
+        }
+    }
+    return claimed;
+}
+
+size_t pci_device_count(void) {
+    return device_count;
+}
+
+pci_device_t* pci_get_device(size_t index) {
+    return index < device_count ? &devices[index] : 0;
+}
+
+int pci_bar_is_io(pci_device_t* dev, int bar) {
+    return (dev->bar[bar] & PCI_BAR_IO) != 0;
+}
+
+uint32_t pci_bar_address(pci_device_t* dev, int bar) {
+    return pci_bar_is_io(dev, bar) ? (dev->bar[bar] & PCI_BAR_IO_MASK) : (dev->bar[bar] & PCI_BAR_MEM_MASK);
+}
+
+// Turn on I/O and memory decoding, and DMA if the driver needs it
+void pci_enable(pci_device_t* dev, int bus_master) {
+    uint16_t command = pci_config_read16(dev->bus, dev->slot, dev->function, PCI_COMMAND);
+    command |= PCI_COMMAND_IO | PCI_COMMAND_MEMORY;
+    command &= ~PCI_COMMAND_INTX_DISABLE;
+    if (bus_master) {
+        command |= PCI_COMMAND_BUS_MASTER;
+    }
+    pci_config_write16(dev->bus, dev->slot, dev->function, PCI_COMMAND, command);
+}
+
+static void print_hex_digits(uint32_t value, int digits) {
+    static const char hex[] = "0123456789abcdef";
+    for (int i = digits - 1; i >= 0; i--) {
+        terminal_putchar(hex[(value >> (i * 4)) & 0xF]);
+    }
+}
+
+// Print the device table (lspci command)
+void pci_list(void) {
+    terminal_println("bus:sl.f  vendor:device  class  irq  driver");
+    for (size_t i = 0; i < device_count; i++) {
+        pci_device_t* dev = &devices[i];
+        print_hex_digits(dev->bus, 2);
+        terminal_putchar(':');
+        print_hex_digits(dev->slot, 2);
+        terminal_putchar('.');
+        print_hex_digits(dev->function, 1);
+        terminal_writestring("   ");
+        print_hex_digits(dev->vendor_id, 4);
+        terminal_putchar(':');
+        print_hex_digits(dev->device_id, 4);
+        terminal_writestring("      ");
+        print_hex_digits(dev->class_code, 2);
+        print_hex_digits(dev->subclass, 2);
+        terminal_writestring("   ");
+        if (dev->irq_line == PCI_NO_IRQ) {
+            terminal_writestring("-  ");
+        } else {
+            terminal_print_dec(dev->irq_line);
+            terminal_writestring(dev->irq_line < 10 ? "  " : " ");
+        }
+        terminal_writestring("  ");
+        terminal_println(dev->driver ? dev->driver->name : "-");
+    }
+}
@@ -0,0 +1,468 @@
+#include "sched.h"
+#include "cpu.h"
+#include "gdt.h"
+#include "memory.h"
+#include "usermode.h"
+#include "ipc.h"
+#include "init.h"
+
+// Global variables
+static thread_t threads[THREAD_MAX];
+static thread_t* current_thread;
+static thread_t* idle_thread;
+static thread_t* run_queue_head;
+static thread_t* run_queue_tail;
+static thread_t* reap_pending;          // Detached thread that just exited
+static uint32_t next_thread_id = 0;
+static volatile int need_resched = 0;
+
+void switch_context(uint32_t* save_esp, uint32_t load_esp);
+static thread_t* thread_alloc(const char* name);
+static void wait_queue_push(wait_queue_t* queue, thread_t* thread);
+void thread_start(void);
+
+// switch_context(&prev->esp, next->esp): push the callee-saved registers
+// and EFLAGS, swap stacks and pop the next thread's. A new thread's stack
+// is prepared so the final ret lands in thread_start.
+__asm__(
+    ".text\n"
+    ".global switch_context\n"
+    "switch_context:\n"
+    "\tmovl 4(%esp), %eax\n"
+    "\tmovl 8(%esp), %edx\n"
+    "\tpushl %ebp\n"
+    "\tpushl %ebx\n"
+    "\tpushl %esi\n"
+    "\tpushl %edi\n"
+    "\tpushfl\n"
+    "\tmovl %esp, (%eax)\n"
+    "\tmovl %edx, %esp\n"
+    "\tpopfl\n"
+    "\tpopl %edi\n"
+    "\tpopl %esi\n"
+    "\tpopl %ebx\n"
+    "\tpopl %ebp\n"
+    "\tret\n"
+);
+
+static void run_queue_push(thread_t* thread) {
+    thread->next = 0;
+    if (run_queue_tail) {
+        run_queue_tail->next = thread;
+    } else {
+        run_queue_head = thread;
+    }
+    run_queue_tail = thread;
+}
+
+static thread_t* run_queue_pop(void) {
+    thread_t* thread = run_queue_head;
+    if (thread) {
+        run_queue_head = thread->next;
+        if (!run_queue_head) {
+            run_queue_tail = 0;
+        }
+        thread->next = 0;
+    }
+    return thread;
+}
+
+static void thread_free(thread_t* thread) {
+    if (thread->owns_space) {
+        address_space_destroy(thread->space);
+    }
+    if (thread->kernel_stack) {
+        pmm_free((void*)thread->kernel_stack, THREAD_STACK_PAGES);
+    }
+    thread->state = THREAD_UNUSED;
+}
+
+// Runs on the new thread's stack right after every switch
+static void sched_finish_switch(void) {
+    if (reap_pending && reap_pending != current_thread) {
+        thread_free(reap_pending);
+        reap_pending = 0;
+    }
+}
+
+// Make next the running thread. Interrupts must be disabled; the caller
+// has already put the previous thread wherever it belongs (run queue,
+// wait queue or nowhere).
+static void switch_to(thread_t* next) {
+    thread_t* prev = current_thread;
+    next->state = THREAD_RUNNING;
+    next->timeslice = THREAD_TIMESLICE;
+    need_resched = 0;
+    if (next == prev) {
+        return;
+    }
+
+    current_thread = next;
+    tss_set_kernel_stack(next->kernel_stack_top);
+    fpu_switch(next);
+    // Kernel threads run in whatever space is loaded: the kernel half is
+    // the same everywhere, so switching to them never reloads CR3
+    if (next->space) {
+        address_space_switch(next->space);
+    }
+
+    switch_context(&prev->esp, next->esp);
+    sched_finish_switch();
+}
+
+// Pick the next thread. Interrupts must be disabled.
+static void schedule(void) {
+    thread_t* prev = current_thread;
+    thread_t* next = run_queue_pop();
+
+    if (prev->state == THREAD_RUNNING) {
+        if (!next) {
+            prev->timeslice = THREAD_TIMESLICE;
+            need_resched = 0;
+            return;
+        }
+        if (prev != idle_thread) {
+            prev->state = THREAD_READY;
+            run_queue_push(prev);
+        }
+    }
+    switch_to(next ? next : idle_thread);
+}
+
+// First code run by every new thread (called from thread_start)
+__attribute__((used))
+void thread_start_c(void) {
+    sched_finish_switch();
+    __asm__ volatile("sti");
+    current_thread->entry(current_thread->arg);
+    thread_exit(0);
+}
+
+__asm__(
+    ".text\n"
+    ".global thread_start\n"
+    "thread_start:\n"
+    "\tcall thread_start_c\n"
+);
+
+static void idle_loop(uint32_t arg) {
+    (void)arg;
+    while (1) {
+        // Interrupt exit switches away as soon as anything is runnable
+        __asm__ volatile("sti\n\thlt");
+    }
+}
+
+// Adopt the boot context as the first thread and create the idle thread
+void __init sched_init(void) {
+    for (int i = 0; i < THREAD_MAX; i++) {
+        threads[i].state = THREAD_UNUSED;
+    }
+
+    thread_t* boot = &threads[0];
+    boot->id = next_thread_id++;
+    boot->name = "kernel";
+    boot->state = THREAD_RUNNING;
+    boot->kernel_stack = 0;
+    boot->kernel_stack_top = tss.esp0;
+    boot->space = 0;
+    boot->owns_space = 0;
+    boot->detached = 0;
+    boot->timeslice = THREAD_TIMESLICE;
+    boot->ipc_caller = 0;
+    boot->fpu_used = 0;
+    wait_queue_init(&boot->join_waiters);
+    current_thread = boot;
+
+    // The idle thread only runs when the run queue is empty, so it is never
+    // queued itself
+    idle_thread = thread_alloc("idle");
+    idle_thread->entry = idle_loop;
+    idle_thread->arg = 0;
+    idle_thread->state = THREAD_READY;
+}
+
+thread_t* sched_current(void) {
+    return current_thread;
+}
+
+void sched_yield(void) {
+    uint32_t flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+// Called from the timer interrupt
+void __hot sched_tick(void) {
+    if (current_thread && current_thread->timeslice && --current_thread->timeslice == 0) {
+        need_resched = 1;
+    }
+}
+
+// Called on interrupt exit, after EOI. Kernel code is not preemptible:
+// threads are only switched when returning to ring 3 or when the CPU was
+// idle; kernel threads give the CPU up by blocking or yielding.
+void __hot sched_preempt(int returning_to_user) {
+    if (!current_thread) {
+        return;
+    }
+    if (current_thread == idle_thread) {
+        if (run_queue_head) {
+            schedule();
+        }
+    } else if (returning_to_user && need_resched) {
+        schedule();
+    }
+}
+
+// Make a blocked thread runnable
+void sched_wake(thread_t* thread) {
+    uint32_t flags = irq_save();
+    if (thread->state == THREAD_BLOCKED) {
+        thread->state = THREAD_READY;
+        run_queue_push(thread);
+        need_resched = 1;
+    }
+    irq_restore(flags);
+}
+
+// Direct handoff: run thread now, bypassing the run queue. thread must be
+// blocked; the caller either blocked itself first or is requeued as ready.
+// Interrupts must be disabled.
+void sched_switch_to(thread_t* thread) {
+    thread_t* prev = current_thread;
+    if (prev->state == THREAD_RUNNING && prev != idle_thread) {
+        prev->state = THREAD_READY;
+        run_queue_push(prev);
+    }
+    switch_to(thread);
+}
+
+// Block the current thread, queued on queue unless it is 0, and run next
+// directly (or the next runnable thread if next is 0). next must be
+// blocked. Interrupts must be disabled; they still are when this returns.
+void sched_block(wait_queue_t* queue, thread_t* next) {
+    current_thread->state = THREAD_BLOCKED;
+    if (queue) {
+        wait_queue_push(queue, current_thread);
+    }
+    if (next) {
+        switch_to(next);
+    } else {
+        schedule();
+    }
+}
+
+// Change the ring 0 stack used by traps from ring 3 for the current thread
+void sched_set_kernel_stack(uint32_t top) {
+    current_thread->kernel_stack_top = top;
+    tss_set_kernel_stack(top);
+}
+
+static thread_t* thread_alloc(const char* name) {
+    uint32_t flags = irq_save();
+    thread_t* thread = 0;
+    for (int i = 0; i < THREAD_MAX; i++) {
+        if (threads[i].state == THREAD_UNUSED) {
+            thread = &threads[i];
+            thread->state = THREAD_BLOCKED;
+            thread->id = next_thread_id++;
+            break;
+        }
+    }
+    irq_restore(flags);
+    if (!thread) {
+        return 0;
+    }
+
+    thread->kernel_stack = (uint32_t)pmm_alloc(THREAD_STACK_PAGES);
+    if (!thread->kernel_stack) {
+        thread->state = THREAD_UNUSED;
+        return 0;
+    }
+    thread->kernel_stack_top = thread->kernel_stack + THREAD_STACK_PAGES * PAGE_SIZE;
+    thread->name = name;
+    thread->console = terminal_get_console();   // The one it was started from
+    thread->output = 0;
+    thread->space = 0;
+    thread->owns_space = 0;
+    thread->detached = 0;
+    thread->next = 0;
+    thread->exit_code = 0;
+    thread->user_entry = 0;
+    thread->user_stack_top = 0;
+    thread->ipc_frame = 0;
+    thread->ipc_caller = 0;
+    thread->ipc_window = 0;
+    thread->fpu_used = 0;
+    wait_queue_init(&thread->join_waiters);
+
+    // Initial frame popped by switch_context: EFLAGS (IF clear), edi, esi,
+    // ebx, ebp, then the return address
+    uint32_t* stack = (uint32_t*)thread->kernel_stack_top;
+    *--stack = 0;                           // thread_start never returns
+    *--stack = (uint32_t)thread_start;
+    *--stack = 0;                           // ebp
+    *--stack = 0;                           // ebx
+    *--stack = 0;                           // esi
+    *--stack = 0;                           // edi
+    *--stack = 0x002;                       // EFLAGS
+    thread->esp = (uint32_t)stack;
+    return thread;
+}
+
+static void thread_ready(thread_t* thread) {
+    uint32_t flags = irq_save();
+    thread->state = THREAD_READY;
+    run_queue_push(thread);
+    irq_restore(flags);
+}
+
+// Create a kernel thread running entry(arg)
+thread_t* thread_create(const char* name, void (*entry)(uint32_t), uint32_t arg) {
+    thread_t* thread = thread_alloc(name);
+    if (!thread) {
+        return 0;
+    }
+    thread->entry = entry;
+    thread->arg = arg;
+    thread_ready(thread);
+    return thread;
+}
+
+// Kernel half of a user thread: pass arg on the user stack like a cdecl
+// call and drop to ring 3
+static void user_thread_start(uint32_t arg) {
+    uint32_t* stack = (uint32_t*)current_thread->user_stack_top;
+    *--stack = arg;
+    *--stack = 0;                           // Return address: must call SYS_EXIT
+    __asm__ volatile("cli");
+    usermode_jump(current_thread->user_entry, (uint32_t)stack);
+}
+
+// Create a thread that runs entry(arg) in ring 3 inside space. The thread
+// takes ownership of space and destroys it when it is reaped.
+thread_t* thread_create_user(const char* name, address_space_t* space, uint32_t entry,
+                             uint32_t user_stack_top, uint32_t arg) {
+    thread_t* thread = thread_alloc(name);
+    if (!thread) {
+        return 0;
+    }
+    thread->entry = user_thread_start;
+    thread->arg = arg;
+    thread->space = space;
+    thread->owns_space = 1;
+    thread->user_entry = entry;
+    thread->user_stack_top = user_stack_top;
+    // Its SYS_WRITE output follows the creator's redirection (exec > /dev/null,
+    // exec ... | grep x); creators join their user threads, so the stream
+    // outlives it
+    thread->output = terminal_get_output();
+    thread_ready(thread);
+    return thread;
+}
+
+void thread_exit(int32_t code) {
+    __asm__ volatile("cli");
+    thread_t* thread = current_thread;
+    thread->exit_code = code;
+    thread->state = THREAD_DEAD;
+    ipc_thread_exit(thread);
+    fpu_thread_exit(thread);
+    if (thread->detached) {
+        // Its stack is in use until the switch; the next thread frees it
+        if (reap_pending) {
+            thread_free(reap_pending);
+        }
+        reap_pending = thread;
+    } else {
+        wait_queue_wake_all(&thread->join_waiters);
+    }
+    schedule();
+
+    // Not reached
+    while (1) {
+        __asm__ volatile("hlt");
+    }
+}
+
+// Wait for thread to exit, free it and return its exit code
+int32_t thread_join(thread_t* thread) {
+    uint32_t flags = irq_save();
+    while (thread->state != THREAD_DEAD) {
+        wait_queue_sleep(&thread->join_waiters);
+    }
+    irq_restore(flags);
+
+    int32_t code = thread->exit_code;
+    thread_free(thread);
+    return code;
+}
+
+// Let the scheduler reap thread when it exits
+void thread_detach(thread_t* thread) {
+    uint32_t flags = irq_save();
+    if (thread->state == THREAD_DEAD) {
+        thread_free(thread);
+    } else {
+        thread->detached = 1;
+    }
+    irq_restore(flags);
+}
+
+void wait_queue_init(wait_queue_t* queue) {
+    queue->head = 0;
+    queue->tail = 0;
+}
+
+int wait_queue_empty(wait_queue_t* queue) {
+    return queue->head == 0;
+}
+
+static void wait_queue_push(wait_queue_t* queue, thread_t* thread) {
+    thread->next = 0;
+    if (queue->tail) {
+        queue->tail->next = thread;
+    } else {
+        queue->head = thread;
+    }
+    queue->tail = thread;
+}
+
+// Remove and return the first waiter without waking it
+thread_t* wait_queue_dequeue(wait_queue_t* queue) {
+    thread_t* thread = queue->head;
+    if (thread) {
+        queue->head = thread->next;
+        if (!queue->head) {
+            queue->tail = 0;
+        }
+        thread->next = 0;
+    }
+    return thread;
+}
+
+// Block the current thread on queue. Interrupts must be disabled; they are
+// still disabled when this returns.
+void wait_queue_sleep(wait_queue_t* queue) {
+    sched_block(queue, 0);
+}
+
+thread_t* wait_queue_wake_one(wait_queue_t* queue) {
+    uint32_t flags = irq_save();
+    thread_t* thread = wait_queue_dequeue(queue);
+    if (thread) {
+        sched_wake(thread);
+    }
+    irq_restore(flags);
+    return thread;
+}
+
+void wait_queue_wake_all(wait_queue_t* queue) {
+    uint32_t flags = irq_save();
+    thread_t* thread;
+    while ((thread = wait_queue_dequeue(queue)) != 0) {
+        sched_wake(thread);
+    }
+    irq_restore(flags);
+}
@@ -0,0 +1,51 @@
+#include "serial.h"
+#include "cpu.h"
+#include "klog.h"
+#include "init.h"
+
+static int present;
+
+// 115200 8N1 with FIFOs. A byte sent in loopback mode must come back,
+// otherwise there is no UART (reads of a missing port return 0xFF).
+void __init serial_init(void) {
+    outb(SERIAL_COM1 + SERIAL_IER, 0x00);
+    outb(SERIAL_COM1 + SERIAL_LCR, SERIAL_LCR_DLAB);
+    outb(SERIAL_COM1 + SERIAL_DATA, 115200 / SERIAL_BAUD);
+    outb(SERIAL_COM1 + SERIAL_IER, 0x00);
+    outb(SERIAL_COM1 + SERIAL_LCR, SERIAL_LCR_8N1);
+    outb(SERIAL_COM1 + SERIAL_FCR, SERIAL_FCR_ENABLE);
+
+    outb(SERIAL_COM1 + SERIAL_MCR, SERIAL_MCR_READY | SERIAL_MCR_LOOP);
+    outb(SERIAL_COM1 + SERIAL_DATA, 0xA5);
+    if (inb(SERIAL_COM1 + SERIAL_DATA) != 0xA5) {
+        klog(KLOG_INFO, "serial", "no UART on COM1");
+        return;
+    }
+    outb(SERIAL_COM1 + SERIAL_MCR, SERIAL_MCR_READY);
+    present = 1;
+    klog(KLOG_INFO, "serial", "COM1 at %u baud", SERIAL_BAUD);
+}
+
+int serial_present(void) {
+    return present;
+}
+
+static inline void serial_putc(char c) {
+    while (!(inb(SERIAL_COM1 + SERIAL_LSR) & SERIAL_LSR_THRE)) {
+        __asm__ volatile("pause");
+    }
+    outb(SERIAL_COM1 + SERIAL_DATA, (uint8_t)c);
+}
+
+// Newlines go out as CR LF for terminals on the other end
+void serial_write(const char* data, size_t size) {
+    if (!present) {
+        return;
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == '\n') {
+            serial_putc('\r');
+        }
+        serial_putc(data[i]);
+    }
+}
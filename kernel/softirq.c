@@ -0,0 +1,344 @@
+#include "softirq.h"
+#include "interrupts.h"
+#include "sched.h"
+#include "timer.h"
+#include "timer_wheel.h"
+#include "blkdev.h"
+#include "memory.h"
+#include "cpu.h"
+#include "klib.h"
+#include "errors.h"
+#include "klog.h"
+#include "init.h"
+
+// How softirqs are run
+#define SOFTIRQ_INLINE   0                  // In the hard handler, interrupts off
+#define SOFTIRQ_IRQ_EXIT 1                  // At interrupt exit, interrupts on
+#define SOFTIRQ_THREAD   2                  // In ksoftirqd
+
+// Benchmark parameters
+#define IRQBENCH_TIMERS        2000         // Spread over IRQBENCH_TIMER_MS
+#define IRQBENCH_TIMER_MS      50
+#define IRQBENCH_READS         512          // Uncached reads from the first disk
+#define IRQBENCH_READ_SECTORS  8
+
+// Per-CPU state. There is one CPU: pending and the tasklet list are
+// changed with interrupts disabled, the rest only by softirq code.
+static struct {
+    volatile uint32_t pending;      // Raised vectors, one bit each
+    tasklet_t* tasklet_head;
+    tasklet_t** tasklet_tail;
+    volatile uint8_t active;        // Softirqs are running
+    volatile uint8_t thread_busy;   // ksoftirqd owns the backlog until it drains
+    thread_t* thread;
+    wait_queue_t thread_wait;
+} cpu;
+
+static softirq_handler_t handlers[SOFTIRQ_COUNT];
+static int deferred = 1;
+static softirq_stats_t stats;
+
+static void tasklet_action(void);
+static void softirq_thread(uint32_t arg);
+
+void __init softirq_init(void) {
+    cpu.tasklet_tail = &cpu.tasklet_head;
+    handlers[SOFTIRQ_TASKLET] = tasklet_action;
+    wait_queue_init(&cpu.thread_wait);
+    cpu.thread = thread_create("ksoftirqd", softirq_thread, 0);
+    if (!cpu.thread) {
+        klog(KLOG_ERR, "softirq", "cannot create ksoftirqd");
+    }
+}
+
+void softirq_register(uint32_t nr, softirq_handler_t handler) {
+    if (nr < SOFTIRQ_COUNT) {
+        handlers[nr] = handler;
+    }
+}
+
+// Work raised outside interrupt context runs at the next interrupt exit
+void __hot softirq_raise(uint32_t nr) {
+    uint32_t flags = irq_save();
+    cpu.pending |= 1u << nr;
+    irq_restore(flags);
+}
+
+void tasklet_init(tasklet_t* tasklet, void (*fn)(void* arg), void* arg) {
+    tasklet->next = 0;
+    tasklet->fn = fn;
+    tasklet->arg = arg;
+    tasklet->scheduled = 0;
+}
+
+void tasklet_schedule(tasklet_t* tasklet) {
+    uint32_t flags = irq_save();
+    if (!tasklet->scheduled) {
+        tasklet->scheduled = 1;
+        tasklet->next = 0;
+        *cpu.tasklet_tail = tasklet;
+        cpu.tasklet_tail = &tasklet->next;
+        cpu.pending |= 1u << SOFTIRQ_TASKLET;
+    }
+    irq_restore(flags);
+}
+
+// Run up to SOFTIRQ_TASKLET_BUDGET queued tasklets; the rest go back on
+// the front of the queue for the next pass
+static void tasklet_action(void) {
+    uint32_t flags = irq_save();
+    tasklet_t* list = cpu.tasklet_head;
+    cpu.tasklet_head = 0;
+    cpu.tasklet_tail = &cpu.tasklet_head;
+    irq_restore(flags);
+
+    for (uint32_t budget = SOFTIRQ_TASKLET_BUDGET; list; budget--) {
+        if (budget == 0) {
+            tasklet_t* last = list;
+            while (last->next) {
+                last = last->next;
+            }
+            flags = irq_save();
+            last->next = cpu.tasklet_head;
+            if (!cpu.tasklet_head) {
+                cpu.tasklet_tail = &last->next;
+            }
+            cpu.tasklet_head = list;
+            cpu.pending |= 1u << SOFTIRQ_TASKLET;
+            irq_restore(flags);
+            return;
+        }
+
+        // Unlink before clearing scheduled: from then on a top half may
+        // queue the tasklet again, which rewrites next
+        tasklet_t* tasklet = list;
+        list = tasklet->next;
+        compiler_barrier();
+        tasklet->scheduled = 0;
+        tasklet->fn(tasklet->arg);
+        stats.tasklets++;
+    }
+}
+
+// Run pending vectors until none are left or the budget is spent.
+// Called and returns with interrupts disabled and cpu.active clear.
+static void __hot softirq_run(int mode, uint32_t max_restart) {
+    uint32_t khz = timer_get_tsc_khz();
+    uint64_t limit = div64_32((uint64_t)khz * SOFTIRQ_MAX_US, 1000);
+    uint64_t start = rdtsc();
+
+    cpu.active = 1;
+    for (uint32_t pass = 0; cpu.pending && pass < max_restart; pass++) {
+        uint32_t pending = cpu.pending;
+        cpu.pending = 0;
+
+        if (mode == SOFTIRQ_IRQ_EXIT) {
+            irq_off_end();
+        }
+        if (mode != SOFTIRQ_INLINE) {
+            __asm__ volatile("sti");
+        }
+        for (uint32_t nr = 0; nr < SOFTIRQ_COUNT; nr++) {
+            if ((pending & (1u << nr)) && handlers[nr]) {
+                uint64_t begin = rdtsc();
+                handlers[nr]();
+                stats.runs[nr]++;
+                stats.cycles[nr] += rdtsc() - begin;
+            }
+        }
+        if (mode != SOFTIRQ_INLINE) {
+            __asm__ volatile("cli");
+        }
+        if (mode == SOFTIRQ_IRQ_EXIT) {
+            irq_off_begin();
+        }
+
+        if (limit && rdtsc() - start >= limit) {
+            break;
+        }
+    }
+    cpu.active = 0;
+}
+
+int softirq_active(void) {
+    return cpu.active;
+}
+
+// Called by the outermost interrupt handler after EOI, interrupts off.
+// While ksoftirqd has a backlog each exit runs a single pass, so the
+// worker and the threads between its batches still get the CPU.
+void __hot softirq_irq_exit(void) {
+    if (!cpu.pending) {
+        return;
+    }
+    stats.exits++;
+    if (!deferred) {
+        softirq_run(SOFTIRQ_INLINE, SOFTIRQ_MAX_RESTART);
+        return;
+    }
+    softirq_run(SOFTIRQ_IRQ_EXIT, cpu.thread_busy ? 1 : SOFTIRQ_MAX_RESTART);
+    if (cpu.pending && !cpu.thread_busy && cpu.thread) {
+        cpu.thread_busy = 1;
+        stats.thread_wakeups++;
+        wait_queue_wake_all(&cpu.thread_wait);
+    }
+}
+
+// ksoftirqd: drain the backlog a budget at a time, yielding in between
+static void softirq_thread(uint32_t arg) {
+    (void)arg;
+    // Interrupts stay off except while softirq_run() runs handlers
+    __asm__ volatile("cli");
+    while (1) {
+        while (!cpu.pending) {
+            cpu.thread_busy = 0;
+            wait_queue_sleep(&cpu.thread_wait);
+        }
+        stats.thread_runs++;
+        softirq_run(SOFTIRQ_THREAD, SOFTIRQ_MAX_RESTART);
+        sched_yield();
+    }
+}
+
+void softirq_set_deferred(int value) {
+    uint32_t flags = irq_save();
+    deferred = value;
+    irq_restore(flags);
+}
+
+void softirq_get_stats(softirq_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+static void print_irq_off(const irq_stats_t* s) {
+    terminal_print_dec(s->off_spans);
+    terminal_writestring(" spans, avg ");
+    terminal_print_dec(timer_cycles_to_ns(s->off_cycles, s->off_spans));
+    terminal_writestring(" ns, max ");
+    terminal_print_dec(timer_cycles_to_ns(s->off_max, 1));
+    terminal_println(" ns");
+}
+
+// Interrupt counts, interrupts-off time and softirq work (irqstat command)
+void softirq_print_stats(void) {
+    irq_stats_t irqs;
+    softirq_stats_t s;
+    irq_get_stats(&irqs);
+    softirq_get_stats(&s);
+
+    terminal_writestring("IRQs:");
+    for (int irq = 0; irq < 16; irq++) {
+        if (irqs.count[irq]) {
+            terminal_writestring("  ");
+            terminal_print_dec(irq);
+            terminal_writestring("=");
+            terminal_print_dec(irqs.count[irq]);
+        }
+    }
+    terminal_putchar('\n');
+    terminal_writestring("Interrupts off in handlers: ");
+    print_irq_off(&irqs);
+
+    terminal_writestring("Softirqs (");
+    terminal_writestring(deferred ? "deferred" : "inline");
+    terminal_writestring("): timer ");
+    terminal_print_dec(s.runs[SOFTIRQ_TIMER]);
+    terminal_writestring(" runs, avg ");
+    terminal_print_dec(timer_cycles_to_ns(s.cycles[SOFTIRQ_TIMER], s.runs[SOFTIRQ_TIMER]));
+    terminal_writestring(" ns; tasklet ");
+    terminal_print_dec(s.runs[SOFTIRQ_TASKLET]);
+    terminal_writestring(" runs, avg ");
+    terminal_print_dec(timer_cycles_to_ns(s.cycles[SOFTIRQ_TASKLET], s.runs[SOFTIRQ_TASKLET]));
+    terminal_writestring(" ns, ");
+    terminal_print_dec(s.tasklets);
+    terminal_println(" tasklets");
+    terminal_writestring("  at interrupt exit: ");
+    terminal_print_dec(s.exits);
+    terminal_writestring("  in ksoftirqd: ");
+    terminal_print_dec(s.thread_runs);
+    terminal_writestring(" (");
+    terminal_print_dec(s.thread_wakeups);
+    terminal_println(" handoffs)");
+}
+
+// Benchmark
+
+static volatile uint32_t bench_fired;
+
+static void bench_timer(void* arg) {
+    (void)arg;
+    bench_fired++;
+}
+
+// Timers expiring over IRQBENCH_TIMER_MS and uncached disk reads, with
+// interrupts-off time measured in one mode
+static void bench_run(int mode, block_device_t* dev, void* buffer) {
+    softirq_set_deferred(mode);
+    irq_reset_stats();
+    bench_fired = 0;
+
+    for (uint32_t i = 0; i < IRQBENCH_TIMERS; i++) {
+        timer_add(1 + i % IRQBENCH_TIMER_MS, bench_timer, 0);
+    }
+    uint32_t errors = 0;
+    if (dev) {
+        uint64_t slots = div64_32(dev->sector_count, IRQBENCH_READ_SECTORS);
+        for (uint32_t i = 0; i < IRQBENCH_READS; i++) {
+            uint64_t sector = (uint64_t)(i < slots ? i : 0) * IRQBENCH_READ_SECTORS;
+            if (blkdev_read(dev, sector, IRQBENCH_READ_SECTORS, buffer) != E_OK) {
+                errors++;
+            }
+        }
+    }
+    sleep_ms(IRQBENCH_TIMER_MS + 10);
+
+    irq_stats_t irqs;
+    irq_get_stats(&irqs);
+    terminal_writestring(mode ? "  deferred: " : "  inline:   ");
+    print_irq_off(&irqs);
+    if (bench_fired != IRQBENCH_TIMERS || errors) {
+        terminal_writestring("    ");
+        terminal_print_dec(bench_fired);
+        terminal_writestring(" timers fired, ");
+        terminal_print_dec(errors);
+        terminal_println(" read errors");
+    }
+}
+
+// Interrupts-off time with bottom halves run inline in the hard handler
+// (the old behaviour) and deferred with interrupts enabled
+void softirq_benchmark(void) {
+    block_device_t* dev = blkdev_count() ? blkdev_get(0) : 0;
+    void* buffer = pmm_alloc(1);
+    if (!buffer) {
+        terminal_println("irqbench: out of memory");
+        return;
+    }
+    if (dev && dev->sector_count < IRQBENCH_READ_SECTORS) {
+        dev = 0;
+    }
+
+    terminal_writestring("irqbench: ");
+    terminal_print_dec(IRQBENCH_TIMERS);
+    terminal_writestring(" timers over ");
+    terminal_print_dec(IRQBENCH_TIMER_MS);
+    terminal_writestring(" ms");
+    if (dev) {
+        terminal_writestring(", ");
+        terminal_print_dec(IRQBENCH_READS);
+        terminal_writestring(" reads of ");
+        terminal_print_dec(IRQBENCH_READ_SECTORS / 2);
+        terminal_writestring(" KB from ");
+        terminal_writestring(dev->name);
+    }
+    terminal_putchar('\n');
+    terminal_println("Interrupts off in handlers:");
+
+    int previous = deferred;
+    bench_run(0, dev, buffer);
+    bench_run(1, dev, buffer);
+    softirq_set_deferred(previous);
+    pmm_free(buffer, 1);
+}
@@ -0,0 +1,83 @@
+#include "stream.h"
+#include "serial.h"
+#include "memory.h"
+#include "errors.h"
+#include "klib.h"
+
+static void null_write(stream_t* stream, const char* data, size_t size) {
+    (void)stream;
+    (void)data;
+    (void)size;
+}
+
+static void pipe_write(stream_t* stream, const char* data, size_t size) {
+    uint32_t space = stream->capacity - stream->length;
+    uint32_t copy = size < space ? size : space;
+    memcpy(stream->buffer + stream->length, data, copy);
+    stream->length += copy;
+    stream->dropped += size - copy;
+}
+
+static void serial_stream_write(stream_t* stream, const char* data, size_t size) {
+    (void)stream;
+    serial_write(data, size);
+}
+
+void stream_null(stream_t* stream) {
+    memset(stream, 0, sizeof(*stream));
+    stream->write = null_write;
+}
+
+int stream_serial(stream_t* stream) {
+    if (!serial_present()) {
+        return E_NODEV;
+    }
+    memset(stream, 0, sizeof(*stream));
+    stream->write = serial_stream_write;
+    return E_OK;
+}
+
+int stream_pipe(stream_t* stream) {
+    memset(stream, 0, sizeof(*stream));
+    stream->buffer = pmm_alloc(STREAM_PIPE_PAGES);
+    if (!stream->buffer) {
+        return E_NOMEM;
+    }
+    stream->capacity = STREAM_PIPE_PAGES * PAGE_SIZE;
+    stream->write = pipe_write;
+    return E_OK;
+}
+
+// Empty a pipe for reuse by a later command
+void stream_rewind(stream_t* stream) {
+    stream->length = 0;
+    stream->read_pos = 0;
+    stream->dropped = 0;
+}
+
+void stream_free(stream_t* stream) {
+    if (stream->buffer) {
+        pmm_free(stream->buffer, STREAM_PIPE_PAGES);
+        stream->buffer = 0;
+    }
+}
+
+// Next line of a pipe without its newline, cut to size - 1 characters.
+// Returns its length, or -1 when everything has been read.
+int32_t stream_read_line(stream_t* stream, char* line, size_t size) {
+    if (stream->read_pos >= stream->length) {
+        return -1;
+    }
+    size_t length = 0;
+    while (stream->read_pos < stream->length) {
+        char c = stream->buffer[stream->read_pos++];
+        if (c == '\n') {
+            break;
+        }
+        if (length + 1 < size) {
+            line[length++] = c;
+        }
+    }
+    line[length] = 0;
+    return length;
+}
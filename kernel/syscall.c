@@ -0,0 +1,234 @@
+#include "syscall.h"
+#include "gdt.h"
+#include "cpu.h"
+#include "user.h"
+#include "usermode.h"
+#include "user_time.h"
+#include "kdata.h"
+#include "sched.h"
+#include "stream.h"
+#include "paging.h"
+#include "klib.h"
+#include "init.h"
+
+// Dispatch table indexed by system call number
+static syscall_fn_t syscall_table[SYSCALL_COUNT];
+static int sysenter_supported = 0;
+
+// Read by user_syscall() in ring 3 to pick the entry path
+USER_DATA uint32_t user_sysenter_available = 0;
+
+void sysenter_entry(void);
+
+// SYSENTER lands here with interrupts off, CS/SS from IA32_SYSENTER_CS and
+// ESP from IA32_SYSENTER_ESP. The ring 0 stack is reloaded from tss.esp0
+// so a context switch only has to update the TSS. The stub then builds an
+// interrupt_frame_t identical to the int 0x80 one (user EIP came in EDX,
+// user ESP in ECX) and leaves through SYSEXIT, which takes them back from
+// EDX/ECX. STI's one-instruction shadow keeps interrupts off until SYSEXIT
+// has switched to ring 3.
+__asm__(
+    ".text\n"
+    ".global sysenter_entry\n"
+    "sysenter_entry:\n"
+    "\tmovl tss+4, %esp\n"
+    "\tpushl $0x23\n"                    // SS: USER_DATA_SELECTOR
+    "\tpushl %ecx\n"                     // User ESP
+    "\tpushfl\n"
+    "\torl $0x200, (%esp)\n"             // User EFLAGS had IF set
+    "\tpushl $0x1B\n"                    // CS: USER_CODE_SELECTOR
+    "\tpushl %edx\n"                     // User EIP
+    "\tpushl $0\n"                       // err_code
+    "\tpushl $0x80\n"                    // int_no: SYSCALL_VECTOR
+    "\tpushal\n"
+    "\tcld\n"
+    "\tpushl %esp\n"
+    "\tcall syscall_dispatch\n"
+    "\taddl $4, %esp\n"
+    "\tpopal\n"
+    "\taddl $8, %esp\n"
+    "\tpopl %edx\n"                      // EIP for SYSEXIT
+    "\taddl $4, %esp\n"
+    "\tbtrl $9, (%esp)\n"                // Keep IF clear until SYSEXIT
+    "\tpopfl\n"
+    "\tpopl %ecx\n"                      // ESP for SYSEXIT
+    "\taddl $4, %esp\n"
+    "\tsti\n"
+    "\tsysexit\n"
+);
+
+// Built-in system calls
+static int32_t sys_null(interrupt_frame_t* frame) {
+    (void)frame;
+    return 0;
+}
+
+static int32_t sys_exit(interrupt_frame_t* frame) {
+    usermode_exit((int32_t)frame->ebx);
+}
+
+// System calls run with interrupts off (both entry paths clear IF), so a
+// long write goes out in TERMINAL_CONSOLE_CHUNK pieces with an interrupt
+// window after each. The buffer must be one ring 3 may pass in; each piece
+// is copied in before the console is touched, so a fault on an unmapped
+// user page ends the task without leaving the console half switched.
+// A program started from a redirected shell command, or run on the shell
+// thread itself, writes to the command's stream.
+static int32_t sys_write(interrupt_frame_t* frame) {
+    uint32_t buffer = frame->ebx;
+    size_t length = frame->esi;
+    thread_t* thread = sched_current();
+    stream_t* output = thread->output ? thread->output : terminal_get_output();
+    char chunk_data[TERMINAL_CONSOLE_CHUNK];
+
+    if (!paging_user_buffer(buffer, length)) {
+        return E_FAULT;
+    }
+    for (size_t done = 0; done < length; ) {
+        size_t chunk = length - done < TERMINAL_CONSOLE_CHUNK ? length - done : TERMINAL_CONSOLE_CHUNK;
+        memcpy(chunk_data, (const char*)buffer + done, chunk);
+        if (output) {
+            output->write(output, chunk_data, chunk);
+        } else {
+            terminal_write_console(thread->console, chunk_data, chunk);
+        }
+        done += chunk;
+        if (done < length) {
+            irq_window();
+        }
+    }
+    return (int32_t)length;
+}
+
+static int32_t sys_clock(interrupt_frame_t* frame) {
+    uint64_t ns = kdata_monotonic_ns();
+    frame->ebx = (uint32_t)(ns >> 32);
+    return (int32_t)(uint32_t)ns;
+}
+
+// Install the int 0x80 gate, program the SYSENTER MSRs and register the
+// built-in system calls
+void __init syscall_init(void) {
+    for (int i = 0; i < SYSCALL_COUNT; i++) {
+        syscall_table[i] = 0;
+    }
+
+    syscall_register(SYS_NULL, sys_null);
+    syscall_register(SYS_EXIT, sys_exit);
+    syscall_register(SYS_WRITE, sys_write);
+    syscall_register(SYS_CLOCK, sys_clock);
+
+    // The fallback gate is always present (DPL 3 so ring 3 may use it)
+    idt_set_gate(SYSCALL_VECTOR, (uint32_t)isr128, GDT_KERNEL_CODE, IDT_GATE_USER_INTERRUPT);
+
+    // SYSENTER needs CPUID.SEP
+    uint32_t edx;
+    cpuid(1, 0, 0, 0, &edx);
+    if (edx & CPUID_EDX_SEP) {
+        wrmsr(MSR_SYSENTER_CS, GDT_KERNEL_CODE);
+        wrmsr(MSR_SYSENTER_ESP, tss.esp0);
+        wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
+        sysenter_supported = 1;
+    }
+    user_sysenter_available = sysenter_supported;
+}
+
+void syscall_register(uint32_t num, syscall_fn_t handler) {
+    if (num < SYSCALL_COUNT) {
+        syscall_table[num] = handler;
+    }
+}
+
+// Common dispatcher for both entry paths
+__attribute__((used))
+void syscall_dispatch(interrupt_frame_t* frame) {
+    uint32_t num = frame->eax;
+    thread_t* thread = sched_current();
+
+    thread->in_syscall = 1;
+    if (num < SYSCALL_COUNT && syscall_table[num]) {
+        frame->eax = (uint32_t)syscall_table[num](frame);
+    } else {
+        frame->eax = (uint32_t)E_NOSYS;
+    }
+    thread->in_syscall = 0;
+}
+
+int syscall_sysenter_supported(void) {
+    return sysenter_supported;
+}
+
+// Null system call round-trip benchmark. A ring 3 task times
+// SYSCALL_BENCH_ITERATIONS calls of SYS_NULL through each entry path, then
+// compares reading the clock through SYS_CLOCK with reading it from the
+// shared kernel data page.
+#define SYSCALL_BENCH_ITERATIONS 10000
+
+USER_DATA static uint64_t bench_int80_cycles;
+USER_DATA static uint64_t bench_sysenter_cycles;
+USER_DATA static uint64_t bench_clock_syscall_cycles;
+USER_DATA static uint64_t bench_clock_kdata_cycles;
+USER_DATA static uint8_t bench_stack[4096] __attribute__((aligned(16)));
+
+USER_TEXT static void syscall_bench_task(void) {
+    uint64_t start = user_rdtsc();
+    for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; i++) {
+        user_syscall_int80(SYS_NULL, 0, 0, 0);
+    }
+    bench_int80_cycles = user_rdtsc() - start;
+
+    if (user_sysenter_available) {
+        start = user_rdtsc();
+        for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; i++) {
+            user_syscall_sysenter(SYS_NULL, 0, 0, 0);
+        }
+        bench_sysenter_cycles = user_rdtsc() - start;
+    }
+
+    start = user_rdtsc();
+    for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; i++) {
+        user_clock_monotonic_ns_syscall();
+    }
+    bench_clock_syscall_cycles = user_rdtsc() - start;
+
+    start = user_rdtsc();
+    for (uint32_t i = 0; i < SYSCALL_BENCH_ITERATIONS; i++) {
+        user_clock_monotonic_ns();
+    }
+    bench_clock_kdata_cycles = user_rdtsc() - start;
+
+    user_syscall_int80(SYS_EXIT, 0, 0, 0);
+}
+
+void syscall_benchmark(void) {
+    bench_int80_cycles = 0;
+    bench_sysenter_cycles = 0;
+    bench_clock_syscall_cycles = 0;
+    bench_clock_kdata_cycles = 0;
+
+    usermode_run(syscall_bench_task, (uint32_t)&bench_stack[sizeof(bench_stack)]);
+
+    terminal_writestring("Null syscall round trip (");
+    terminal_print_dec(SYSCALL_BENCH_ITERATIONS);
+    terminal_println(" calls):");
+
+    terminal_writestring("  int 0x80: ");
+    terminal_print_dec((uint32_t)div64_32(bench_int80_cycles, SYSCALL_BENCH_ITERATIONS));
+    terminal_println(" cycles/call");
+
+    terminal_writestring("  sysenter: ");
+    if (sysenter_supported) {
+        terminal_print_dec((uint32_t)div64_32(bench_sysenter_cycles, SYSCALL_BENCH_ITERATIONS));
+        terminal_println(" cycles/call");
+    } else {
+        terminal_println("not supported by this CPU");
+    }
+
+    terminal_writestring("  clock via syscall:    ");
+    terminal_print_dec((uint32_t)div64_32(bench_clock_syscall_cycles, SYSCALL_BENCH_ITERATIONS));
+    terminal_println(" cycles/read");
+
+    terminal_writestring("  clock via kdata page: ");
+    terminal_print_dec((uint32_t)div64_32(bench_clock_kdata_cycles, SYSCALL_BENCH_ITERATIONS));
+    terminal_println(" cycles/read");
+}
@@ -1,180 +1,843 @@
 #include "terminal.h"
+#include "klib.h"
+#include "cpu.h"
+#include "timer.h"
+#include "errors.h"
+#include "init.h"
+#include "stream.h"
+#include "sched.h"
+
+// Escape sequence parser states
+#define ESC_GROUND     0
+#define ESC_ESCAPE     1                    // After ESC
+#define ESC_INTER      2                    // ESC + intermediates (charset selection)
+#define ESC_CSI        3                    // After ESC [, collecting parameters
+#define ESC_CSI_IGNORE 4                    // Unsupported CSI, skipped to its final byte
+#define ESC_STATES     5
+
+// Character classes
+#define CC_CONTROL 0                        // C0 controls other than the ones below
+#define CC_ESC     1
+#define CC_CANCEL  2                        // CAN, SUB: abort a sequence
+#define CC_DIGIT   3
+#define CC_SEMI    4
+#define CC_COLON   5
+#define CC_PRIVATE 6                        // < = > ?
+#define CC_INTER   7                        // 0x20 - 0x2F
+#define CC_BRACKET 8
+#define CC_FINAL   9                        // 0x40 - 0x7E other than '['
+#define CC_DEL     10
+#define CC_HIGH    11                       // 0x80 - 0xFF
+#define CC_CLASSES 12
+
+// Parser actions
+#define EA_NONE         0
+#define EA_PRINT        1
+#define EA_EXECUTE      2                   // Control character
+#define EA_CLEAR        3                   // CSI started: reset parameters
+#define EA_PARAM        4                   // Digit of the current parameter
+#define EA_SEPARATE     5                   // Next parameter
+#define EA_PRIVATE      6
+#define EA_ESC_DISPATCH 7
+#define EA_CSI_DISPATCH 8
+
+// Transition table entry: action in the high nibble, next state in the low
+#define T(action, state) (uint8_t)((EA_##action) << 4 | (ESC_##state))
+
+static const uint8_t esc_transitions[ESC_STATES][CC_CLASSES] = {
+    // CONTROL, ESC, CANCEL, DIGIT, SEMI, COLON, PRIVATE, INTER, BRACKET, FINAL, DEL, HIGH
+    [ESC_GROUND] = {
+        T(EXECUTE, GROUND), T(NONE, ESCAPE), T(NONE, GROUND), T(PRINT, GROUND),
+        T(PRINT, GROUND), T(PRINT, GROUND), T(PRINT, GROUND), T(PRINT, GROUND),
+        T(PRINT, GROUND), T(PRINT, GROUND), T(NONE, GROUND), T(PRINT, GROUND),
+    },
+    [ESC_ESCAPE] = {
+        T(EXECUTE, ESCAPE), T(NONE, ESCAPE), T(NONE, GROUND), T(ESC_DISPATCH, GROUND),
+        T(ESC_DISPATCH, GROUND), T(ESC_DISPATCH, GROUND), T(ESC_DISPATCH, GROUND), T(NONE, INTER),
+        T(CLEAR, CSI), T(ESC_DISPATCH, GROUND), T(NONE, ESCAPE), T(NONE, GROUND),
+    },
+    [ESC_INTER] = {
+        T(EXECUTE, INTER), T(NONE, ESCAPE), T(NONE, GROUND), T(NONE, GROUND),
+        T(NONE, GROUND), T(NONE, GROUND), T(NONE, GROUND), T(NONE, INTER),
+        T(NONE, GROUND), T(NONE, GROUND), T(NONE, INTER), T(NONE, GROUND),
+    },
+    [ESC_CSI] = {
+        T(EXECUTE, CSI), T(NONE, ESCAPE), T(NONE, GROUND), T(PARAM, CSI),
+        T(SEPARATE, CSI), T(NONE, CSI_IGNORE), T(PRIVATE, CSI), T(NONE, CSI_IGNORE),
+        T(CSI_DISPATCH, GROUND), T(CSI_DISPATCH, GROUND), T(NONE, CSI), T(NONE, GROUND),
+    },
+    [ESC_CSI_IGNORE] = {
+        T(EXECUTE, CSI_IGNORE), T(NONE, ESCAPE), T(NONE, GROUND), T(NONE, CSI_IGNORE),
+        T(NONE, CSI_IGNORE), T(NONE, CSI_IGNORE), T(NONE, CSI_IGNORE), T(NONE, CSI_IGNORE),
+        T(NONE, GROUND), T(NONE, GROUND), T(NONE, CSI_IGNORE), T(NONE, GROUND),
+    },
+};
+
+// ANSI color number to VGA color
+static const uint8_t ansi_colors[8] = {
+    VGA_BLACK, VGA_RED, VGA_GREEN, VGA_BROWN, VGA_BLUE, VGA_MAGENTA, VGA_CYAN, VGA_LIGHT_GREY,
+};
+
+// ansibench: frames written, rows and columns drawn per frame
+#define ANSIBENCH_FRAMES 50
+#define ANSIBENCH_ROWS   24
+#define ANSIBENCH_COLS   70
+
+// vcbench: round trips between two consoles, lines written to each
+#define VCBENCH_SWITCHES 1000
+#define VCBENCH_LINES    2000
 
 // Global variables
-static uint16_t* vga_buffer = (uint16_t*)VGA_BUFFER;
-static terminal_state_t terminal_state = {0};
-
-// Initialize terminal
-void terminal_initialize(void) {
-    terminal_state.cursor.x = 0;
-    terminal_state.cursor.y = 0;
-    terminal_state.color = VGA_COLOR(VGA_LIGHT_GREY, VGA_BLACK);
-    terminal_state.saved_color = terminal_state.color;
-    terminal_state.saved_cursor = terminal_state.cursor;
-    
+#define VGA_PAGE_BACKEND(n) {(uint16_t*)(VGA_BUFFER + (n) * VGA_PAGE_SIZE), VGA_WIDTH, VGA_HEIGHT, 0, 0, 0}
+static const terminal_backend_t vga_backends[TERMINAL_CONSOLES] = {
+    VGA_PAGE_BACKEND(0), VGA_PAGE_BACKEND(1), VGA_PAGE_BACKEND(2),
+    VGA_PAGE_BACKEND(3), VGA_PAGE_BACKEND(4), VGA_PAGE_BACKEND(5),
+};
+static terminal_state_t consoles[TERMINAL_CONSOLES];
+static uint32_t active_console = 0;         // The one on screen
+
+// Console being written to, normally the active one
+static const terminal_backend_t* backend = &vga_backends[0];
+static terminal_state_t* terminal_state = &consoles[0];
+static terminal_stats_t terminal_stats;
+
+// Last hardware cursor written to the CRTC; 0xFFFF forces the next update
+static uint16_t hw_cursor_pos = 0xFFFF;
+static uint8_t hw_cursor_hidden = 0xFF;
+
+// Scrollback: lines that scrolled off the top of each console, in a byte
+// ring. A line is its trailing blank's attribute followed by runs of
+// [count][attribute][characters], with the trailing blanks dropped, so
+// single-color text costs about a byte per character. start[] locates
+// each line; the oldest lines are dropped to make room.
+typedef struct {
+    uint8_t data[TERMINAL_SCROLLBACK_BYTES];
+    uint16_t start[TERMINAL_SCROLLBACK_LINES];  // Offset of each line in data
+    uint32_t first;                 // Index of the oldest line in start[]
+    uint32_t count;                 // Lines held
+    uint32_t head;                  // Next free byte in data
+    uint32_t used;                  // Bytes held
+    uint32_t chars;                 // Characters held, blanks trimmed
+} scrollback_t;
+
+#define SCROLLBACK_MASK      (TERMINAL_SCROLLBACK_BYTES - 1)
+#define SCROLLBACK_LINE_MASK (TERMINAL_SCROLLBACK_LINES - 1)
+#define SCROLLBACK_RUN_MAX   255
+
+static scrollback_t scrollbacks[TERMINAL_CONSOLES];
+static uint32_t scrollback_view = 0;        // Lines the active console is scrolled back
+
+static void terminal_scrollback_exit(void);
+
+// Output of the thread that set it goes to a stream instead (shell pipes
+// and redirections): text is written to the stream, and clearing, drawing
+// and cursor movement are dropped. Other threads and
+// terminal_write_console() still reach the screen.
+static stream_t* output;
+static thread_t* output_thread;
+
+// The calling thread's stream, 0 if it writes to the screen
+static inline stream_t* terminal_redirected(void) {
+    stream_t* stream = output;
+    return stream && sched_current() == output_thread ? stream : 0;
+}
+
+static inline void terminal_changed(void) {
+    if (scrollback_view && terminal_state == &consoles[active_console]) {
+        terminal_scrollback_exit();         // New output: back to the live screen
+    }
+    if (backend->changed) {
+        backend->changed();
+    }
+}
+
+static void terminal_reset_region(void) {
+    terminal_state->scroll_top = 0;
+    terminal_state->scroll_bottom = backend->height - 1;
+}
+
+// Fill count cells with blanks in the current color
+static void terminal_fill(uint16_t* cells, uint32_t count) {
+    uint16_t blank = VGA_ENTRY(' ', terminal_state->color);
+    for (uint32_t i = 0; i < count; i++) {
+        cells[i] = blank;
+    }
+}
+
+// Point the CRTC at the active console's text page
+static void terminal_show_page(void) {
+    uint16_t start = active_console * VGA_PAGE_CELLS;
+    outw(VGA_CRTC_INDEX, VGA_CRTC_START_HIGH | (start >> 8) << 8);
+    outw(VGA_CRTC_INDEX, VGA_CRTC_START_LOW | (start & 0xFF) << 8);
+    hw_cursor_pos = 0xFFFF;
+    hw_cursor_hidden = 0xFF;
+}
+
+// Initialize terminal: every console starts blank, the first one shown
+void __init terminal_initialize(void) {
+    for (uint32_t i = 0; i < TERMINAL_CONSOLES; i++) {
+        terminal_state = &consoles[i];
+        backend = &vga_backends[i];
+        terminal_state->cursor.x = 0;
+        terminal_state->cursor.y = 0;
+        terminal_state->color = TERMINAL_DEFAULT_COLOR;
+        terminal_state->saved_color = terminal_state->color;
+        terminal_state->saved_cursor = terminal_state->cursor;
+        terminal_state->cursor_hidden = 0;
+        terminal_state->reverse = 0;
+        terminal_state->esc_state = ESC_GROUND;
+        terminal_reset_region();
+        terminal_fill(backend->cells, VGA_WIDTH * VGA_HEIGHT);
+    }
+
+    active_console = 0;
+    terminal_state = &consoles[0];
+    backend = &vga_backends[0];
+    terminal_show_page();
     terminal_clear();
 }
 
 // Clear entire screen
 void terminal_clear(void) {
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            vga_buffer[index] = VGA_ENTRY(' ', terminal_state.color);
-        }
+    if (terminal_redirected()) {
+        return;
     }
-    terminal_state.cursor.x = 0;
-    terminal_state.cursor.y = 0;
+    terminal_fill(backend->cells, backend->width * backend->height);
+    terminal_state->cursor.x = 0;
+    terminal_state->cursor.y = 0;
+    terminal_changed();
+    terminal_update_cursor();
 }
 
 // Clear specific line
 void terminal_clear_line(uint16_t line) {
-    if (line >= VGA_HEIGHT) return;
+    if (terminal_redirected()) {
+        return;
+    }
+    if (line >= backend->height) return;
     
-    for (size_t x = 0; x < VGA_WIDTH; x++) {
-        const size_t index = line * VGA_WIDTH + x;
-        vga_buffer[index] = VGA_ENTRY(' ', terminal_state.color);
+    terminal_fill(backend->cells + line * backend->width, backend->width);
+    terminal_changed();
+}
+
+// Move lines top..bottom (inclusive) up by n lines, or down for negative n,
+// blanking the lines that come in
+static void terminal_scroll_lines(uint16_t top, uint16_t bottom, int32_t n) {
+    uint16_t width = backend->width;
+    uint32_t lines = bottom - top + 1;
+    uint32_t count = n < 0 ? -n : n;
+    if (count > lines) {
+        count = lines;
+    }
+    uint32_t keep = lines - count;
+    uint16_t* region = backend->cells + top * width;
+
+    if (n > 0) {
+        memmove(region, region + count * width, keep * width * sizeof(uint16_t));
+        if (top == 0 && bottom == backend->height - 1 && backend->scrolled) {
+            for (uint32_t i = 0; i < count; i++) {
+                backend->scrolled();
+            }
+        }
+        terminal_fill(region + keep * width, count * width);
+    } else {
+        memmove(region + count * width, region, keep * width * sizeof(uint16_t));
+        terminal_fill(region, count * width);
+    }
+    terminal_changed();
+}
+
+// Size of the line at index i of start[] (i counts from the oldest)
+static uint32_t scrollback_line_size(const scrollback_t* sb, uint32_t i) {
+    uint32_t end = i + 1 < sb->count ? sb->start[(sb->first + i + 1) & SCROLLBACK_LINE_MASK] : sb->head;
+    return (end - sb->start[(sb->first + i) & SCROLLBACK_LINE_MASK]) & SCROLLBACK_MASK;
+}
+
+static void scrollback_drop_oldest(scrollback_t* sb) {
+    uint32_t pos = sb->start[sb->first & SCROLLBACK_LINE_MASK];
+    uint32_t size = scrollback_line_size(sb, 0);
+
+    // Walk the run headers to keep the character count
+    for (uint32_t i = 1; i < size; ) {
+        uint32_t run = sb->data[(pos + i) & SCROLLBACK_MASK];
+        sb->chars -= run;
+        i += 2 + run;
+    }
+    sb->used -= size;
+    sb->first = (sb->first + 1) & SCROLLBACK_LINE_MASK;
+    sb->count--;
+}
+
+static inline void scrollback_put(scrollback_t* sb, uint8_t byte) {
+    sb->data[sb->head] = byte;
+    sb->head = (sb->head + 1) & SCROLLBACK_MASK;
+}
+
+// Append a screen row. Only the row is looked at, and only as many old
+// lines are dropped as the new one needs room for.
+static void scrollback_push(scrollback_t* sb, const uint16_t* cells, uint32_t width) {
+    uint8_t fill = cells[width - 1] >> 8;
+    uint32_t length = width;
+    while (length && cells[length - 1] == VGA_ENTRY(' ', fill)) {
+        length--;
+    }
+
+    uint32_t size = 1 + length;
+    for (uint32_t i = 0, run = 0; i < length; i++, run++) {
+        if (i == 0 || run == SCROLLBACK_RUN_MAX || cells[i] >> 8 != cells[i - 1] >> 8) {
+            size += 2;
+            run = 0;
+        }
+    }
+
+    while (sb->count == TERMINAL_SCROLLBACK_LINES || TERMINAL_SCROLLBACK_BYTES - sb->used < size) {
+        scrollback_drop_oldest(sb);
+    }
+
+    sb->start[(sb->first + sb->count) & SCROLLBACK_LINE_MASK] = sb->head;
+    sb->count++;
+    sb->used += size;
+    sb->chars += length;
+    scrollback_put(sb, fill);
+    for (uint32_t i = 0; i < length; ) {
+        uint8_t attr = cells[i] >> 8;
+        uint32_t run = 1;
+        while (i + run < length && run < SCROLLBACK_RUN_MAX && cells[i + run] >> 8 == attr) {
+            run++;
+        }
+        scrollback_put(sb, run);
+        scrollback_put(sb, attr);
+        for (uint32_t j = 0; j < run; j++) {
+            scrollback_put(sb, cells[i + j] & 0xFF);
+        }
+        i += run;
+    }
+}
+
+// Decode line i (0 is the oldest) into width cells
+static void scrollback_line(const scrollback_t* sb, uint32_t i, uint16_t* cells, uint32_t width) {
+    uint32_t pos = sb->start[(sb->first + i) & SCROLLBACK_LINE_MASK];
+    uint32_t end = pos + scrollback_line_size(sb, i);
+    uint16_t blank = VGA_ENTRY(' ', sb->data[pos & SCROLLBACK_MASK]);
+    uint32_t x = 0;
+
+    pos++;
+    while (pos < end) {
+        uint32_t run = sb->data[pos & SCROLLBACK_MASK];
+        uint8_t attr = sb->data[(pos + 1) & SCROLLBACK_MASK];
+        pos += 2;
+        for (uint32_t j = 0; j < run; j++, pos++) {
+            if (x < width) {
+                cells[x++] = VGA_ENTRY(sb->data[pos & SCROLLBACK_MASK], attr);
+            }
+        }
+    }
+    while (x < width) {
+        cells[x++] = blank;
+    }
+}
+
+// Keep the top count rows of the console before they scroll away
+static void terminal_save_lines(uint32_t count) {
+    scrollback_t* sb = &scrollbacks[terminal_state - consoles];
+    for (uint32_t y = 0; y < count && y < backend->height; y++) {
+        scrollback_push(sb, backend->cells + y * backend->width, backend->width);
     }
 }
 
 // Scroll screen up
 void terminal_scroll(void) {
-    // Move all lines up by one
-    for (size_t y = 0; y < VGA_HEIGHT - 1; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[y * VGA_WIDTH + x] = vga_buffer[(y + 1) * VGA_WIDTH + x];
-        }
+    if (terminal_redirected()) {
+        return;
     }
-    
-    // Clear the last line
-    terminal_clear_line(VGA_HEIGHT - 1);
+    // Move all lines up by one and clear the last line
+    terminal_save_lines(1);
+    terminal_scroll_lines(0, backend->height - 1, 1);
     
     // Adjust cursor if it was at the bottom
-    if (terminal_state.cursor.y > 0) {
-        terminal_state.cursor.y--;
+    if (terminal_state->cursor.y > 0) {
+        terminal_state->cursor.y--;
     }
 }
 
 // Color management functions
 void terminal_setcolor(uint8_t color) {
-    terminal_state.color = color;
+    terminal_state->color = color;
 }
 
 uint8_t terminal_getcolor(void) {
-    return terminal_state.color;
+    return terminal_state->color;
 }
 
 void terminal_set_foreground(uint8_t color) {
-    terminal_state.color = (terminal_state.color & 0xF0) | (color & 0x0F);
+    terminal_state->color = (terminal_state->color & 0xF0) | (color & 0x0F);
 }
 
 void terminal_set_background(uint8_t color) {
-    terminal_state.color = (terminal_state.color & 0x0F) | ((color & 0x0F) << 4);
+    terminal_state->color = (terminal_state->color & 0x0F) | ((color & 0x0F) << 4);
 }
 
 void terminal_save_color(void) {
-    terminal_state.saved_color = terminal_state.color;
+    terminal_state->saved_color = terminal_state->color;
 }
 
 void terminal_restore_color(void) {
-    terminal_state.color = terminal_state.saved_color;
+    terminal_state->color = terminal_state->saved_color;
 }
 
 // Cursor management functions
 void terminal_set_cursor(uint16_t x, uint16_t y) {
-    if (x < VGA_WIDTH && y < VGA_HEIGHT) {
-        terminal_state.cursor.x = x;
-        terminal_state.cursor.y = y;
+    if (terminal_redirected()) {
+        return;
+    }
+    if (x < backend->width && y < backend->height) {
+        terminal_state->cursor.x = x;
+        terminal_state->cursor.y = y;
+        terminal_changed();
+        terminal_update_cursor();
     }
 }
 
 void terminal_get_cursor(uint16_t* x, uint16_t* y) {
-    if (x) *x = terminal_state.cursor.x;
-    if (y) *y = terminal_state.cursor.y;
+    if (x) *x = terminal_state->cursor.x;
+    if (y) *y = terminal_state->cursor.y;
 }
 
 void terminal_move_cursor(int16_t dx, int16_t dy) {
-    int32_t new_x = terminal_state.cursor.x + dx;
-    int32_t new_y = terminal_state.cursor.y + dy;
+    if (terminal_redirected()) {
+        return;
+    }
+    int32_t new_x = terminal_state->cursor.x + dx;
+    int32_t new_y = terminal_state->cursor.y + dy;
     
-    if (new_x >= 0 && new_x < VGA_WIDTH && new_y >= 0 && new_y < VGA_HEIGHT) {
-        terminal_state.cursor.x = new_x;
-        terminal_state.cursor.y = new_y;
+    if (new_x >= 0 && new_x < backend->width && new_y >= 0 && new_y < backend->height) {
+        terminal_state->cursor.x = new_x;
+        terminal_state->cursor.y = new_y;
+        terminal_changed();
+        terminal_update_cursor();
     }
 }
 
 void terminal_save_cursor(void) {
-    terminal_state.saved_cursor = terminal_state.cursor;
+    if (terminal_redirected()) {
+        return;
+    }
+    terminal_state->saved_cursor = terminal_state->cursor;
 }
 
 void terminal_restore_cursor(void) {
-    terminal_state.cursor = terminal_state.saved_cursor;
+    if (terminal_redirected()) {
+        return;
+    }
+    terminal_state->cursor = terminal_state->saved_cursor;
+    terminal_changed();
+    terminal_update_cursor();
 }
 
 void terminal_hide_cursor(void) {
-    // In text mode, we can't actually hide the cursor, but we can move it off-screen
-    terminal_set_cursor(VGA_WIDTH, VGA_HEIGHT);
+    if (terminal_redirected()) {
+        return;
+    }
+    terminal_state->cursor_hidden = 1;
+    terminal_changed();
+    terminal_update_cursor();
 }
 
 void terminal_show_cursor(void) {
-    // Move cursor back to a visible position
-    terminal_set_cursor(terminal_state.cursor.x, terminal_state.cursor.y);
+    if (terminal_redirected()) {
+        return;
+    }
+    terminal_state->cursor_hidden = 0;
+    terminal_changed();
+    terminal_update_cursor();
 }
 
-// Character output functions
-void terminal_putchar(char c) {
-    if (c == '\n') {
-        terminal_state.cursor.x = 0;
-        if (++terminal_state.cursor.y == VGA_HEIGHT) {
-            terminal_scroll();
+int terminal_cursor_visible(void) {
+    return !terminal_state->cursor_hidden;
+}
+
+// Move down a line, scrolling the scroll region at its bottom
+static void __hot terminal_linefeed(void) {
+    if (terminal_state->cursor.y == terminal_state->scroll_bottom) {
+        if (terminal_state->scroll_top == 0) {
+            terminal_save_lines(1);
         }
+        terminal_scroll_lines(terminal_state->scroll_top, terminal_state->scroll_bottom, 1);
+    } else if (terminal_state->cursor.y + 1 < backend->height) {
+        terminal_state->cursor.y++;
+    }
+}
+
+// Put a character at the cursor and advance, wrapping at the right edge
+static void __hot terminal_print(char c) {
+    const size_t index = terminal_state->cursor.y * backend->width + terminal_state->cursor.x;
+    backend->cells[index] = VGA_ENTRY(c, terminal_state->color);
+    if (++terminal_state->cursor.x == backend->width) {
+        terminal_state->cursor.x = 0;
+        terminal_linefeed();
+    }
+}
+
+static void __hot terminal_execute(char c) {
+    if (c == '\n') {
+        terminal_state->cursor.x = 0;
+        terminal_linefeed();
     } else if (c == '\r') {
-        terminal_state.cursor.x = 0;
+        terminal_state->cursor.x = 0;
     } else if (c == '\t') {
         // Tab: move to next tab stop (every 8 characters)
-        terminal_state.cursor.x = (terminal_state.cursor.x + 8) & ~7;
-        if (terminal_state.cursor.x >= VGA_WIDTH) {
-            terminal_state.cursor.x = 0;
-            if (++terminal_state.cursor.y == VGA_HEIGHT) {
-                terminal_scroll();
-            }
+        terminal_state->cursor.x = (terminal_state->cursor.x + 8) & ~7;
+        if (terminal_state->cursor.x >= backend->width) {
+            terminal_state->cursor.x = 0;
+            terminal_linefeed();
         }
     } else if (c == '\b') {
         // Backspace
-        if (terminal_state.cursor.x > 0) {
-            terminal_state.cursor.x--;
-            terminal_putchar_at(' ', terminal_state.cursor.x, terminal_state.cursor.y);
+        if (terminal_state->cursor.x > 0) {
+            terminal_state->cursor.x--;
+            backend->cells[terminal_state->cursor.y * backend->width + terminal_state->cursor.x] =
+                VGA_ENTRY(' ', terminal_state->color);
         }
-    } else {
-        terminal_putchar_at(c, terminal_state.cursor.x, terminal_state.cursor.y);
-        if (++terminal_state.cursor.x == VGA_WIDTH) {
-            terminal_state.cursor.x = 0;
-            if (++terminal_state.cursor.y == VGA_HEIGHT) {
-                terminal_scroll();
+    } else if (c != '\a') {
+        // Other control characters show their code page 437 glyph
+        terminal_print(c);
+    }
+}
+
+// Numeric parameter i of the current sequence; missing and zero
+// parameters take the default
+static uint16_t esc_param(uint32_t i, uint16_t def) {
+    if (i < terminal_state->esc_count && terminal_state->esc_params[i]) {
+        return terminal_state->esc_params[i];
+    }
+    return def;
+}
+
+// Select graphic rendition: colors, bold (bright foreground) and reverse
+static void terminal_sgr(void) {
+    uint32_t count = terminal_state->esc_count ? terminal_state->esc_count : 1;
+    uint8_t color = terminal_state->color;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t p = i < terminal_state->esc_count ? terminal_state->esc_params[i] : 0;
+        if (p == 0) {
+            color = TERMINAL_DEFAULT_COLOR;
+            terminal_state->reverse = 0;
+        } else if (p == 1) {
+            color |= 0x08;
+        } else if (p == 22) {
+            color &= ~0x08;
+        } else if ((p == 7 && !terminal_state->reverse) || (p == 27 && terminal_state->reverse)) {
+            color = (uint8_t)(color << 4 | color >> 4);
+            terminal_state->reverse = p == 7;
+        } else if (p >= 30 && p <= 37) {
+            color = (color & 0xF8) | ansi_colors[p - 30];
+        } else if (p == 39) {
+            color = (color & 0xF0) | (TERMINAL_DEFAULT_COLOR & 0x0F);
+        } else if (p >= 40 && p <= 47) {
+            color = (color & 0x0F) | ansi_colors[p - 40] << 4;
+        } else if (p == 49) {
+            color = (color & 0x0F) | (TERMINAL_DEFAULT_COLOR & 0xF0);
+        } else if (p >= 90 && p <= 97) {
+            color = (color & 0xF0) | ansi_colors[p - 90] | 0x08;
+        } else if (p >= 100 && p <= 107) {
+            color = (color & 0x0F) | (ansi_colors[p - 100] | 0x08) << 4;
+        }
+    }
+    terminal_state->color = color;
+}
+
+// Erase cells [from, to) of the screen, counted row by row
+static void terminal_erase(uint32_t from, uint32_t to) {
+    if (from < to) {
+        terminal_fill(backend->cells + from, to - from);
+        terminal_changed();
+    }
+}
+
+static void terminal_csi_dispatch(char final) {
+    uint32_t width = backend->width;
+    uint32_t height = backend->height;
+    uint32_t x = terminal_state->cursor.x;
+    uint32_t y = terminal_state->cursor.y;
+    uint32_t top = terminal_state->scroll_top;
+    uint32_t bottom = terminal_state->scroll_bottom;
+    uint32_t cursor = y * width + x;
+    uint32_t n = esc_param(0, 1);
+
+    if (terminal_state->esc_private) {
+        // DECTCEM: ESC[?25h shows the cursor, ESC[?25l hides it
+        if (terminal_state->esc_private == '?' && esc_param(0, 0) == 25 && (final == 'h' || final == 'l')) {
+            terminal_state->cursor_hidden = final == 'l';
+            terminal_changed();
+        }
+        return;
+    }
+
+    switch (final) {
+        case 'A':   // Cursor up
+            y = n > y ? 0 : y - n;
+            break;
+        case 'B':   // Cursor down
+            y += n;
+            break;
+        case 'C':   // Cursor forward
+            x += n;
+            break;
+        case 'D':   // Cursor back
+            x = n > x ? 0 : x - n;
+            break;
+        case 'E':   // Cursor to the start of a following line
+            x = 0;
+            y += n;
+            break;
+        case 'F':   // Cursor to the start of a preceding line
+            x = 0;
+            y = n > y ? 0 : y - n;
+            break;
+        case 'G':   // Cursor to column
+        case '`':
+            x = n - 1;
+            break;
+        case 'd':   // Cursor to row
+            y = n - 1;
+            break;
+        case 'H':   // Cursor position (1-based row;column)
+        case 'f':
+            y = n - 1;
+            x = esc_param(1, 1) - 1;
+            break;
+        case 'J':   // Erase in display: to end, from start, all
+            n = esc_param(0, 0);
+            if (n == 0) {
+                terminal_erase(cursor, width * height);
+            } else if (n == 1) {
+                terminal_erase(0, cursor + 1);
+            } else {
+                terminal_erase(0, width * height);
+            }
+            break;
+        case 'K':   // Erase in line: to end, from start, all
+            n = esc_param(0, 0);
+            if (n == 0) {
+                terminal_erase(cursor, (y + 1) * width);
+            } else if (n == 1) {
+                terminal_erase(y * width, cursor + 1);
+            } else {
+                terminal_erase(y * width, (y + 1) * width);
+            }
+            break;
+        case 'X':   // Erase characters
+            terminal_erase(cursor, cursor + (n < width - x ? n : width - x));
+            break;
+        case 'L':   // Insert lines at the cursor, within the scroll region
+        case 'M':   // Delete lines
+            if (y >= top && y <= bottom) {
+                terminal_scroll_lines(y, bottom, final == 'L' ? -(int32_t)n : (int32_t)n);
+                x = 0;
+            }
+            break;
+        case 'S':   // Scroll the region up
+            terminal_scroll_lines(top, bottom, n);
+            break;
+        case 'T':   // Scroll the region down
+            terminal_scroll_lines(top, bottom, -(int32_t)n);
+            break;
+        case 'm':
+            terminal_sgr();
+            break;
+        case 'r':   // Set scroll region (1-based top;bottom), cursor home
+            top = esc_param(0, 1) - 1;
+            bottom = esc_param(1, height) - 1;
+            if (top < bottom && bottom < height) {
+                terminal_state->scroll_top = top;
+                terminal_state->scroll_bottom = bottom;
+                x = 0;
+                y = 0;
             }
+            break;
+        case 's':
+            terminal_state->saved_cursor = terminal_state->cursor;
+            break;
+        case 'u':
+            x = terminal_state->saved_cursor.x;
+            y = terminal_state->saved_cursor.y;
+            break;
+        default:
+            return;
+    }
+
+    terminal_state->cursor.x = x < width ? x : width - 1;
+    terminal_state->cursor.y = y < height ? y : height - 1;
+    terminal_stats.sequences++;
+}
+
+static void terminal_esc_dispatch(char final) {
+    switch (final) {
+        case '7':   // Save cursor and color
+            terminal_state->saved_cursor = terminal_state->cursor;
+            terminal_state->saved_color = terminal_state->color;
+            break;
+        case '8':   // Restore them
+            terminal_state->cursor = terminal_state->saved_cursor;
+            terminal_state->color = terminal_state->saved_color;
+            break;
+        case 'D':   // Index
+            terminal_linefeed();
+            break;
+        case 'E':   // Next line
+            terminal_state->cursor.x = 0;
+            terminal_linefeed();
+            break;
+        case 'M':   // Reverse index
+            if (terminal_state->cursor.y == terminal_state->scroll_top) {
+                terminal_scroll_lines(terminal_state->scroll_top, terminal_state->scroll_bottom, -1);
+            } else if (terminal_state->cursor.y > 0) {
+                terminal_state->cursor.y--;
+            }
+            break;
+        case 'c':   // Reset
+            terminal_state->color = TERMINAL_DEFAULT_COLOR;
+            terminal_state->reverse = 0;
+            terminal_state->cursor_hidden = 0;
+            terminal_reset_region();
+            terminal_erase(0, backend->width * backend->height);
+            terminal_state->cursor.x = 0;
+            terminal_state->cursor.y = 0;
+            break;
+        default:
+            return;
+    }
+    terminal_stats.sequences++;
+}
+
+static uint8_t __hot esc_class(uint8_t c) {
+    if (c >= 0x80) return CC_HIGH;
+    if (c >= 0x40) return c == '[' ? CC_BRACKET : c == 0x7F ? CC_DEL : CC_FINAL;
+    if (c >= 0x3C) return CC_PRIVATE;
+    if (c >= 0x30) return c == ';' ? CC_SEMI : c == ':' ? CC_COLON : CC_DIGIT;
+    if (c >= 0x20) return CC_INTER;
+    if (c == 0x1B) return CC_ESC;
+    if (c == 0x18 || c == 0x1A) return CC_CANCEL;
+    return CC_CONTROL;
+}
+
+// Feed one byte through the escape sequence state machine
+static void __hot terminal_parse(char c) {
+    uint8_t entry = esc_transitions[terminal_state->esc_state][esc_class((uint8_t)c)];
+    terminal_state->esc_state = entry & 0x0F;
+
+    switch (entry >> 4) {
+        case EA_PRINT:
+            terminal_print(c);
+            break;
+        case EA_EXECUTE:
+            terminal_execute(c);
+            break;
+        case EA_CLEAR:
+            terminal_state->esc_private = 0;
+            terminal_state->esc_count = 0;
+            terminal_state->esc_params[0] = 0;
+            break;
+        case EA_PARAM: {
+            if (terminal_state->esc_count == 0) {
+                terminal_state->esc_count = 1;
+            }
+            uint16_t* param = &terminal_state->esc_params[terminal_state->esc_count - 1];
+            uint32_t value = *param * 10 + (c - '0');
+            *param = value > TERMINAL_ESC_PARAM_MAX ? TERMINAL_ESC_PARAM_MAX : value;
+            break;
         }
+        case EA_SEPARATE:
+            if (terminal_state->esc_count == 0) {
+                terminal_state->esc_count = 1;
+            }
+            if (terminal_state->esc_count < TERMINAL_ESC_PARAMS) {
+                terminal_state->esc_params[terminal_state->esc_count++] = 0;
+            }
+            break;
+        case EA_PRIVATE:
+            terminal_state->esc_private = c;
+            break;
+        case EA_ESC_DISPATCH:
+            terminal_esc_dispatch(c);
+            break;
+        case EA_CSI_DISPATCH:
+            terminal_csi_dispatch(c);
+            break;
+    }
+}
+
+// Redirect the calling thread's output, or give it back the screen with 0.
+// Returns the previous stream.
+stream_t* terminal_set_output(stream_t* stream) {
+    uint32_t flags = irq_save();
+    stream_t* previous = output;
+    output = stream;
+    output_thread = sched_current();
+    irq_restore(flags);
+    return previous;
+}
+
+// The calling thread's stream, 0 if it writes to the screen
+stream_t* terminal_get_output(void) {
+    return terminal_redirected();
+}
+
+// Character output functions
+void __hot terminal_putchar(char c) {
+    stream_t* stream = terminal_redirected();
+    if (stream) {
+        stream->write(stream, &c, 1);
+        return;
     }
+    terminal_stats.chars++;
+    terminal_parse(c);
+    terminal_changed();
+    terminal_update_cursor();
 }
 
 void terminal_putchar_at(char c, uint16_t x, uint16_t y) {
-    if (x < VGA_WIDTH && y < VGA_HEIGHT) {
-        const size_t index = y * VGA_WIDTH + x;
-        vga_buffer[index] = VGA_ENTRY(c, terminal_state.color);
+    if (terminal_redirected()) {
+        return;
+    }
+    if (x < backend->width && y < backend->height) {
+        const size_t index = y * backend->width + x;
+        backend->cells[index] = VGA_ENTRY(c, terminal_state->color);
+        terminal_changed();
     }
 }
 
 void terminal_putchar_color(char c, uint8_t color) {
-    uint8_t old_color = terminal_state.color;
-    terminal_state.color = color;
+    uint8_t old_color = terminal_state->color;
+    terminal_state->color = color;
     terminal_putchar(c);
-    terminal_state.color = old_color;
+    terminal_state->color = old_color;
 }
 
-// String output functions
-void terminal_write(const char* data, size_t size) {
+// String output functions. Plain text skips the parser; the hardware
+// cursor is written once at the end, not per character.
+static void __hot terminal_write_screen(const char* data, size_t size) {
     for (size_t i = 0; i < size; i++) {
-        terminal_putchar(data[i]);
+        char c = data[i];
+        if (terminal_state->esc_state == ESC_GROUND && c >= 0x20 && c < 0x7F) {
+            terminal_print(c);
+        } else {
+            terminal_parse(c);
+        }
+    }
+    terminal_stats.chars += size;
+    terminal_changed();
+    terminal_update_cursor();
+}
+
+void __hot terminal_write(const char* data, size_t size) {
+    stream_t* stream = terminal_redirected();
+    if (stream) {
+        stream->write(stream, data, size);
+        return;
     }
+    terminal_write_screen(data, size);
 }
 
 void terminal_writestring(const char* data) {
@@ -182,8 +845,8 @@ void terminal_writestring(const char* data) {
 }
 
 void terminal_writestring_at(const char* data, uint16_t x, uint16_t y) {
-    uint16_t old_x = terminal_state.cursor.x;
-    uint16_t old_y = terminal_state.cursor.y;
+    uint16_t old_x = terminal_state->cursor.x;
+    uint16_t old_y = terminal_state->cursor.y;
     
     terminal_set_cursor(x, y);
     terminal_writestring(data);
@@ -192,10 +855,10 @@ void terminal_writestring_at(const char* data, uint16_t x, uint16_t y) {
 }
 
 void terminal_writestring_color(const char* data, uint8_t color) {
-    uint8_t old_color = terminal_state.color;
-    terminal_state.color = color;
+    uint8_t old_color = terminal_state->color;
+    terminal_state->color = color;
     terminal_writestring(data);
-    terminal_state.color = old_color;
+    terminal_state->color = old_color;
 }
 
 // Enhanced output functions
@@ -206,7 +869,7 @@ void terminal_println(const char* str) {
 
 void terminal_print_hex(uint32_t value) {
     const char hex_chars[] = "0123456789ABCDEF";
-    char hex_str[9] = "0x";
+    char hex_str[11] = "0x";
     
     for (int i = 0; i < 8; i++) {
         hex_str[i + 2] = hex_chars[(value >> (28 - i * 4)) & 0xF];
@@ -222,18 +885,28 @@ void terminal_print_dec(uint32_t value) {
         return;
     }
     
-    char buffer[11];
-    int i = 0;
+    char buffer[10];
+    int i = sizeof(buffer);
     
+    // Fill from the end, then print in one write
     while (value > 0) {
-        buffer[i++] = '0' + (value % 10);
+        buffer[--i] = '0' + (value % 10);
         value /= 10;
     }
-    
-    // Print in reverse order
-    while (i > 0) {
-        terminal_putchar(buffer[--i]);
-    }
+    terminal_write(buffer + i, sizeof(buffer) - i);
+}
+
+// 64-bit values (TSC cycle counts); there is no 64-bit divide to link
+// against, so digits come from div64_32()
+void terminal_print_dec64(uint64_t value) {
+    char buffer[20];
+    int i = sizeof(buffer);
+    do {
+        uint64_t quotient = div64_32(value, 10);
+        buffer[--i] = '0' + (uint32_t)(value - quotient * 10);
+        value = quotient;
+    } while (value);
+    terminal_write(buffer + i, sizeof(buffer) - i);
 }
 
 void terminal_print_bin(uint32_t value) {
@@ -247,16 +920,19 @@ void terminal_print_bin(uint32_t value) {
     // Find the highest bit set
     uint32_t mask = 0x80000000;
     int started = 0;
+    char buffer[32];
+    int n = 0;
     
     for (int i = 0; i < 32; i++) {
         if (value & mask) {
             started = 1;
-            terminal_putchar('1');
+            buffer[n++] = '1';
         } else if (started) {
-            terminal_putchar('0');
+            buffer[n++] = '0';
         }
         mask >>= 1;
     }
+    terminal_write(buffer, n);
 }
 
 // Simple printf implementation
@@ -268,23 +944,29 @@ void terminal_printf(const char* format, ...) {
 
 // Screen management functions
 void terminal_fill_screen(char c, uint8_t color) {
-    uint8_t old_color = terminal_state.color;
-    terminal_state.color = color;
+    if (terminal_redirected()) {
+        return;
+    }
+    uint8_t old_color = terminal_state->color;
+    terminal_state->color = color;
     
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
+    for (size_t y = 0; y < backend->height; y++) {
+        for (size_t x = 0; x < backend->width; x++) {
             terminal_putchar_at(c, x, y);
         }
     }
     
-    terminal_state.color = old_color;
+    terminal_state->color = old_color;
 }
 
 void terminal_draw_box(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, char border_char, uint8_t color) {
-    if (x1 >= VGA_WIDTH || y1 >= VGA_HEIGHT || x2 >= VGA_WIDTH || y2 >= VGA_HEIGHT) return;
+    if (terminal_redirected()) {
+        return;
+    }
+    if (x1 >= backend->width || y1 >= backend->height || x2 >= backend->width || y2 >= backend->height) return;
     
-    uint8_t old_color = terminal_state.color;
-    terminal_state.color = color;
+    uint8_t old_color = terminal_state->color;
+    terminal_state->color = color;
     
     // Draw horizontal lines
     for (uint16_t x = x1; x <= x2; x++) {
@@ -298,93 +980,413 @@ void terminal_draw_box(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, char
         terminal_putchar_at(border_char, x2, y);
     }
     
-    terminal_state.color = old_color;
+    terminal_state->color = old_color;
 }
 
 void terminal_draw_line_horizontal(uint16_t x, uint16_t y, uint16_t length, char c, uint8_t color) {
-    if (y >= VGA_HEIGHT) return;
+    if (terminal_redirected()) {
+        return;
+    }
+    if (y >= backend->height) return;
     
-    uint8_t old_color = terminal_state.color;
-    terminal_state.color = color;
+    uint8_t old_color = terminal_state->color;
+    terminal_state->color = color;
     
-    for (uint16_t i = 0; i < length && x + i < VGA_WIDTH; i++) {
+    for (uint16_t i = 0; i < length && x + i < backend->width; i++) {
         terminal_putchar_at(c, x + i, y);
     }
     
-    terminal_state.color = old_color;
+    terminal_state->color = old_color;
 }
 
 void terminal_draw_line_vertical(uint16_t x, uint16_t y, uint16_t length, char c, uint8_t color) {
-    if (x >= VGA_WIDTH) return;
+    if (terminal_redirected()) {
+        return;
+    }
+    if (x >= backend->width) return;
     
-    uint8_t old_color = terminal_state.color;
-    terminal_state.color = color;
+    uint8_t old_color = terminal_state->color;
+    terminal_state->color = color;
     
-    for (uint16_t i = 0; i < length && y + i < VGA_HEIGHT; i++) {
+    for (uint16_t i = 0; i < length && y + i < backend->height; i++) {
         terminal_putchar_at(c, x, y + i);
     }
     
-    terminal_state.color = old_color;
+    terminal_state->color = old_color;
+}
+
+// Output backend
+void terminal_set_backend(const terminal_backend_t* new_backend) {
+    if (scrollback_view) {
+        terminal_scrollback_exit();
+    }
+    backend = new_backend ? new_backend : &vga_backends[active_console];
+    if (terminal_state->cursor.x >= backend->width) {
+        terminal_state->cursor.x = backend->width - 1;
+    }
+    if (terminal_state->cursor.y >= backend->height) {
+        terminal_state->cursor.y = backend->height - 1;
+    }
+    terminal_reset_region();
+    if (!new_backend) {
+        terminal_show_page();       // Text mode registers were reloaded
+    }
+    terminal_changed();
+    terminal_update_cursor();
+}
+
+const terminal_backend_t* terminal_get_backend(void) {
+    return backend;
+}
+
+uint16_t terminal_get_width(void) {
+    return backend->width;
+}
+
+uint16_t terminal_get_height(void) {
+    return backend->height;
+}
+
+// Push pending output to the screen, e.g. before halting
+void terminal_flush(void) {
+    if (backend->flush) {
+        backend->flush();
+    }
+}
+
+// Virtual consoles. Each one owns a page of VGA text memory, so showing
+// another is two CRTC writes rather than a copy of the screen, and output
+// to a console in the background is plain memory writes: its cursor and
+// scrolling never touch the VGA registers.
+int terminal_switch_console(uint32_t console) {
+    if (console >= TERMINAL_CONSOLES) {
+        return E_INVAL;
+    }
+
+    uint32_t flags = irq_save();
+    if (backend != &vga_backends[active_console]) {
+        irq_restore(flags);
+        return E_BUSY;              // The framebuffer console owns the screen
+    }
+    if (console != active_console) {
+        scrollback_view = 0;
+        active_console = console;
+        terminal_state = &consoles[console];
+        backend = &vga_backends[console];
+        terminal_show_page();
+        terminal_update_cursor();
+        terminal_stats.switches++;
+    }
+    irq_restore(flags);
+    return E_OK;
+}
+
+uint32_t terminal_get_console(void) {
+    return active_console;
+}
+
+// Write to a console whether or not it is on screen. A background console
+// is swapped in with interrupts disabled for the whole write, so callers
+// keep writes short: klog lines, and TERMINAL_CONSOLE_CHUNK pieces of a
+// user program's SYS_WRITE.
+void terminal_write_console(uint32_t console, const char* data, size_t size) {
+    uint32_t flags = irq_save();
+    if (console >= TERMINAL_CONSOLES || console == active_console) {
+        terminal_write_screen(data, size);
+        irq_restore(flags);
+        return;
+    }
+
+    const terminal_backend_t* shown = backend;
+    terminal_state = &consoles[console];
+    backend = &vga_backends[console];
+    terminal_write_screen(data, size);
+    terminal_state = &consoles[active_console];
+    backend = shown;
+    irq_restore(flags);
+}
+
+// Show the active console scrolled back by lines from the live screen.
+// The view is drawn into a spare text page and displayed from there, so
+// the console itself is left alone and output to it goes on as usual.
+void terminal_scrollback(int32_t lines) {
+    uint32_t flags = irq_save();
+    const scrollback_t* sb = &scrollbacks[active_console];
+    if (backend != &vga_backends[active_console] || terminal_state != &consoles[active_console]) {
+        irq_restore(flags);
+        return;                     // Text mode only
+    }
+
+    int32_t view = (int32_t)scrollback_view + lines;
+    if (view > (int32_t)sb->count) {
+        view = sb->count;
+    }
+    if (view <= 0) {
+        if (scrollback_view) {
+            terminal_scrollback_exit();
+            terminal_update_cursor();
+        }
+        irq_restore(flags);
+        return;
+    }
+
+    uint16_t* page = (uint16_t*)(VGA_BUFFER + TERMINAL_SCROLLBACK_PAGE * VGA_PAGE_SIZE);
+    for (uint32_t y = 0; y < VGA_HEIGHT; y++) {
+        uint32_t line = sb->count - view + y;
+        if (line < sb->count) {
+            scrollback_line(sb, line, page + y * VGA_WIDTH, VGA_WIDTH);
+        } else {
+            memcpy(page + y * VGA_WIDTH, backend->cells + (line - sb->count) * VGA_WIDTH,
+                   VGA_WIDTH * sizeof(uint16_t));
+        }
+    }
+
+    uint16_t start = TERMINAL_SCROLLBACK_PAGE * VGA_PAGE_CELLS;
+    outw(VGA_CRTC_INDEX, VGA_CRTC_START_HIGH | (start >> 8) << 8);
+    outw(VGA_CRTC_INDEX, VGA_CRTC_START_LOW | (start & 0xFF) << 8);
+    scrollback_view = view;
+    irq_restore(flags);
+}
+
+static void terminal_scrollback_exit(void) {
+    scrollback_view = 0;
+    terminal_show_page();
+}
+
+void terminal_scrollback_print_stats(void) {
+    const scrollback_t* sb = &scrollbacks[active_console];
+    uint32_t cells = sb->count * backend->width;
+
+    terminal_writestring("Scrollback (console ");
+    terminal_print_dec(active_console + 1);
+    terminal_writestring("): ");
+    terminal_print_dec(sb->count);
+    terminal_writestring(" of ");
+    terminal_print_dec(TERMINAL_SCROLLBACK_LINES);
+    terminal_writestring(" lines, ");
+    terminal_print_dec(sb->used);
+    terminal_writestring(" of ");
+    terminal_print_dec(TERMINAL_SCROLLBACK_BYTES);
+    terminal_println(" bytes");
+    terminal_writestring("  ");
+    terminal_print_dec(sb->chars);
+    terminal_writestring(" characters kept, ");
+    if (sb->chars) {
+        uint32_t hundredths = (uint32_t)div64_32((uint64_t)sb->used * 100, sb->chars);
+        terminal_print_dec(hundredths / 100);
+        terminal_putchar('.');
+        terminal_putchar('0' + hundredths / 10 % 10);
+        terminal_putchar('0' + hundredths % 10);
+    } else {
+        terminal_putchar('0');
+    }
+    terminal_writestring(" bytes each; as screen cells: ");
+    terminal_print_dec(cells * 2);
+    terminal_println(" bytes");
 }
 
 // Utility functions
 uint16_t terminal_get_index(uint16_t x, uint16_t y) {
-    return y * VGA_WIDTH + x;
+    return y * backend->width + x;
 }
 
-void terminal_update_cursor(void) {
-    // In a real implementation, you might update hardware cursor
-    // For now, we just ensure our internal state is consistent
+// Move the VGA hardware cursor to the logical one. Every port access is a
+// VM exit under QEMU, so the CRTC is only written when something changed,
+// and callers update once per call rather than once per character.
+void __hot terminal_update_cursor(void) {
+    if (backend != &vga_backends[active_console] || terminal_state != &consoles[active_console]) {
+        return;                     // Other backends draw their own cursor,
+    }                               // background consoles have none
+
+    uint8_t hidden = terminal_state->cursor_hidden;
+    if (hidden != hw_cursor_hidden) {
+        outb(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_START);
+        uint8_t start = inb(VGA_CRTC_DATA) & ~VGA_CURSOR_DISABLE;
+        outb(VGA_CRTC_DATA, hidden ? start | VGA_CURSOR_DISABLE : start);
+        hw_cursor_hidden = hidden;
+    }
+
+    uint16_t pos = active_console * VGA_PAGE_CELLS +
+                   terminal_state->cursor.y * VGA_WIDTH + terminal_state->cursor.x;
+    if (!hidden && pos != hw_cursor_pos) {
+        outw(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_LOW | (pos & 0xFF) << 8);
+        outw(VGA_CRTC_INDEX, VGA_CRTC_CURSOR_HIGH | (pos >> 8) << 8);
+        hw_cursor_pos = pos;
+        terminal_stats.cursor_writes++;
+    }
 }
 
+// Run a complete escape sequence, e.g. "\033[2J"
 void terminal_handle_escape_sequence(const char* sequence) {
-    // Basic escape sequence handling
-    // This would be expanded in a full implementation
-    (void)sequence; // Suppress unused parameter warning
+    terminal_writestring(sequence);
 }
 
-// String length function
-size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len]) {
-        len++;
+void terminal_get_stats(terminal_stats_t* stats) {
+    *stats = terminal_stats;
+}
+
+// Append a decimal number to a buffer
+static uint32_t append_dec(char* buffer, uint32_t len, uint32_t value) {
+    char digits[10];
+    int i = sizeof(digits);
+    do {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (i < (int)sizeof(digits)) {
+        buffer[len++] = digits[i++];
     }
     return len;
 }
 
-// String copy function
-char* strcpy(char* dest, const char* src) {
-    char* ptr = dest;
-    while (*src) {
-        *ptr = *src;
-        ptr++;
-        src++;
+static uint32_t append_str(char* buffer, uint32_t len, const char* s) {
+    while (*s) {
+        buffer[len++] = *s++;
     }
-    *ptr = '\0';
-    return dest;
+    return len;
 }
 
-// String compare function
-int strcmp(const char* str1, const char* str2) {
-    while (*str1 && *str2) {
-        if (*str1 != *str2) {
-            return (*str1 < *str2) ? -1 : 1;
+// Draw a full-screen "TUI" frame, a row at a time with cursor positioning,
+// colors and erase-to-end-of-line, through terminal_write() and through
+// terminal_putchar() one byte at a time (the hardware cursor moves with
+// every character)
+void terminal_benchmark(void) {
+    static char frame[ANSIBENCH_ROWS * (ANSIBENCH_COLS + 32) + 16];
+    uint32_t len = 0;
+    for (uint32_t row = 0; row < ANSIBENCH_ROWS; row++) {
+        len = append_str(frame, len, "\033[");
+        len = append_dec(frame, len, row + 1);
+        len = append_str(frame, len, ";1H\033[");
+        len = append_dec(frame, len, 30 + row % 8);
+        frame[len++] = ';';
+        len = append_dec(frame, len, 40 + (row + 4) % 8);
+        frame[len++] = 'm';
+        for (uint32_t col = 0; col < ANSIBENCH_COLS; col++) {
+            frame[len++] = 'A' + (row + col) % 26;
         }
-        str1++;
-        str2++;
+        len = append_str(frame, len, "\033[0m\033[K");
     }
-    return (*str1 == *str2) ? 0 : (*str1 < *str2) ? -1 : 1;
-}
 
-// String compare with length function
-int strncmp(const char* str1, const char* str2, size_t n) {
-    for (size_t i = 0; i < n; i++) {
-        if (str1[i] != str2[i]) {
-            return (str1[i] < str2[i]) ? -1 : 1;
-        }
-        if (str1[i] == '\0') {
-            return 0;
+    uint8_t old_color = terminal_state->color;
+    terminal_stats_t before, after_write, after_putchar;
+    terminal_get_stats(&before);
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < ANSIBENCH_FRAMES; i++) {
+        terminal_write(frame, len);
+    }
+    uint64_t write_cycles = rdtsc() - start;
+    terminal_get_stats(&after_write);
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < ANSIBENCH_FRAMES; i++) {
+        for (uint32_t j = 0; j < len; j++) {
+            terminal_putchar(frame[j]);
         }
     }
-    return 0;
-} 
\ No newline at end of file
+    uint64_t putchar_cycles = rdtsc() - start;
+    terminal_get_stats(&after_putchar);
+
+    terminal_state->color = old_color;
+    terminal_clear();
+    terminal_writestring("ansibench: ");
+    terminal_print_dec(len);
+    terminal_writestring(" byte frame, ");
+    terminal_print_dec((after_write.sequences - before.sequences) / ANSIBENCH_FRAMES);
+    terminal_println(" escape sequences");
+    terminal_writestring("  terminal_write:   ");
+    terminal_print_dec(timer_cycles_to_us(write_cycles, ANSIBENCH_FRAMES));
+    terminal_writestring(" us/frame, ");
+    terminal_print_dec((after_write.cursor_writes - before.cursor_writes) / ANSIBENCH_FRAMES);
+    terminal_println(" cursor updates/frame");
+    terminal_writestring("  terminal_putchar: ");
+    terminal_print_dec(timer_cycles_to_us(putchar_cycles, ANSIBENCH_FRAMES));
+    terminal_writestring(" us/frame, ");
+    terminal_print_dec((after_putchar.cursor_writes - after_write.cursor_writes) / ANSIBENCH_FRAMES);
+    terminal_println(" cursor updates/frame");
+    if (backend != &vga_backends[active_console]) {
+        terminal_println("  (framebuffer console: no hardware cursor)");
+    }
+}
+
+// Time a console switch against copying a screen, and output to a console
+// in the background against the same output on screen
+void terminal_console_benchmark(void) {
+    static uint16_t screen[VGA_WIDTH * VGA_HEIGHT];
+    static char line[VGA_WIDTH];
+    uint32_t home = active_console;
+    uint32_t other = home == TERMINAL_CONSOLES - 1 ? 0 : TERMINAL_CONSOLES - 1;
+
+    if (backend != &vga_backends[home]) {
+        terminal_println("vcbench: not available on the framebuffer console");
+        return;
+    }
+    if (!timer_get_tsc_khz()) {
+        terminal_println("vcbench: TSC not calibrated");
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < VCBENCH_SWITCHES; i++) {
+        terminal_switch_console(other);
+        terminal_switch_console(home);
+    }
+    uint64_t switch_cycles = rdtsc() - start;
+
+    // A copying switch saves the screen and loads the other one; the spare
+    // page past the last console stands in for the display
+    uint16_t* spare = (uint16_t*)(VGA_BUFFER + (VGA_PAGES - 1) * VGA_PAGE_SIZE);
+    start = rdtsc();
+    for (uint32_t i = 0; i < VCBENCH_SWITCHES; i++) {
+        memcpy(screen, backend->cells, sizeof(screen));
+        memcpy(spare, screen, sizeof(screen));
+    }
+    uint64_t copy_cycles = rdtsc() - start;
+
+    uint32_t len = append_str(line, 0, "vcbench: background output ");
+    while (len < sizeof(line) - 1) {
+        line[len] = 'a' + len % 26;
+        len++;
+    }
+    line[len++] = '\n';
+
+    terminal_stats_t before, after_background, after_foreground;
+    terminal_get_stats(&before);
+    start = rdtsc();
+    for (uint32_t i = 0; i < VCBENCH_LINES; i++) {
+        terminal_write_console(other, line, len);
+    }
+    uint64_t background_cycles = rdtsc() - start;
+    terminal_get_stats(&after_background);
+
+    start = rdtsc();
+    for (uint32_t i = 0; i < VCBENCH_LINES; i++) {
+        terminal_write(line, len);
+    }
+    uint64_t foreground_cycles = rdtsc() - start;
+    terminal_get_stats(&after_foreground);
+
+    uint64_t kbytes = (uint64_t)VCBENCH_LINES * len * 1000000 / 1024;
+    uint32_t background_us = timer_cycles_to_us(background_cycles, 1);
+    uint32_t foreground_us = timer_cycles_to_us(foreground_cycles, 1);
+
+    terminal_clear();
+    terminal_writestring("vcbench: switch ");
+    terminal_print_dec(timer_cycles_to_ns(switch_cycles, 2 * VCBENCH_SWITCHES));
+    terminal_writestring(" ns, copying a screen instead ");
+    terminal_print_dec(timer_cycles_to_ns(copy_cycles, VCBENCH_SWITCHES));
+    terminal_println(" ns");
+    terminal_writestring("  console ");
+    terminal_print_dec(other + 1);
+    terminal_writestring(" (background): ");
+    terminal_print_dec(background_us ? (uint32_t)div64_32(kbytes, background_us) : 0);
+    terminal_writestring(" KB/s, ");
+    terminal_print_dec(after_background.cursor_writes - before.cursor_writes);
+    terminal_println(" cursor updates");
+    terminal_writestring("  console ");
+    terminal_print_dec(home + 1);
+    terminal_writestring(" (on screen):  ");
+    terminal_print_dec(foreground_us ? (uint32_t)div64_32(kbytes, foreground_us) : 0);
+    terminal_writestring(" KB/s, ");
+    terminal_print_dec(after_foreground.cursor_writes - after_background.cursor_writes);
+    terminal_println(" cursor updates");
+}
@@ -0,0 +1,126 @@
+#include "timer.h"
+#include "cpu.h"
+#include "kdata.h"
+#include "memory.h"
+#include "sched.h"
+#include "softirq.h"
+#include "klog.h"
+#include "init.h"
+
+// Global variables
+static volatile uint64_t timer_ticks = 0;
+static uint32_t tsc_khz = 0;
+
+static uint8_t __init rtc_read(uint8_t reg) {
+    outb(CMOS_ADDRESS_PORT, reg);
+    return inb(CMOS_DATA_PORT);
+}
+
+static uint32_t __init bcd_to_binary(uint32_t value) {
+    return (value & 0x0F) + (value >> 4) * 10;
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date
+static uint32_t __init days_from_civil(uint32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    uint32_t era = year / 400;
+    uint32_t yoe = year - era * 400;
+    uint32_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// Read the RTC as seconds since 1970-01-01 UTC (the RTC is assumed to
+// keep UTC, as QEMU's does by default)
+uint32_t __init rtc_read_unix_time(void) {
+    while (rtc_read(RTC_STATUS_A) & 0x80) {
+        // Update in progress
+    }
+
+    uint32_t second = rtc_read(RTC_SECONDS);
+    uint32_t minute = rtc_read(RTC_MINUTES);
+    uint32_t hour = rtc_read(RTC_HOURS);
+    uint32_t day = rtc_read(RTC_DAY);
+    uint32_t month = rtc_read(RTC_MONTH);
+    uint32_t year = rtc_read(RTC_YEAR);
+    uint8_t status_b = rtc_read(RTC_STATUS_B);
+
+    // Values are BCD unless status B bit 2 is set
+    if (!(status_b & 0x04)) {
+        second = bcd_to_binary(second);
+        minute = bcd_to_binary(minute);
+        hour = bcd_to_binary(hour & 0x7F) | (hour & 0x80);
+        day = bcd_to_binary(day);
+        month = bcd_to_binary(month);
+        year = bcd_to_binary(year);
+    }
+
+    // 12-hour mode keeps the PM flag in bit 7
+    if (!(status_b & 0x02) && (hour & 0x80)) {
+        hour = ((hour & 0x7F) + 12) % 24;
+    }
+
+    year += 2000;
+    return days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+}
+
+// Program PIT channel 0 for TIMER_HZ, measure the TSC against it and
+// publish the clock in the shared kernel data page. Interrupts must be on.
+void __init timer_init(void) {
+    uint32_t divisor = PIT_BASE_FREQUENCY / TIMER_HZ;
+    outb(PIT_COMMAND, PIT_MODE_RATE_GEN);
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);
+
+    // Start on a tick boundary, then count cycles over the window
+    uint64_t start_tick = timer_ticks;
+    while (timer_ticks == start_tick) {
+        __asm__ volatile("hlt");
+    }
+    uint64_t tsc_start = rdtsc();
+    start_tick = timer_ticks;
+    while (timer_ticks - start_tick < TIMER_CALIBRATE_TICKS) {
+        __asm__ volatile("hlt");
+    }
+    uint64_t cycles = rdtsc() - tsc_start;
+
+    // cycles per window -> kHz
+    tsc_khz = (uint32_t)div64_32(cycles * TIMER_HZ, TIMER_CALIBRATE_TICKS * 1000);
+
+    uint64_t wall_ns = (uint64_t)rtc_read_unix_time() * 1000000000ULL;
+    kdata_set_clock(tsc_khz, wall_ns);
+    klog(KLOG_INFO, "timer", "%u Hz, TSC %u kHz", TIMER_HZ, tsc_khz);
+}
+
+// IRQ0 handler. Expired timers run from the timer softirq.
+void __hot timer_handler(void) {
+    timer_ticks++;
+    kdata_tick();
+    sched_tick();
+    softirq_raise(SOFTIRQ_TIMER);
+}
+
+uint64_t timer_get_ticks(void) {
+    uint32_t flags = irq_save();
+    uint64_t ticks = timer_ticks;
+    irq_restore(flags);
+    return ticks;
+}
+
+uint32_t timer_get_tsc_khz(void) {
+    return tsc_khz;
+}
+
+uint32_t timer_cycles_to_us(uint64_t cycles, uint32_t count) {
+    if (!tsc_khz || !count) {
+        return 0;
+    }
+    return (uint32_t)div64_32(div64_32(cycles * 1000, tsc_khz), count);
+}
+
+uint32_t timer_cycles_to_ns(uint64_t cycles, uint32_t count) {
+    if (!tsc_khz || !count) {
+        return 0;
+    }
+    return (uint32_t)div64_32(div64_32(cycles * 1000000, tsc_khz), count);
+}
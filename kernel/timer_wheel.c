@@ -0,0 +1,358 @@
+#include "timer_wheel.h"
+#include "timer.h"
+#include "cpu.h"
+#include "klib.h"
+#include "memory.h"
+#include "sched.h"
+#include "softirq.h"
+#include "klog.h"
+#include "init.h"
+
+#define ROOT_MASK  (TIMER_WHEEL_ROOT_SIZE - 1)
+#define LEVEL_MASK (TIMER_WHEEL_SIZE - 1)
+
+// Longest delay: wheel time is compared modulo 2^32
+#define TIMER_MAX_TICKS 0x7FFFFFFFu
+
+// Benchmark parameters
+#define TIMER_BENCH_OPS    1000000          // Adds (and as many cancels)
+#define TIMER_BENCH_LIVE   1024             // Timers armed at any time during that run
+#define TIMER_BENCH_EXPIRE 200              // Timers for the expiry run, 1 ms apart
+
+// Global variables
+static struct {
+    timer_t* root[TIMER_WHEEL_ROOT_SIZE];
+    timer_t* levels[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+    uint32_t jiffies;               // Next tick to process
+} wheel;
+
+static timer_t* pool;
+static timer_t* free_timers;
+static uint32_t pool_pages;
+static int initialized = 0;
+static timer_wheel_stats_t stats;
+
+static void timer_wheel_softirq(void);
+
+static void timer_link(timer_t* timer, timer_t** bucket) {
+    timer->next = *bucket;
+    if (timer->next) {
+        timer->next->pprev = &timer->next;
+    }
+    *bucket = timer;
+    timer->pprev = bucket;
+}
+
+static void timer_unlink(timer_t* timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+// Bucket for a timer due at expires: the root level within
+// TIMER_WHEEL_ROOT_SIZE ticks, otherwise the lowest level whose span
+// covers the delay. Timers already due go in the bucket processed next.
+static timer_t** wheel_bucket(uint32_t expires) {
+    uint32_t delta = expires - wheel.jiffies;
+    if ((int32_t)delta < 0) {
+        return &wheel.root[wheel.jiffies & ROOT_MASK];
+    }
+    if (delta < TIMER_WHEEL_ROOT_SIZE) {
+        return &wheel.root[expires & ROOT_MASK];
+    }
+    uint32_t level = 0;
+    uint32_t shift = TIMER_WHEEL_ROOT_BITS;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= 1u << (shift + TIMER_WHEEL_BITS)) {
+        level++;
+        shift += TIMER_WHEEL_BITS;
+    }
+    return &wheel.levels[level][(expires >> shift) & LEVEL_MASK];
+}
+
+// Redistribute one bucket of a level into the levels below; returns the
+// bucket index so the caller knows whether this level wrapped too
+static uint32_t wheel_cascade(uint32_t level) {
+    uint32_t index = (wheel.jiffies >> (TIMER_WHEEL_ROOT_BITS + level * TIMER_WHEEL_BITS)) & LEVEL_MASK;
+    timer_t* timer = wheel.levels[level][index];
+    wheel.levels[level][index] = 0;
+    while (timer) {
+        timer_t* next = timer->next;
+        timer_link(timer, wheel_bucket(timer->expires));
+        stats.cascaded++;
+        timer = next;
+    }
+    return index;
+}
+
+static int timer_from_pool(timer_t* timer) {
+    return timer >= pool && timer < pool + TIMER_POOL_SIZE;
+}
+
+static void timer_free(timer_t* timer) {
+    timer->generation++;
+    timer->next = free_timers;
+    free_timers = timer;
+}
+
+// Arm timer for ticks from now. Interrupts must be disabled.
+static void timer_arm(timer_t* timer, uint32_t ticks, timer_fn_t fn, void* arg) {
+    if (ticks == 0) {
+        ticks = 1;
+    } else if (ticks > TIMER_MAX_TICKS) {
+        ticks = TIMER_MAX_TICKS;
+    }
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->expires = wheel.jiffies + ticks;
+    timer_link(timer, wheel_bucket(timer->expires));
+    stats.added++;
+}
+
+static uint32_t ms_to_ticks(uint32_t ms) {
+    return (uint32_t)div64_32((uint64_t)ms * TIMER_HZ, 1000);
+}
+
+void __init timer_wheel_init(void) {
+    pool_pages = PAGE_ALIGN_UP(TIMER_POOL_SIZE * sizeof(timer_t)) / PAGE_SIZE;
+    pool = (timer_t*)pmm_alloc(pool_pages);
+    if (!pool) {
+        klog(KLOG_ERR, "timer", "out of memory for the timer pool");
+        return;
+    }
+    memset(pool, 0, pool_pages * PAGE_SIZE);
+    free_timers = 0;
+    for (int i = TIMER_POOL_SIZE - 1; i >= 0; i--) {
+        timer_free(&pool[i]);
+    }
+    wheel.jiffies = (uint32_t)timer_get_ticks() + 1;
+    initialized = 1;
+    softirq_register(SOFTIRQ_TIMER, timer_wheel_softirq);
+}
+
+// Process every tick up to now. Interrupts are only disabled while the
+// wheel itself changes, not while callbacks run.
+void timer_wheel_run(uint64_t now) {
+    if (!initialized) {
+        return;
+    }
+    uint32_t flags = irq_save();
+    while ((int32_t)((uint32_t)now - wheel.jiffies) >= 0) {
+        uint32_t index = wheel.jiffies & ROOT_MASK;
+        if (index == 0) {
+            for (uint32_t level = 0; level < TIMER_WHEEL_LEVELS && wheel_cascade(level) == 0; level++) {
+            }
+        }
+
+        // Take the whole bucket; callbacks may cancel timers still on it
+        // or arm new ones, which land in later buckets
+        timer_t* expired = wheel.root[index];
+        wheel.root[index] = 0;
+        if (expired) {
+            expired->pprev = &expired;
+        }
+        wheel.jiffies++;
+
+        while (expired) {
+            timer_t* timer = expired;
+            timer_fn_t fn = timer->fn;
+            void* arg = timer->arg;
+            timer_unlink(timer);
+            stats.expired++;
+            if (timer_from_pool(timer)) {
+                timer_free(timer);
+            }
+            irq_restore(flags);
+            fn(arg);
+            flags = irq_save();
+        }
+    }
+    irq_restore(flags);
+}
+
+static void timer_wheel_softirq(void) {
+    timer_wheel_run(timer_get_ticks());
+}
+
+uint32_t timer_add(uint32_t delay_ms, timer_fn_t fn, void* arg) {
+    if (!initialized || !fn) {
+        return 0;
+    }
+    uint32_t flags = irq_save();
+    timer_t* timer = free_timers;
+    uint32_t id = 0;
+    if (timer) {
+        free_timers = timer->next;
+        timer_arm(timer, ms_to_ticks(delay_ms), fn, arg);
+        id = ((uint32_t)timer->generation << 16) | (uint32_t)(timer - pool + 1);
+    }
+    irq_restore(flags);
+    return id;
+}
+
+// Stop a timer before it fires; returns 1 if it was still pending
+int timer_cancel(uint32_t id) {
+    uint32_t index = (id & 0xFFFF) - 1;
+    if (!initialized || index >= TIMER_POOL_SIZE) {
+        return 0;
+    }
+    timer_t* timer = &pool[index];
+    uint32_t flags = irq_save();
+    int pending = timer->generation == (id >> 16) && timer->pprev;
+    if (pending) {
+        timer_unlink(timer);
+        timer_free(timer);
+        stats.cancelled++;
+    }
+    irq_restore(flags);
+    return pending;
+}
+
+typedef struct {
+    thread_t* thread;
+    volatile int done;
+} sleeper_t;
+
+static void sleep_expired(void* arg) {
+    sleeper_t* sleeper = (sleeper_t*)arg;
+    sleeper->done = 1;
+    sched_wake(sleeper->thread);
+}
+
+// Block the calling thread for at least ms. The timer lives on the stack,
+// so sleeping never runs out of pool timers.
+void sleep_ms(uint32_t ms) {
+    if (!initialized) {
+        return;
+    }
+    timer_t timer;
+    sleeper_t sleeper = { sched_current(), 0 };
+    uint32_t flags = irq_save();
+    timer_arm(&timer, ms_to_ticks(ms), sleep_expired, &sleeper);
+    while (!sleeper.done) {
+        sched_block(0, 0);
+    }
+    irq_restore(flags);
+}
+
+void timer_wheel_get_stats(timer_wheel_stats_t* out) {
+    uint32_t flags = irq_save();
+    *out = stats;
+    irq_restore(flags);
+}
+
+// Benchmark
+
+static uint32_t bench_seed;
+static uint32_t bench_ids[TIMER_BENCH_LIVE];
+static uint64_t bench_due[TIMER_BENCH_EXPIRE];
+static int64_t bench_late[TIMER_BENCH_EXPIRE];
+static volatile uint32_t bench_fired;
+
+static uint32_t bench_random(void) {
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return bench_seed;
+}
+
+// Delays spread over every level of the wheel
+static uint32_t bench_delay(void) {
+    uint32_t r = bench_random();
+    uint32_t bits = TIMER_WHEEL_ROOT_BITS + (r >> 28) % (TIMER_WHEEL_LEVELS + 1) * TIMER_WHEEL_BITS;
+    return (r & ((1u << (bits > 27 ? 27 : bits)) - 1)) + 1;
+}
+
+static void bench_nop(void* arg) {
+    (void)arg;
+}
+
+static void bench_expired(void* arg) {
+    uint32_t i = (uint32_t)arg;
+    bench_late[i] = (int64_t)(rdtsc() - bench_due[i]);
+    bench_fired++;
+}
+
+static void bench_print_cycles(const char* label, uint64_t cycles, uint32_t ops) {
+    terminal_writestring(label);
+    terminal_print_dec((uint32_t)div64_32(cycles, ops));
+    terminal_println(" cycles");
+}
+
+// Add and cancel TIMER_BENCH_OPS timers with TIMER_BENCH_LIVE of them
+// armed at a time, then measure how late TIMER_BENCH_EXPIRE timers fire
+void timer_wheel_benchmark(void) {
+    if (!initialized) {
+        terminal_println("timerbench: timer wheel not initialized");
+        return;
+    }
+    uint32_t khz = timer_get_tsc_khz();
+    bench_seed = (uint32_t)rdtsc();
+    uint32_t cascaded = stats.cascaded;
+
+    uint64_t add_cycles = 0;
+    uint64_t cancel_cycles = 0;
+    uint32_t rounds = TIMER_BENCH_OPS / TIMER_BENCH_LIVE;
+    for (uint32_t round = 0; round < rounds; round++) {
+        uint64_t start = rdtsc();
+        for (uint32_t i = 0; i < TIMER_BENCH_LIVE; i++) {
+            bench_ids[i] = timer_add(bench_delay(), bench_nop, 0);
+        }
+        uint64_t mid = rdtsc();
+        for (uint32_t i = 0; i < TIMER_BENCH_LIVE; i++) {
+            timer_cancel(bench_ids[i]);
+        }
+        cancel_cycles += rdtsc() - mid;
+        add_cycles += mid - start;
+    }
+    uint32_t ops = rounds * TIMER_BENCH_LIVE;
+    terminal_writestring("Timer wheel: ");
+    terminal_print_dec(ops);
+    terminal_writestring(" adds and cancels, ");
+    terminal_print_dec(TIMER_BENCH_LIVE);
+    terminal_println(" armed at a time");
+    bench_print_cycles("  add:    ", add_cycles, ops);
+    bench_print_cycles("  cancel: ", cancel_cycles, ops);
+
+    // Expiry: one timer per ms; lateness against the TSC deadline
+    bench_fired = 0;
+    for (uint32_t i = 0; i < TIMER_BENCH_EXPIRE; i++) {
+        bench_due[i] = rdtsc() + (uint64_t)(i + 1) * khz;
+        timer_add(i + 1, bench_expired, (void*)i);
+    }
+    uint64_t start = rdtsc();
+    sleep_ms(TIMER_BENCH_EXPIRE + 10);
+    uint64_t slept = rdtsc() - start;
+
+    uint64_t total = 0;
+    uint64_t worst = 0;
+    uint32_t early = 0;
+    for (uint32_t i = 0; i < bench_fired; i++) {
+        if (bench_late[i] < 0) {
+            early++;
+            continue;
+        }
+        total += (uint64_t)bench_late[i];
+        if ((uint64_t)bench_late[i] > worst) {
+            worst = (uint64_t)bench_late[i];
+        }
+    }
+    terminal_writestring("  expiry: ");
+    terminal_print_dec(bench_fired);
+    terminal_writestring("/");
+    terminal_print_dec(TIMER_BENCH_EXPIRE);
+    terminal_writestring(" fired, late by ");
+    terminal_print_dec(timer_cycles_to_us(total, bench_fired - early));
+    terminal_writestring(" us average, ");
+    terminal_print_dec(timer_cycles_to_us(worst, 1));
+    terminal_writestring(" us worst, ");
+    terminal_print_dec(early);
+    terminal_println(" early");
+    terminal_writestring("  sleep_ms(");
+    terminal_print_dec(TIMER_BENCH_EXPIRE + 10);
+    terminal_writestring(") took ");
+    terminal_print_dec(timer_cycles_to_us(slept, 1));
+    terminal_writestring(" us; ");
+    terminal_print_dec(stats.cascaded - cascaded);
+    terminal_println(" timers cascaded");
+}
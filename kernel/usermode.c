@@ -0,0 +1,102 @@
+#include "usermode.h"
+#include "gdt.h"
+#include "sched.h"
+
+// Kernel stack used for traps and system calls taken from ring 3
+static uint8_t usermode_kernel_stack[USERMODE_KERNEL_STACK_SIZE] __attribute__((aligned(16)));
+
+// Kernel stack pointer saved by usermode_run(), restored by usermode_return()
+// (used from assembly only)
+uint32_t usermode_saved_esp __attribute__((used));
+
+// Thread currently inside usermode_run(), if any
+static thread_t* usermode_owner;
+
+int32_t usermode_enter(uint32_t entry, uint32_t user_stack_top);
+void usermode_resume(int32_t code) __attribute__((noreturn));
+
+// usermode_enter(entry, user_stack_top): save callee-saved registers and
+// EFLAGS on the current stack, then iret into ring 3.
+// usermode_jump(entry, user_stack_top): iret into ring 3 without saving
+// anything; used to start user threads.
+// usermode_resume(code): switch back to that stack and return code from
+// usermode_enter() as if it were an ordinary call.
+__asm__(
+    ".text\n"
+    ".global usermode_enter\n"
+    "usermode_enter:\n"
+    "\tpushl %ebp\n"
+    "\tpushl %ebx\n"
+    "\tpushl %esi\n"
+    "\tpushl %edi\n"
+    "\tpushfl\n"
+    "\tmovl %esp, usermode_saved_esp\n"
+    "\tmovl 24(%esp), %ecx\n"            // entry
+    "\tmovl 28(%esp), %edx\n"            // user_stack_top
+    "\tjmp usermode_iret\n"
+    ".global usermode_jump\n"
+    "usermode_jump:\n"
+    "\tmovl 4(%esp), %ecx\n"
+    "\tmovl 8(%esp), %edx\n"
+    "usermode_iret:\n"
+    "\tmovw $0x23, %ax\n"                // USER_DATA_SELECTOR
+    "\tmovw %ax, %ds\n"
+    "\tmovw %ax, %es\n"
+    "\tmovw %ax, %fs\n"
+    "\tmovw %ax, %gs\n"
+    "\tpushl $0x23\n"                    // SS
+    "\tpushl %edx\n"                     // ESP
+    "\tpushl $0x202\n"                   // EFLAGS: IF set
+    "\tpushl $0x1B\n"                    // CS: USER_CODE_SELECTOR
+    "\tpushl %ecx\n"                     // EIP
+    "\txorl %eax, %eax\n"
+    "\txorl %ebx, %ebx\n"
+    "\txorl %ecx, %ecx\n"
+    "\txorl %edx, %edx\n"
+    "\txorl %esi, %esi\n"
+    "\txorl %edi, %edi\n"
+    "\txorl %ebp, %ebp\n"
+    "\tiret\n"
+    ".global usermode_resume\n"
+    "usermode_resume:\n"
+    "\tmovl 4(%esp), %eax\n"             // code
+    "\tmovw $0x10, %cx\n"                // GDT_KERNEL_DATA
+    "\tmovw %cx, %ds\n"
+    "\tmovw %cx, %es\n"
+    "\tmovw %cx, %fs\n"
+    "\tmovw %cx, %gs\n"
+    "\tmovl usermode_saved_esp, %esp\n"
+    "\tpopfl\n"
+    "\tpopl %edi\n"
+    "\tpopl %esi\n"
+    "\tpopl %ebx\n"
+    "\tpopl %ebp\n"
+    "\tret\n"
+);
+
+// The task runs on the calling thread, which keeps its own address space;
+// traps from ring 3 use a dedicated kernel stack for the duration.
+int32_t usermode_run(void (*entry)(void), uint32_t user_stack_top) {
+    thread_t* thread = sched_current();
+    uint32_t saved_stack_top = thread->kernel_stack_top;
+
+    usermode_owner = thread;
+    sched_set_kernel_stack((uint32_t)&usermode_kernel_stack[USERMODE_KERNEL_STACK_SIZE]);
+    int32_t code = usermode_enter((uint32_t)entry, user_stack_top);
+    sched_set_kernel_stack(saved_stack_top);
+    usermode_owner = 0;
+    return code;
+}
+
+void usermode_return(int32_t code) {
+    usermode_resume(code);
+}
+
+// End the ring 3 code running on the current thread: return from
+// usermode_run(), or terminate a user thread
+void usermode_exit(int32_t code) {
+    if (usermode_owner && usermode_owner == sched_current()) {
+        usermode_return(code);
+    }
+    thread_exit(code);
+}
@@ -0,0 +1,183 @@
+#include "virtio.h"
+#include "cpu.h"
+#include "errors.h"
+#include "klib.h"
+#include "memory.h"
+
+// The device writes used->idx, used->flags and avail_event behind the
+// compiler's back
+static inline uint16_t vring_used_idx(virtqueue_t* vq) {
+    return *(volatile uint16_t*)&vq->used->idx;
+}
+
+static inline volatile uint16_t* vring_used_event(virtqueue_t* vq) {
+    return (volatile uint16_t*)&vq->avail->ring[vq->size];
+}
+
+static inline volatile uint16_t* vring_avail_event(virtqueue_t* vq) {
+    return (volatile uint16_t*)&vq->used->ring[vq->size];
+}
+
+// True if moving the index from old to new passed event (virtio spec
+// vring_need_event); all arithmetic wraps at 16 bits
+static inline int vring_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx) {
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+void virtio_reset(uint16_t io_base) {
+    outb(io_base + VIRTIO_PCI_STATUS, 0);
+}
+
+void virtio_add_status(uint16_t io_base, uint8_t status) {
+    outb(io_base + VIRTIO_PCI_STATUS, inb(io_base + VIRTIO_PCI_STATUS) | status);
+}
+
+// Accept the subset of the device's features the driver supports
+uint32_t virtio_negotiate(uint16_t io_base, uint32_t supported) {
+    uint32_t features = inl(io_base + VIRTIO_PCI_HOST_FEATURES) & supported;
+    outl(io_base + VIRTIO_PCI_GUEST_FEATURES, features);
+    return features;
+}
+
+// Allocate the rings for queue `index` and hand them to the device. The
+// legacy layout is fixed: descriptors, then the available ring, then the
+// used ring on the next 4 KB boundary.
+int32_t virtqueue_init(virtqueue_t* vq, uint16_t io_base, uint16_t index, uint8_t event_idx) {
+    outw(io_base + VIRTIO_PCI_QUEUE_SELECT, index);
+    uint16_t size = inw(io_base + VIRTIO_PCI_QUEUE_SIZE);
+    if (size == 0 || size > VIRTQUEUE_MAX_SIZE) {
+        return E_NODEV;
+    }
+
+    uint32_t avail_offset = size * sizeof(vring_desc_t);
+    uint32_t used_offset = PAGE_ALIGN_UP(avail_offset + sizeof(uint16_t) * (3 + size));
+    uint32_t bytes = used_offset + PAGE_ALIGN_UP(sizeof(uint16_t) * 3 + sizeof(vring_used_elem_t) * size);
+    uint8_t* ring = (uint8_t*)pmm_alloc(bytes / PAGE_SIZE);
+    if (!ring) {
+        return E_NOMEM;
+    }
+    memset(ring, 0, bytes);
+
+    vq->io_base = io_base;
+    vq->index = index;
+    vq->size = size;
+    vq->event_idx = event_idx;
+    vq->desc = (vring_desc_t*)ring;
+    vq->avail = (vring_avail_t*)(ring + avail_offset);
+    vq->used = (vring_used_t*)(ring + used_offset);
+    vq->pages = bytes / PAGE_SIZE;
+    vq->free_head = 0;
+    vq->num_free = size;
+    vq->last_used = 0;
+    vq->avail_idx = 0;
+    vq->kicked_idx = 0;
+    for (uint16_t i = 0; i < size; i++) {
+        vq->desc[i].next = i + 1;
+    }
+
+    outl(io_base + VIRTIO_PCI_QUEUE_PFN, (uint32_t)ring >> PAGE_SHIFT);
+    return E_OK;
+}
+
+// Chain `count` buffers and append the chain to the available ring. The
+// device does not see it until virtqueue_kick_prepare() publishes the
+// index, so a batch of chains costs one index update and one notification.
+// Returns the head descriptor, or E_AGAIN if the ring is full.
+int32_t virtqueue_add(virtqueue_t* vq, const virtq_buffer_t* bufs, uint32_t count) {
+    if (count == 0 || vq->num_free < count) {
+        return E_AGAIN;
+    }
+
+    uint16_t head = vq->free_head;
+    uint16_t idx = head;
+    uint16_t last = head;
+    for (uint32_t i = 0; i < count; i++) {
+        vring_desc_t* desc = &vq->desc[idx];
+        desc->addr = (uint32_t)bufs[i].addr;
+        desc->len = bufs[i].len;
+        desc->flags = (bufs[i].writable ? VRING_DESC_F_WRITE : 0) |
+                      (i + 1 < count ? VRING_DESC_F_NEXT : 0);
+        last = idx;
+        idx = desc->next;
+    }
+    vq->free_head = vq->desc[last].next;
+    vq->num_free -= count;
+
+    vq->avail->ring[vq->avail_idx % vq->size] = head;
+    vq->avail_idx++;
+    return head;
+}
+
+// Publish added chains. Returns nonzero if the device asked to be told:
+// with event indices only when the new index passes avail_event, otherwise
+// unless it set VRING_USED_F_NO_NOTIFY while it is already polling.
+int virtqueue_kick_prepare(virtqueue_t* vq) {
+    uint16_t old_idx = vq->kicked_idx;
+    uint16_t new_idx = vq->avail_idx;
+    if (old_idx == new_idx) {
+        return 0;
+    }
+
+    // Ring entries before the index, and the index before reading the
+    // device's notification hint
+    compiler_barrier();
+    *(volatile uint16_t*)&vq->avail->idx = new_idx;
+    memory_barrier();
+    vq->kicked_idx = new_idx;
+
+    if (vq->event_idx) {
+        return vring_need_event(*vring_avail_event(vq), new_idx, old_idx);
+    }
+    return !(*(volatile uint16_t*)&vq->used->flags & VRING_USED_F_NO_NOTIFY);
+}
+
+void virtqueue_notify(virtqueue_t* vq) {
+    outw(vq->io_base + VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+}
+
+// Take the next completed chain and return its descriptors to the free
+// list. Returns the head descriptor, or -1 if nothing has completed.
+int32_t virtqueue_get_used(virtqueue_t* vq, uint32_t* len) {
+    if (vq->last_used == vring_used_idx(vq)) {
+        return -1;
+    }
+    compiler_barrier();
+
+    vring_used_elem_t* elem = &vq->used->ring[vq->last_used % vq->size];
+    uint16_t head = (uint16_t)elem->id;
+    if (len) {
+        *len = elem->len;
+    }
+    vq->last_used++;
+
+    uint16_t idx = head;
+    uint16_t count = 1;
+    while (vq->desc[idx].flags & VRING_DESC_F_NEXT) {
+        idx = vq->desc[idx].next;
+        count++;
+    }
+    vq->desc[idx].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += count;
+    return head;
+}
+
+// Ask for an interrupt once `batch` more chains have completed (a single
+// completion without event indices). The caller must keep at least
+// `batch` chains in flight. Returns 0 if completions arrived that the
+// interrupt will not cover, in which case the caller drains again.
+int virtqueue_enable_cb(virtqueue_t* vq, uint16_t batch) {
+    if (batch == 0) {
+        batch = 1;
+    }
+
+    if (vq->event_idx) {
+        *vring_used_event(vq) = (uint16_t)(vq->last_used + batch - 1);
+    } else {
+        vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+        batch = 1;
+    }
+    memory_barrier();
+
+    return (uint16_t)(vring_used_idx(vq) - vq->last_used) < batch;
+}
@@ -0,0 +1,251 @@
+#include "virtio_blk.h"
+#include "virtio.h"
+#include "blkdev.h"
+#include "pci.h"
+#include "interrupts.h"
+#include "cpu.h"
+#include "errors.h"
+#include "memory.h"
+#include "softirq.h"
+#include "init.h"
+
+// Each request is a descriptor chain: header (device reads), one data
+// descriptor per merged segment and a status byte (device writes).
+// Headers and status bytes live in arrays indexed by the chain's head
+// descriptor so nothing is allocated per request.
+typedef struct {
+    block_device_t blk;
+    pci_device_t* pci;
+    uint16_t io_base;
+    uint8_t has_flush;
+    virtqueue_t vq;
+    virtio_blk_header_t* headers;   // Indexed by head descriptor
+    blk_request_t** inflight;
+    uint8_t* status;
+    uint32_t in_flight;
+    blk_request_t* backlog_head;    // Submitted while the ring was full
+    blk_request_t* backlog_tail;
+    tasklet_t tasklet;              // Completion processing
+} virtio_blk_t;
+
+static int32_t virtio_blk_submit(block_device_t* dev, blk_request_t* req);
+static void virtio_blk_kick(block_device_t* dev);
+
+// Global variables
+static virtio_blk_t disks[VIRTIO_BLK_MAX_DEVICES];
+static size_t disk_count = 0;
+static const blk_ops_t virtio_blk_ops = { virtio_blk_submit, virtio_blk_kick };
+
+// Put a request on the ring (not yet visible to the device)
+static int32_t virtio_blk_start(virtio_blk_t* vb, blk_request_t* req) {
+    uint32_t count = req->op == BLK_OP_FLUSH ? 2 : req->nr_segments + 2;
+    if (vb->vq.num_free < count) {
+        return E_AGAIN;
+    }
+
+    uint16_t head = virtqueue_next_head(&vb->vq);
+    virtio_blk_header_t* header = &vb->headers[head];
+    header->type = req->op == BLK_OP_READ ? VIRTIO_BLK_T_IN :
+                   req->op == BLK_OP_WRITE ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_FLUSH;
+    header->reserved = 0;
+    header->sector = req->op == BLK_OP_FLUSH ? 0 : req->sector;
+    vb->status[head] = 0xFF;
+
+    virtq_buffer_t bufs[VIRTIO_BLK_MAX_SEGMENTS + 2];
+    uint32_t n = 0;
+    bufs[n].addr = header;
+    bufs[n].len = sizeof(*header);
+    bufs[n++].writable = 0;
+    if (req->op != BLK_OP_FLUSH) {
+        for (blk_request_t* seg = req; seg; seg = seg->merge_next) {
+            bufs[n].addr = seg->buffer;
+            bufs[n].len = seg->count << BLK_SECTOR_SHIFT;
+            bufs[n++].writable = req->op == BLK_OP_READ;
+        }
+    }
+    bufs[n].addr = &vb->status[head];
+    bufs[n].len = 1;
+    bufs[n++].writable = 1;
+
+    virtqueue_add(&vb->vq, bufs, n);
+    vb->inflight[head] = req;
+    vb->in_flight++;
+    return E_OK;
+}
+
+// Called with interrupts disabled (blkdev_submit)
+static int32_t virtio_blk_submit(block_device_t* dev, blk_request_t* req) {
+    virtio_blk_t* vb = (virtio_blk_t*)dev->driver_data;
+
+    // Without VIRTIO_BLK_F_FLUSH the device has no volatile write cache
+    if (req->op == BLK_OP_FLUSH && !vb->has_flush) {
+        blkdev_complete(dev, req, E_OK);
+        return E_OK;
+    }
+
+    // Keep submission order: once anything is waiting, queue behind it
+    if (vb->backlog_head || virtio_blk_start(vb, req) != E_OK) {
+        if (vb->backlog_tail) {
+            vb->backlog_tail->next = req;
+        } else {
+            vb->backlog_head = req;
+        }
+        vb->backlog_tail = req;
+    }
+    return E_OK;
+}
+
+// Publish everything added since the last kick with one index update and
+// at most one doorbell write
+static void virtio_blk_kick(block_device_t* dev) {
+    virtio_blk_t* vb = (virtio_blk_t*)dev->driver_data;
+    uint32_t flags = irq_save();
+    if (virtqueue_kick_prepare(&vb->vq)) {
+        virtqueue_notify(&vb->vq);
+        dev->stats.notifications++;
+    }
+    irq_restore(flags);
+}
+
+static void virtio_blk_start_backlog(virtio_blk_t* vb) {
+    while (vb->backlog_head && virtio_blk_start(vb, vb->backlog_head) == E_OK) {
+        vb->backlog_head = vb->backlog_head->next;
+        if (!vb->backlog_head) {
+            vb->backlog_tail = 0;
+        }
+    }
+}
+
+// Interrupt coalescing: with event indices the next interrupt is requested
+// after half of the in-flight requests (up to VIRTIO_BLK_COALESCE_MAX)
+// have completed, and each interrupt drains every completion available
+static uint16_t virtio_blk_batch(virtio_blk_t* vb) {
+    uint32_t batch = vb->in_flight / 2;
+    if (batch > VIRTIO_BLK_COALESCE_MAX) {
+        batch = VIRTIO_BLK_COALESCE_MAX;
+    }
+    return batch ? (uint16_t)batch : 1;
+}
+
+// Top half: acknowledge the interrupt and leave the completions to the
+// tasklet
+static void virtio_blk_irq(void* context) {
+    virtio_blk_t* vb = (virtio_blk_t*)context;
+
+    // Reading ISR acknowledges the interrupt; zero means another device
+    // on a shared line raised it
+    if (!(inb(vb->io_base + VIRTIO_PCI_ISR) & VIRTIO_ISR_QUEUE)) {
+        return;
+    }
+    vb->blk.stats.interrupts++;
+    tasklet_schedule(&vb->tasklet);
+}
+
+// Bottom half: complete up to VIRTIO_BLK_BH_BUDGET requests, then run
+// again later if more are waiting
+static void virtio_blk_complete(void* context) {
+    virtio_blk_t* vb = (virtio_blk_t*)context;
+    uint32_t budget = VIRTIO_BLK_BH_BUDGET;
+
+    do {
+        int32_t head;
+        while ((head = virtqueue_get_used(&vb->vq, 0)) >= 0) {
+            blk_request_t* req = vb->inflight[head];
+            uint8_t status = vb->status[head];
+            vb->inflight[head] = 0;
+            vb->in_flight--;
+            blkdev_complete(&vb->blk, req, status == VIRTIO_BLK_S_OK ? E_OK :
+                            status == VIRTIO_BLK_S_UNSUPP ? E_NOSYS : E_IO);
+            if (--budget == 0) {
+                virtio_blk_start_backlog(vb);
+                virtio_blk_kick(&vb->blk);
+                tasklet_schedule(&vb->tasklet);
+                return;
+            }
+        }
+        virtio_blk_start_backlog(vb);
+    } while (!virtqueue_enable_cb(&vb->vq, virtio_blk_batch(vb)));
+
+    // Requests resubmitted by completion callbacks go out together
+    virtio_blk_kick(&vb->blk);
+}
+
+static int virtio_blk_probe(pci_device_t* pci) {
+    if (disk_count >= VIRTIO_BLK_MAX_DEVICES || !pci_bar_is_io(pci, 0) || pci->irq_line == PCI_NO_IRQ) {
+        return -1;
+    }
+
+    virtio_blk_t* vb = &disks[disk_count];
+    uint16_t io = (uint16_t)pci_bar_address(pci, 0);
+    vb->pci = pci;
+    vb->io_base = io;
+    pci_enable(pci, 1);
+
+    virtio_reset(io);
+    virtio_add_status(io, VIRTIO_STATUS_ACKNOWLEDGE);
+    virtio_add_status(io, VIRTIO_STATUS_DRIVER);
+    uint32_t features = virtio_negotiate(io, VIRTIO_RING_F_EVENT_IDX | VIRTIO_BLK_F_SIZE_MAX |
+                                             VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+    if (virtqueue_init(&vb->vq, io, 0, (features & VIRTIO_RING_F_EVENT_IDX) != 0) != E_OK) {
+        virtio_add_status(io, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+
+    // Per-descriptor request bookkeeping; headers and status bytes are
+    // read and written by the device
+    uint32_t size = vb->vq.size;
+    uint32_t bytes = size * (sizeof(virtio_blk_header_t) + sizeof(blk_request_t*) + 1);
+    uint8_t* table = (uint8_t*)pmm_alloc(PAGE_ALIGN_UP(bytes) / PAGE_SIZE);
+    if (!table) {
+        virtio_add_status(io, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    vb->headers = (virtio_blk_header_t*)table;
+    vb->inflight = (blk_request_t**)(table + size * sizeof(virtio_blk_header_t));
+    vb->status = (uint8_t*)(vb->inflight + size);
+    vb->in_flight = 0;
+    vb->backlog_head = 0;
+    vb->backlog_tail = 0;
+    tasklet_init(&vb->tasklet, virtio_blk_complete, vb);
+    vb->has_flush = (features & VIRTIO_BLK_F_FLUSH) != 0;
+
+    block_device_t* blk = &vb->blk;
+    blk->name[0] = 'v';
+    blk->name[1] = 'd';
+    blk->name[2] = (char)('a' + disk_count);
+    blk->name[3] = '\0';
+    blk->sector_count = ((uint64_t)inl(io + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_CAPACITY + 4) << 32) |
+                        inl(io + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_CAPACITY);
+    blk->max_sectors = VIRTIO_BLK_MAX_SECTORS;
+    if (features & VIRTIO_BLK_F_SIZE_MAX) {
+        uint32_t size_max = inl(io + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_SIZE_MAX) >> BLK_SECTOR_SHIFT;
+        if (size_max && size_max < blk->max_sectors) {
+            blk->max_sectors = size_max;
+        }
+    }
+    blk->max_segments = size - 2 < VIRTIO_BLK_MAX_SEGMENTS ? size - 2 : VIRTIO_BLK_MAX_SEGMENTS;
+    blk->queue_depth = size / 3;
+    blk->read_only = (features & VIRTIO_BLK_F_RO) != 0;
+    blk->ops = &virtio_blk_ops;
+    blk->driver_data = vb;
+
+    if (irq_register_handler(pci->irq_line, virtio_blk_irq, vb) != E_OK) {
+        virtio_add_status(io, VIRTIO_STATUS_FAILED);
+        return -1;
+    }
+    virtqueue_enable_cb(&vb->vq, 1);
+    virtio_add_status(io, VIRTIO_STATUS_DRIVER_OK);
+
+    blkdev_register(blk);
+    pci->driver_data = vb;
+    disk_count++;
+    return 0;
+}
+
+static const pci_driver_t virtio_blk_driver = {
+    "virtio-blk", VIRTIO_PCI_VENDOR, VIRTIO_BLK_DEVICE_ID, PCI_ANY_ID, virtio_blk_probe
+};
+
+void __init virtio_blk_init(void) {
+    pci_register_driver(&virtio_blk_driver);
+}
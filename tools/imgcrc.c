@@ -0,0 +1,79 @@
+// imgcrc - store the CRC-32C of a Mini OS kernel image in its trailer
+//
+// Usage: imgcrc <kernel.bin>
+//
+// Runs on the build host. The image ends with the 8-byte trailer from
+// include/crc32c.h (magic, checksum); the checksum covers everything
+// before it, which the kernel recomputes at boot.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CRC32C_POLY        0x82F63B78
+#define CRC32C_IMAGE_MAGIC 0x43524349       // "ICRC"
+#define TRAILER_SIZE       8
+
+static void die(const char* message, const char* detail) {
+    fprintf(stderr, "imgcrc: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+    exit(1);
+}
+
+static uint32_t crc32c(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: imgcrc <kernel.bin>\n");
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "r+b");
+    if (!file) {
+        die("cannot open", argv[1]);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    if (size < TRAILER_SIZE) {
+        die("image too small", argv[1]);
+    }
+    uint8_t* image = malloc(size);
+    if (!image) {
+        die("out of memory", NULL);
+    }
+    rewind(file);
+    if (fread(image, 1, size, file) != (size_t)size) {
+        die("cannot read", argv[1]);
+    }
+
+    uint8_t* trailer = image + size - TRAILER_SIZE;
+    if (get32(trailer) != CRC32C_IMAGE_MAGIC) {
+        die("no checksum trailer at the end of", argv[1]);
+    }
+    put32(trailer + 4, crc32c(image, size - TRAILER_SIZE));
+    fseek(file, size - TRAILER_SIZE, SEEK_SET);
+    if (fwrite(trailer, 1, TRAILER_SIZE, file) != TRAILER_SIZE || fclose(file) != 0) {
+        die("cannot write", argv[1]);
+    }
+    free(image);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+# Keystroke replay for the latency command: types a reproducible stream of
+# keys into a running mini-os through the QEMU monitor (sendkey), then runs
+# `latency` so the keystroke-to-glyph percentiles show on screen.
+#
+# QEMU must be started with its monitor on TCP, which `make replay` does:
+#   qemu-system-i386 ... -monitor tcp:127.0.0.1:4444,server,nowait
+#
+# Each line of random characters is erased with backspace rather than
+# entered, so no commands run between measured keystrokes. The same seed
+# gives the same keys at the same pace.
+
+import argparse
+import random
+import socket
+import string
+import sys
+import time
+
+PROMPT = b"(qemu) "
+KEYS = string.ascii_lowercase + string.digits + " "
+
+
+def key_name(c):
+    return "spc" if c == " " else c
+
+
+class Monitor:
+    def __init__(self, host, port, timeout):
+        deadline = time.monotonic() + timeout
+        while True:
+            try:
+                self.sock = socket.create_connection((host, port))
+                break
+            except OSError:
+                if time.monotonic() > deadline:
+                    sys.exit(f"keyreplay: no QEMU monitor on {host}:{port}")
+                time.sleep(0.2)
+        self.read_prompt()
+
+    def read_prompt(self):
+        data = b""
+        while not data.endswith(PROMPT):
+            chunk = self.sock.recv(4096)
+            if not chunk:
+                sys.exit("keyreplay: QEMU closed the monitor")
+            data += chunk
+
+    def sendkey(self, key, hold_ms):
+        self.sock.sendall(f"sendkey {key} {hold_ms}\n".encode())
+        self.read_prompt()
+
+
+def type_keys(monitor, keys, args):
+    for key in keys:
+        monitor.sendkey(key, args.hold)
+        time.sleep(args.interval / 1000)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay keystrokes into mini-os for the latency command")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=4444)
+    parser.add_argument("--keys", type=int, default=5000, help="characters to type (default 5000)")
+    parser.add_argument("--line", type=int, default=60, help="characters per line before erasing it")
+    parser.add_argument("--interval", type=int, default=20, help="ms between keys (default 20)")
+    parser.add_argument("--hold", type=int, default=10, help="ms each key is held down (default 10)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--boot", type=float, default=5.0, help="seconds to wait for the shell (default 5)")
+    args = parser.parse_args()
+
+    monitor = Monitor(args.host, args.port, args.boot + 10)
+    time.sleep(args.boot)
+
+    # Start from an empty histogram
+    type_keys(monitor, [key_name(c) for c in "latency"] + ["ret"], args)
+
+    rng = random.Random(args.seed)
+    typed = 0
+    start = time.monotonic()
+    while typed < args.keys:
+        count = min(args.line, args.keys - typed)
+        type_keys(monitor, [key_name(rng.choice(KEYS)) for _ in range(count)], args)
+        type_keys(monitor, ["backspace"] * count, args)
+        typed += count
+        print(f"\rkeyreplay: {typed}/{args.keys} keys", end="", flush=True)
+    print(f"\rkeyreplay: {typed} keys in {time.monotonic() - start:.1f} s")
+
+    type_keys(monitor, [key_name(c) for c in "latency"] + ["ret"], args)
+
+
+if __name__ == "__main__":
+    main()
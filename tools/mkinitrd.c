@@ -0,0 +1,187 @@
+// mkinitrd - pack a directory into a Mini OS initrd archive
+//
+// Usage: mkinitrd <directory> <output>
+//
+// Runs on the build host. The layout is described in include/initrd.h;
+// the constants below must match it. Entries are written parents first
+// with siblings sorted by name, so the kernel can link each entry to its
+// parent in one pass.
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define INITRD_MAGIC    0x44524E49          // "INRD"
+#define INITRD_VERSION  1
+#define INITRD_ALIGN    16
+#define INITRD_PATH_MAX 256
+#define INITRD_FILE     1
+#define INITRD_DIR      2
+
+typedef struct {
+    char path[INITRD_PATH_MAX];             // Inside the archive, from "/"
+    char* source;                           // On the host
+    uint32_t type;
+    uint32_t size;
+    uint32_t data;
+} entry_t;
+
+static entry_t* entries = NULL;
+static size_t entry_count = 0;
+static size_t entry_capacity = 0;
+
+static void die(const char* message, const char* detail) {
+    fprintf(stderr, "mkinitrd: %s%s%s\n", message, detail ? ": " : "", detail ? detail : "");
+    exit(1);
+}
+
+static void put32(FILE* out, uint32_t value) {
+    uint8_t bytes[4] = { value, value >> 8, value >> 16, value >> 24 };
+    if (fwrite(bytes, 1, 4, out) != 4) {
+        die("write failed", NULL);
+    }
+}
+
+static void pad(FILE* out, long to) {
+    while (ftell(out) < to) {
+        if (fputc(0, out) == EOF) {
+            die("write failed", NULL);
+        }
+    }
+}
+
+static void add_tree(const char* source, const char* path) {
+    struct dirent** names;
+    int n = scandir(source, &names, NULL, alphasort);
+    if (n < 0) {
+        die("cannot read directory", source);
+    }
+
+    for (int i = 0; i < n; i++) {
+        const char* name = names[i]->d_name;
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            free(names[i]);
+            continue;
+        }
+
+        if (entry_count == entry_capacity) {
+            entry_capacity = entry_capacity ? entry_capacity * 2 : 64;
+            entries = realloc(entries, entry_capacity * sizeof(entry_t));
+            if (!entries) {
+                die("out of memory", NULL);
+            }
+        }
+        entry_t* entry = &entries[entry_count];
+        memset(entry, 0, sizeof(*entry));
+        if ((size_t)snprintf(entry->path, sizeof(entry->path), "%s/%s", path, name) >= sizeof(entry->path)) {
+            die("path too long", name);
+        }
+        size_t source_len = strlen(source) + strlen(name) + 2;
+        entry->source = malloc(source_len);
+        if (!entry->source) {
+            die("out of memory", NULL);
+        }
+        snprintf(entry->source, source_len, "%s/%s", source, name);
+
+        struct stat st;
+        if (stat(entry->source, &st) != 0) {
+            die("cannot stat", entry->source);
+        }
+        free(names[i]);
+        if (S_ISDIR(st.st_mode)) {
+            // The recursion may move entries, so pass copies
+            char child_path[INITRD_PATH_MAX];
+            strcpy(child_path, entry->path);
+            char* child_source = entry->source;
+            entry->type = INITRD_DIR;
+            entry_count++;
+            add_tree(child_source, child_path);
+        } else if (S_ISREG(st.st_mode)) {
+            if (st.st_size > 0x7FFFFFFF) {
+                die("file too large", entry->source);
+            }
+            entry->type = INITRD_FILE;
+            entry->size = (uint32_t)st.st_size;
+            entry_count++;
+        } else {
+            free(entry->source);            // Skip devices, sockets, ...
+        }
+    }
+    free(names);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: mkinitrd <directory> <output>\n");
+        return 1;
+    }
+    add_tree(argv[1], "");
+
+    // Header and entries first, then the file data
+    uint32_t offset = 16;
+    for (size_t i = 0; i < entry_count; i++) {
+        offset += 16 + ((strlen(entries[i].path) + 4) & ~3u);
+    }
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].type == INITRD_FILE) {
+            offset = (offset + INITRD_ALIGN - 1) & ~(uint32_t)(INITRD_ALIGN - 1);
+            entries[i].data = offset;
+            offset += entries[i].size;
+        }
+    }
+
+    FILE* out = fopen(argv[2], "wb");
+    if (!out) {
+        die("cannot create", argv[2]);
+    }
+    put32(out, INITRD_MAGIC);
+    put32(out, INITRD_VERSION);
+    put32(out, (uint32_t)entry_count);
+    put32(out, offset);
+    for (size_t i = 0; i < entry_count; i++) {
+        uint32_t len = (uint32_t)strlen(entries[i].path);
+        put32(out, entries[i].type);
+        put32(out, entries[i].size);
+        put32(out, entries[i].data);
+        put32(out, len);
+        if (fwrite(entries[i].path, 1, len, out) != len) {
+            die("write failed", NULL);
+        }
+        pad(out, ftell(out) + 1);
+        pad(out, (ftell(out) + 3) & ~3L);
+    }
+
+    static uint8_t buffer[65536];
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i].type != INITRD_FILE) {
+            continue;
+        }
+        pad(out, entries[i].data);
+        FILE* in = fopen(entries[i].source, "rb");
+        if (!in) {
+            die("cannot open", entries[i].source);
+        }
+        uint32_t left = entries[i].size;
+        while (left) {
+            size_t chunk = left < sizeof(buffer) ? left : sizeof(buffer);
+            if (fread(buffer, 1, chunk, in) != chunk) {
+                die("short read", entries[i].source);
+            }
+            if (fwrite(buffer, 1, chunk, out) != chunk) {
+                die("write failed", NULL);
+            }
+            left -= (uint32_t)chunk;
+        }
+        fclose(in);
+    }
+    pad(out, offset);
+    if (fclose(out) != 0) {
+        die("write failed", NULL);
+    }
+
+    printf("mkinitrd: %zu entries, %u bytes\n", entry_count, offset);
+    return 0;
+}
@@ -0,0 +1,27 @@
+# Kernel symbol table (ksyms.h) from `nm -n kernel.elf`: every function,
+# sorted by address, with the names in one string. Everything goes into
+# the .ksyms section, which linker.ld places after all code. With no input
+# it gives an empty table for the first link.
+BEGIN {
+    print "// Generated by tools/mksyms.awk"
+    print "#include \"ksyms.h\""
+    print ""
+    print "const ksym_t ksyms[] KSYMS_SECTION = {"
+}
+$2 ~ /^[tT]$/ {
+    printf "    { 0x%s, %d },\n", $1, offset
+    names[count++] = $3
+    offset += length($3) + 1
+}
+END {
+    print "    { 0, 0 }"
+    print "};"
+    print ""
+    printf "const uint32_t ksyms_count KSYMS_SECTION = %d;\n", count
+    print ""
+    print "const char ksyms_names[] KSYMS_SECTION ="
+    for (i = 0; i < count; i++) {
+        printf "    \"%s\\0\"\n", names[i]
+    }
+    print "    \"\";"
+}
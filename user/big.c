@@ -0,0 +1,14 @@
+#include "crt.h"
+
+// hello with 4 MB of read-only data, of which only one page is read: its
+// start-up cost should match hello's
+#define BIG_TABLE_SIZE (4 * 1024 * 1024)
+
+static const uint8_t table[BIG_TABLE_SIZE] = { 1 };
+static volatile int32_t counter = 41;
+
+int main(void) {
+    crt_print("Hello from a big ELF program\n");
+    counter++;
+    return counter == 42 && *(const volatile uint8_t*)table == 1 ? 0 : 1;
+}
@@ -0,0 +1,7 @@
+#include "crt.h"
+
+// Entry point of every user program (ENTRY in user/user.ld). It lives in
+// its own object, linked into each program ahead of the program's code.
+void _start(void) {
+    crt_exit(main());
+}
@@ -0,0 +1,30 @@
+#ifndef USER_CRT_H
+#define USER_CRT_H
+
+#include "user.h"
+
+// Support for standalone user programs (user/user.ld), which run on a
+// thread started by the ELF loader. They only use the int 0x80 gate: the
+// flag selecting sysenter lives in the kernel image. The entry point,
+// _start, is in crt.c, built once and linked into every program; this
+// header only has inline helpers, so any number of a program's files can
+// include it.
+int main(void);
+
+USER_INLINE void crt_exit(int32_t code) {
+    user_syscall_int80(SYS_EXIT, (uint32_t)code, 0, 0);
+}
+
+USER_INLINE void crt_write(const char* buffer, size_t length) {
+    user_syscall_int80(SYS_WRITE, (uint32_t)buffer, length, 0);
+}
+
+USER_INLINE void crt_print(const char* text) {
+    size_t length = 0;
+    while (text[length]) {
+        length++;
+    }
+    crt_write(text, length);
+}
+
+#endif // USER_CRT_H
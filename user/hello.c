@@ -0,0 +1,13 @@
+#include "crt.h"
+
+// Touches one page of text, data and bss each; exits 0 when initialized
+// data and bss look right
+static volatile int32_t counter = 41;
+static volatile uint8_t scratch[64 * 1024];
+
+int main(void) {
+    crt_print("Hello from an ELF program\n");
+    counter++;
+    scratch[sizeof(scratch) / 2] = 1;
+    return counter == 42 && scratch[0] == 0 ? 0 : 1;
+}